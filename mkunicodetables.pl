@@ -0,0 +1,452 @@
+#!/usr/bin/perl
+#
+# Generate the Unicode character data from the UCD that comes with perl
+# (Unicode::UCD and Unicode::Normalize):
+#
+# perl mkunicodetables.pl unicodetables.inc unicodeprops.inc
+#
+# unicodetables.inc has what unicodestreams.cxx needs for itself,
+# unicodeprops.inc the properties unicodestreams.hxx gives everyone. Run
+# it with make tables, the output is checked in so building doesn't need
+# perl.
+#
+# Properties are looked up in two or three stage tables: the high bits
+# of the code point index the first stage that gives a block in the
+# next stage, the following bits index that block and so on. Equal
+# blocks are stored once and the number of stages and the block sizes
+# are chosen to make the tables as small as possible.
+# Code points above the last one with a value other than the default
+# are not in the tables at all.
+
+use strict;
+use warnings;
+
+use Unicode::UCD qw(charinfo prop_invlist prop_invmap);
+use Unicode::Normalize qw(getCanon getCompat getCombinClass getComposite
+			  isComp_Ex isNFC_MAYBE isNFC_NO isNFD_NO
+			  isNFKC_MAYBE isNFKC_NO isNFKD_NO);
+
+my $MAXCP = 0x10ffff;
+
+# how the tables are declared, the public ones are in a header.
+my $storage = "constexpr";
+
+sub is_hangul { my $c = shift; return $c >= 0xac00 && $c <= 0xd7a3; }
+
+# the smallest C++ unsigned type for values up to $max.
+sub ctype
+{
+  my $max = shift;
+  return $max < 0x100 ? "std::uint8_t"
+    : $max < 0x10000 ? "std::uint16_t" : "std::uint32_t";
+}
+
+sub csize
+{
+  my $t = shift;
+  return $t eq "std::uint8_t" ? 1 : $t eq "std::uint16_t" ? 2 : 4;
+}
+
+# values as C++ source, so many on each line.
+sub numbers
+{
+  my ($per, @v) = @_;
+  my $s = "";
+  for (my $i = 0; $i < @v; $i += $per) {
+    my $e = $i + $per - 1;
+    $e = $#v if $e > $#v;
+    $s .= "  " . join(", ", @v[$i .. $e]) . ",\n";
+  }
+  return $s;
+}
+
+# split @$v in blocks of $bs, equal blocks stored once. Return the
+# block number of each block and the blocks.
+sub blocks
+{
+  my ($v, $bs) = @_;
+  my (%seen, @index, @data);
+  for (my $b = 0; $b < @$v; $b += $bs) {
+    my @blk = @$v[$b .. $b + $bs - 1];
+    my $key = join(",", @blk);
+    if (! exists $seen{$key}) {
+      $seen{$key} = @data / $bs;
+      push @data, @blk;
+    }
+    push @index, $seen{$key};
+  }
+  return (\@index, \@data);
+}
+
+sub max { my $m = shift; for (@_) { $m = $_ if $_ > $m; } return $m; }
+
+# table for $name from the values in @$v, which has one for every code
+# point: two stages, or three when that is smaller.
+sub trie
+{
+  my ($name, $doc, $v, $default) = @_;
+  my $last = $MAXCP;
+
+  $last-- while $last > 0 && ($v->[$last] // $default) == $default;
+
+  my ($best, $bsize);
+  for my $shift (4 .. 9) {
+    my $bs = 1 << $shift;
+    my $limit = (($last >> $shift) + 1) << $shift;
+    my @vals = map { $v->[$_] // $default } 0 .. $limit - 1;
+    my ($s1, $s2) = blocks(\@vals, $bs);
+    my $t1 = ctype(@$s2 / $bs);
+    my $t2 = ctype(max(@$s2));
+    my $size2 = @$s2 * csize($t2);
+    my $size = @$s1 * csize($t1) + $size2;
+    if (! defined $bsize || $size < $bsize) {
+      $bsize = $size;
+      $best = [ $limit, [ $shift, $t2, $s2 ], [ 0, $t1, $s1 ] ];
+    }
+    # for three stages pad the first one with a block of defaults.
+    my @s2x = @$s2;
+    my ($dblk) = grep {
+      ! grep { $_ != $default } @s2x[$_ * $bs .. ($_ + 1) * $bs - 1]
+    } 0 .. @s2x / $bs - 1;
+    if (! defined $dblk) {
+      $dblk = @s2x / $bs;
+      push @s2x, ($default) x $bs;
+    }
+    for my $shift0 (2 .. 8) {
+      my $bs0 = 1 << $shift0;
+      my $n1 = (((@$s1 - 1) >> $shift0) + 1) << $shift0;
+      my @idx = (@$s1, ($dblk) x ($n1 - @$s1));
+      my ($s0, $s1b) = blocks(\@idx, $bs0);
+      my $t0 = ctype(@$s1b / $bs0);
+      my $t1b = ctype(@s2x / $bs);
+      $size = @$s0 * csize($t0) + @$s1b * csize($t1b) + @s2x * csize($t2);
+      if ($size < $bsize) {
+	$bsize = $size;
+	$best = [ $n1 << $shift, [ $shift, $t2, [ @s2x ] ],
+		  [ $shift0, $t1b, $s1b ], [ 0, $t0, $s0 ] ];
+      }
+    }
+  }
+
+  my ($limit, @stages) = @$best;
+  my $n = @stages;
+  printf "// %s, %d bytes.\n", $doc, $bsize;
+  for my $i (reverse 0 .. $n - 1) {
+    my ($shift, $t, $data) = @{$stages[$i]};
+    my $k = $n - $i;
+    printf "%s %s %s_stage%d[%d] = {\n", $storage, $t, $name, $k,
+      scalar @$data;
+    print numbers(16, @$data), "};\n\n";
+  }
+  # stage k gives a block of stage k + 1, stage 1 is indexed by the high
+  # bits of c.
+  my $total = 0;
+  $total += $_->[0] for @stages[0 .. $n - 2];
+  my $t = $stages[0][1];
+  print "constexpr $t $name(char32_t c)\n";
+  print "{\n";
+  printf "  if (c >= 0x%x)\n", $limit;
+  print "    return $default;\n";
+  print "  std::size_t i = ${name}_stage1[c >> $total];\n";
+  for my $k (2 .. $n) {
+    my $sh = $stages[$n - $k][0];
+    $total -= $sh;
+    my $mask = (1 << $sh) - 1;
+    my $low = $total ? "((c >> $total) & $mask)" : "(c & $mask)";
+    print $k < $n ? "  i = " : "  return ", "${name}_stage$k\[(i << $sh) | $low];\n";
+  }
+  print "}\n\n";
+}
+
+my $version = Unicode::UCD::UnicodeVersion();
+my ($private, $public) = @ARGV;
+
+die "usage: $0 unicodetables.inc unicodeprops.inc\n" if ! defined $public;
+open(PRIVATE, '>', $private) || die "$private: $!\n";
+open(PUBLIC, '>', $public) || die "$public: $!\n";
+select PRIVATE;
+
+print <<"EOF";
+// Generated by mkunicodetables.pl from Unicode $version, do not edit.
+// Run make tables to regenerate it.
+
+EOF
+
+########################################
+# normalization
+
+# norm_props: bits 0-7 are the canonical combining class. For each form
+# f, 0 NFC, 1 NFD, 2 NFKC and 3 NFKD, bit 8 + 2 f is set when the quick
+# check isn't Yes and bit 9 + 2 f is set when the char doesn't start a
+# segment, that is what is before it may change when it follows. For
+# the decomposing forms a segment starts where the decomposition starts
+# with a starter, for the composing forms that starter must also never
+# compose with what is before it.
+
+my (@ccc, @canon, @compat);
+for my $c (0 .. $MAXCP) {
+  $ccc[$c] = getCombinClass($c);
+  next if is_hangul($c);
+  my $d = getCanon($c);
+  my $k = getCompat($c);
+  $canon[$c] = [ map { ord } split //, $d ] if defined $d;
+  $compat[$c] = [ map { ord } split //, $k ]
+    if defined $k && (! defined $d || $k ne $d);
+}
+
+my @norm;
+my @min = ($MAXCP + 1) x 4;
+for my $c (0 .. $MAXCP) {
+  my $cd = $canon[$c] ? $canon[$c][0] : $c;
+  my $kd = $compat[$c] ? $compat[$c][0] : $cd;
+  $cd = 0x1100 + int(($c - 0xac00) / 588) if is_hangul($c);
+  $kd = $cd if is_hangul($c);
+  my @notyes = (isNFC_NO($c) || isNFC_MAYBE($c), isNFD_NO($c),
+		isNFKC_NO($c) || isNFKC_MAYBE($c), isNFKD_NO($c));
+  my @notbb = ($ccc[$cd] != 0 || isNFC_MAYBE($cd), $ccc[$cd] != 0,
+	       $ccc[$kd] != 0 || isNFC_MAYBE($kd), $ccc[$kd] != 0);
+  my $v = $ccc[$c];
+  for my $f (0 .. 3) {
+    $v |= 1 << (8 + 2 * $f) if $notyes[$f];
+    $v |= 1 << (9 + 2 * $f) if $notbb[$f];
+    $min[$f] = $c if $c < $min[$f] && ($notyes[$f] || $notbb[$f]
+				       || $ccc[$c] != 0);
+  }
+  $norm[$c] = $v;
+}
+
+trie("norm_props", "combining class and quick check", \@norm, 0);
+
+printf "// below these every char is a starter that is normalized and starts\n";
+printf "// a segment, for NFC, NFD, NFKC and NFKD.\n";
+printf "constexpr char32_t norm_fast_limit[4] = { 0x%x, 0x%x, 0x%x, 0x%x };\n\n",
+  @min;
+
+# decomp_index: where the full decompositions of a char start in
+# decomp_pool, 0 if it has none. There the first unit is the length of
+# the canonical one plus 256 times the length of the compatibility one
+# when that differs, then come the canonical and the compatibility
+# decompositions. Hangul syllables are left to the algorithm.
+
+my @pool = (0);
+my @index = (0) x ($MAXCP + 1);
+for my $c (0 .. $MAXCP) {
+  next if ! $canon[$c] && ! $compat[$c];
+  my @d = $canon[$c] ? @{$canon[$c]} : ();
+  my @k = $compat[$c] ? @{$compat[$c]} : ();
+  $index[$c] = @pool;
+  push @pool, @d + 256 * @k, @d, @k;
+}
+die "decomp_pool too big" if @pool >= 0x10000;
+
+trie("decomp_index", "where decompositions are in decomp_pool", \@index, 0);
+
+printf "constexpr char32_t decomp_pool[%d] = {\n", scalar @pool;
+print numbers(8, map { sprintf "0x%x", $_ } @pool), "};\n\n";
+
+# compose_pairs: the primary composites, sorted on the two chars they
+# are composed of. Hangul is left to the algorithm.
+
+my @pairs;
+for my $c (0 .. $MAXCP) {
+  next if ! $canon[$c] || is_hangul($c) || isComp_Ex($c);
+  my $info = charinfo($c);
+  next if ! $info || $info->{decomposition} =~ /</;
+  my @d = map { hex } split / /, $info->{decomposition};
+  next if @d != 2;
+  my $p = getComposite($d[0], $d[1]);
+  next if ! defined $p || $p != $c;
+  push @pairs, [ @d, $c ];
+}
+@pairs = sort { $a->[0] <=> $b->[0] || $a->[1] <=> $b->[1] } @pairs;
+
+print "struct compose_pair { char32_t first, second, composite; };\n\n";
+printf "constexpr compose_pair compose_pairs[%d] = {\n", scalar @pairs;
+print numbers(3, map { sprintf "{ 0x%x, 0x%x, 0x%x }", @$_ } @pairs), "};\n\n";
+
+########################################
+# case folding
+
+# case_fold: how a char folds with the C and F mappings of
+# CaseFolding.txt, 0 if it folds to itself. Below 0x8000 it indexes
+# fold_deltas, what to add to the char to fold it, else the low 11 bits
+# tell where its folding starts in fold_pool and the 4 bits above them
+# how long it is.
+
+my $folds = Unicode::UCD::all_casefolds();
+my (@fold, @deltas, %delta, @fpool);
+my $fmax = 1;
+@deltas = (0);
+for my $c (sort { $a <=> $b } keys %$folds) {
+  my @f = map { hex } split / /, $folds->{$c}{full};
+  if (@f == 1) {
+    my $d = $f[0] - $c;
+    if (! exists $delta{$d}) {
+      $delta{$d} = @deltas;
+      push @deltas, $d;
+    }
+    $fold[$c] = $delta{$d};
+  } else {
+    $fold[$c] = 0x8000 | (@f << 11) | @fpool;
+    push @fpool, @f;
+    $fmax = @f if @f > $fmax;
+  }
+}
+die "fold_pool too big" if @fpool >= 0x800 || @deltas >= 0x8000;
+$fold[$_] //= 0 for 0 .. $MAXCP;
+
+trie("case_fold", "how chars fold", \@fold, 0);
+
+printf "constexpr std::int32_t fold_deltas[%d] = {\n", scalar @deltas;
+print numbers(8, @deltas), "};\n\n";
+printf "constexpr char32_t fold_pool[%d] = {\n", scalar @fpool;
+print numbers(8, map { sprintf "0x%x", $_ } @fpool), "};\n\n";
+print "// the most chars a char folds to.\n";
+print "constexpr unsigned fold_maxlen = $fmax;\n";
+
+########################################
+# grapheme clusters
+
+# grapheme_props: the Grapheme_Cluster_Break of a char in the low 4 bits
+# (the GCB_ values), GCB_EXTPICT is added for Extended_Pictographic.
+# Hangul syllables are all LVT here, the LV ones every 28 chars would
+# make most blocks there differ.
+
+my @gcb_names = qw(Other CR LF Control Extend ZWJ Regional_Indicator
+		   Prepend SpacingMark L V T LV LVT);
+my %gcb_value;
+@gcb_value{@gcb_names} = 0 .. $#gcb_names;
+$gcb_value{ExtPict_XX} = 0;
+
+my @gcb = (0) x ($MAXCP + 1);
+{
+  my ($list, $map) = prop_invmap("GCB");
+  for my $i (0 .. $#$list) {
+    my $v = $gcb_value{$map->[$i]};
+    die "unknown GCB $map->[$i]" if ! defined $v;
+    next if $v == 0;
+    my $e = $i < $#$list ? $list->[$i + 1] - 1 : $MAXCP;
+    $gcb[$_] = $v for $list->[$i] .. $e;
+  }
+  $gcb[$_] = $gcb_value{LVT} for grep { is_hangul($_) } 0xac00 .. 0xd7a3;
+  my @ep = prop_invlist("Extended_Pictographic");
+  for (my $i = 0; $i < @ep; $i += 2) {
+    my $e = $i + 1 < @ep ? $ep[$i + 1] - 1 : $MAXCP;
+    $gcb[$_] |= 16 for $ep[$i] .. $e;
+  }
+}
+
+print "enum {\n";
+print "  GCB_", uc($gcb_names[$_] =~ s/Regional_Indicator/RI/r), " = $_,\n"
+  for 0 .. $#gcb_names;
+print "  GCB_EXTPICT = 16\n";
+print "};\n\n";
+
+trie("grapheme_props", "Grapheme_Cluster_Break", \@gcb, 0);
+
+########################################
+# properties for everyone, unicodestreams.hxx includes this in
+# namespace alf::unicodestreams.
+
+select PUBLIC;
+$storage = "inline constexpr";
+
+print <<"EOF";
+// Generated by mkunicodetables.pl from Unicode $version, do not edit.
+// Run make tables to regenerate it. unicodestreams.hxx includes it in
+// namespace alf::unicodestreams.
+
+EOF
+
+# the values of a property by code point, from its inversion map.
+sub invmap
+{
+  my ($prop, $value) = @_;
+  my ($list, $map) = prop_invmap($prop);
+  my @v = (0) x ($MAXCP + 1);
+  for my $i (0 .. $#$list) {
+    my $x = $value->{$map->[$i]};
+    die "unknown $prop $map->[$i]" if ! defined $x;
+    next if $x == 0;
+    my $e = $i < $#$list ? $list->[$i + 1] - 1 : $MAXCP;
+    $v[$_] = $x for $list->[$i] .. $e;
+  }
+  return @v;
+}
+
+# print enum class $name with @names, the first one is 0.
+sub enumeration
+{
+  my ($name, $type, $doc, @names) = @_;
+  print "// $doc\n";
+  print "enum class $name : $type {\n";
+  print "  $_,\n" for @names;
+  print "};\n\n";
+}
+
+# props: the General_Category in bits 0-4, East_Asian_Width in bits 5-7
+# and the char_flag binary properties above them.
+
+my @gc_names = qw(Cn Lu Ll Lt Lm Lo Mn Mc Me Nd Nl No Pc Pd Ps Pe Pi Pf Po
+		  Sm Sc Sk So Zs Zl Zp Cc Cf Cs Co);
+my %gc_value;
+@gc_value{@gc_names} = 0 .. $#gc_names;
+
+my @ea_names = qw(N Na A W H F);
+my %ea_value;
+@ea_value{@ea_names} = 0 .. $#ea_names;
+$ea_value{Neutral} = 0;
+
+my @flag_props = qw(White_Space Alphabetic Uppercase Lowercase
+		    Emoji_Presentation Extended_Pictographic
+		    Default_Ignorable_Code_Point);
+
+enumeration("general_category", "unsigned char",
+	    "General_Category, Cn for what isn't assigned.", @gc_names);
+enumeration("east_asian_width", "unsigned char",
+	    "East_Asian_Width, N (Neutral) for what isn't listed.", @ea_names);
+
+print "// binary properties, char_flags() gives them.\n";
+print "enum char_flag : unsigned int {\n";
+for my $i (0 .. $#flag_props) {
+  my $n = uc $flag_props[$i];
+  $n =~ s/_CODE_POINT//;
+  printf "  PROP_%s = 0x%x,\n", $n, 1 << $i;
+}
+print "};\n\n";
+
+my @props = invmap("gc", \%gc_value);
+my @ea = invmap("ea", \%ea_value);
+$props[$_] |= $ea[$_] << 5 for 0 .. $MAXCP;
+for my $i (0 .. $#flag_props) {
+  my @l = prop_invlist($flag_props[$i]);
+  for (my $j = 0; $j < @l; $j += 2) {
+    my $e = $j + 1 < @l ? $l[$j + 1] - 1 : $MAXCP;
+    $props[$_] |= 1 << (8 + $i) for $l[$j] .. $e;
+  }
+}
+
+# scripts: Unknown first, the rest as the UCD names them.
+
+my %sc_seen;
+{
+  my (undef, $map) = prop_invmap("sc");
+  $sc_seen{$_} = 1 for @$map;
+}
+my @sc_names = ("Unknown", sort grep { $_ ne "Unknown" } keys %sc_seen);
+my %sc_value;
+@sc_value{@sc_names} = 0 .. $#sc_names;
+my @sc = invmap("sc", \%sc_value);
+
+enumeration("script", "unsigned char",
+	    "Script, by the long names of the UCD. Unknown for what has none.",
+	    @sc_names);
+
+print "namespace ucd {\n\n";
+trie("props", "General_Category, East_Asian_Width and char_flag", \@props,
+     0);
+trie("scripts", "Script", \@sc, 0);
+printf "inline constexpr const char * script_names[%d] = {\n",
+  scalar @sc_names;
+print numbers(4, map { "\"$_\"" } @sc_names), "};\n\n";
+print "}; // end of namespace ucd\n";
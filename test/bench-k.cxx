@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Compare reading and writing a large UTF-8 file through std::fstream,
+// uring_source/uring_sink and their pread()/pwrite() fallback.
+// Usage: bench-k [megabytes]
+
+namespace us = alf::unicodestreams;
+
+#if defined(__unix__) || defined(__APPLE__)
+
+typedef std::chrono::steady_clock clock_type;
+
+double since(clock_type::time_point t)
+{
+  return std::chrono::duration<double>(clock_type::now() - t).count();
+}
+
+std::size_t read_all(std::istream & f)
+{
+  us::u32utf8istream g(f);
+  char32_t buf[4096];
+  std::size_t n = 0;
+
+  while (g.read(buf, 4096), g.gcount() > 0)
+    n += g.gcount();
+  return n;
+}
+
+void write_all(std::ostream & f, const std::u32string & txt, int times)
+{
+  us::u32utf8ostream g(f);
+
+  for (int i = 0; i < times; ++i)
+    g.write(txt.data(), txt.size());
+  g.flush();
+}
+
+int main(int argc, char ** argv)
+{
+  int mb = argc > 1 ? std::atoi(argv[1]) : 64;
+  std::u32string txt;
+  for (int i = 0; i < 100000; ++i) {
+    txt += U"some text ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  int times = int(mb * 1024.0 * 1024 / us::to_utf8(txt).size()) + 1;
+  const char * name = "bench-k.txt";
+  clock_type::time_point t;
+
+  t = clock_type::now();
+  {
+    std::ofstream f(name, std::ios::binary);
+    write_all(f, txt, times);
+  }
+  std::cout << "write fstream  " << since(t) << " s" << std::endl;
+  for (int u = 1; u >= 0; --u) {
+    t = clock_type::now();
+    us::uring_ostream f(name, us::uring_sink::BLOCKSZ,
+			us::uring_sink::DEPTH, u != 0);
+    write_all(f, txt, times);
+    std::cout << "write " << (f.uses_uring() ? "io_uring " : "pwrite   ")
+	      << since(t) << " s" << std::endl;
+  }
+
+  std::size_t n;
+  t = clock_type::now();
+  {
+    std::ifstream f(name, std::ios::binary);
+    n = read_all(f);
+  }
+  std::cout << "read fstream   " << since(t) << " s, " << n << " chars"
+	    << std::endl;
+  for (int u = 1; u >= 0; --u) {
+    t = clock_type::now();
+    us::uring_istream f(name, us::uring_source::BLOCKSZ,
+			us::uring_source::DEPTH, u != 0);
+    n = read_all(f);
+    std::cout << "read " << (f.uses_uring() ? "io_uring  " : "pread     ")
+	      << since(t) << " s, " << n << " chars" << std::endl;
+  }
+  std::remove(name);
+}
+
+#else
+
+int main()
+{
+  std::cout << "no uring_source here." << std::endl;
+}
+
+#endif
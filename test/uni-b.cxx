@@ -0,0 +1,323 @@
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../unicodestreams.hxx"
+
+// Test the line readers, skip() and reset().
+
+std::u32string make_text(std::vector<std::u32string> & lines)
+{
+  std::u32string txt;
+  std::u32string longline;
+
+  for (int i = 0; i < 5000; ++i)
+    longline += char32_t(i % 2 ? U'æ' : U'\U0001f600');
+
+  lines.push_back(U"Hello there");
+  lines.push_back(U"CR LF øå");
+  lines.push_back(U"line separator");
+  lines.push_back(U"paragraph \U00010400 separator");
+  lines.push_back(U"");
+  lines.push_back(longline);
+  lines.push_back(U"lone\rCR");
+  lines.push_back(U"last line");
+
+  txt = lines[0] + U"\n" + lines[1] + U"\r\n" + lines[2] + U" "
+    + lines[3] + U" " + lines[4] + U"\n" + lines[5] + U"\r\n"
+    + lines[6] + U"\n" + lines[7];
+  return txt;
+}
+
+void do_write(const char * fn, const std::u32string & txt)
+{
+  std::ofstream f(fn);
+  alf::unicodestreams::u32utf8ostream g(f);
+
+  g << txt;
+}
+
+template <class S>
+bool check(const char * what, int k, const S & line, const std::u32string & x)
+{
+  std::u32string y;
+
+  for (std::size_t i = 0; i < line.size(); ++i) {
+    char32_t c = line[i];
+    if (sizeof(line[i]) == 2 && c >= 0xd800 && c < 0xdc00) {
+      c = (((c & 0x3ff) << 10) | (line[++i] & 0x3ff)) + 0x10000;
+    }
+    y += c;
+  }
+  if (y == x)
+    return true;
+  std::cout << what << ": line " << k << " is wrong, size "
+	    << y.size() << " expected " << x.size() << std::endl;
+  return false;
+}
+
+bool do_read32(const char * fn, const std::vector<std::u32string> & lines)
+{
+  std::ifstream f(fn);
+  alf::unicodestreams::u32utf8istream g(f);
+  alf::unicodestreams::u32line_reader r(g, alf::unicodestreams::EOL_ALL, 16);
+  std::u32string_view line;
+  std::size_t k = 0;
+
+  while (r.getline(line)) {
+    if (k >= lines.size()) {
+      std::cout << "u32: too many lines" << std::endl;
+      return false;
+    }
+    if (! check("u32", k, line, lines[k]))
+      return false;
+    ++k;
+  }
+  if (k != lines.size()) {
+    std::cout << "u32: got " << k << " lines, expected "
+	      << lines.size() << std::endl;
+    return false;
+  }
+  if (g.streambuf_status() != alf::unicodestreams::status_type::OK) {
+    std::cout << "u32: bad status " << int(g.streambuf_status()) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_read16(const char * fn, const std::vector<std::u32string> & lines)
+{
+  std::ifstream f(fn);
+  alf::unicodestreams::u16utf8istream g(f);
+  alf::unicodestreams::u16line_reader r(g, alf::unicodestreams::EOL_ALL, 16);
+  std::u16string_view line;
+  std::size_t k = 0;
+
+  while (r.getline(line)) {
+    if (k >= lines.size()) {
+      std::cout << "u16: too many lines" << std::endl;
+      return false;
+    }
+    if (! check("u16", k, line, lines[k]))
+      return false;
+    ++k;
+  }
+  if (k != lines.size()) {
+    std::cout << "u16: got " << k << " lines, expected "
+	      << lines.size() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// only '\n' ends a line when no eol flags are given.
+bool do_read_lf(const char * fn, const std::u32string & txt)
+{
+  std::ifstream f(fn);
+  alf::unicodestreams::u32utf8istream g(f);
+  alf::unicodestreams::u32line_reader r(g);
+  std::u32string_view line;
+  std::u32string all;
+
+  while (r.getline(line)) {
+    all += line;
+    all += U'\n';
+  }
+  std::u32string x = txt + U'\n';
+  if (all != x) {
+    std::cout << "lf: text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// skip() counts code points and leaves the stream at the next one.
+template <class S, class C>
+bool do_skip(const char * what, const char * fn, const std::u32string & txt)
+{
+  std::ifstream f(fn);
+  S g(f);
+  std::size_t at = 0;
+  std::streamsize steps[] = { 3, 1, 0, 4000, 10, 100 };
+
+  for (std::streamsize n : steps) {
+    if (g.skip(n) != n) {
+      std::cout << what << ": short skip at " << at << std::endl;
+      return false;
+    }
+    at += n + 1;
+    char32_t c = g.get();
+    if (sizeof(C) == 2
+	&& c >= 0xd800 && c < 0xdc00)
+      c = (((c & 0x3ff) << 10) | (g.get() & 0x3ff)) + 0x10000;
+    if (c != txt[at - 1]) {
+      std::cout << what << ": wrong char after skip to " << at << std::endl;
+      return false;
+    }
+  }
+  if (g.skip(txt.size()) != std::streamsize(txt.size() - at) || ! g.eof()) {
+    std::cout << what << ": skip to end is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// a stream reset to a new source forgets all about the old one.
+bool do_reset(const char * fn, const std::u32string & txt)
+{
+  std::istringstream bad("ab\xf0\x9f\x98\x80" "c\xff");
+  alf::unicodestreams::u16utf8istream g(bad);
+  char16_t buf[3];
+
+  // leave half a surrogate pair in the buffer and then fail.
+  g.read(buf, 3);
+  while (g.get() != std::char_traits<char16_t>::eof())
+    ;
+  if (g.streambuf_status() == alf::unicodestreams::status_type::OK) {
+    std::cout << "reset: error not found" << std::endl;
+    return false;
+  }
+
+  std::ifstream f(fn);
+  std::u16string y;
+  std::char_traits<char16_t>::int_type c;
+  g.reset(f);
+  while ((c = g.get()) != std::char_traits<char16_t>::eof())
+    y += char16_t(c);
+  if (g.streambuf_status() != alf::unicodestreams::status_type::OK
+      || ! check("reset", 0, y, txt)) {
+    std::cout << "reset: text differs" << std::endl;
+    return false;
+  }
+
+  std::ostringstream o1, o2;
+  alf::unicodestreams::u16utf8ostream h(o1);
+  h.put(char16_t(0xd800));
+  h.reset(o2);
+  h << u"ok \U0001f600";
+  if (o2.str() != "ok \xf0\x9f\x98\x80") {
+    std::cout << "reset: output differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Read from F and G in turn, G bounded takes nothing beyond what it gives.
+bool do_bounded()
+{
+  std::istringstream f("ab\xf0\x9f\x98\x80" "cd");
+  alf::unicodestreams::u32utf8istream g(f);
+  g.set_bounded(true);
+  std::u32string s;
+  std::string t;
+
+  s += char32_t(g.get());
+  t += char(f.get());
+  s += char32_t(g.get());
+  t += char(f.get());
+  if (s != U"a\U0001f600" || t != "bc") {
+    std::cout << "bounded: u32 read too much" << std::endl;
+    return false;
+  }
+
+  std::istringstream f2("\xf0\x9f\x98\x80" "ab");
+  alf::unicodestreams::u16utf8istream h(f2);
+  h.set_bounded(true);
+  std::u16string u;
+  u += char16_t(h.get());
+  u += char16_t(h.get());
+  if (u != u"\U0001f600" || f2.get() != 'a' || h.get() != 'b') {
+    std::cout << "bounded: u16 read too much" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// a sequence cut at the end is only cut when what there is of it is good.
+bool do_cut()
+{
+  const char * bad[] = { "ab\xe0" "A", "ab\xe0" "Acd", "ab\xf0\x9f" "A" };
+  const char * cut = "ab\xf0\x9f";
+
+  for (int i = 0; i < 4; ++i) {
+    std::istringstream f(i < 3 ? bad[i] : cut);
+    alf::unicodestreams::u32utf8istream g(f);
+    std::u32string y;
+    std::char_traits<char32_t>::int_type c;
+    while ((c = g.get()) != std::char_traits<char32_t>::eof())
+      y += char32_t(c);
+    if (y != U"ab" || g.streambuf_status() != (i < 3
+	? alf::unicodestreams::status_type::NOT_UTF8
+	: alf::unicodestreams::status_type::BAD_STREAM)) {
+      std::cout << "cut: status " << int(g.streambuf_status())
+		<< " for case " << i << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// after an error is cleared reading goes on right after the bad code.
+template <class S>
+bool do_resume(const char * what)
+{
+  const char * text = "A\x80" "BCDEFGHIJ";
+  S f(text);
+  alf::unicodestreams::u32utf8istream g(f);
+  std::u32string y;
+  std::char_traits<char32_t>::int_type c;
+
+  while ((c = g.get()) != std::char_traits<char32_t>::eof())
+    y += char32_t(c);
+  if (y != U"A"
+      || g.streambuf_status() != alf::unicodestreams::status_type::NO_LEAD) {
+    std::cout << what << ": error not found" << std::endl;
+    return false;
+  }
+  g.clear_streambuf_status();
+  g.clear();
+  y.clear();
+  while ((c = g.get()) != std::char_traits<char32_t>::eof())
+    y += char32_t(c);
+  if (y != U"BCDEFGHIJ") {
+    std::cout << what << ": text after the error is lost" << std::endl;
+    return false;
+  }
+
+  // skip() too only takes the bad code.
+  S f2(text);
+  alf::unicodestreams::u32utf8istream h(f2);
+  h.skip(3);
+  h.clear_streambuf_status();
+  h.clear();
+  if (h.get() != U'B') {
+    std::cout << what << ": skip lost the text after the error"
+	      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::vector<std::u32string> lines;
+  std::u32string txt = make_text(lines);
+
+  do_write("test-b.txt", txt);
+  if (do_read32("test-b.txt", lines)
+      && do_read16("test-b.txt", lines)
+      && do_read_lf("test-b.txt", txt)
+      && do_skip<alf::unicodestreams::u32utf8istream, char32_t>(
+	   "u32 skip", "test-b.txt", txt)
+      && do_skip<alf::unicodestreams::u16utf8istream, char16_t>(
+	   "u16 skip", "test-b.txt", txt)
+      && do_reset("test-b.txt", txt)
+      && do_bounded() && do_cut() && do_resume<std::istringstream>("resume")
+      && do_resume<alf::unicodestreams::memory_istream<char> >(
+	   "memory resume"))
+    std::cout << "lines read are ok." << std::endl;
+}
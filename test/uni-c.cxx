@@ -0,0 +1,69 @@
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+
+#include "../unicodestreams.hxx"
+
+// Test the counting functions against what the streams produce.
+
+namespace us = alf::unicodestreams;
+
+char32_t random_char()
+{
+  static const char32_t range[] = { 0x80, 0x800, 0xd800, 0x10000, 0x110000 };
+  char32_t c;
+
+  do {
+    int k = std::rand() % 8;
+    c = std::rand() % (k < 4 ? 0x80 : range[k - 4]);
+  } while ((c >= 0xd800 && c < 0xe000) || (c & 0xfffe) == 0xfffe);
+  return c;
+}
+
+bool check(const char * what, std::size_t n, std::size_t got, std::size_t x)
+{
+  if (got == x)
+    return true;
+  std::cout << what << ": length " << n << " gives " << got
+	    << " expected " << x << std::endl;
+  return false;
+}
+
+bool do_test(std::size_t n)
+{
+  std::u32string txt;
+
+  for (std::size_t i = 0; i < n; ++i)
+    txt += random_char();
+
+  std::ostringstream o8;
+  { us::u32utf8ostream g(o8); g << txt; }
+  std::string t8 = o8.str();
+
+  std::basic_ostringstream<char16_t> o16;
+  { us::u32u16ostream g(o16); g << txt; }
+  std::u16string t16 = o16.str();
+
+  return check("count_utf8", n, us::count_utf8(t8.data(), t8.size()), n)
+    && check("count_u16", n, us::count_u16(t16.data(), t16.size()), n)
+    && check("utf8_length u32", n,
+	     us::utf8_length(txt.data(), txt.size()), t8.size())
+    && check("utf8_length u16", n,
+	     us::utf8_length(t16.data(), t16.size()), t8.size())
+    && check("u16_length u32", n,
+	     us::u16_length(txt.data(), txt.size()), t16.size())
+    && check("u16_length utf8", n,
+	     us::u16_length(t8.data(), t8.size()), t16.size());
+}
+
+int main()
+{
+  for (std::size_t n = 0; n < 100; ++n)
+    if (! do_test(n))
+      return 1;
+  if (! do_test(100000))
+    return 1;
+  std::cout << "counting is ok." << std::endl;
+}
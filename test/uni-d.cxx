@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../unicodestreams.hxx"
+
+// Test the reverse readers.
+
+std::u32string make_text(std::vector<std::u32string> & lines)
+{
+  std::u32string longline;
+
+  for (int i = 0; i < 3000; ++i)
+    longline += char32_t(i % 3 ? U'€' : U'\U0001f600');
+
+  lines.push_back(U"first øå");
+  lines.push_back(U"");
+  lines.push_back(longline);
+  lines.push_back(U"CR\rLF");
+  lines.push_back(U"\U00010400 last");
+  return lines[0] + U"\r\n" + lines[1] + U"\n" + lines[2] + U"\n"
+    + lines[3] + U"\r\n" + lines[4] + U"\n";
+}
+
+std::u16string to_u16(const std::u32string & txt)
+{
+  std::u16string s;
+
+  for (char32_t c : txt) {
+    if (c >= 0x10000) {
+      s += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      s += char16_t(0xdc00 + (c & 0x3ff));
+    } else
+      s += char16_t(c);
+  }
+  return s;
+}
+
+template <class R, class S>
+bool do_lines(const char * what, S & f,
+	      const std::vector<std::u32string> & lines)
+{
+  R r(f, alf::unicodestreams::EOL_CRLF, 16);
+  std::u32string line;
+  std::size_t k = lines.size();
+
+  while (r.getline(line)) {
+    if (k == 0 || line != lines[--k]) {
+      std::cout << what << ": line " << k << " is wrong" << std::endl;
+      return false;
+    }
+  }
+  if (k != 0 || r.status() != alf::unicodestreams::status_type::OK) {
+    std::cout << what << ": " << k << " lines left, status "
+	      << int(r.status()) << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <class R, class S>
+bool do_chars(const char * what, S & f, const std::u32string & txt)
+{
+  R r(f, alf::unicodestreams::EOL_LF, 16);
+  std::u32string y;
+  std::char_traits<char32_t>::int_type c;
+
+  while ((c = r.get()) != std::char_traits<char32_t>::eof())
+    y += char32_t(c);
+  if (std::u32string(y.rbegin(), y.rend()) != txt || r.tell() != 0) {
+    std::cout << what << ": text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// an error is found when we get to it, not before.
+bool do_bad()
+{
+  std::istringstream f("ab\x80" "cd\xe2\x82");
+  alf::unicodestreams::u32utf8_reverse_reader r(f);
+
+  if (r.get() != std::char_traits<char32_t>::eof()
+      || r.status() != alf::unicodestreams::status_type::BAD_STREAM) {
+    std::cout << "bad: truncated end not found" << std::endl;
+    return false;
+  }
+
+  std::istringstream g("ab\x80" "cd");
+  alf::unicodestreams::u32utf8_reverse_reader q(g);
+  if (q.get() != 'd' || q.get() != 'c'
+      || q.get() != std::char_traits<char32_t>::eof()
+      || q.status() != alf::unicodestreams::status_type::NO_LEAD) {
+    std::cout << "bad: lone trailing byte not found" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::vector<std::u32string> lines;
+  std::u32string txt = make_text(lines);
+
+  {
+    std::ofstream f("test-d.txt");
+    alf::unicodestreams::u32utf8ostream g(f);
+    g << txt;
+  }
+
+  std::ifstream f1("test-d.txt");
+  std::ifstream f2("test-d.txt");
+  std::basic_istringstream<char16_t> g1(to_u16(txt));
+  std::basic_istringstream<char16_t> g2(to_u16(txt));
+
+  if (do_lines<alf::unicodestreams::u32utf8_reverse_reader>("utf8 lines",
+							     f1, lines)
+      && do_chars<alf::unicodestreams::u32utf8_reverse_reader>("utf8 chars",
+							       f2, txt)
+      && do_lines<alf::unicodestreams::u32u16_reverse_reader>("u16 lines",
+							      g1, lines)
+      && do_chars<alf::unicodestreams::u32u16_reverse_reader>("u16 chars",
+							      g2, txt)
+      && do_bad())
+    std::cout << "reverse read is ok." << std::endl;
+}
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <iterator>
+
+#include "../unicodestreams.hxx"
+
+// Test the codecvt facets with basic_filebuf and by hand.
+
+typedef std::codecvt_base cvt;
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 2000; ++i) {
+    txt += U"plain ascii text ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+    if (i % 100 == 0)
+      txt += U'\n';
+  }
+  return txt;
+}
+
+std::u16string to_u16(const std::u32string & txt)
+{
+  std::u16string s;
+
+  for (char32_t c : txt) {
+    if (c >= 0x10000) {
+      s += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      s += char16_t(0xdc00 + (c & 0x3ff));
+    } else
+      s += char16_t(c);
+  }
+  return s;
+}
+
+std::string slurp(const char * fn)
+{
+  std::ifstream f(fn);
+  return std::string(std::istreambuf_iterator<char>(f),
+		     std::istreambuf_iterator<char>());
+}
+
+template <class C, class F, class S>
+bool do_read(const char * what, const char * fn, const S & x)
+{
+  std::basic_ifstream<C> f;
+  f.imbue(std::locale(f.getloc(), new F));
+  f.open(fn);
+  S y(std::istreambuf_iterator<C>(f), (std::istreambuf_iterator<C>()));
+  if (y != x) {
+    std::cout << what << ": read " << y.size() << " chars, expected "
+	      << x.size() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <class C, class F, class S>
+bool do_write(const char * what, const char * fn, const S & x,
+	      const std::string & bytes)
+{
+  {
+    std::basic_ofstream<C> f;
+    f.imbue(std::locale(f.getloc(), new F));
+    f.open(fn);
+    f << x;
+  }
+  if (slurp(fn) != bytes) {
+    std::cout << what << ": written bytes differ" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// feed in() a byte at a time with room for one char16_t at a time,
+// everything has to go through the mbstate_t.
+bool do_trickle(const std::string & bytes, const std::u16string & x)
+{
+  alf::unicodestreams::u16utf8_codecvt f;
+  std::mbstate_t st = std::mbstate_t();
+  std::u16string y;
+  const char * p = bytes.data();
+  const char * pe = p + bytes.size();
+  char16_t c;
+
+  while (true) {
+    const char * e = p < pe ? p + 1 : pe;
+    char16_t * q;
+    cvt::result r = f.in(st, p, e, p, & c, & c + 1, q);
+    if (r == cvt::error) {
+      std::cout << "trickle: error at " << (p - bytes.data()) << std::endl;
+      return false;
+    }
+    if (q > & c)
+      y += c;
+    else if (p == pe)
+      break;
+  }
+  if (y != x) {
+    std::cout << "trickle: text differs" << std::endl;
+    return false;
+  }
+
+  // and back, a char16_t at a time.
+  std::string z;
+  const char16_t * s = x.data();
+  const char16_t * se = s + x.size();
+  st = std::mbstate_t();
+  while (s < se) {
+    char buf[4];
+    char * q;
+    if (f.out(st, s, s + 1, s, buf, buf + 4, q) == cvt::error) {
+      std::cout << "trickle: out error" << std::endl;
+      return false;
+    }
+    z.append(buf, q);
+  }
+  if (z != bytes) {
+    std::cout << "trickle: out text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_bad()
+{
+  alf::unicodestreams::u32utf8_codecvt f;
+  alf::unicodestreams::u32iso8859_1_codecvt g;
+  std::mbstate_t st = std::mbstate_t();
+  const char bad[] = "ab\xed\xa0\x80";
+  const char * p;
+  char32_t buf[8];
+  char32_t * q;
+
+  if (f.in(st, bad, bad + 5, p, buf, buf + 8, q) != cvt::error
+      || p != bad + 2 || q != buf + 2) {
+    std::cout << "bad: surrogate in UTF-8 not found" << std::endl;
+    return false;
+  }
+  if (f.length(st, "a\xc3\xa6\xc3", "a\xc3\xa6\xc3" + 4, 2) != 3) {
+    std::cout << "bad: length is wrong" << std::endl;
+    return false;
+  }
+
+  // a surrogate pair that doesn't fit in max is left.
+  alf::unicodestreams::u16utf8_codecvt h;
+  const char pair[] = "a\xf0\x9f\x98\x80" "b";
+  if (h.length(st, pair, pair + 6, 1) != 1
+      || h.length(st, pair, pair + 6, 2) != 1
+      || h.length(st, pair, pair + 6, 3) != 5
+      || h.length(st, pair, pair + 6, 4) != 6
+      || h.length(st, pair + 1, pair + 6, 1) != 0) {
+    std::cout << "bad: length of a pair is wrong" << std::endl;
+    return false;
+  }
+
+  const char32_t latin[] = U"aæĀ";
+  const char32_t * s;
+  char out[8];
+  char * o;
+  if (g.out(st, latin, latin + 3, s, out, out + 8, o) != cvt::error
+      || s != latin + 2 || o != out + 2 || out[1] != '\xe6') {
+    std::cout << "bad: latin1 out is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::u16string txt16 = to_u16(txt);
+  std::wstring wtxt(txt.begin(), txt.end());
+
+  {
+    std::ofstream f("test-e.txt");
+    alf::unicodestreams::u32utf8ostream g(f);
+    g << txt;
+  }
+  std::string bytes = slurp("test-e.txt");
+
+  using namespace alf::unicodestreams;
+  if (do_read<wchar_t, wutf8_codecvt>("wchar_t", "test-e.txt", wtxt)
+      && do_read<char16_t, u16utf8_codecvt>("char16_t", "test-e.txt", txt16)
+      && do_read<char32_t, u32utf8_codecvt>("char32_t", "test-e.txt", txt)
+      && do_write<char32_t, u32utf8_codecvt>("char32_t", "test-e2.txt",
+					     txt, bytes)
+      && do_write<char16_t, u16utf8_codecvt>("char16_t", "test-e2.txt",
+					     txt16, bytes)
+      && do_trickle(bytes, txt16)
+      && do_bad())
+    std::cout << "codecvt is ok." << std::endl;
+}
@@ -0,0 +1,196 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <cstring>
+
+#include "../unicodestreams.hxx"
+
+// Test the light readers and writers with tiny buffers.
+
+struct mem_source {
+  const std::string * s;
+  std::size_t pos;
+};
+
+// give at most 3 bytes at a time.
+std::ptrdiff_t from_mem(void * ctx, char * buf, std::size_t n)
+{
+  mem_source * m = (mem_source *)ctx;
+  std::size_t k = m->s->size() - m->pos;
+  if (k > n)
+    k = n;
+  if (k > 3)
+    k = 3;
+  std::memcpy(buf, m->s->data() + m->pos, k);
+  m->pos += k;
+  return k;
+}
+
+std::ptrdiff_t to_string(void * ctx, const char * buf, std::size_t n)
+{
+  ((std::string *)ctx)->append(buf, n);
+  return n;
+}
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 500; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+std::u16string to_u16(const std::u32string & txt)
+{
+  std::u16string s;
+
+  for (char32_t c : txt) {
+    if (c >= 0x10000) {
+      s += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      s += char16_t(0xdc00 + (c & 0x3ff));
+    } else
+      s += char16_t(c);
+  }
+  return s;
+}
+
+bool do_get32(const std::string & bytes, const std::u32string & txt)
+{
+  mem_source m = { & bytes, 0 };
+  alf::unicodestreams::utf8_reader<char32_t> r(from_mem, & m, 4);
+  std::u32string y;
+  std::char_traits<char32_t>::int_type c;
+
+  while ((c = r.peek()) != std::char_traits<char32_t>::eof()) {
+    if (r.get() != c) {
+      std::cout << "get32: peek and get differ" << std::endl;
+      return false;
+    }
+    y += char32_t(c);
+  }
+  if (y != txt || ! r.eof()
+      || r.status() != alf::unicodestreams::status_type::OK) {
+    std::cout << "get32: text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_read16(const std::string & bytes, const std::u16string & txt,
+	       std::size_t chunk)
+{
+  mem_source m = { & bytes, 0 };
+  char buf[5];
+  alf::unicodestreams::utf8_reader<char16_t> r(from_mem, & m, buf, 5);
+  std::u16string y;
+  char16_t tmp[16];
+  std::size_t k;
+
+  while ((k = r.read(tmp, chunk)) > 0)
+    y.append(tmp, k);
+  if (y != txt) {
+    std::cout << "read16: text differs for chunk " << chunk << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_skip(const std::string & bytes, const std::u32string & txt)
+{
+  mem_source m = { & bytes, 0 };
+  alf::unicodestreams::utf8_reader<char32_t> r(from_mem, & m, 4);
+  std::size_t at = 0;
+
+  for (std::size_t n : { 1, 5, 100, 0, 33 }) {
+    if (r.skip(n) != n || char32_t(r.get()) != txt[at + n]) {
+      std::cout << "skip: wrong char after " << at << " + " << n << std::endl;
+      return false;
+    }
+    at += n + 1;
+  }
+  if (r.skip(txt.size()) != txt.size() - at || ! r.eof()) {
+    std::cout << "skip: skip to end is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_write(const std::string & bytes, const std::u32string & txt,
+	      const std::u16string & txt16)
+{
+  std::string a, b;
+  {
+    alf::unicodestreams::utf8_writer<char32_t> w(to_string, & a, 4);
+    for (char32_t c : txt)
+      w.put(c);
+  }
+  {
+    alf::unicodestreams::utf8_writer<char16_t> w(to_string, & b, 5);
+    for (std::size_t i = 0; i < txt16.size(); i += 7)
+      w.write(txt16.data() + i, std::min<std::size_t>(7, txt16.size() - i));
+  }
+  if (a != bytes || b != bytes) {
+    std::cout << "write: bytes differ" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_bad()
+{
+  std::string bad("ab\xc3\xa6" "c\xc3");
+  mem_source m = { & bad, 0 };
+  alf::unicodestreams::utf8_reader<char32_t> r(from_mem, & m, 4);
+  char32_t buf[8];
+
+  if (r.read(buf, 8) != 4
+      || r.status() != alf::unicodestreams::status_type::BAD_STREAM) {
+    std::cout << "bad: truncated sequence not found" << std::endl;
+    return false;
+  }
+
+  // a bad sequence after a char is only found when reading past it.
+  std::string bad2("a\xff");
+  mem_source m2 = { & bad2, 0 };
+  alf::unicodestreams::utf8_reader<char32_t> r2(from_mem, & m2, 4);
+  if (r2.peek() != U'a' || r2.get() != U'a'
+      || r2.status() != alf::unicodestreams::status_type::OK
+      || r2.get() != std::char_traits<char32_t>::eof()
+      || r2.status() != alf::unicodestreams::status_type::NOT_UTF8) {
+    std::cout << "bad: peek before a bad sequence" << std::endl;
+    return false;
+  }
+
+  std::string out;
+  alf::unicodestreams::utf8_writer<char32_t> w(to_string, & out);
+  const char32_t txt[] = { U'a', 0xd800, U'b' };
+  if (w.write(txt, 3) != 1 || ! w.flush() || out != "a"
+      || w.status() != alf::unicodestreams::status_type::NOT_UNICODE) {
+    std::cout << "bad: surrogate written" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::u16string txt16 = to_u16(txt);
+  std::ostringstream f;
+  {
+    alf::unicodestreams::u32utf8ostream g(f);
+    g << txt;
+  }
+  std::string bytes = f.str();
+
+  if (do_get32(bytes, txt)
+      && do_read16(bytes, txt16, 1)
+      && do_read16(bytes, txt16, 7)
+      && do_skip(bytes, txt)
+      && do_write(bytes, txt, txt16)
+      && do_bad())
+    std::cout << "light readers are ok." << std::endl;
+}
@@ -0,0 +1,161 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test the memory sources and sinks and the one shot conversions.
+
+namespace us = alf::unicodestreams;
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 3000; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+std::u16string make_u16(const std::u32string & txt)
+{
+  std::u16string s;
+
+  for (char32_t c : txt) {
+    if (c >= 0x10000) {
+      s += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      s += char16_t(0xdc00 + (c & 0x3ff));
+    } else
+      s += char16_t(c);
+  }
+  return s;
+}
+
+bool do_read(const std::string & bytes, const std::u32string & txt,
+	     const std::u16string & txt16)
+{
+  us::memory_istream<char> f(bytes);
+  us::u32utf8istream g(f);
+  std::u32string y;
+  char32_t buf[37];
+  std::char_traits<char32_t>::int_type c = g.get();
+
+  y += char32_t(c);
+  while (g.read(buf, 37), g.gcount() > 0)
+    y.append(buf, g.gcount());
+  if (y != txt || g.streambuf_status() != us::status_type::OK
+      || ! f.view().empty()) {
+    std::cout << "read: u32 text differs" << std::endl;
+    return false;
+  }
+
+  // odd sizes so surrogate pairs get split.
+  us::memory_istream<char> h(bytes);
+  us::u16utf8istream k(h);
+  std::u16string z;
+  char16_t buf16[13];
+
+  while (k.read(buf16, 13), k.gcount() > 0)
+    z.append(buf16, k.gcount());
+  if (z != txt16) {
+    std::cout << "read: u16 text differs" << std::endl;
+    return false;
+  }
+
+  us::memory_istream<char> m(bytes);
+  us::u32utf8istream n(m);
+  if (n.skip(1000) != 1000 || char32_t(n.get()) != txt[1000]) {
+    std::cout << "read: skip is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_write(const std::string & bytes, const std::u32string & txt,
+	      const std::u16string & txt16)
+{
+  us::memory_ostream<char> f;
+  {
+    us::u32utf8ostream g(f);
+    g.put(txt[0]);
+    g.write(txt.data() + 1, txt.size() - 1);
+  }
+  if (f.size() != bytes.size() || f.release() != bytes || f.size() != 0) {
+    std::cout << "write: u32 bytes differ" << std::endl;
+    return false;
+  }
+
+  us::memory_ostream<char> h;
+  {
+    us::u16utf8ostream k(h);
+    for (std::size_t i = 0; i < txt16.size(); i += 11)
+      k.write(txt16.data() + i, std::min<std::size_t>(11, txt16.size() - i));
+  }
+  if (h.view() != bytes) {
+    std::cout << "write: u16 bytes differ" << std::endl;
+    return false;
+  }
+
+  // any other streambuf still works.
+  std::ostringstream s;
+  {
+    us::u16utf8ostream k(s);
+    k.write(txt16.data(), txt16.size());
+  }
+  if (s.str() != bytes) {
+    std::cout << "write: u16 to ostringstream differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_convert(const std::string & bytes, const std::u32string & txt,
+		const std::u16string & txt16)
+{
+  us::status_type st;
+
+  if (us::to_utf8(txt, & st) != bytes || st != us::status_type::OK
+      || us::to_utf8(txt16, & st) != bytes || st != us::status_type::OK
+      || us::to_u32(bytes, & st) != txt || st != us::status_type::OK
+      || us::to_u16(bytes, & st) != txt16 || st != us::status_type::OK) {
+    std::cout << "convert: round trip differs" << std::endl;
+    return false;
+  }
+
+  if (us::to_u32("ab\xc3\xa6" "c\xc3", & st) != U"abæc"
+      || st != us::status_type::BAD_STREAM) {
+    std::cout << "convert: truncated sequence not found" << std::endl;
+    return false;
+  }
+  if (us::to_utf8(u"ab\xd800", & st) != "ab"
+      || st != us::status_type::NO_FOLLOW) {
+    std::cout << "convert: lone high surrogate not found" << std::endl;
+    return false;
+  }
+  const char32_t bad[] = { U'a', 0xdc00, U'b' };
+  if (us::to_utf8(std::u32string_view(bad, 3), & st) != "a"
+      || st != us::status_type::NOT_UNICODE) {
+    std::cout << "convert: surrogate written" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::u16string txt16 = make_u16(txt);
+  std::ostringstream f;
+  {
+    us::u32utf8ostream g(f);
+    g << txt;
+  }
+  std::string bytes = f.str();
+
+  if (do_read(bytes, txt, txt16)
+      && do_write(bytes, txt, txt16)
+      && do_convert(bytes, txt, txt16))
+    std::cout << "memory streams are ok." << std::endl;
+}
@@ -0,0 +1,133 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../unicodestreams.hxx"
+
+// Test the batch conversions against the one shot conversions.
+
+namespace us = alf::unicodestreams;
+
+// short values, mostly ASCII, some empty and some not.
+std::vector<std::u32string> make_values()
+{
+  std::vector<std::u32string> v;
+
+  for (int i = 0; i < 2000; ++i) {
+    std::u32string s;
+    for (int j = 0; j < i % 23; ++j)
+      s += char32_t(U'a' + j);
+    if (i % 7 == 0)
+      s += i % 2 ? U'ø' : U'\U0001f600';
+    if (i % 11 == 0)
+      s += U"tail";
+    v.push_back(s);
+  }
+  return v;
+}
+
+template <class C, class E>
+bool same(const us::batch<C> & b, const std::vector<std::basic_string<E>> & v,
+	  const char * what)
+{
+  if (b.size() != v.size() || b.errors() != 0) {
+    std::cout << what << ": wrong number of values" << std::endl;
+    return false;
+  }
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    if (b[i] != v[i] || b.status(i) != us::status_type::OK) {
+      std::cout << what << ": value " << i << " differs" << std::endl;
+      return false;
+    }
+  }
+  if (b.offsets()[b.size()] != b.length()) {
+    std::cout << what << ": offsets are wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// all values one after the other with their offsets.
+template <class E>
+std::basic_string<E> flatten(const std::vector<std::basic_string<E>> & v,
+			     std::vector<std::size_t> & off)
+{
+  std::basic_string<E> s;
+
+  off.assign(1, 0);
+  for (const std::basic_string<E> & x : v) {
+    s += x;
+    off.push_back(s.size());
+  }
+  return s;
+}
+
+bool do_batch(const std::vector<std::u32string> & v32)
+{
+  std::vector<std::u16string> v16;
+  std::vector<std::string> v8;
+  for (const std::u32string & s : v32) {
+    v8.push_back(us::to_utf8(s));
+    v16.push_back(us::to_u16(v8.back()));
+  }
+
+  std::vector<std::size_t> off32, off16, off8;
+  std::u32string d32 = flatten(v32, off32);
+  std::u16string d16 = flatten(v16, off16);
+  std::string d8 = flatten(v8, off8);
+
+  us::batch<char> a, b;
+  us::batch<char16_t> c;
+  us::batch<char32_t> d;
+  us::batch_to_utf8(d32.data(), off32.data(), v32.size(), a);
+  us::batch_to_utf8(d16.data(), off16.data(), v16.size(), b);
+  us::batch_to_u16(d8.data(), off8.data(), v8.size(), c);
+  us::batch_to_u32(d8.data(), off8.data(), v8.size(), d);
+  if (! same(a, v8, "u32 to utf8") || ! same(b, v8, "u16 to utf8")
+      || ! same(c, v16, "utf8 to u16") || ! same(d, v32, "utf8 to u32"))
+    return false;
+
+  std::vector<std::u16string_view> w16(v16.begin(), v16.end());
+  std::vector<std::string_view> w8(v8.begin(), v8.end());
+  b.clear();
+  d.clear();
+  us::batch_to_utf8(w16.data(), w16.size(), b);
+  us::batch_to_u32(w8.data(), w8.size(), d);
+  return same(b, v8, "u16 views to utf8") && same(d, v32, "utf8 views to u32");
+}
+
+bool do_errors()
+{
+  // the bad values do not disturb their neighbours.
+  std::string d = "abc" "x\xc3" "\xff" "def" "" "\xe2\x82\xac";
+  std::size_t off[] = { 0, 3, 5, 6, 9, 9, 12 };
+  us::batch<char32_t> b;
+
+  if (us::batch_to_u32(d.data(), off, 6, b) != 2 || b.size() != 6
+      || b[0] != U"abc" || b.status(0) != us::status_type::OK
+      || b[1] != U"x" || b.status(1) != us::status_type::BAD_STREAM
+      || b[2] != U"" || b.status(2) != us::status_type::NOT_UTF8
+      || b[3] != U"def" || b[4] != U"" || b[5] != U"€"
+      || b.status(5) != us::status_type::OK) {
+    std::cout << "errors: bad UTF-8 values are wrong" << std::endl;
+    return false;
+  }
+
+  std::u16string e = u"ab\xd800" u"\xdc00" u"cd";
+  std::size_t off16[] = { 0, 3, 4, 6 };
+  us::batch<char> c;
+  if (us::batch_to_utf8(e.data(), off16, 3, c) != 2
+      || c[0] != "ab" || c.status(0) != us::status_type::NO_FOLLOW
+      || c[1] != "" || c.status(1) != us::status_type::NO_LEAD
+      || c[2] != "cd" || c.status(2) != us::status_type::OK) {
+    std::cout << "errors: bad UTF-16 values are wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  if (do_batch(make_values()) && do_errors())
+    std::cout << "batches are ok." << std::endl;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../unicodethreads.hxx"
+
+// Test many threads writing records to one shared_u32utf8ostream.
+
+namespace us = alf::unicodestreams;
+
+enum { THREADS = 8, RECORDS = 2000 };
+
+std::u32string number(int n)
+{
+  std::u32string s;
+
+  do
+    s.insert(s.begin(), char32_t(U'0' + n % 10));
+  while (n /= 10);
+  return s;
+}
+
+// record i of thread t, written in pieces.
+void writer(us::shared_u32utf8ostream * log, int t)
+{
+  for (int i = 0; i < RECORDS; ++i) {
+    if (i % 5 == 0) {
+      log->write(U"t" + number(t) + U" r" + number(i) + U" ø€😀 w\n");
+      continue;
+    }
+    us::u32utf8record r(*log);
+    r << U"t" << number(t) << U" r" << number(i);
+    r.put(U' ');
+    r << U"ø€😀";
+    if (i % 7 == 0)
+      r << U" and a rather long tail to make the record overflow the put "
+	U"area of the record streambuf at least once";
+    r << U" w\n";
+    if (i % 5 == 1)
+      r << std::flush;
+  }
+}
+
+bool do_threads()
+{
+  std::ostringstream f;
+  {
+    us::shared_u32utf8ostream log(f);
+    std::vector<std::thread> v;
+    for (int t = 0; t < THREADS; ++t)
+      v.emplace_back(writer, & log, t);
+    for (std::thread & x : v)
+      x.join();
+    if (log.status() != us::status_type::OK) {
+      std::cout << "threads: bad status" << std::endl;
+      return false;
+    }
+  }
+
+  // every record is whole and those of a thread come in order.
+  std::istringstream in(f.str());
+  std::string line;
+  std::vector<int> next(THREADS, 0);
+  int lines = 0;
+  while (std::getline(in, line)) {
+    int t, i;
+    char tail[256];
+    if (std::sscanf(line.c_str(), "t%d r%d %255[^\n]", & t, & i, tail) != 3
+	|| t < 0 || t >= THREADS || i != next[t]
+	|| (std::string(tail) != "ø€😀 w"
+	    && std::string(tail) != "ø€😀 and a rather long tail to make the "
+	    "record overflow the put area of the record streambuf at least "
+	    "once w")) {
+      std::cout << "threads: bad record: " << line << std::endl;
+      return false;
+    }
+    ++next[t];
+    ++lines;
+  }
+  if (lines != THREADS * RECORDS) {
+    std::cout << "threads: " << lines << " records" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_bad()
+{
+  std::ostringstream f;
+  us::shared_u32utf8ostream log(f);
+  {
+    us::u32utf8record r(log);
+    r << U"ab";
+    r.put(char32_t(0xd800));
+    r << U"cd";
+    r.commit();
+    if (r.streambuf_status() != us::status_type::NOT_UNICODE) {
+      std::cout << "bad: surrogate not found" << std::endl;
+      return false;
+    }
+  }
+  log.flush();
+  if (f.str() != "ab" || log.status() != us::status_type::NOT_UNICODE) {
+    std::cout << "bad: wrong output" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  if (do_threads() && do_bad())
+    std::cout << "shared stream is ok." << std::endl;
+}
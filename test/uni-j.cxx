@@ -0,0 +1,153 @@
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#include "../unicodethreads.hxx"
+
+// Test reading ahead in a thread with small blocks.
+
+namespace us = alf::unicodestreams;
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 20000; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+bool do_read(const std::string & bytes, const std::u32string & txt,
+	     std::size_t blocksz, std::size_t nblocks)
+{
+  std::istringstream f(bytes);
+  us::readahead_istream r(f, blocksz, nblocks);
+  us::u32utf8istream g(r);
+  std::u32string y;
+  char32_t buf[100];
+
+  while (g.read(buf, 100), g.gcount() > 0)
+    y.append(buf, g.gcount());
+  if (y != txt || r.streambuf_status() != us::status_type::OK) {
+    std::cout << "read: text differs for " << blocksz << " x " << nblocks
+	      << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// stop while the thread waits for room.
+bool do_stop(const std::string & bytes, const std::u32string & txt)
+{
+  std::istringstream f(bytes);
+  {
+    us::readahead_istream r(f, 100, 2);
+    us::u32utf8istream g(r);
+    char32_t buf[10];
+    if (! g.read(buf, 10) || txt.compare(0, 10, buf, 10) != 0) {
+      std::cout << "stop: text differs" << std::endl;
+      return false;
+    }
+  }
+  // it read no more than the ring holds and the one after.
+  if (f.tellg() > 400) {
+    std::cout << "stop: read too far ahead" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// a source that has only what was written to it so far, like a pipe.
+class trickle_buf : public std::streambuf {
+
+public:
+
+  void write(const std::string & s)
+  {
+    std::lock_guard<std::mutex> l(m_);
+    data_ += s;
+    cv_.notify_all();
+  }
+
+  void close()
+  {
+    std::lock_guard<std::mutex> l(m_);
+    closed_ = true;
+    cv_.notify_all();
+  }
+
+protected:
+
+  virtual int_type underflow()
+  {
+    std::unique_lock<std::mutex> l(m_);
+    cv_.wait(l, [&] { return pos_ < data_.size() || closed_; });
+    if (pos_ == data_.size())
+      return traits_type::eof();
+    c_ = data_[pos_++];
+    this->setg(& c_, & c_, & c_ + 1);
+    return traits_type::to_int_type(c_);
+  }
+
+  virtual std::streamsize showmanyc()
+  {
+    std::lock_guard<std::mutex> l(m_);
+    if (pos_ == data_.size())
+      return closed_ ? -1 : 0;
+    return data_.size() - pos_;
+  }
+
+private:
+
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::string data_;
+  std::size_t pos_ = 0;
+  bool closed_ = false;
+  char c_;
+
+};
+
+// what the source has comes through before a block is full.
+bool do_trickle()
+{
+  trickle_buf t;
+  std::istream f(& t);
+  us::readahead_istream r(f, 1000, 2);
+  us::u32utf8istream g(r);
+  std::u32string y;
+
+  t.write("ab\xc3\xa6");
+  for (int i = 0; i < 3; ++i)
+    y += char32_t(g.get());
+  t.write("c");
+  t.write("d");
+  t.close();
+  char32_t buf[10];
+  g.read(buf, 10);
+  y.append(buf, g.gcount());
+  if (y != U"abæcd" || ! g.eof()) {
+    std::cout << "trickle: text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::string bytes = us::to_utf8(txt);
+
+  if (do_read(bytes, txt, 1, 1)
+      && do_read(bytes, txt, 1000, 3)
+      && do_read(bytes, txt, bytes.size(), 2)
+      && do_read(bytes, txt, 64 * 1024, 2)
+      && do_read(std::string(), std::u32string(), 16, 2)
+      && do_stop(bytes, txt)
+      && do_trickle())
+    std::cout << "read ahead is ok." << std::endl;
+}
@@ -0,0 +1,166 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "../unicodestreams.hxx"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
+// Test the io_uring file source and sink, with and without io_uring.
+
+namespace us = alf::unicodestreams;
+
+#if defined(__unix__) || defined(__APPLE__)
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 30000; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+// whether this system lets us have an io_uring, then the streams must
+// use it when asked to.
+bool uring_available()
+{
+#if defined(__NR_io_uring_setup)
+  io_uring_params p;
+  std::memset(& p, 0, sizeof(p));
+  int fd = int(::syscall(__NR_io_uring_setup, 4, & p));
+  if (fd < 0)
+    return false;
+  ::close(fd);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool do_file(const std::u32string & txt, std::size_t blocksz,
+	     unsigned depth, bool try_uring)
+{
+  {
+    us::uring_ostream f("test-k.txt", blocksz, depth, try_uring);
+    us::u32utf8ostream g(f);
+    g.write(txt.data(), txt.size());
+    g.flush();
+    if (! f.is_open() || f.streambuf_status() != us::status_type::OK) {
+      std::cout << "file: writing failed" << std::endl;
+      return false;
+    }
+    if (f.uses_uring() != (try_uring && uring_available())) {
+      std::cout << "file: io_uring used is wrong for writing" << std::endl;
+      return false;
+    }
+  }
+
+  std::ifstream h("test-k.txt", std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(h)),
+		    std::istreambuf_iterator<char>());
+  if (bytes != us::to_utf8(txt)) {
+    std::cout << "file: bytes differ for " << blocksz << " x " << depth
+	      << (try_uring ? "" : " plain") << std::endl;
+    return false;
+  }
+
+  us::uring_istream f("test-k.txt", blocksz, depth, try_uring);
+  if (f.uses_uring() != (try_uring && uring_available())) {
+    std::cout << "file: io_uring used is wrong for reading" << std::endl;
+    return false;
+  }
+  us::u32utf8istream g(f);
+  std::u32string y;
+  char32_t buf[333];
+  while (g.read(buf, 333), g.gcount() > 0)
+    y.append(buf, g.gcount());
+  if (y != txt || f.streambuf_status() != us::status_type::OK) {
+    std::cout << "file: text differs for " << blocksz << " x " << depth
+	      << (try_uring ? "" : " plain") << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// a pipe has no offsets, it is read and written in order.
+bool do_pipe(const std::u32string & txt)
+{
+  int fd[2];
+  if (::pipe(fd) != 0)
+    return true;
+
+  std::thread w([&] {
+    {
+      us::uring_sink s(fd[1], 4096, 4);
+      std::ostream o(& s);
+      us::u32utf8ostream g(o);
+      g.write(txt.data(), txt.size());
+    }
+    ::close(fd[1]);
+  });
+
+  us::uring_source s(fd[0], 4096, 4);
+  std::istream i(& s);
+  us::u32utf8istream g(i);
+  std::u32string y;
+  char32_t buf[333];
+  while (g.read(buf, 333), g.gcount() > 0)
+    y.append(buf, g.gcount());
+  w.join();
+  ::close(fd[0]);
+  if (y != txt || s.status() != us::status_type::OK || s.uses_uring()) {
+    std::cout << "pipe: text differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_missing()
+{
+  us::uring_istream f("no/such/file.txt");
+  if (f || f.is_open()
+      || f.streambuf_status() != us::status_type::NO_STREAM) {
+    std::cout << "missing: opened a missing file" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+
+  if (do_file(txt, 4096, 1, true)
+      && do_file(txt, 4096, 4, true)
+      && do_file(txt, 65536, 4, true)
+      && do_file(txt, 4096, 3, false)
+      && do_file(std::u32string(), 4096, 2, true)
+      && do_pipe(txt)
+      && do_missing())
+    std::cout << "uring files are ok." << std::endl;
+  std::remove("test-k.txt");
+}
+
+#else
+
+int main()
+{
+  std::cout << "uring files are ok." << std::endl;
+}
+
+#endif
@@ -0,0 +1,176 @@
+#include <deque>
+#include <iostream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test the coroutine readers with a source that suspends on every read
+// and gives at most 3 codes at a time. Built with -std=c++20.
+
+namespace us = alf::unicodestreams;
+
+#if defined(ALF_UNICODESTREAMS_COROUTINES)
+
+// the coroutines waiting for their source.
+std::deque<std::coroutine_handle<>> ready;
+
+template <class E>
+struct slow_source {
+
+  struct awaiter {
+    slow_source * s;
+    E * buf;
+    std::size_t n;
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) { ready.push_back(h); }
+    std::ptrdiff_t await_resume()
+    {
+      if (s->fail && s->pos > 0)
+	return -1;
+      std::size_t k = s->text.size() - s->pos;
+      if (k > n)
+	k = n;
+      if (k > 3)
+	k = 3;
+      s->text.copy(buf, k, s->pos);
+      s->pos += k;
+      return k;
+    }
+  };
+
+  std::basic_string<E> text;
+  std::size_t pos = 0;
+  bool fail = false;
+
+  awaiter read_some(E * buf, std::size_t n) { return awaiter{ this, buf, n }; }
+
+};
+
+void run(us::task<bool> & t)
+{
+  t.start();
+  while (! ready.empty()) {
+    std::coroutine_handle<> h = ready.front();
+    ready.pop_front();
+    h.resume();
+  }
+}
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 300; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+us::task<bool> read32(std::string bytes, std::u32string txt)
+{
+  slow_source<char> src{ bytes };
+  us::async_u32utf8_reader<slow_source<char>> r(src, 5);
+  std::u32string y;
+  char32_t buf[7];
+  std::size_t k;
+
+  while ((k = co_await r.read_some(buf, 7)) > 0)
+    y.append(buf, k);
+  co_return y == txt && r.eof() && r.status() == us::status_type::OK;
+}
+
+us::task<bool> read16(std::string bytes, std::u16string txt)
+{
+  slow_source<char> src{ bytes };
+  us::async_u16utf8_reader<slow_source<char>> r(src, 4);
+  std::u16string y;
+  char16_t c;
+
+  // one char at a time so surrogate pairs are split.
+  while (co_await r.read_some(& c, 1) > 0)
+    y += c;
+  co_return y == txt;
+}
+
+// NUL after a char read alone is a char too.
+us::task<bool> nuls()
+{
+  std::string z("a\0b\0", 4);
+  slow_source<char> src{ z };
+  us::async_u32utf8_reader<slow_source<char>> r(src);
+  std::u32string y;
+  char32_t c;
+
+  while (co_await r.read_some(& c, 1) > 0)
+    y += c;
+  co_return y == std::u32string(U"a\0b\0", 4) && r.eof();
+}
+
+us::task<bool> blocks(std::u16string units, std::u32string txt)
+{
+  slow_source<char16_t> src{ units };
+  us::async_u32u16_reader<slow_source<char16_t>> r(src);
+  std::u32string y;
+  auto g = r.blocks(10);
+
+  while (const std::u32string_view * b = co_await g.next()) {
+    if (b->size() > 10)
+      co_return false;
+    y += *b;
+  }
+  co_return y == txt;
+}
+
+us::task<bool> bad()
+{
+  slow_source<char> src{ std::string("ab\xc3\xa6" "c\xc3") };
+  us::async_u32utf8_reader<slow_source<char>> r(src);
+  std::u32string y;
+  char32_t buf[8];
+  std::size_t k;
+
+  while ((k = co_await r.read_some(buf, 8)) > 0)
+    y.append(buf, k);
+  if (y != U"abæc" || r.status() != us::status_type::BAD_STREAM)
+    co_return false;
+
+  slow_source<char> broken{ std::string("abcdef"), 0, true };
+  us::async_u32utf8_reader<slow_source<char>> s(broken);
+  while (co_await s.read_some(buf, 8) > 0)
+    ;
+  co_return s.status() == us::status_type::BAD_STREAM;
+}
+
+bool check(us::task<bool> t, const char * what)
+{
+  run(t);
+  if (! t.done() || ! t.result()) {
+    std::cout << what << ": failed" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::string bytes = us::to_utf8(txt);
+  std::u16string units = us::to_u16(bytes);
+
+  if (check(read32(bytes, txt), "read32")
+      && check(read16(bytes, units), "read16")
+      && check(nuls(), "nuls")
+      && check(blocks(units, txt), "blocks")
+      && check(bad(), "bad"))
+    std::cout << "coroutines are ok." << std::endl;
+}
+
+#else
+
+int main()
+{
+  std::cout << "coroutines are ok." << std::endl;
+}
+
+#endif
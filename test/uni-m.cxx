@@ -0,0 +1,198 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test reading through stacks of streams, which decodes from the
+// bottom of the stack directly.
+
+namespace us = alf::unicodestreams;
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 3000; ++i) {
+    txt += U"ascii ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+std::u16string make_u16(const std::u32string & txt)
+{
+  std::u16string s;
+
+  for (char32_t c : txt) {
+    if (c >= 0x10000) {
+      s += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      s += char16_t(0xdc00 + (c & 0x3ff));
+    } else
+      s += char16_t(c);
+  }
+  return s;
+}
+
+std::u16string swap16(std::u16string s)
+{
+  for (char16_t & c : s)
+    c = char16_t((c << 8) | (c >> 8));
+  return s;
+}
+
+std::u32string swap32(std::u32string s)
+{
+  for (char32_t & c : s)
+    c = (c << 24) | ((c & 0xff00) << 8) | ((c >> 8) & 0xff00) | (c >> 24);
+  return s;
+}
+
+template <class S, class C>
+std::basic_string<C> read_all(S & s, C *)
+{
+  std::basic_string<C> y;
+  C buf[37];
+
+  while (s.read(buf, 37), s.gcount() > 0)
+    y.append(buf, s.gcount());
+  return y;
+}
+
+bool do_utf8(const std::string & bytes, const std::u32string & txt,
+	     const std::u16string & txt16)
+{
+  std::istringstream f(bytes);
+  us::u16utf8istream g(f);
+  us::u32u16istream h(g);
+
+  if (read_all(h, (char32_t *)0) != txt
+      || h.streambuf_status() != us::status_type::OK) {
+    std::cout << "utf8: u32 over u16 differs" << std::endl;
+    return false;
+  }
+
+  std::istringstream k(bytes);
+  us::u32utf8istream m(k);
+  us::u16u32istream n(m);
+  if (read_all(n, (char16_t *)0) != txt16) {
+    std::cout << "utf8: u16 over u32 differs" << std::endl;
+    return false;
+  }
+
+  // a get() first leaves the stream below with nothing buffered only
+  // after the next block, both ways must agree.
+  std::istringstream p(bytes);
+  us::u16utf8istream q(p);
+  us::u32u16istream r(q);
+  std::u32string y;
+  y += char32_t(r.get());
+  if (r.skip(999) != 999)
+    return false;
+  y += char32_t(r.get());
+  if (y[0] != txt[0] || y[1] != txt[1000]) {
+    std::cout << "utf8: skip is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_bswap(const std::u32string & txt, const std::u16string & txt16)
+{
+  std::u16string sw16 = swap16(txt16);
+  us::memory_istream<char16_t> f(sw16);
+  us::u16bswap_istream g(f, us::u16_swap_state_type::v21);
+  us::u32u16istream h(g);
+
+  if (read_all(h, (char32_t *)0) != txt) {
+    std::cout << "bswap: swapped u16 differs" << std::endl;
+    return false;
+  }
+
+  us::memory_istream<char16_t> k(txt16);
+  us::u16bswap_istream m(k, us::u16_swap_state_type::v12);
+  us::u32u16istream n(m);
+  if (n.skip(2000) != 2000 || char32_t(n.get()) != txt[2000]) {
+    std::cout << "bswap: skip is wrong" << std::endl;
+    return false;
+  }
+
+  std::u32string sw32 = swap32(txt);
+  us::memory_istream<char32_t> p(sw32);
+  us::u32bswap_istream q(p, us::u32_swap_state_type::v4321);
+  us::u16u32istream r(q);
+  if (read_all(r, (char16_t *)0) != txt16) {
+    std::cout << "bswap: swapped u32 differs" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// the same through the swappers that have the swap fixed.
+bool do_basic_bswap(const std::u32string & txt, const std::u16string & txt16)
+{
+  std::u16string sw16 = swap16(txt16);
+  us::memory_istream<char16_t> f(sw16);
+  us::basic_bswap_istream<char16_t, 21> g(f);
+  us::u32u16istream h(g);
+
+  if (read_all(h, (char32_t *)0) != txt) {
+    std::cout << "basic bswap: swapped u16 differs" << std::endl;
+    return false;
+  }
+
+  us::memory_istream<char16_t> k(txt16);
+  us::basic_bswap_istream<char16_t, 12> m(k);
+  us::u32u16istream n(m);
+  if (n.skip(2000) != 2000 || char32_t(n.get()) != txt[2000]) {
+    std::cout << "basic bswap: skip is wrong" << std::endl;
+    return false;
+  }
+
+  std::u32string sw32 = swap32(txt);
+  us::memory_istream<char32_t> p(sw32);
+  us::basic_bswap_istream<char32_t, 4321> q(p);
+  us::u16u32istream r(q);
+  if (read_all(r, (char16_t *)0) != txt16) {
+    std::cout << "basic bswap: swapped u32 differs" << std::endl;
+    return false;
+  }
+
+  us::memory_istream<char32_t> s(sw32);
+  us::basic_bswap_istream<char32_t, 4321> t(s);
+  us::u32istream u(t);
+  if (u.skip(2000) != 2000 || char32_t(u.get()) != txt[2000]) {
+    std::cout << "basic bswap: u32 skip is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_errors(const std::string & bytes)
+{
+  // a stray continuation byte is an error of the stream below.
+  std::string bad = bytes.substr(0, 5000) + "\x80" + bytes.substr(5000);
+  std::istringstream f(bad);
+  us::u16utf8istream g(f);
+  us::u32u16istream h(g);
+  std::u32string y = read_all(h, (char32_t *)0);
+
+  if (y.empty() || g.streambuf_status() != us::status_type::NO_LEAD
+      || h.streambuf_status() != us::status_type::OK || ! h.eof()) {
+    std::cout << "errors: status is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::u16string txt16 = make_u16(txt);
+  std::string bytes = us::to_utf8(txt);
+
+  if (do_utf8(bytes, txt, txt16) && do_bswap(txt, txt16)
+      && do_basic_bswap(txt, txt16) && do_errors(bytes))
+    std::cout << "stacked streams are ok." << std::endl;
+  return 0;
+}
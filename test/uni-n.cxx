@@ -0,0 +1,202 @@
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test the byte swapping streams, both those that sort out the swap
+// state when running and those where it is fixed at compile time.
+
+namespace us = alf::unicodestreams;
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 500; ++i) {
+    txt += U"swap ";
+    txt += char32_t(i % 3 ? U'ø' : i % 2 ? U'€' : U'\U0001f600');
+  }
+  return txt;
+}
+
+// the bytes of s as a little or big endian file would have them.
+template <class C>
+std::string to_bytes(const std::basic_string<C> & s, bool big)
+{
+  std::string b;
+
+  for (C c : s)
+    for (unsigned i = 0; i < sizeof(C); ++i) {
+      unsigned k = big ? sizeof(C) - 1 - i : i;
+      b += char((char32_t(c) >> (8 * k)) & 0xff);
+    }
+  return b;
+}
+
+// those bytes read as units on this machine.
+template <class C>
+std::basic_string<C> from_bytes(const std::string & b)
+{
+  std::basic_string<C> s(b.size() / sizeof(C), C());
+
+  std::memcpy(& s[0], b.data(), b.size());
+  return s;
+}
+
+// read a unit at a time through a source that is not a memory_source.
+template <class S, class C>
+std::basic_string<C> get_all(const std::basic_string<C> & units, C *)
+{
+  std::basic_stringbuf<C> sb(units);
+  std::basic_istream<C> f(& sb);
+  S g(f);
+  std::basic_string<C> y;
+  typename S::int_type c;
+
+  while (! S::traits_type::eq_int_type(c = g.get(), S::traits_type::eof()))
+    y += C(c);
+  return y;
+}
+
+template <class S, class C>
+std::basic_string<C> read_all(const std::basic_string<C> & units, C *)
+{
+  us::memory_istream<C> f(units);
+  S g(f);
+  std::basic_string<C> y;
+  C buf[37];
+
+  while (g.read(buf, 37), g.gcount() > 0)
+    y.append(buf, g.gcount());
+  return y;
+}
+
+template <class S, class C>
+std::string write_all(const std::basic_string<C> & txt)
+{
+  us::memory_ostream<C> f;
+  {
+    S g(f);
+    g.put(txt[0]);
+    g.write(txt.data() + 1, txt.size() - 1);
+    g.flush();
+  }
+  std::basic_string<C> u = f.release();
+  return std::string((const char *)u.data(), u.size() * sizeof(C));
+}
+
+bool do_fixed(const std::u32string & txt, const std::u16string & txt16)
+{
+  std::u32string le = from_bytes<char32_t>(to_bytes(txt, false));
+  std::u32string be = from_bytes<char32_t>(to_bytes(txt, true));
+  std::u16string le16 = from_bytes<char16_t>(to_bytes(txt16, false));
+  std::u16string be16 = from_bytes<char16_t>(to_bytes(txt16, true));
+
+  if (read_all<us::u32le_istream>(le, (char32_t *)0) != txt
+      || read_all<us::u32be_istream>(be, (char32_t *)0) != txt
+      || get_all<us::u32be_istream>(be, (char32_t *)0) != txt
+      || read_all<us::u16le_istream>(le16, (char16_t *)0) != txt16
+      || read_all<us::u16be_istream>(be16, (char16_t *)0) != txt16
+      || get_all<us::u16be_istream>(be16, (char16_t *)0) != txt16) {
+    std::cout << "fixed: read is wrong" << std::endl;
+    return false;
+  }
+
+  if (write_all<us::u32le_ostream>(txt) != to_bytes(txt, false)
+      || write_all<us::u32be_ostream>(txt) != to_bytes(txt, true)
+      || write_all<us::u16le_ostream>(txt16) != to_bytes(txt16, false)
+      || write_all<us::u16be_ostream>(txt16) != to_bytes(txt16, true)) {
+    std::cout << "fixed: write is wrong" << std::endl;
+    return false;
+  }
+
+  // swapping the 16 bit halves and then the bytes in each is 4321.
+  typedef us::basic_bswap_istream<char32_t, 3412> s3412;
+  typedef us::basic_bswap_istream<char32_t, 2143> s2143;
+  std::u32string a = read_all<s3412>(be, (char32_t *)0);
+  std::u32string b = read_all<s2143>(a, (char32_t *)0);
+  if (b != read_all<us::basic_bswap_istream<char32_t, 4321> >(be,
+							      (char32_t *)0)) {
+    std::cout << "fixed: 3412 and 2143 are wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool do_dynamic(const std::u32string & txt, const std::u16string & txt16)
+{
+  typedef us::u32_swap_state_type s32;
+  typedef us::u16_swap_state_type s16;
+  std::u32string be = from_bytes<char32_t>(to_bytes(txt, true));
+  std::u16string le16 = from_bytes<char16_t>(to_bytes(txt16, false));
+
+  // more than the buffer holds, a unit at a time.
+  std::basic_stringbuf<char32_t> sb(be);
+  std::basic_istream<char32_t> f(& sb);
+  us::u32bswap_istream g(f, s32::BE);
+  std::u32string y;
+  for (int i = 0; i < 200; ++i)
+    y += char32_t(g.get());
+  if (y != txt.substr(0, 200)
+      || g.streambuf_swap_state() != us::u32_be_state) {
+    std::cout << "dynamic: get is wrong" << std::endl;
+    return false;
+  }
+
+  // the first unit is a BOM that tells.
+  std::u32string bom = from_bytes<char32_t>(to_bytes(U"\ufeff" + txt, true));
+  std::u32string z = read_all<us::u32bswap_istream>(bom, (char32_t *)0);
+  us::memory_istream<char32_t> k(bom);
+  us::u32bswap_istream m(k, s32::FChar);
+  char32_t buf[64];
+  m.read(buf, 64);
+  if (z != bom || buf[0] != 0xfeff
+      || std::u32string(buf + 1, 63) != txt.substr(0, 63)
+      || m.streambuf_swap_state() != us::u32_be_state) {
+    std::cout << "dynamic: FChar is wrong" << std::endl;
+    return false;
+  }
+
+  us::memory_istream<char16_t> p(le16);
+  us::u16bswap_istream q(p, s16::LE);
+  std::u16string w;
+  char16_t buf16[37];
+  while (q.read(buf16, 37), q.gcount() > 0)
+    w.append(buf16, q.gcount());
+  if (w != txt16) {
+    std::cout << "dynamic: LE is wrong" << std::endl;
+    return false;
+  }
+
+  us::memory_ostream<char16_t> r;
+  {
+    us::u16bswap_ostream t(r, s16::BE);
+    t.put(txt16[0]);
+    t.write(txt16.data() + 1, txt16.size() - 1);
+  }
+  us::memory_ostream<char32_t> u;
+  {
+    us::u32bswap_ostream v(u, s32::FChar);
+    v.write(txt.data(), txt.size());
+  }
+  std::u16string r16 = r.release();
+  std::u32string u32 = u.release();
+  if (to_bytes(r16, false) != to_bytes(txt16, true)
+      || u32 != U"\ufeff" + txt) {
+    std::cout << "dynamic: write is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+  std::u16string txt16 = us::to_u16(us::to_utf8(txt));
+
+  if (do_fixed(txt, txt16) && do_dynamic(txt, txt16))
+    std::cout << "byte swapping is ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test normalization, of strings and of streams.
+
+namespace us = alf::unicodestreams;
+
+struct norm_case {
+  const char32_t * s;
+  const char32_t * nfc;
+  const char32_t * nfd;
+  const char32_t * nfkc;
+  const char32_t * nfkd;
+};
+
+// some from UAX #15 and the usual suspects: reordering, Hangul,
+// singletons, exclusions and compatibility.
+const norm_case cases[] = {
+  { U"e\u0301", U"\u00e9", U"e\u0301", U"\u00e9", U"e\u0301" },
+  { U"\u00e9", U"\u00e9", U"e\u0301", U"\u00e9", U"e\u0301" },
+  { U"\u212b", U"\u00c5", U"A\u030a", U"\u00c5", U"A\u030a" },
+  { U"\u2126", U"\u03a9", U"\u03a9", U"\u03a9", U"\u03a9" },
+  { U"\u1e9b\u0323", U"\u1e9b\u0323", U"\u017f\u0323\u0307", U"\u1e69",
+    U"s\u0323\u0307" },
+  { U"a\u0301\u0323", U"\u1ea1\u0301", U"a\u0323\u0301", U"\u1ea1\u0301",
+    U"a\u0323\u0301" },
+  { U"\u0958", U"\u0915\u093c", U"\u0915\u093c", U"\u0915\u093c",
+    U"\u0915\u093c" },
+  { U"\ud55c", U"\ud55c", U"\u1112\u1161\u11ab", U"\ud55c",
+    U"\u1112\u1161\u11ab" },
+  { U"\u1100\u1161\u11a8", U"\uac01", U"\u1100\u1161\u11a8", U"\uac01",
+    U"\u1100\u1161\u11a8" },
+  { U"\ufb01x", U"\ufb01x", U"\ufb01x", U"fix", U"fix" },
+  { U"\u0301a", U"\u0301a", U"\u0301a", U"\u0301a", U"\u0301a" },
+  { U"\u00bd", U"\u00bd", U"\u00bd", U"1\u20442", U"1\u20442" },
+};
+
+bool do_strings()
+{
+  for (const norm_case & c : cases) {
+    if (us::normalize(c.s) != c.nfc
+	|| us::normalize(c.s, us::normal_form::NFD) != c.nfd
+	|| us::normalize(c.s, us::normal_form::NFKC) != c.nfkc
+	|| us::normalize(c.s, us::normal_form::NFKD) != c.nfkd) {
+      std::cout << "strings: a case is wrong" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// a string normalizes as one segment however long that is.
+bool do_long()
+{
+  std::u32string acutes(1100, U'\u0301');
+  std::u32string s = U"a" + acutes + U"\u0323";
+
+  if (us::normalize(s, us::normal_form::NFD) != U"a\u0323" + acutes
+      || us::normalize(s) != U"\u1ea1" + acutes) {
+    std::cout << "long: a long segment is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 3000; ++i) {
+    txt += U"plain text ";
+    if (i % 7 == 0)
+      txt += cases[i % std::size(cases)].s;
+    if (i % 11 == 0)
+      txt += U"e\u0301te\u0301 ";
+  }
+  return txt;
+}
+
+// read and write through the streams in pieces of odd sizes, it must
+// come out as the whole string normalized.
+bool do_streams(const std::u32string & txt, us::normal_form f)
+{
+  std::u32string want = us::normalize(txt, f);
+
+  us::memory_istream<char32_t> a(txt);
+  us::u32normalize_istream b(a, f);
+  std::u32string y;
+  char32_t buf[37];
+  while (b.read(buf, 37), b.gcount() > 0)
+    y.append(buf, b.gcount());
+  if (y != want) {
+    std::cout << "streams: read is wrong" << std::endl;
+    return false;
+  }
+
+  std::basic_stringbuf<char32_t> sb(txt);
+  std::basic_istream<char32_t> c(& sb);
+  us::u32normalize_istream d(c, f);
+  std::u32string z;
+  std::char_traits<char32_t>::int_type k;
+  while (! std::char_traits<char32_t>::eq_int_type(k = d.get(),
+			std::char_traits<char32_t>::eof()))
+    z += char32_t(k);
+  if (z != want) {
+    std::cout << "streams: get is wrong" << std::endl;
+    return false;
+  }
+
+  us::memory_ostream<char32_t> e;
+  {
+    us::u32normalize_ostream g(e, f);
+    for (std::size_t i = 0; i < txt.size(); i += 53) {
+      g.put(txt[i]);
+      g.write(txt.data() + i + 1,
+	      std::min<std::size_t>(52, txt.size() - i - 1));
+    }
+  }
+  if (e.view() != want) {
+    std::cout << "streams: write is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+
+  if (do_strings() && do_long() && do_streams(txt, us::normal_form::NFC)
+      && do_streams(txt, us::normal_form::NFD)
+      && do_streams(txt, us::normal_form::NFKC)
+      && do_streams(txt, us::normal_form::NFKD))
+    std::cout << "normalization is ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test case folding, of strings and of streams.
+
+namespace us = alf::unicodestreams;
+
+struct fold_case {
+  const char32_t * s;
+  const char32_t * folded;
+};
+
+// simple and full foldings, ISO 8859-1 and beyond.
+const fold_case cases[] = {
+  { U"Hello, World!", U"hello, world!" },
+  { U"\u00c0\u00d7\u00de\u00ff", U"\u00e0\u00d7\u00fe\u00ff" },
+  { U"Stra\u00dfe", U"strasse" },
+  { U"\u1e9e", U"ss" },
+  { U"\u00b5m", U"\u03bcm" },
+  { U"\u0130", U"i\u0307" },
+  { U"\u0390", U"\u03b9\u0308\u0301" },
+  { U"\ufb03", U"ffi" },
+  { U"\u03a3\u03c3\u03c2", U"\u03c3\u03c3\u03c3" },
+  { U"\u0412\u041e\u0414\u0410", U"\u0432\u043e\u0434\u0430" },
+  { U"\u212a\u212b", U"k\u00e5" },
+  { U"\U00010400\U0001e900", U"\U00010428\U0001e922" },
+  { U"\u4e2d\u6587", U"\u4e2d\u6587" },
+};
+
+bool do_strings()
+{
+  for (const fold_case & c : cases) {
+    if (us::casefold(c.s) != c.folded) {
+      std::cout << "strings: a case is wrong" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 3000; ++i) {
+    txt += U"Plain TEXT, Mostly ASCII ";
+    if (i % 5 == 0)
+      txt += cases[i % std::size(cases)].s;
+  }
+  return txt;
+}
+
+std::string to_utf8(const std::u32string & s)
+{
+  std::ostringstream a;
+  {
+    us::u32utf8ostream b(a);
+    b.write(s.data(), s.size());
+  }
+  return a.str();
+}
+
+// read and write through the streams in pieces of odd sizes, it must
+// come out as the whole string folded.
+bool do_streams(const std::u32string & txt)
+{
+  std::u32string want = us::casefold(txt);
+
+  us::memory_istream<char32_t> a(txt);
+  us::u32casefold_istream b(a);
+  std::u32string y;
+  char32_t buf[37];
+  while (b.read(buf, 37), b.gcount() > 0)
+    y.append(buf, b.gcount());
+  if (y != want) {
+    std::cout << "streams: read is wrong" << std::endl;
+    return false;
+  }
+
+  std::basic_stringbuf<char32_t> sb(txt);
+  std::basic_istream<char32_t> c(& sb);
+  us::u32casefold_istream d(c);
+  std::u32string z;
+  std::char_traits<char32_t>::int_type k;
+  while (! std::char_traits<char32_t>::eq_int_type(k = d.get(),
+			std::char_traits<char32_t>::eof()))
+    z += char32_t(k);
+  if (z != want) {
+    std::cout << "streams: get is wrong" << std::endl;
+    return false;
+  }
+
+  us::memory_ostream<char32_t> e;
+  {
+    us::u32casefold_ostream g(e);
+    for (std::size_t i = 0; i < txt.size(); i += 53) {
+      g.put(txt[i]);
+      g.write(txt.data() + i + 1,
+	      std::min<std::size_t>(52, txt.size() - i - 1));
+    }
+  }
+  if (e.view() != want) {
+    std::cout << "streams: write is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// the same folding while decoding and encoding UTF-8.
+bool do_utf8(const std::u32string & txt)
+{
+  std::u32string want = us::casefold(txt);
+  std::string u = to_utf8(txt);
+
+  for (std::size_t piece : { std::size_t(1), std::size_t(2),
+			     std::size_t(37), std::size_t(4096) }) {
+    std::istringstream a(u);
+    us::u32utf8casefold_istream b(a);
+    std::u32string y;
+    char32_t buf[4096];
+    while (b.read(buf, piece), b.gcount() > 0)
+      y.append(buf, b.gcount());
+    if (y != want || b.streambuf_status() != us::status_type::OK) {
+      std::cout << "utf8: read is wrong" << std::endl;
+      return false;
+    }
+  }
+
+  std::ostringstream e;
+  {
+    us::u32utf8casefold_ostream g(e);
+    for (std::size_t i = 0; i < txt.size(); i += 53) {
+      g.put(txt[i]);
+      g.write(txt.data() + i + 1,
+	      std::min<std::size_t>(52, txt.size() - i - 1));
+    }
+  }
+  if (e.str() != to_utf8(want)) {
+    std::cout << "utf8: write is wrong" << std::endl;
+    return false;
+  }
+
+  std::istringstream f("ABC\x80");
+  us::u32utf8casefold_istream g(f);
+  std::u32string z;
+  char32_t c;
+  while (g.get(c))
+    z += c;
+  if (z != U"abc" || g.streambuf_status() != us::status_type::NO_LEAD) {
+    std::cout << "utf8: error is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  std::u32string txt = make_text();
+
+  if (do_strings() && do_streams(txt) && do_utf8(txt))
+    std::cout << "case folding is ok." << std::endl;
+  return 0;
+}
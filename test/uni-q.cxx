@@ -0,0 +1,110 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../unicodestreams.hxx"
+
+// Test grapheme clusters, of strings and of streams.
+
+namespace us = alf::unicodestreams;
+
+struct cluster_case {
+  const char32_t * s;
+  std::vector<std::size_t> lengths;
+};
+
+// one of each rule of UAX #29 and then some.
+const cluster_case cases[] = {
+  { U"abc", { 1, 1, 1 } },
+  { U"a\r\nb", { 1, 2, 1 } },
+  { U"\n\r", { 1, 1 } },
+  { U"e\u0301\u0308x", { 3, 1 } },
+  { U"\u1100\u1161\u11a8\uac00\u11a8\uac01\u11a8", { 3, 2, 2 } },
+  { U"\u0915\u094d\u0937", { 2, 1 } },
+  { U"\u0600a", { 2 } },
+  { U"\u0e01\u0e33", { 2 } },
+  { U"\U0001f468\u200d\U0001f469\u200d\U0001f467", { 5 } },
+  { U"\u2764\ufe0f\u200d\U0001f525", { 4 } },
+  { U"a\u200d\U0001f525", { 2, 1 } },
+  { U"\U0001f44d\U0001f3fd", { 2 } },
+  { U"\U0001f1eb\U0001f1f7\U0001f1e9\U0001f1ea\U0001f1fa", { 2, 2, 1 } },
+  { U"\t\u0301", { 1, 1 } },
+  { U"", { } },
+};
+
+std::vector<std::size_t> split(std::u32string_view s)
+{
+  std::vector<std::size_t> r;
+  while (! s.empty()) {
+    std::u32string_view c = us::first_grapheme(s);
+    r.push_back(c.size());
+    s.remove_prefix(c.size());
+  }
+  return r;
+}
+
+bool do_strings()
+{
+  for (const cluster_case & c : cases) {
+    if (split(c.s) != c.lengths) {
+      std::cout << "strings: a case is wrong" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+std::u32string make_text()
+{
+  std::u32string txt;
+
+  for (int i = 0; i < 2000; ++i) {
+    txt += U"Plain text, ";
+    txt += cases[i % std::size(cases)].s;
+    if (i % 9 == 0)
+      txt += U"e\u0301\u0301\u0301\u0301\u0301\u0301\u0301\u0301\u0301"
+	U"\u0301\u0301\u0301\u0301\u0301\u0301\u0301\u0301\u0301\u0301";
+  }
+  return txt;
+}
+
+// the reader must split the same way, also with a small buffer that
+// has to grow for a long cluster.
+bool do_streams(const std::u32string & txt)
+{
+  std::vector<std::size_t> want = split(txt);
+
+  us::memory_istream<char32_t> a(txt);
+  us::u32grapheme_reader b(a, 16);
+  std::vector<std::size_t> y;
+  std::u32string z;
+  std::u32string_view c;
+  while (b.next(c)) {
+    y.push_back(c.size());
+    z += c;
+  }
+  if (y != want || z != txt) {
+    std::cout << "streams: memory is wrong" << std::endl;
+    return false;
+  }
+
+  std::basic_stringbuf<char32_t> sb(txt);
+  std::basic_istream<char32_t> d(& sb);
+  us::u32grapheme_reader e(d);
+  y.clear();
+  while (e.next(c))
+    y.push_back(c.size());
+  if (y != want) {
+    std::cout << "streams: stringbuf is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int main()
+{
+  if (do_strings() && do_streams(make_text()))
+    std::cout << "grapheme clusters are ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include <cstring>
+#include <iostream>
+
+#include "../unicodestreams.hxx"
+
+// Test the character properties, they are also usable at compile time.
+
+namespace us = alf::unicodestreams;
+
+static_assert(us::general_category_of(U'A') == us::general_category::Lu);
+static_assert(us::script_of(U'\u4e00') == us::script::Han);
+
+struct prop_case {
+  char32_t c;
+  us::general_category gc;
+  us::east_asian_width ea;
+  us::script sc;
+  unsigned int flags;
+};
+
+const prop_case cases[] = {
+  { U'A', us::general_category::Lu, us::east_asian_width::Na,
+    us::script::Latin, us::PROP_ALPHABETIC | us::PROP_UPPERCASE },
+  { U' ', us::general_category::Zs, us::east_asian_width::Na,
+    us::script::Common, us::PROP_WHITE_SPACE },
+  { 0x301, us::general_category::Mn, us::east_asian_width::A,
+    us::script::Inherited, 0 },
+  { 0xad, us::general_category::Cf, us::east_asian_width::A,
+    us::script::Common, us::PROP_DEFAULT_IGNORABLE },
+  { 0x3b1, us::general_category::Ll, us::east_asian_width::A,
+    us::script::Greek, us::PROP_ALPHABETIC | us::PROP_LOWERCASE },
+  { 0x644, us::general_category::Lo, us::east_asian_width::N,
+    us::script::Arabic, us::PROP_ALPHABETIC },
+  { 0x4e00, us::general_category::Lo, us::east_asian_width::W,
+    us::script::Han, us::PROP_ALPHABETIC },
+  { 0xac00, us::general_category::Lo, us::east_asian_width::W,
+    us::script::Hangul, us::PROP_ALPHABETIC },
+  { 0xff21, us::general_category::Lu, us::east_asian_width::F,
+    us::script::Latin, us::PROP_ALPHABETIC | us::PROP_UPPERCASE },
+  { 0xff61, us::general_category::Po, us::east_asian_width::H,
+    us::script::Common, 0 },
+  { 0x1f600, us::general_category::So, us::east_asian_width::W,
+    us::script::Common,
+    us::PROP_EMOJI_PRESENTATION | us::PROP_EXTENDED_PICTOGRAPHIC },
+  { 0x378, us::general_category::Cn, us::east_asian_width::N,
+    us::script::Unknown, 0 },
+  { 0xd800, us::general_category::Cs, us::east_asian_width::N,
+    us::script::Unknown, 0 },
+  { 0x10fffd, us::general_category::Co, us::east_asian_width::A,
+    us::script::Unknown, 0 },
+  { 0x110000, us::general_category::Cn, us::east_asian_width::N,
+    us::script::Unknown, 0 },
+};
+
+int main()
+{
+  for (const prop_case & p : cases) {
+    if (us::general_category_of(p.c) != p.gc
+	|| us::east_asian_width_of(p.c) != p.ea
+	|| us::script_of(p.c) != p.sc || us::char_flags(p.c) != p.flags) {
+      std::cout << "a case is wrong" << std::endl;
+      return 0;
+    }
+  }
+  if (std::strcmp(us::script_name(us::script::Old_Italic), "Old_Italic")
+      != 0) {
+    std::cout << "script names are wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "character properties are ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test the display widths of chars and texts, and truncating a text to
+// some columns.
+
+namespace us = alf::unicodestreams;
+
+static_assert(us::char_width(U'a') == 1);
+static_assert(us::char_width(U'\u4e00') == 2);
+
+struct char_case {
+  char32_t c;
+  int w;
+};
+
+const char_case chars[] = {
+  { 0, 0 }, { '\n', -1 }, { 0x7f, -1 }, { 0x9b, -1 }, { 'A', 1 },
+  { 0xad, 1 }, { 0x301, 0 }, { 0x200b, 0 }, { 0x200d, 0 }, { 0xfe0f, 0 },
+  { 0x1160, 0 }, { 0x11a8, 0 }, { 0x1100, 2 }, { 0xac00, 2 },
+  { 0xff21, 2 }, { 0xff61, 1 }, { 0x3000, 2 }, { 0x1f600, 2 },
+  { 0x2764, 1 }, { 0x1f1e6, 2 }, { 0x20000, 2 },
+};
+
+struct text_case {
+  const char32_t * s;
+  std::size_t w;
+};
+
+const text_case texts[] = {
+  { U"", 0 },
+  { U"hello, world", 12 },
+  { U"tab\there", 7 },
+  { U"e\u0301te\u0301", 3 },
+  { U"\u65e5\u672c\u8a9e", 6 },
+  { U"\u1100\u1161\u11a8", 2 },
+  { U"\u2764", 1 },
+  { U"\u2764\ufe0f", 2 },
+  { U"\U0001f600\ufe0e", 1 },
+  { U"\U0001f1eb\U0001f1f7", 2 },
+  { U"\U0001f1eb\U0001f1f7\U0001f1e9", 4 },
+  { U"\U0001f468\u200d\U0001f469\u200d\U0001f467", 2 },
+  { U"a long run of ascii text, longer than sixteen bytes", 51 },
+};
+
+std::string utf8(const std::u32string & s)
+{
+  std::string r;
+  for (char32_t c : s) {
+    if (c < 0x80)
+      r += char(c);
+    else if (c < 0x800) {
+      r += char(0xc0 | (c >> 6));
+      r += char(0x80 | (c & 0x3f));
+    } else if (c < 0x10000) {
+      r += char(0xe0 | (c >> 12));
+      r += char(0x80 | ((c >> 6) & 0x3f));
+      r += char(0x80 | (c & 0x3f));
+    } else {
+      r += char(0xf0 | (c >> 18));
+      r += char(0x80 | ((c >> 12) & 0x3f));
+      r += char(0x80 | ((c >> 6) & 0x3f));
+      r += char(0x80 | (c & 0x3f));
+    }
+  }
+  return r;
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+bool test_truncate()
+{
+  std::u32string s = U"ab\u4e00e\u0301\U0001f1eb\U0001f1f7xyz";
+
+  // columns: a b [2] e' [flag 2] x y z, 10 in all.
+  const std::size_t lens[] = { 0, 1, 2, 2, 3, 5, 5, 7, 8, 9, 10, 10 };
+  for (std::size_t n = 0; n < sizeof(lens) / sizeof(lens[0]); ++n) {
+    std::u32string_view t = us::truncate_width(s, n);
+    if (t.size() != lens[n] || us::display_width(t) > n)
+      return false;
+    std::string s8 = utf8(s);
+    std::string_view t8 = us::truncate_width(s8, n);
+    if (t8 != utf8(std::u32string(t)))
+      return false;
+    std::u16string s16 = utf16(s);
+    if (us::truncate_width(s16, n) != utf16(std::u32string(t)))
+      return false;
+  }
+
+  // the fast path for ASCII stops where the columns do.
+  std::string a(100, 'x');
+  if (us::truncate_width(a, 37).size() != 37
+      || us::truncate_width("\xc3\xa9" + a, 37).size() != 38)
+    return false;
+  return true;
+}
+
+int main()
+{
+  for (const char_case & c : chars) {
+    if (us::char_width(c.c) != c.w) {
+      std::cout << "width of U+" << std::hex << unsigned(c.c)
+		<< " is wrong" << std::endl;
+      return 0;
+    }
+  }
+  for (const text_case & t : texts) {
+    std::u32string s = t.s;
+    if (us::display_width(s) != t.w || us::display_width(utf8(s)) != t.w
+	|| us::display_width(utf16(s)) != t.w) {
+      std::cout << "a text width is wrong" << std::endl;
+      return 0;
+    }
+  }
+
+  // wrong codes take the place of U+FFFD.
+  if (us::display_width(std::string("a\xff\xc3z")) != 4
+      || us::display_width(std::u16string(u"a\xdc00z")) != 3) {
+    std::cout << "widths of wrong codes are wrong" << std::endl;
+    return 0;
+  }
+  if (! test_truncate()) {
+    std::cout << "truncating is wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "display widths are ok." << std::endl;
+  return 0;
+}
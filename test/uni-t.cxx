@@ -0,0 +1,167 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test escaping for JSON and XML while writing UTF-8, a block at a time
+// through a std::ostringstream and a memory_sink, and a char at a time.
+
+namespace us = alf::unicodestreams;
+
+// the escape of c, one char at a time the plain way.
+std::string reference(char32_t c, us::escape_type e)
+{
+  static const char hex[] = "0123456789abcdef";
+  std::string r;
+
+  auto u16 = [&](char32_t u) {
+    r += "\\u";
+    for (int s = 12; s >= 0; s -= 4)
+      r += hex[(u >> s) & 15];
+  };
+  if (e == us::escape_type::XML) {
+    switch (c) {
+    case '&': return "&amp;";
+    case '<': return "&lt;";
+    case '>': return "&gt;";
+    case '"': return "&quot;";
+    case '\'': return "&apos;";
+    case '\r': return "&#13;";
+    }
+    if (c < 0x20 && c != '\t' && c != '\n')
+      c = 0xfffd;
+  } else {
+    switch (c) {
+    case '"': return "\\\"";
+    case '\\': return "\\\\";
+    case '\b': return "\\b";
+    case '\f': return "\\f";
+    case '\n': return "\\n";
+    case '\r': return "\\r";
+    case '\t': return "\\t";
+    }
+    if (c < 0x20 || (c >= 0x80 && e == us::escape_type::JSON_ASCII)) {
+      if (c < 0x10000)
+	u16(c);
+      else {
+	u16(0xd800 | ((c - 0x10000) >> 10));
+	u16(0xdc00 | (c & 0x3ff));
+      }
+      return r;
+    }
+  }
+  if (c < 0x80)
+    r += char(c);
+  else if (c < 0x800) {
+    r += char(0xc0 | (c >> 6));
+    r += char(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    r += char(0xe0 | (c >> 12));
+    r += char(0x80 | ((c >> 6) & 0x3f));
+    r += char(0x80 | (c & 0x3f));
+  } else {
+    r += char(0xf0 | (c >> 18));
+    r += char(0x80 | ((c >> 12) & 0x3f));
+    r += char(0x80 | ((c >> 6) & 0x3f));
+    r += char(0x80 | (c & 0x3f));
+  }
+  return r;
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+bool check(const std::u32string & s, us::escape_type e)
+{
+  std::string want;
+  for (char32_t c : s)
+    want += reference(c, e);
+
+  std::ostringstream o1;
+  {
+    us::u32utf8ostream w(o1, e);
+    w.write(s.data(), s.size());
+    if (w.streambuf_status() != us::status_type::OK)
+      return false;
+  }
+  us::memory_sink<char> ms;
+  std::ostream o2(& ms);
+  {
+    us::u16utf8ostream w(o2, e);
+    std::u16string t = utf16(s);
+    w.write(t.data(), t.size());
+    if (w.streambuf_status() != us::status_type::OK)
+      return false;
+  }
+  std::ostringstream o3;
+  {
+    us::u32utf8ostream w(o3);
+    w.set_escape(e);
+    for (char32_t c : s)
+      w.put(c);
+  }
+  return o1.str() == want && ms.view() == want && o3.str() == want;
+}
+
+int main()
+{
+  const us::escape_type modes[] = {
+    us::escape_type::JSON, us::escape_type::JSON_ASCII, us::escape_type::XML,
+  };
+  const char32_t specials[] = {
+    '"', '\\', '&', '<', '>', '\'', '\n', '\r', '\t', 0, 0x1f, 0x7f,
+    0xe9, 0x20ac, 0x1f600,
+  };
+
+  // every special at every place of a text longer than a block.
+  std::u32string plain = U"The quick brown fox jumps over the lazy dog 0123";
+  for (us::escape_type e : modes) {
+    if (! check(plain, e)) {
+      std::cout << "plain text is wrong" << std::endl;
+      return 0;
+    }
+    for (char32_t c : specials) {
+      for (std::size_t i = 0; i <= plain.size(); ++i) {
+	std::u32string s = plain;
+	s.insert(i, 1, c);
+	if (! check(s, e)) {
+	  std::cout << "escape of U+" << std::hex << unsigned(c)
+		    << " is wrong" << std::endl;
+	  return 0;
+	}
+      }
+    }
+  }
+
+  std::ostringstream o;
+  us::u32utf8ostream w(o, us::escape_type::JSON);
+  w << U"say \"hi\"\n";
+  w.flush();
+  if (o.str() != "say \\\"hi\\\"\\n") {
+    std::cout << "json is wrong" << std::endl;
+    return 0;
+  }
+
+  // not Unicode is still an error.
+  std::u32string bad = U"ok";
+  bad += char32_t(0xd800);
+  w.write(bad.data(), bad.size());
+  if (w.streambuf_status() != us::status_type::NOT_UNICODE) {
+    std::cout << "a surrogate was escaped" << std::endl;
+    return 0;
+  }
+  std::cout << "escaping is ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test decoding JSON strings: escapes, surrogate pairs, checking UTF-8,
+// stopping at the closing quote and decoding a step at a time.
+
+namespace us = alf::unicodestreams;
+
+struct json_case {
+  const char * s;
+  const char32_t * want;
+  us::status_type st;
+};
+
+const json_case cases[] = {
+  { "\"", U"", us::status_type::OK },
+  { "plain text\", 1]", U"plain text", us::status_type::OK },
+  { "a\\\"b\\\\c\\/d\\b\\f\\n\\r\\t\"", U"a\"b\\c/d\b\f\n\r\t",
+    us::status_type::OK },
+  { "\\u00e9\\u20AC\\u0000\"", U"\u00e9\u20ac", us::status_type::OK },
+  { "\\ud83d\\ude00 \xf0\x9f\x98\x80\"", U"\U0001f600 \U0001f600",
+    us::status_type::OK },
+  { "caf\xc3\xa9 \xe2\x82\xac\"", U"caf\u00e9 \u20ac", us::status_type::OK },
+  { "no end", U"no end", us::status_type::EOF_STREAM },
+  { "bad \\x\"", U"bad ", us::status_type::BAD_INPUT },
+  { "bad \\u12g4\"", U"bad ", us::status_type::BAD_INPUT },
+  { "tab\there\"", U"tab", us::status_type::BAD_INPUT },
+  { "low \\udc00\"", U"low ", us::status_type::NO_LEAD },
+  { "high \\ud800x\"", U"high ", us::status_type::NO_FOLLOW },
+  { "high \\ud800\\u0041\"", U"high ", us::status_type::NO_FOLLOW },
+  { "nonchar \\uffff\"", U"nonchar ", us::status_type::NOT_UNICODE },
+  { "cut \xc3\"", U"cut ", us::status_type::NOT_UTF8 },
+  { "lead \x80\"", U"lead ", us::status_type::NO_LEAD },
+  { "long \xc0\x80\"", U"long ", us::status_type::NOT_UTF8 },
+  { "cut \\u12", U"cut ", us::status_type::BAD_STREAM },
+  { "short \\u12\"", U"short ", us::status_type::BAD_INPUT },
+  { "short \\ud800\\u12\"", U"short ", us::status_type::BAD_INPUT },
+};
+
+std::string utf8(const std::u32string & s)
+{
+  std::ostringstream o;
+  {
+    us::u32utf8ostream w(o);
+    w << s;
+  }
+  return o.str();
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+bool test_cases()
+{
+  for (const json_case & c : cases) {
+    std::string s = c.s;
+    // "\u0000" is a NUL the literal can't hold.
+    std::u32string want = c.want;
+    if (s.find("\\u0000") != std::string::npos)
+      want += char32_t(0);
+    us::status_type st, st16, st8;
+    std::size_t n, n16, n8;
+    std::u32string r = us::json_to_u32(s, & st, & n);
+    std::u16string r16 = us::json_to_u16(s, & st16, & n16);
+    std::string r8 = us::json_to_utf8(s, & st8, & n8);
+    if (r != want || st != c.st || r16 != utf16(want) || st16 != c.st
+	|| r8 != utf8(want) || st8 != c.st || n16 != n || n8 != n) {
+      std::cout << "case " << c.s << " is wrong" << std::endl;
+      return false;
+    }
+    if (st == us::status_type::OK && s[n] != '"')
+      return false;
+  }
+  return true;
+}
+
+// escaping with escape_type::JSON and decoding gives the text back, also
+// when the input comes a byte at a time.
+bool test_round_trip()
+{
+  std::u32string t;
+  for (char32_t c = 0; c < 0x3000; c += 7)
+    t += c;
+  t += U"\U0001f600 and some plain ASCII text to have a long run of it";
+  std::ostringstream o;
+  {
+    us::u32utf8ostream w(o, us::escape_type::JSON);
+    w << t;
+  }
+  std::string j = o.str() + '"';
+
+  std::size_t n;
+  if (us::json_to_u32(j, 0, & n) != t || n + 1 != j.size())
+    return false;
+
+  std::u16string r;
+  char16_t buf[2];
+  const char * s = j.data();
+  const char * se = s;
+  while (*s != '"') {
+    char16_t * d = buf;
+    if (us::decode_json(s, se, d, buf + 2) != us::status_type::OK)
+      return false;
+    r.append(buf, d - buf);
+    if (d == buf)
+      ++se;
+  }
+  return r == utf16(t);
+}
+
+int main()
+{
+  if (! test_cases())
+    return 0;
+  if (! test_round_trip()) {
+    std::cout << "a round trip is wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "JSON strings are ok." << std::endl;
+  return 0;
+}
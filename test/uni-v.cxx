@@ -0,0 +1,154 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test decoding and encoding percent-encoded UTF-8.
+
+namespace us = alf::unicodestreams;
+
+struct decode_case {
+  const char * s;
+  const char32_t * want;
+  us::status_type st;
+};
+
+const decode_case decodes[] = {
+  { "", U"", us::status_type::OK },
+  { "/search?q=plain+text&lang=en", U"/search?q=plain+text&lang=en",
+    us::status_type::OK },
+  { "caf%C3%A9 %e2%82%ac", U"caf\u00e9 \u20ac", us::status_type::OK },
+  { "caf\xc3%A9", U"caf\u00e9", us::status_type::OK },
+  { "%F0%9F%98%80%2F%25", U"\U0001f600/%", us::status_type::OK },
+  { "raw \xf0\x9f\x98\x80", U"raw \U0001f600", us::status_type::OK },
+  { "bad %G0", U"bad ", us::status_type::BAD_INPUT },
+  { "bad %4", U"bad ", us::status_type::BAD_STREAM },
+  { "cut %C3", U"cut ", us::status_type::BAD_STREAM },
+  { "cut %C3x", U"cut ", us::status_type::NOT_UTF8 },
+  { "lead %80", U"lead ", us::status_type::NO_LEAD },
+  { "long %C0%80", U"long ", us::status_type::NOT_UTF8 },
+  { "surrogate %ED%A0%80", U"surrogate ", us::status_type::NOT_UNICODE },
+};
+
+struct encode_case {
+  const char32_t * s;
+  const char * want;
+  const char * reserved;
+};
+
+const encode_case encodes[] = {
+  { U"", "", 0 },
+  { U"AZaz09-._~", "AZaz09-._~", 0 },
+  { U"a b/c?d=e&f", "a%20b%2Fc%3Fd%3De%26f", 0 },
+  { U"a b/c?d=e&f", "a%20b/c?d=e&f", "" },
+  { U"a b/c?d=e&f", "a%20b/c?d=e%26f", "&" },
+  { U"100% \"<{|}>\"", "100%25%20%22%3C%7B%7C%7D%3E%22", "" },
+  { U"caf\u00e9 \U0001f600", "caf%C3%A9%20%F0%9F%98%80", 0 },
+};
+
+std::string utf8(const std::u32string & s)
+{
+  std::ostringstream o;
+  {
+    us::u32utf8ostream w(o);
+    w << s;
+  }
+  return o.str();
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+bool test_decode()
+{
+  for (const decode_case & c : decodes) {
+    us::status_type st, st16, st8;
+    std::u32string r = us::percent_to_u32(c.s, & st);
+    std::u16string r16 = us::percent_to_u16(c.s, & st16);
+    std::string r8 = us::percent_to_utf8(c.s, & st8);
+    if (r != c.want || st != c.st || r16 != utf16(c.want) || st16 != c.st
+	|| r8 != utf8(c.want) || st8 != c.st) {
+      std::cout << "decoding " << c.s << " is wrong" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+bool test_encode()
+{
+  for (const encode_case & c : encodes) {
+    us::percent_set r = c.reserved ? us::percent_set(c.reserved)
+      : us::percent_set::reserved();
+    std::u32string s = c.s;
+    if (us::percent_encode(s, r) != c.want
+	|| us::percent_encode(utf16(s), r) != c.want
+	|| us::percent_encode(utf8(s), r) != c.want) {
+      std::cout << "encoding " << c.want << " is wrong" << std::endl;
+      return false;
+    }
+  }
+  us::status_type st;
+  std::string bad = "ok \xc3";
+  if (us::percent_encode(bad, us::percent_set(), & st) != "ok%20"
+      || st != us::status_type::BAD_STREAM
+      || us::percent_encode(std::u32string_view(U"\xd800"),
+			    us::percent_set(), & st) != ""
+      || st != us::status_type::NOT_UNICODE) {
+    std::cout << "encoding errors are wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// everything encoded decodes back, also a byte at a time.
+bool test_round_trip()
+{
+  std::u32string t;
+  for (char32_t c = 1; c < 0x3000; c += 5)
+    t += c;
+  t += U"\U0001f600 a long run of plain text to go 16 bytes at a time";
+  std::string e = us::percent_encode(t);
+  us::status_type st;
+  if (us::percent_to_u32(e, & st) != t || st != us::status_type::OK)
+    return false;
+
+  std::u32string r;
+  char32_t buf[1];
+  const char * s = e.data();
+  const char * se = s;
+  const char * end = e.data() + e.size();
+  while (s < end) {
+    char32_t * d = buf;
+    if (us::decode_percent(s, se, d, buf + 1) != us::status_type::OK)
+      return false;
+    r.append(buf, d - buf);
+    if (d == buf)
+      ++se;
+  }
+  return r == t;
+}
+
+int main()
+{
+  if (! test_decode() || ! test_encode())
+    return 0;
+  if (! test_round_trip()) {
+    std::cout << "a round trip is wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "percent encoding is ok." << std::endl;
+  return 0;
+}
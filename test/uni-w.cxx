@@ -0,0 +1,191 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test changing line ends while decoding and encoding, CR LF cut at all
+// sorts of block boundaries, skipping and reading through a stack.
+
+namespace us = alf::unicodestreams;
+
+// the same the plain way.
+std::u32string reference(const std::u32string & s, bool nel)
+{
+  std::u32string r;
+  for (std::size_t i = 0; i < s.size(); ++i) {
+    char32_t c = s[i];
+    if (c == '\r') {
+      r += U'\n';
+      if (i + 1 < s.size() && s[i + 1] == '\n')
+	++i;
+    } else if (nel && (c == 0x85 || c == 0x2028))
+      r += U'\n';
+    else
+      r += c;
+  }
+  return r;
+}
+
+std::string utf8(const std::u32string & s)
+{
+  std::ostringstream o;
+  {
+    us::u32utf8ostream w(o);
+    w << s;
+  }
+  return o.str();
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+template <class S>
+std::u32string read_all(S & s, std::size_t chunk)
+{
+  std::u32string y;
+  char32_t buf[1100];
+
+  if (chunk == 1) {
+    for (auto c = s.get(); ! s.eof(); c = s.get())
+      y += char32_t(c);
+    return y;
+  }
+  while (s.read(buf, chunk), s.gcount() > 0)
+    y.append(buf, s.gcount());
+  return y;
+}
+
+// a text with line ends of all kinds, a CR LF cut at every place a block
+// of 64, 1024 or one read can end.
+std::u32string text()
+{
+  std::u32string t;
+  for (int i = 0; t.size() < 5000; ++i) {
+    t += U"line é\U0001f600";
+    t.append(i % 13, U'x');
+    switch (i % 5) {
+    case 0: t += U"\r\n"; break;
+    case 1: t += U"\r"; break;
+    case 2: t += U"\n"; break;
+    case 3: t += U"\r\r\n\n"; break;
+    case 4: t += U"\u0085  "; break;
+    }
+  }
+  return t;
+}
+
+bool test_read()
+{
+  std::u32string t = text();
+  std::string t8 = utf8(t);
+  std::u16string t16 = utf16(t);
+  const std::size_t chunks[] = { 1, 3, 37, 64, 1000, 1024, 1100 };
+
+  for (unsigned int nl : { us::NEWLINE_LF, us::NEWLINE_NEL }) {
+    std::u32string want = reference(t, nl == us::NEWLINE_NEL);
+    for (std::size_t c : chunks) {
+      std::istringstream f(t8);
+      us::u32utf8istream g(f, nl);
+      us::memory_istream<char16_t> h(t16);
+      us::u32u16istream k(h, nl);
+      us::memory_istream<char> m(t8);
+      us::u32utf8istream n(m, nl);
+      if (read_all(g, c) != want || read_all(k, c) != want
+	  || read_all(n, c) != want) {
+	std::cout << "reading " << c << " at a time is wrong" << std::endl;
+	return false;
+      }
+    }
+
+    // skip counts what is left of the text.
+    std::istringstream f(t8);
+    us::u32utf8istream g(f, nl);
+    if (g.skip(3000) != 3000 || char32_t(g.get()) != want[3000]) {
+      std::cout << "skip is wrong" << std::endl;
+      return false;
+    }
+
+    // reading through it from the stream on top.
+    std::istringstream p(t8);
+    us::u32utf8istream q(p, nl);
+    us::u16u32istream r(q);
+    std::u16string y;
+    char16_t buf[100];
+    while (r.read(buf, 100), r.gcount() > 0)
+      y.append(buf, r.gcount());
+    if (y != utf16(want)) {
+      std::cout << "reading through is wrong" << std::endl;
+      return false;
+    }
+  }
+
+  // the line reader agrees.
+  std::istringstream f(t8);
+  us::u32utf8istream g(f, us::NEWLINE_LF);
+  us::u32line_reader lr(g);
+  std::u32string_view line;
+  std::u32string y;
+  while (lr.getline(line))
+    (y += line) += U'\n';
+  if (y != reference(t, false)) {
+    std::cout << "lines are wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool test_write()
+{
+  std::u32string t = U"one\ntwo\r\nthree\n";
+  std::ostringstream o1;
+  {
+    us::u32utf8ostream w(o1);
+    w.set_newline(us::NEWLINE_CRLF);
+    w << t;
+    w.put(U'\n');
+  }
+  if (o1.str() != "one\r\ntwo\r\r\nthree\r\n\r\n")
+    return false;
+
+  std::ostringstream o2;
+  {
+    us::u32utf8ostream w(o2, us::escape_type::JSON);
+    w.set_newline(us::NEWLINE_CRLF);
+    w << t;
+  }
+  if (o2.str() != "one\\r\\ntwo\\r\\r\\nthree\\r\\n")
+    return false;
+
+  us::memory_sink<char16_t> ms;
+  std::basic_ostream<char16_t> o3(& ms);
+  {
+    us::u32u16ostream w(o3);
+    w.set_newline(us::NEWLINE_CRLF);
+    w << t;
+  }
+  return ms.view() == u"one\r\ntwo\r\r\nthree\r\n";
+}
+
+int main()
+{
+  if (! test_read())
+    return 0;
+  if (! test_write()) {
+    std::cout << "writing CR LF is wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "line ends are ok." << std::endl;
+  return 0;
+}
@@ -0,0 +1,299 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "../unicodestreams.hxx"
+
+// Test modified UTF-8, CESU-8 and WTF-8 both ways, from char16_t and
+// char32_t, with the 6 byte pairs cut at every place a block can end.
+
+namespace us = alf::unicodestreams;
+
+// the 3 bytes of u.
+void three(std::string & r, char32_t u)
+{
+  r += char(0xe0 | (u >> 12));
+  r += char(0x80 | ((u >> 6) & 0x3f));
+  r += char(0x80 | (u & 0x3f));
+}
+
+// s in form f the plain way, surrogates in s are lone ones.
+std::string encode(const std::u32string & s, us::utf8_form f)
+{
+  std::string r;
+  for (char32_t c : s) {
+    if (c == 0 && f == us::utf8_form::MODIFIED)
+      r += "\xc0\x80";
+    else if (c < 0x80)
+      r += char(c);
+    else if (c < 0x800) {
+      r += char(0xc0 | (c >> 6));
+      r += char(0x80 | (c & 0x3f));
+    } else if (c < 0x10000)
+      three(r, c);
+    else if (f != us::utf8_form::WTF8) {
+      three(r, 0xd800 + ((c - 0x10000) >> 10));
+      three(r, 0xdc00 + (c & 0x3ff));
+    } else {
+      r += char(0xf0 | (c >> 18));
+      r += char(0x80 | ((c >> 12) & 0x3f));
+      r += char(0x80 | ((c >> 6) & 0x3f));
+      r += char(0x80 | (c & 0x3f));
+    }
+  }
+  return r;
+}
+
+std::u16string utf16(const std::u32string & s)
+{
+  std::u16string r;
+  for (char32_t c : s) {
+    if (c < 0x10000)
+      r += char16_t(c);
+    else {
+      r += char16_t(0xd800 + ((c - 0x10000) >> 10));
+      r += char16_t(0xdc00 + (c & 0x3ff));
+    }
+  }
+  return r;
+}
+
+template <class S, class C>
+std::basic_string<C> read_all(S & s, std::size_t chunk, C *)
+{
+  std::basic_string<C> y;
+  C buf[1100];
+
+  if (chunk == 1) {
+    for (auto c = s.get(); ! s.eof(); c = s.get())
+      y += C(c);
+    return y;
+  }
+  while (s.read(buf, chunk), s.gcount() > 0)
+    y.append(buf, s.gcount());
+  return y;
+}
+
+std::u32string text(bool lone)
+{
+  std::u32string t;
+  for (int i = 0; t.size() < 3000; ++i) {
+    t.append(i % 11, U'a');
+    t += U"é\U0001f600";
+    if (i % 3 == 0)
+      t += char32_t(0);
+    if (i % 4 == 0)
+      t += U"€\U00010348";
+    if (lone && i % 5 == 0)
+      t += char32_t(0xd800 + i);
+  }
+  return t;
+}
+
+const char * name(us::utf8_form f)
+{
+  switch (f) {
+  case us::utf8_form::MODIFIED: return "modified UTF-8";
+  case us::utf8_form::CESU8: return "CESU-8";
+  case us::utf8_form::WTF8: return "WTF-8";
+  default: return "UTF-8";
+  }
+}
+
+bool test_form(us::utf8_form f)
+{
+  std::u32string t = text(f == us::utf8_form::WTF8);
+  std::u16string t16 = utf16(t);
+  std::string b = encode(t, f);
+  const std::size_t chunks[] = { 1, 2, 5, 63, 64, 1000, 1024, 1100 };
+
+  for (std::size_t c : chunks) {
+    std::istringstream f1(b);
+    us::u32utf8istream r1(f1);
+    r1.set_form(f);
+    us::memory_istream<char> f2(b);
+    us::u16utf8istream r2(f2);
+    r2.set_form(f);
+    std::istringstream f3(b);
+    us::u16utf8istream r3(f3);
+    r3.set_form(f);
+    if (read_all(r1, c, (char32_t *)0) != t
+	|| r1.streambuf_status() != us::status_type::OK
+	|| read_all(r2, c, (char16_t *)0) != t16
+	|| read_all(r3, c, (char16_t *)0) != t16) {
+      std::cout << name(f) << " read " << c << " at a time is wrong"
+		<< std::endl;
+      return false;
+    }
+  }
+
+  std::istringstream f4(b);
+  us::u32utf8istream r4(f4);
+  r4.set_form(f);
+  if (r4.skip(2000) != 2000 || char32_t(r4.get()) != t[2000]) {
+    std::cout << name(f) << " skip is wrong" << std::endl;
+    return false;
+  }
+
+  std::ostringstream o1;
+  {
+    us::u32utf8ostream w(o1);
+    w.set_form(f);
+    w << t.substr(0, 100);
+    w.put(t[100]);
+    w << t.substr(101);
+  }
+  std::ostringstream o2;
+  {
+    us::u16utf8ostream w(o2);
+    w.set_form(f);
+    w.write(t16.data(), 99);
+    for (std::size_t i = 99; i < 140; ++i)
+      w.put(t16[i]);
+    w << t16.substr(140);
+  }
+  if (o1.str() != b || o2.str() != b) {
+    std::cout << name(f) << " write is wrong" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+template <class S>
+us::status_type status_of(const std::string & b, us::utf8_form f)
+{
+  std::istringstream s(b);
+  S r(s);
+  r.set_form(f);
+  while (r.get(), r)
+    ;
+  return r.streambuf_status();
+}
+
+bool test_errors()
+{
+  using us::status_type;
+  using us::utf8_form;
+  const struct {
+    const char * b;
+    utf8_form f;
+    status_type st;
+  } tests[] = {
+    { "a\xf0\x9f\x98\x80", utf8_form::MODIFIED, status_type::NOT_UTF8 },
+    { "a\xf0\x9f\x98\x80", utf8_form::CESU8, status_type::NOT_UTF8 },
+    { "a\xc0\x80", utf8_form::CESU8, status_type::NOT_UTF8 },
+    { "a\xc0\x80", utf8_form::WTF8, status_type::NOT_UTF8 },
+    { "a\xed\xa0\x80" "b", utf8_form::MODIFIED, status_type::NO_FOLLOW },
+    { "a\xed\xb0\x80", utf8_form::CESU8, status_type::NO_LEAD },
+    { "a\xed\xa0\x80\xed\xa0\x80", utf8_form::CESU8, status_type::NO_FOLLOW },
+    { "a\xed\xa0\x80", utf8_form::STANDARD, status_type::NOT_UNICODE },
+    { "a\xed\xa0", utf8_form::WTF8, status_type::BAD_STREAM },
+    { "a\xed\xa0\x80\xed\xb0\x80", utf8_form::WTF8, status_type::NOT_UTF8 },
+    { "\xed\xa0\x80" "a\xed\xb0\x80", utf8_form::WTF8, status_type::OK },
+  };
+
+  for (const auto & t : tests)
+    if (status_of<us::u32utf8istream>(t.b, t.f) != t.st
+	|| status_of<us::u16utf8istream>(t.b, t.f) != t.st) {
+      std::cout << name(t.f) << " error is wrong" << std::endl;
+      return false;
+    }
+
+  // lone surrogates are only for WTF-8.
+  std::ostringstream o;
+  us::u16utf8ostream w(o);
+  w.set_form(utf8_form::CESU8);
+  w << u"a" << char16_t(0xdc00);
+  if (w.streambuf_status() != status_type::NO_LEAD)
+    return false;
+  us::u32utf8ostream v(o);
+  v.set_form(utf8_form::MODIFIED);
+  v << U"a" << char32_t(0xd800);
+  return v.streambuf_status() == status_type::NOT_UNICODE;
+}
+
+// WTF-8 has a pair only as 4 bytes, also when the 3 byte halves are
+// cut between blocks or written one by one.
+bool test_pairs()
+{
+  using us::status_type;
+  const us::utf8_form f = us::utf8_form::WTF8;
+
+  for (std::size_t i = 0; i < 130; ++i) {
+    std::string b = std::string(i, 'a') + "\xed\xa0\xbd\xed\xb8\x80";
+    if (status_of<us::u32utf8istream>(b, f) != status_type::NOT_UTF8
+	|| status_of<us::u16utf8istream>(b, f) != status_type::NOT_UTF8)
+      return false;
+  }
+
+  const char32_t hi = 0xd83d, lo = 0xde00;
+  const char32_t pair[] = { U'a', hi, lo, U'b' };
+  std::ostringstream o1;
+  {
+    us::u32utf8ostream w(o1);
+    w.set_form(f);
+    w.write(pair, 4);
+    w.write(pair, 2);
+    w.write(pair + 2, 2);
+    w.put(hi);
+    w.put(lo);
+    w << hi << U'\n';
+    w.set_newline(us::NEWLINE_CRLF);
+    w << hi << U'\n' << hi;
+  }
+  return o1.str() == "a\xf0\x9f\x98\x80" "b" "a\xf0\x9f\x98\x80" "b"
+    "\xf0\x9f\x98\x80" "\xed\xa0\xbd\n" "\xed\xa0\xbd\r\n" "\xed\xa0\xbd";
+}
+
+bool test_other()
+{
+  // a lone high surrogate at the very end goes out when closing.
+  std::ostringstream o1;
+  {
+    us::u16utf8ostream w(o1);
+    w.set_form(us::utf8_form::WTF8);
+    w << u"\xd801" "a" << char16_t(0xd802);
+  }
+  if (o1.str() != "\xed\xa0\x81" "a\xed\xa0\x82")
+    return false;
+
+  // escaping writes standard UTF-8.
+  std::ostringstream o2;
+  {
+    us::u32utf8ostream w(o2, us::escape_type::JSON);
+    w.set_form(us::utf8_form::MODIFIED);
+    w << U"\U0001f600" << char32_t(0);
+  }
+  if (o2.str() != "\xf0\x9f\x98\x80\\u0000")
+    return false;
+
+  // reading through a stack, and with line ends changed too.
+  std::string b = encode(U"x\r\n\U0001f600\ry", us::utf8_form::MODIFIED);
+  std::istringstream f1(b);
+  us::u32utf8istream r1(f1, us::NEWLINE_LF);
+  r1.set_form(us::utf8_form::MODIFIED);
+  us::u16u32istream r2(r1);
+  return read_all(r2, 64, (char16_t *)0) == u"x\n\U0001f600\ny";
+}
+
+int main()
+{
+  for (us::utf8_form f : { us::utf8_form::MODIFIED, us::utf8_form::CESU8,
+			   us::utf8_form::WTF8 })
+    if (! test_form(f))
+      return 0;
+  if (! test_errors()) {
+    std::cout << "errors are wrong" << std::endl;
+    return 0;
+  }
+  if (! test_pairs()) {
+    std::cout << "WTF-8 pairs are wrong" << std::endl;
+    return 0;
+  }
+  if (! test_other()) {
+    std::cout << "WTF-8 closing, escaping or stacking is wrong" << std::endl;
+    return 0;
+  }
+  std::cout << "UTF-8 forms are ok." << std::endl;
+  return 0;
+}
@@ -1,8 +1,88 @@
 
+#include <algorithm>
+#include <climits>
+#include <cstring>
 #include <iostream>
 #include <fstream>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#define ALF_UNICODESTREAMS_URING 1
+#endif
+#endif
+#endif
 
 #include "unicodestreams.hxx"
+#include "unicodethreads.hxx"
+
+// When a stream reads from another of our streams that decodes, say an
+// u32u16istream on top of an u16utf8istream, decode_from() below skips
+// the middle and decodes straight from the source at the bottom: UTF-8
+// to UTF-32 in one go instead of UTF-8 to UTF-16 to UTF-32 a unit at a
+// time. This is done per block read, whenever the stream below has
+// nothing buffered and no error. Errors that the stream below would have
+// found are still its status and the stream on top sees end of input,
+// just as when reading through it. fusion is the friend of the streams
+// below that gives access to what it takes.
+
+class alf::unicodestreams::fusion {
+
+public:
+
+  // the source of b if reading through b can be done by decoding that
+  // source instead, 0 if not now.
+  template <class B>
+  static auto source(B * b) -> decltype(b->is_)
+  {
+    if (b->is_ == 0 || b->status_ != status_type::OK
+	|| b->gptr() != b->egptr())
+      return 0;
+    return b->is_;
+  }
+
+  // not when b changes line ends or reads another form of UTF-8.
+  static std::istream * source(u32utf8streambuf * b)
+  {
+    if ((b->newline_ & (NEWLINE_LF | NEWLINE_NEL))
+	|| b->form_ != utf8_form::STANDARD)
+      return 0;
+    return source<u32utf8streambuf>(b);
+  }
+
+  static std::istream * source(u16utf8streambuf * b)
+  {
+    if (b->form_ != utf8_form::STANDARD)
+      return 0;
+    return source<u16utf8streambuf>(b);
+  }
+
+  template <class B>
+  static void set_status(B * b, status_type s) { b->status_ = s; }
+
+  // how b swaps, 12 or 1234 when it doesn't, 0 if not known yet.
+  static int swap_mode(u16bswap_streambuf * b);
+  static int swap_mode(u32bswap_streambuf * b);
+
+}; // end of class fusion
 
 namespace {
 
@@ -248,2209 +328,10805 @@ put_u32(std::basic_ostream<char32_t> * os,
 
 } // end of function put_u32
 
-// s is either LE or BE
-// check endianess of hardware and set swap_state based on
-// expected input to be LE/BE according to s.
+// s is either LE or BE, give the swap state that reads/writes that
+// on this machine. Other states are returned as they are.
+inline
 alf::unicodestreams::u32_swap_state_type
 u32_check(alf::unicodestreams::u32_swap_state_type s)
 {
   typedef alf::unicodestreams::u32_swap_state_type u32_swap_state_type;
 
-  union {
-    unsigned int v;
-    char b[4];
-  };
-
-  v = 0x01020304;
-  switch (s) {
-  case u32_swap_state_type::LE:
-    switch (b[0]) {
-    case 1:
-      // 1234 -> 4321
-      return u32_swap_state_type::v4321;
-    case 2:
-      // 2143 -> 4321
-      return u32_swap_state_type::v3412;
-    case 3:
-      // 3412 -> 4321
-      return u32_swap_state_type::v2143;
-    case 4:
-      // 4321 -> 4321
-      return u32_swap_state_type::v1234;
-    }
-    break;
-  case u32_swap_state_type::BE:
-    switch(b[0]) {
-    case 1: // 1234 -> 1234
-      return u32_swap_state_type::v1234;
-    case 2: // 2143 -> 1234
-      return u32_swap_state_type::v2143;
-    case 3: // 3412 -> 1234
-      return u32_swap_state_type::v3412;
-    case 4: // 4321 -> 1234
-      return u32_swap_state_type::v4321;
-    }
-    break;
-  }
-  return u32_swap_state_type::None;
+  if (s == u32_swap_state_type::LE)
+    return alf::unicodestreams::u32_le_state;
+  if (s == u32_swap_state_type::BE)
+    return alf::unicodestreams::u32_be_state;
+  return s;
 }
 
-// s is either LE or BE
-// check endianess of hardware and set swap_state based on
-// expected input to be LE/BE according to s.
+// s is either LE or BE, give the swap state that reads/writes that
+// on this machine. Other states are returned as they are.
+inline
 alf::unicodestreams::u16_swap_state_type
 u16_check(alf::unicodestreams::u16_swap_state_type s)
 {
   typedef alf::unicodestreams::u16_swap_state_type u16_swap_state_type;
 
-  union {
-    unsigned short int v;
-    char b[2];
-  };
-
-  v = 0x0102;
-  switch (s) {
-  case u16_swap_state_type::LE:
-    switch (b[0]) {
-    case 1:
-      // 12 -> 21
-      return u16_swap_state_type::v21;
-    case 2:
-      // 21 -> 21
-      return u16_swap_state_type::v12;
-    }
-    break;
-  case u16_swap_state_type::BE:
-    switch(b[0]) {
-    case 1: // 12 -> 12
-      return u16_swap_state_type::v12;
-    case 2: // 21 -> 12
-      return u16_swap_state_type::v21;
-    }
-    break;
-  }
-  return u16_swap_state_type::None;
+  if (s == u16_swap_state_type::LE)
+    return alf::unicodestreams::u16_le_state;
+  if (s == u16_swap_state_type::BE)
+    return alf::unicodestreams::u16_be_state;
+  return s;
 }
 
-}; // end of anonymous namespace
+//////////////////////////////////////
+// block decoding
 
-///////////////////////////////////////
-// u32
+// The streambufs that decode from a source stream no longer do it one
+// char at a time. They read a block of raw codes from the source and
+// run one of the decoders below over it.
 
-// for reading.
-alf::unicodestreams::u32streambuf::u32streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
-{
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
-}
+typedef alf::unicodestreams::status_type status_type;
 
-// for writing
-alf::unicodestreams::u32streambuf::u32streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+// Swap a unit as the swap state with the value M does.
+template <int M, class C>
+inline
+C
+swap_unit(C c)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  char32_t w = c;
+
+  if constexpr (M == 21)
+    return C((w << 8) | (w >> 8));
+  else if constexpr (M == 2143)
+    return C(((w & 0xff00ff) << 8) | ((w >> 8) & 0xff00ff));
+  else if constexpr (M == 3412)
+    return C((w << 16) | (w >> 16));
+  else if constexpr (M == 4321)
+    return C((w << 24) | ((w & 0xff00) << 8) | ((w >> 8) & 0xff00)
+	     | (w >> 24));
+  else
+    return c;
 }
 
-// for both.
-alf::unicodestreams::u32streambuf::
-u32streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+#if defined(__SSE2__)
+// The same for the 8 char16_t or 4 char32_t in v. Swapping the bytes
+// in each 16 bit half is the same for 21 and 2143.
+template <int M>
+inline
+__m128i
+swap_vector(__m128i v)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if constexpr (M == 21 || M == 2143)
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+  else if constexpr (M == 3412)
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xb1), 0xb1);
+  else if constexpr (M == 4321)
+    return swap_vector<2143>(swap_vector<3412>(v));
+  else
+    return v;
 }
+#endif
 
-alf::unicodestreams::u32streambuf::~u32streambuf()
+// [s, s + n) swapped to d, s may be d.
+template <int M, class C>
+inline
+void
+swap_units(const C * s, C * d, std::size_t n)
 {
-  if (os_)
-    overflow(traits_type::eof());
-}
+  std::size_t i = 0;
 
-// we do not buffer anything, so rather than fill a buffer we just
-// read one char and return it - leaving the buffer empty.
+#if defined(__SSE2__)
+  enum { K = 16 / sizeof(C) };
+  for (; i + K <= n; i += K) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    _mm_storeu_si128((__m128i *)(d + i), swap_vector<M>(v));
+  }
+#endif
+  for (; i < n; ++i)
+    d[i] = swap_unit<M>(s[i]);
+}
 
-// virtual
-alf::unicodestreams::u32streambuf::int_type
-alf::unicodestreams::u32streambuf::underflow()
+// The same with the swap state known only when running, it is looked
+// at once for the whole block. None, v12 and v1234 only copy.
+void
+swap_units(int m, const char16_t * s, char16_t * d, std::size_t n)
 {
-  return get();
+  if (m == 21)
+    swap_units<21>(s, d, n);
+  else if (s != d)
+    std::char_traits<char16_t>::copy(d, s, n);
 }
 
-// virtual
-alf::unicodestreams::u32streambuf::int_type
-alf::unicodestreams::u32streambuf::overflow(int_type __c)
+void
+swap_units(int m, const char32_t * s, char32_t * d, std::size_t n)
 {
-  return put(__c);
+  switch (m) {
+  case 2143:
+    swap_units<2143>(s, d, n);
+    break;
+  case 3412:
+    swap_units<3412>(s, d, n);
+    break;
+  case 4321:
+    swap_units<4321>(s, d, n);
+    break;
+  default:
+    if (s != d)
+      std::char_traits<char32_t>::copy(d, s, n);
+    break;
+  }
 }
 
-// virtual
-alf::unicodestreams::u32streambuf::streambuf *
-alf::unicodestreams::u32streambuf::
-setbuf(char_type * __s, std::streamsize __n)
-{
+// A decoder for decode_from() and skip_from() that only swaps, for the
+// bswap streams. M is the swap state, or 0 when that is given to the
+// constructor.
+template <class C, int M = 0>
+struct swap_copier {
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
+  enum { MAXLEN = 1, EXPAND = 1 };
 
-}
+  explicit swap_copier(int m = M) : mode(m) {}
 
-alf::unicodestreams::u32streambuf::int_type
-alf::unicodestreams::u32streambuf::get()
-{
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  int_type c = get_u32(is_);
-  if (c < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb, ibufe - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  status_type operator () (const C *& s, const C * se, C *& d, C * de) const
+  {
+    std::size_t n = se - s < de - d ? se - s : de - d;
+
+    if constexpr (M != 0)
+      swap_units<M>(s, d, n);
+    else
+      swap_units(mode, s, d, n);
+    s += n;
+    d += n;
+    return status_type::OK;
   }
-  this->setg(this->egptr(), this->gptr(), this->egptr() + 1);
-  return traits_type::to_int_type(*gptr() = c);
-}
 
-alf::unicodestreams::u32streambuf::int_type
-alf::unicodestreams::u32streambuf::put(int_type __c)
-{
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+  status_type skip(const C *& s, const C * se, std::streamsize & n) const
+  {
+    std::streamsize k = se - s < n ? se - s : n;
 
-  int_type k = 0;
-  if (! traits_type::eq_int_type(__c, traits_type::eof())) {
-    if ((k = put_u32(os_, __c)) < 0)
-      return err_status((status_type)-k);
-    return __c;
+    s += k;
+    n -= k;
+    return status_type::OK;
   }
-  return traits_type::not_eof(__c);
-}
 
-////////////////////////////////
-// u32u16
+  static int need(const C *, const C *) { return 0; }
 
-// for reading.
-alf::unicodestreams::u32u16streambuf::u32u16streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
-{
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
-}
+  int mode;
 
-// for writing
-alf::unicodestreams::u32u16streambuf::u32u16streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+}; // end of struct swap_copier
+
+// Sort out FChar, LE and BE before writing c: FChar writes a BOM unless
+// c is one. Return false if that fails.
+template <class S, class C>
+bool
+put_swap_state(std::basic_ostream<C> * os, S & s, S none, C c)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (s == S::FChar) {
+    if (c != 0xfeff && ! os->put(C(0xfeff)))
+      return false;
+    s = none;
+  } else if (s == S::LE || s == S::BE) {
+    if constexpr (sizeof(C) == 4)
+      s = u32_check(s);
+    else
+      s = u16_check(s);
+  }
+  return true;
 }
 
-// for both.
-alf::unicodestreams::u32u16streambuf::
-u32u16streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+// Write [s, s + n) to os swapped as the swap state m says, a chunk at
+// a time. Return the number of units written.
+template <class C>
+std::streamsize
+put_swapped(std::basic_ostream<C> * os, int m, const C * s, std::streamsize n)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  constexpr std::streamsize CHUNK = 256;
+  C tmp[CHUNK];
+  std::streamsize k = 0;
+
+  if (m == 0 || m == 12 || m == 1234) {
+    os->write(s, n);
+    return *os ? n : 0;
+  }
+  while (k < n) {
+    std::streamsize j = n - k < CHUNK ? n - k : CHUNK;
+    swap_units(m, s + k, tmp, j);
+    if (! os->write(tmp, j))
+      break;
+    k += j;
+  }
+  return k;
 }
 
-alf::unicodestreams::u32u16streambuf::~u32u16streambuf()
+// length of an UTF-8 sequence given its first byte, 0 if not a lead byte.
+inline
+int
+utf8_seq_len(unsigned char c)
 {
-  if (os_)
-    overflow(traits_type::eof());
+  if (c < 0x80)
+    return 1;
+  if (c < 0xc0)
+    return 0;
+  if (c < 0xe0)
+    return 2;
+  if (c < 0xf0)
+    return 3;
+  if (c < 0xf8)
+    return 4;
+  return 0;
 }
 
-// virtual
-alf::unicodestreams::u32u16streambuf::int_type
-alf::unicodestreams::u32u16streambuf::underflow()
+inline
+void
+put_unit(char32_t *& q, char32_t w)
 {
-  return get();
+  *q++ = w;
 }
 
-// virtual
-alf::unicodestreams::u32u16streambuf::int_type
-alf::unicodestreams::u32u16streambuf::overflow(int_type __c)
+inline
+void
+put_unit(char16_t *& q, char32_t w)
 {
-  return put(__c);
+  if (w < 0x10000) {
+    *q++ = char16_t(w);
+    return;
+  }
+  w -= 0x10000;
+  *q++ = char16_t(0xd800 | (w >> 10));
+  *q++ = char16_t(0xdc00 | (w & 0x3ff));
 }
 
-// virtual
-alf::unicodestreams::u32u16streambuf::streambuf *
-alf::unicodestreams::u32u16streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+// Copy the leading ASCII bytes of [p, p + n) to q,
+// return the number of bytes copied.
+template <class C>
+inline
+std::size_t
+widen_ascii(const unsigned char * p, std::size_t n, C * q)
 {
+  std::size_t i = 0;
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+#if defined(__SSE2__)
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    if (_mm_movemask_epi8(v))
+      break;
+    __m128i lo = _mm_unpacklo_epi8(v, z);
+    __m128i hi = _mm_unpackhi_epi8(v, z);
+    if (sizeof(C) == 2) {
+      _mm_storeu_si128((__m128i *)(q + i), lo);
+      _mm_storeu_si128((__m128i *)(q + i + 8), hi);
+    } else {
+      _mm_storeu_si128((__m128i *)(q + i), _mm_unpacklo_epi16(lo, z));
+      _mm_storeu_si128((__m128i *)(q + i + 4), _mm_unpackhi_epi16(lo, z));
+      _mm_storeu_si128((__m128i *)(q + i + 8), _mm_unpacklo_epi16(hi, z));
+      _mm_storeu_si128((__m128i *)(q + i + 12), _mm_unpackhi_epi16(hi, z));
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
   }
-  return this;
-
+#endif
+  while (i < n && p[i] < 0x80) {
+    q[i] = p[i];
+    ++i;
+  }
+  return i;
 }
 
-alf::unicodestreams::u32u16streambuf::int_type
-alf::unicodestreams::u32u16streambuf::get()
+// Number of leading ASCII bytes of [p, p + n).
+inline
+std::size_t
+ascii_run(const unsigned char * p, std::size_t n)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  int_type c = get_u16(is_);
-  if (c < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb, ibufe - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    int m = _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(p + i)));
+    if (m)
+      return i + __builtin_ctz(m);
   }
-  this->setg(this->egptr(), this->gptr(), this->egptr() + 1);
-  return traits_type::to_int_type(*gptr() = c);
+#endif
+  while (i < n && p[i] < 0x80)
+    ++i;
+  return i;
 }
 
-alf::unicodestreams::u32u16streambuf::int_type
-alf::unicodestreams::u32u16streambuf::put(int_type c)
+// Copy all of [p, p + n) to q, every ISO 8859-1 byte is a code point.
+template <class C>
+inline
+void
+widen_latin1(const unsigned char * p, std::size_t n, C * q)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  if (os_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *os_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
-  if (! is_valid_utf32(c))
-    return err_status(status_type::NOT_UNICODE);
-  int_type k = put_u16(os_, c);
-  if (k < 0)
-    return err_status((status_type)-k);
-  return c;
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i lo = _mm_unpacklo_epi8(v, z);
+    __m128i hi = _mm_unpackhi_epi8(v, z);
+    if (sizeof(C) == 2) {
+      _mm_storeu_si128((__m128i *)(q + i), lo);
+      _mm_storeu_si128((__m128i *)(q + i + 8), hi);
+    } else {
+      _mm_storeu_si128((__m128i *)(q + i), _mm_unpacklo_epi16(lo, z));
+      _mm_storeu_si128((__m128i *)(q + i + 4), _mm_unpackhi_epi16(lo, z));
+      _mm_storeu_si128((__m128i *)(q + i + 8), _mm_unpacklo_epi16(hi, z));
+      _mm_storeu_si128((__m128i *)(q + i + 12), _mm_unpackhi_epi16(hi, z));
+    }
+  }
+#endif
+  for (; i < n; ++i)
+    q[i] = p[i];
 }
 
-////////////////////////////////
-// u32utf8
-
-// for reading.
-alf::unicodestreams::u32utf8streambuf::u32utf8streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+// Check the complete k byte UTF-8 sequence at p (k > 1) the same
+// way get_utf8 does and store the code point in w.
+inline
+status_type
+check_utf8(const unsigned char * p, int k, char32_t & w)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  w = p[0] & (0x7f >> k);
+  for (int j = 1; j < k; ++j) {
+    unsigned int c = p[j];
+    if (c < 0x80 || c >= 0xc0)
+      return status_type::NOT_UTF8;
+    w = (w << 6) | (c & 0x3f);
+  }
+  if (! is_valid_utf32(w))
+    return status_type::NOT_UNICODE;
+  if (w < char32_t(arr__[k]))
+    return status_type::NOT_UTF8;
+  return status_type::OK;
 }
 
-// for writing
-alf::unicodestreams::u32utf8streambuf::u32utf8streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+// Whether the follow bytes of the sequence at p that are in [p, pe) are
+// all valid, a sequence cut at pe is NOT_UTF8 at once when one is not.
+inline
+bool
+utf8_cut_ok(const unsigned char * p, const unsigned char * pe)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  while (++p < pe)
+    if (! is_valid_utf8_follow(*p))
+      return false;
+  return true;
 }
 
-// for both.
-alf::unicodestreams::u32utf8streambuf::
-u32utf8streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+// Number of leading codes of [p, p + n) below 0xd800, those are
+// always valid unicode and never part of a surrogate pair.
+inline
+std::size_t
+bmp_run(const char16_t * p, std::size_t n)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i bias = _mm_set1_epi16(short(0x8000));
+  const __m128i lim = _mm_set1_epi16(short(0xd800 ^ 0x8000));
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias);
+    if (_mm_movemask_epi8(_mm_cmplt_epi16(v, lim)) != 0xffff)
+      break;
+  }
+#endif
+  while (i < n && p[i] < 0xd800)
+    ++i;
+  return i;
+}
+
+inline
+std::size_t
+bmp_run(const char32_t * p, std::size_t n)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i bias = _mm_set1_epi32(int(0x80000000));
+  const __m128i lim = _mm_set1_epi32(int(0xd800 ^ 0x80000000));
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(p + i)), bias);
+    if (_mm_movemask_epi8(_mm_cmplt_epi32(v, lim)) != 0xffff)
+      break;
+  }
+#endif
+  while (i < n && p[i] < 0xd800)
+    ++i;
+  return i;
+}
+
+// The decoders convert as much as possible of [s, se) into [d, de)
+// following the same rules as get_utf8, get_u16 and get_u32 above.
+// They stop at the end of either range, in front of a sequence that is
+// not complete in [s, se) or that does not fit in [d, de) and in front of
+// the first invalid sequence in which case the error is returned.
+// s and d are left pointing past what was consumed and produced.
+// need() tells how many more codes the sequence at s needs, if any.
+// skip() works the same way but only validates and counts down n for
+// every code point it passes, stopping when n reach 0.
+// EXPAND is the most codes of output a single code of input gives.
+
+struct utf8_decoder {
+
+  enum { MAXLEN = 4, EXPAND = 1 };
+
+  template <class C>
+  status_type operator () (const char *& s, const char * se,
+			   C *& d, C * de) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    const unsigned char * pe = (const unsigned char *)se;
+    C * q = d;
+    status_type st = status_type::OK;
+    char32_t w;
+    int k;
+
+    while (p < pe && q < de) {
+      unsigned int c = *p;
+      if (c < 0x80) {
+	std::size_t n = pe - p;
+	if (std::size_t(de - q) < n)
+	  n = de - q;
+	n = widen_ascii(p, n, q);
+	p += n;
+	q += n;
+	continue;
+      }
+      if ((k = utf8_seq_len(c)) == 0) {
+	st = c < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+	break;
+      }
+      if (pe - p < k) {
+	if (! utf8_cut_ok(p, pe))
+	  st = status_type::NOT_UTF8;
+	break;
+      }
+      if (sizeof(C) == 2 && k == 4 && de - q < 2)
+	break;
+      if ((st = check_utf8(p, k, w)) != status_type::OK)
+	break;
+      p += k;
+      put_unit(q, w);
+    }
+    s = (const char *)p;
+    d = q;
+    return st;
+  }
+
+  status_type skip(const char *& s, const char * se,
+		   std::streamsize & n) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    const unsigned char * pe = (const unsigned char *)se;
+    status_type st = status_type::OK;
+    char32_t w;
+    int k;
+
+    while (p < pe && n > 0) {
+      unsigned int c = *p;
+      if (c < 0x80) {
+	std::size_t m = pe - p;
+	if (std::size_t(n) < m)
+	  m = n;
+	m = ascii_run(p, m);
+	p += m;
+	n -= m;
+	continue;
+      }
+      if ((k = utf8_seq_len(c)) == 0) {
+	st = c < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+	break;
+      }
+      if (pe - p < k) {
+	if (! utf8_cut_ok(p, pe))
+	  st = status_type::NOT_UTF8;
+	break;
+      }
+      if ((st = check_utf8(p, k, w)) != status_type::OK)
+	break;
+      p += k;
+      --n;
+    }
+    s = (const char *)p;
+    return st;
+  }
+
+  static int need(const char * s, const char * se)
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    int m = utf8_seq_len(*p) - int(se - s);
+    return m > 0 && utf8_cut_ok(p, (const unsigned char *)se) ? m : 0;
+  }
+
+}; // end of struct utf8_decoder
+
+struct u16_decoder {
+
+  enum { MAXLEN = 2, EXPAND = 1 };
+
+  template <class C>
+  status_type operator () (const char16_t *& s, const char16_t * se,
+			   C *& d, C * de) const
+  {
+    const char16_t * p = s;
+    C * q = d;
+    status_type st = status_type::OK;
+    char32_t c, w;
+
+    while (p < se && q < de) {
+      std::size_t n = se - p;
+      if (std::size_t(de - q) < n)
+	n = de - q;
+      n = bmp_run(p, n);
+      for (std::size_t i = 0; i < n; ++i)
+	q[i] = p[i];
+      p += n;
+      q += n;
+      if (p == se || q == de)
+	break;
+      c = *p;
+      if (c < 0xd800 || c >= 0xe000) {
+	if (! is_valid_utf32(c)) {
+	  st = status_type::NOT_UNICODE;
+	  break;
+	}
+	*q++ = C(c);
+	++p;
+	continue;
+      }
+      if (c >= 0xdc00) {
+	st = status_type::NO_LEAD;
+	break;
+      }
+      if (se - p < 2)
+	break;
+      if (sizeof(C) == 2 && de - q < 2)
+	break;
+      w = p[1];
+      if (w < 0xdc00 || w >= 0xe000) {
+	st = status_type::NO_FOLLOW;
+	break;
+      }
+      w = (((c & 0x3ff) << 10) | (w & 0x3ff)) + 0x10000;
+      if (! is_valid_utf32(w)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      p += 2;
+      put_unit(q, w);
+    }
+    s = p;
+    d = q;
+    return st;
+  }
+
+  status_type skip(const char16_t *& s, const char16_t * se,
+		   std::streamsize & n) const
+  {
+    const char16_t * p = s;
+    status_type st = status_type::OK;
+    char32_t c, w;
+
+    while (p < se && n > 0) {
+      std::size_t m = se - p;
+      if (std::size_t(n) < m)
+	m = n;
+      m = bmp_run(p, m);
+      p += m;
+      n -= m;
+      if (p == se || n == 0)
+	break;
+      c = *p;
+      if (c < 0xd800 || c >= 0xe000) {
+	if (! is_valid_utf32(c)) {
+	  st = status_type::NOT_UNICODE;
+	  break;
+	}
+	++p;
+	--n;
+	continue;
+      }
+      if (c >= 0xdc00) {
+	st = status_type::NO_LEAD;
+	break;
+      }
+      if (se - p < 2)
+	break;
+      w = p[1];
+      if (w < 0xdc00 || w >= 0xe000) {
+	st = status_type::NO_FOLLOW;
+	break;
+      }
+      w = (((c & 0x3ff) << 10) | (w & 0x3ff)) + 0x10000;
+      if (! is_valid_utf32(w)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      p += 2;
+      --n;
+    }
+    s = p;
+    return st;
+  }
+
+  static int need(const char16_t * s, const char16_t * se)
+  { return *s >= 0xd800 && *s < 0xdc00 && se - s == 1; }
+
+}; // end of struct u16_decoder
+
+struct u32_decoder {
+
+  enum { MAXLEN = 1, EXPAND = 2 };
+
+  template <class C>
+  status_type operator () (const char32_t *& s, const char32_t * se,
+			   C *& d, C * de) const
+  {
+    const char32_t * p = s;
+    C * q = d;
+    status_type st = status_type::OK;
+    char32_t c;
+
+    while (p < se && q < de) {
+      std::size_t n = se - p;
+      if (std::size_t(de - q) < n)
+	n = de - q;
+      n = bmp_run(p, n);
+      for (std::size_t i = 0; i < n; ++i)
+	q[i] = C(p[i]);
+      p += n;
+      q += n;
+      if (p == se || q == de)
+	break;
+      c = *p;
+      if (! is_valid_utf32(c)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      if (sizeof(C) == 2 && c >= 0x10000 && de - q < 2)
+	break;
+      ++p;
+      put_unit(q, c);
+    }
+    s = p;
+    d = q;
+    return st;
+  }
+
+  status_type skip(const char32_t *& s, const char32_t * se,
+		   std::streamsize & n) const
+  {
+    const char32_t * p = s;
+    status_type st = status_type::OK;
+
+    while (p < se && n > 0) {
+      std::size_t m = se - p;
+      if (std::size_t(n) < m)
+	m = n;
+      m = bmp_run(p, m);
+      p += m;
+      n -= m;
+      if (p == se || n == 0)
+	break;
+      if (! is_valid_utf32(*p)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      ++p;
+      --n;
+    }
+    s = p;
+    return st;
+  }
+
+  static int need(const char32_t *, const char32_t *)
+  { return 0; }
+
+}; // end of struct u32_decoder
+
+struct latin1_decoder {
+
+  enum { MAXLEN = 1, EXPAND = 1 };
+
+  template <class C>
+  status_type operator () (const char *& s, const char * se,
+			   C *& d, C * de) const
+  {
+    std::size_t n = se - s;
+    if (std::size_t(de - d) < n)
+      n = de - d;
+    widen_latin1((const unsigned char *)s, n, d);
+    s += n;
+    d += n;
+    return status_type::OK;
+  }
+
+  status_type skip(const char *& s, const char * se,
+		   std::streamsize & n) const
+  {
+    std::streamsize m = se - s;
+    if (n < m)
+      m = n;
+    s += m;
+    n -= m;
+    return status_type::OK;
+  }
+
+  static int need(const char *, const char *)
+  { return 0; }
+
+}; // end of struct latin1_decoder
+
+// Decodes the other forms of UTF-8, see utf8_form. ASCII goes through
+// widen_ascii() and ascii_run() as in utf8_decoder, only C0 80, the 3
+// byte surrogates ED A0..BF xx and 4 byte sequences are taken differently.
+// *high tells whether the last sequence read was a high surrogate on its
+// own and is kept for the next block, a low one of 3 bytes right after it
+// would be a pair that WTF-8 only has as 4 bytes.
+struct form_decoder {
+
+  enum { MAXLEN = 6, EXPAND = 1 };
+
+  form_decoder(alf::unicodestreams::utf8_form f, bool * h)
+    : form(f), high(h)
+  { }
+
+  // The sequence at p, which isn't ASCII, as a code point or a lone
+  // surrogate in w and its length in k, which is 0 when the sequence
+  // isn't all in [p, pe). h is the *high before it.
+  status_type seq(const unsigned char * p, const unsigned char * pe,
+		  int & k, char32_t & w, bool h) const
+  {
+    using alf::unicodestreams::utf8_form;
+    unsigned int c = *p;
+    int n = utf8_seq_len(c);
+    status_type st;
+
+    k = 0;
+    if (n == 0)
+      return c < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+    if (n == 4 && form != utf8_form::WTF8)
+      return status_type::NOT_UTF8;
+    if (pe - p < n)
+      return utf8_cut_ok(p, pe) ? status_type::OK : status_type::NOT_UTF8;
+    if (c == 0xc0 && p[1] == 0x80 && form == utf8_form::MODIFIED) {
+      w = 0;
+      k = 2;
+      return status_type::OK;
+    }
+    if (c != 0xed || (p[1] & 0xe0) != 0xa0) {
+      if ((st = check_utf8(p, n, w)) == status_type::OK)
+	k = n;
+      return st;
+    }
+    if (! is_valid_utf8_follow(p[2]))
+      return status_type::NOT_UTF8;
+    w = 0xd000 | ((p[1] & 0x3f) << 6) | (p[2] & 0x3f);
+    if (form == utf8_form::WTF8) {
+      if (h && w >= 0xdc00)
+	return status_type::NOT_UTF8;
+      k = 3;
+      return status_type::OK;
+    }
+    // the high half of a pair, the low one must follow.
+    if (w >= 0xdc00)
+      return status_type::NO_LEAD;
+    if (pe - p > 3 && p[3] != 0xed)
+      return status_type::NO_FOLLOW;
+    if (pe - p > 4 && (p[4] & 0xf0) != 0xb0)
+      return status_type::NO_FOLLOW;
+    if (pe - p < 6)
+      return status_type::OK;
+    if (! is_valid_utf8_follow(p[5]))
+      return status_type::NOT_UTF8;
+    w = (((w & 0x3ff) << 10) | ((p[4] & 0x0f) << 6) | (p[5] & 0x3f))
+      + 0x10000;
+    if (! is_valid_utf32(w))
+      return status_type::NOT_UNICODE;
+    k = 6;
+    return status_type::OK;
+  }
+
+  template <class C>
+  status_type operator () (const char *& s, const char * se,
+			   C *& d, C * de) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    const unsigned char * pe = (const unsigned char *)se;
+    C * q = d;
+    status_type st = status_type::OK;
+    bool h = *high;
+    char32_t w;
+    int k;
+
+    while (p < pe && q < de) {
+      if (*p < 0x80) {
+	std::size_t n = pe - p;
+	if (std::size_t(de - q) < n)
+	  n = de - q;
+	n = widen_ascii(p, n, q);
+	p += n;
+	q += n;
+	h = false;
+	continue;
+      }
+      if ((st = seq(p, pe, k, w, h)) != status_type::OK || k == 0)
+	break;
+      if (sizeof(C) == 2 && w >= 0x10000 && de - q < 2)
+	break;
+      p += k;
+      put_unit(q, w);
+      h = w >= 0xd800 && w < 0xdc00;
+    }
+    s = (const char *)p;
+    d = q;
+    *high = h;
+    return st;
+  }
+
+  status_type skip(const char *& s, const char * se,
+		   std::streamsize & n) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    const unsigned char * pe = (const unsigned char *)se;
+    status_type st = status_type::OK;
+    bool h = *high;
+    char32_t w;
+    int k;
+
+    while (p < pe && n > 0) {
+      if (*p < 0x80) {
+	std::size_t m = pe - p;
+	if (std::size_t(n) < m)
+	  m = n;
+	m = ascii_run(p, m);
+	p += m;
+	n -= m;
+	h = false;
+	continue;
+      }
+      if ((st = seq(p, pe, k, w, h)) != status_type::OK || k == 0)
+	break;
+      p += k;
+      --n;
+      h = w >= 0xd800 && w < 0xdc00;
+    }
+    s = (const char *)p;
+    *high = h;
+    return st;
+  }
+
+  // a high surrogate wants the low one of 3 bytes after it.
+  int need(const char * s, const char * se) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    if (form != alf::unicodestreams::utf8_form::WTF8 && se - s > 1
+	&& p[0] == 0xed && (p[1] & 0xf0) == 0xa0)
+      return 6 - int(se - s);
+    return utf8_decoder::need(s, se);
+  }
+
+  alf::unicodestreams::utf8_form form;
+  bool * high;
+
+}; // end of struct form_decoder
+
+// Copy the leading ASCII codes of [p, p + n) to q as bytes,
+// return the number of codes copied.
+inline
+std::size_t
+narrow_ascii(const char16_t * p, std::size_t n, unsigned char * q)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i hi = _mm_set1_epi16(short(0xff80));
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(v, hi), z)) != 0xffff)
+      break;
+    _mm_storel_epi64((__m128i *)(q + i), _mm_packus_epi16(v, v));
+  }
+#endif
+  for (; i < n && p[i] < 0x80; ++i)
+    q[i] = (unsigned char)p[i];
+  return i;
+}
+
+inline
+std::size_t
+narrow_ascii(const char32_t * p, std::size_t n, unsigned char * q)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i hi = _mm_set1_epi32(int(0xffffff80));
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + i + 4));
+    __m128i m = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(a, hi), z),
+			      _mm_cmpeq_epi32(_mm_and_si128(b, hi), z));
+    if (_mm_movemask_epi8(m) != 0xffff)
+      break;
+    __m128i v = _mm_packs_epi32(a, b);
+    _mm_storel_epi64((__m128i *)(q + i), _mm_packus_epi16(v, v));
+  }
+#endif
+  for (; i < n && p[i] < 0x80; ++i)
+    q[i] = (unsigned char)p[i];
+  return i;
+}
+
+// Encoders are the other way around, they encode [s, se) as UTF-8 to
+// [d, de) checking the input the same way the streams do. They stop
+// on error, when there is no room for the next code point or when a
+// surrogate pair is cut at se (need() tells). s and d are updated.
+
+struct utf8_encoder {
+
+  enum { MAXLEN = 4 };
+
+  template <class C>
+  status_type operator () (const C *& s, const C * se,
+			   char *& d, char * de) const
+  {
+    const C * p = s;
+    unsigned char * q = (unsigned char *)d;
+    unsigned char * qe = (unsigned char *)de;
+    status_type st = status_type::OK;
+    char32_t w, v;
+    int k, n;
+
+    while (p < se && q < qe) {
+      w = *p;
+      if (w < 0x80) {
+	std::size_t m = se - p;
+	if (std::size_t(qe - q) < m)
+	  m = qe - q;
+	m = narrow_ascii(p, m, q);
+	p += m;
+	q += m;
+	continue;
+      }
+      k = 1;
+      if (sizeof(C) == 2 && w >= 0xd800 && w < 0xe000) {
+	if (w >= 0xdc00) {
+	  st = status_type::NO_LEAD;
+	  break;
+	}
+	if (se - p < 2)
+	  break;
+	v = p[1];
+	if (v < 0xdc00 || v >= 0xe000) {
+	  st = status_type::NO_FOLLOW;
+	  break;
+	}
+	w = (((w & 0x3ff) << 10) | (v & 0x3ff)) + 0x10000;
+	k = 2;
+      }
+      if (! is_valid_utf32(w)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      n = w < 0x800 ? 2 : w < 0x10000 ? 3 : 4;
+      if (qe - q < n)
+	break;
+      switch (n) {
+      case 2:
+	q[0] = 0xc0 | (w >> 6);
+	break;
+      case 3:
+	q[0] = 0xe0 | (w >> 12);
+	q[1] = 0x80 | ((w >> 6) & 0x3f);
+	break;
+      case 4:
+	q[0] = 0xf0 | (w >> 18);
+	q[1] = 0x80 | ((w >> 12) & 0x3f);
+	q[2] = 0x80 | ((w >> 6) & 0x3f);
+	break;
+      }
+      q[n - 1] = 0x80 | (w & 0x3f);
+      q += n;
+      p += k;
+    }
+    s = p;
+    d = (char *)q;
+    return st;
+  }
+
+  template <class C>
+  static int need(const C * s, const C * se)
+  { return sizeof(C) == 2 && *s >= 0xd800 && *s < 0xdc00 && se - s == 1; }
+
+}; // end of struct utf8_encoder
+
+// Whether esc writes the ASCII code c as it is.
+inline
+bool
+plain_ascii(char32_t c, alf::unicodestreams::escape_type esc)
+{
+  typedef alf::unicodestreams::escape_type escape_type;
+
+  if (c < 0x20)
+    return esc == escape_type::XML && (c == '\t' || c == '\n');
+  switch (c) {
+  case '"':
+    return false;
+  case '\\':
+    return esc == escape_type::XML;
+  case '&': case '<': case '>': case '\'':
+    return esc != escape_type::XML;
+  }
+  return true;
+}
+
+#if defined(__SSE2__)
+// Load 8 codes at p as 16 bit lanes, false if one of them isn't ASCII.
+inline
+bool
+load_ascii8(const char16_t * p, __m128i & v)
+{
+  v = _mm_loadu_si128((const __m128i *)p);
+  __m128i m = _mm_and_si128(v, _mm_set1_epi16(short(0xff80)));
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(m, _mm_setzero_si128()))
+    == 0xffff;
+}
+
+inline
+bool
+load_ascii8(const char32_t * p, __m128i & v)
+{
+  const __m128i hi = _mm_set1_epi32(int(0xffffff80));
+  const __m128i z = _mm_setzero_si128();
+  __m128i a = _mm_loadu_si128((const __m128i *)p);
+  __m128i b = _mm_loadu_si128((const __m128i *)(p + 4));
+  __m128i m = _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(a, hi), z),
+			    _mm_cmpeq_epi32(_mm_and_si128(b, hi), z));
+  v = _mm_packs_epi32(a, b);
+  return _mm_movemask_epi8(m) == 0xffff;
+}
+#endif
+
+// Copy the leading ASCII codes of [p, p + n) that esc writes as they
+// are to q as bytes, return the number of codes copied.
+template <class C>
+inline
+std::size_t
+plain_ascii_run(const C * p, std::size_t n, unsigned char * q,
+		alf::unicodestreams::escape_type esc)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  bool xml = esc == alf::unicodestreams::escape_type::XML;
+  const __m128i sp = _mm_set1_epi16(0x20);
+  const __m128i quot = _mm_set1_epi16('"');
+  const __m128i x1 = _mm_set1_epi16(xml ? '&' : '\\');
+  const __m128i x2 = _mm_set1_epi16(xml ? '<' : '\\');
+  const __m128i x3 = _mm_set1_epi16(xml ? '>' : '\\');
+  const __m128i x4 = _mm_set1_epi16(xml ? '\'' : '\\');
+  for (; i + 8 <= n; i += 8) {
+    __m128i v;
+    if (! load_ascii8(p + i, v))
+      break;
+    __m128i m = _mm_or_si128(_mm_cmplt_epi16(v, sp), _mm_cmpeq_epi16(v, quot));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, x1),
+				     _mm_cmpeq_epi16(v, x2)));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, x3),
+				     _mm_cmpeq_epi16(v, x4)));
+    if (_mm_movemask_epi8(m))
+      break;
+    _mm_storel_epi64((__m128i *)(q + i), _mm_packus_epi16(v, v));
+  }
+#endif
+  for (; i < n && p[i] < 0x80 && plain_ascii(p[i], esc); ++i)
+    q[i] = (unsigned char)p[i];
+  return i;
+}
+
+// write \uXXXX for the UTF-16 code u at q.
+inline
+char *
+put_json_u16(char * q, char32_t u)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  q[0] = '\\';
+  q[1] = 'u';
+  q[2] = hex[(u >> 12) & 15];
+  q[3] = hex[(u >> 8) & 15];
+  q[4] = hex[(u >> 4) & 15];
+  q[5] = hex[u & 15];
+  return q + 6;
+}
+
+// write the escape of the ASCII code c for esc to q, which has room for
+// at least 6 bytes, return the end of it.
+inline
+char *
+put_ascii_escape(char * q, char32_t c, alf::unicodestreams::escape_type esc)
+{
+  const char * e = 0;
+
+  if (esc == alf::unicodestreams::escape_type::XML) {
+    switch (c) {
+    case '&': e = "&amp;"; break;
+    case '<': e = "&lt;"; break;
+    case '>': e = "&gt;"; break;
+    case '"': e = "&quot;"; break;
+    case '\'': e = "&apos;"; break;
+    case '\r': e = "&#13;"; break;
+    case '\t': case '\n': *q = char(c); return q + 1;
+    default: e = "\xef\xbf\xbd"; break;
+    }
+  } else {
+    switch (c) {
+    case '"': e = "\\\""; break;
+    case '\\': e = "\\\\"; break;
+    case '\b': e = "\\b"; break;
+    case '\f': e = "\\f"; break;
+    case '\n': e = "\\n"; break;
+    case '\r': e = "\\r"; break;
+    case '\t': e = "\\t"; break;
+    default: return put_json_u16(q, c);
+    }
+  }
+  while (*e)
+    *q++ = *e++;
+  return q;
+}
+
+// Encodes as utf8_encoder does, escaping as esc has it.
+struct escape_encoder {
+
+  enum { MAXLEN = 12 }; // a surrogate pair as two \uXXXX.
+
+  alf::unicodestreams::escape_type esc;
+
+  explicit escape_encoder(alf::unicodestreams::escape_type e)
+    : esc(e)
+  { }
+
+  template <class C>
+  status_type operator () (const C *& s, const C * se,
+			   char *& d, char * de) const
+  {
+    const C * p = s;
+    char * q = d;
+    status_type st = status_type::OK;
+
+    while (p < se && q < de) {
+      char32_t w = *p;
+      if (w < 0x80) {
+	std::size_t m = se - p;
+	if (std::size_t(de - q) < m)
+	  m = de - q;
+	m = plain_ascii_run(p, m, (unsigned char *)q, esc);
+	p += m;
+	q += m;
+	if (m > 0)
+	  continue;
+	if (de - q < 6)
+	  break;
+	q = put_ascii_escape(q, w, esc);
+	++p;
+	continue;
+      }
+      if (esc != alf::unicodestreams::escape_type::JSON_ASCII) {
+	// up to the next ASCII code as it is.
+	const C * r = p;
+	while (r < se && *r >= 0x80)
+	  ++r;
+	const C * b = p;
+	st = utf8_encoder()(p, r, q, de);
+	if (st != status_type::OK || p == b)
+	  break;
+	continue;
+      }
+      int k = 1;
+      if (sizeof(C) == 2 && w >= 0xd800 && w < 0xe000) {
+	if (w >= 0xdc00) {
+	  st = status_type::NO_LEAD;
+	  break;
+	}
+	if (se - p < 2)
+	  break;
+	char32_t v = p[1];
+	if (v < 0xdc00 || v >= 0xe000) {
+	  st = status_type::NO_FOLLOW;
+	  break;
+	}
+	w = (((w & 0x3ff) << 10) | (v & 0x3ff)) + 0x10000;
+	k = 2;
+      }
+      if (! is_valid_utf32(w)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      if (de - q < (w < 0x10000 ? 6 : 12))
+	break;
+      if (w < 0x10000)
+	q = put_json_u16(q, w);
+      else {
+	q = put_json_u16(q, 0xd800 | ((w - 0x10000) >> 10));
+	q = put_json_u16(q, 0xdc00 | (w & 0x3ff));
+      }
+      p += k;
+    }
+    s = p;
+    d = q;
+    return st;
+  }
+
+  template <class C>
+  static int need(const C * s, const C * se)
+  { return utf8_encoder::need(s, se); }
+
+}; // end of struct escape_encoder
+
+// An encoder that writes LF as CR LF, both through N so they are escaped
+// the way N escapes them.
+template <class N>
+struct crlf_encoder {
+
+  enum { MAXLEN = 2 * N::MAXLEN };
+
+  explicit crlf_encoder(N n)
+    : enc(n)
+  { }
+
+  template <class C>
+  status_type operator () (const C *& s, const C * se,
+			   char *& d, char * de) const
+  {
+    static const C crlf[2] = { '\r', '\n' };
+
+    while (s < se) {
+      const C * r = std::char_traits<C>::find(s, se - s, C('\n'));
+      if (r == 0)
+	r = se;
+      status_type st = enc(s, r, d, de);
+      if (st != status_type::OK || s < r || r == se)
+	return st;
+      char tmp[MAXLEN];
+      char * t = tmp;
+      const C * c = crlf;
+      enc(c, crlf + 2, t, tmp + MAXLEN);
+      if (de - d < t - tmp)
+	break;
+      std::memcpy(d, tmp, t - tmp);
+      d += t - tmp;
+      ++s;
+    }
+    return status_type::OK;
+  }
+
+  template <class C>
+  int need(const C * s, const C * se) const
+  { return enc.need(s, se); }
+
+  N enc;
+
+}; // end of struct crlf_encoder
+
+// Store the 3 bytes of the BMP code or surrogate u at q.
+inline
+void
+put_utf8_3(unsigned char * q, char32_t u)
+{
+  q[0] = 0xe0 | (u >> 12);
+  q[1] = 0x80 | ((u >> 6) & 0x3f);
+  q[2] = 0x80 | (u & 0x3f);
+}
+
+// Encodes to the other forms of UTF-8, see utf8_form, ASCII through
+// narrow_ascii() as in utf8_encoder. A surrogate pair from char16_t, or
+// in WTF-8 from char32_t too, is one code point, any other surrogate is
+// an error but in WTF-8. A high surrogate at se waits (need() tells).
+struct form_encoder {
+
+  enum { MAXLEN = 6 };
+
+  explicit form_encoder(alf::unicodestreams::utf8_form f)
+    : form(f)
+  { }
+
+  template <class C>
+  status_type operator () (const C *& s, const C * se,
+			   char *& d, char * de) const
+  {
+    using alf::unicodestreams::utf8_form;
+    const C * p = s;
+    unsigned char * q = (unsigned char *)d;
+    unsigned char * qe = (unsigned char *)de;
+    status_type st = status_type::OK;
+    char32_t w, v;
+    int k, n;
+
+    while (p < se && q < qe) {
+      w = *p;
+      if (w < 0x80 && (w != 0 || form != utf8_form::MODIFIED)) {
+	std::size_t m = se - p;
+	if (std::size_t(qe - q) < m)
+	  m = qe - q;
+	m = narrow_ascii(p, m, q);
+	if (form == utf8_form::MODIFIED)
+	  if (const void * z = std::memchr(q, 0, m))
+	    m = (const unsigned char *)z - q;
+	p += m;
+	q += m;
+	continue;
+      }
+      k = 1;
+      if (w >= 0xd800 && w < 0xe000) {
+	if ((sizeof(C) == 2 || form == utf8_form::WTF8) && w < 0xdc00) {
+	  if (se - p < 2)
+	    break;
+	  v = p[1];
+	  if (v >= 0xdc00 && v < 0xe000) {
+	    w = (((w & 0x3ff) << 10) | (v & 0x3ff)) + 0x10000;
+	    k = 2;
+	  }
+	}
+	if (k == 1 && form != utf8_form::WTF8) {
+	  st = sizeof(C) == 4 ? status_type::NOT_UNICODE
+	    : w < 0xdc00 ? status_type::NO_FOLLOW : status_type::NO_LEAD;
+	  break;
+	}
+      }
+      if (k == 2 || w < 0xd800 || w >= 0xe000)
+	if (! is_valid_utf32(w)) {
+	  st = status_type::NOT_UNICODE;
+	  break;
+	}
+      n = w < 0x800 ? 2 : w < 0x10000 ? 3 : form == utf8_form::WTF8 ? 4 : 6;
+      if (qe - q < n)
+	break;
+      switch (n) {
+      case 2:
+	q[0] = 0xc0 | (w >> 6);
+	q[1] = 0x80 | (w & 0x3f);
+	break;
+      case 3:
+	put_utf8_3(q, w);
+	break;
+      case 4:
+	q[0] = 0xf0 | (w >> 18);
+	q[1] = 0x80 | ((w >> 12) & 0x3f);
+	q[2] = 0x80 | ((w >> 6) & 0x3f);
+	q[3] = 0x80 | (w & 0x3f);
+	break;
+      case 6:
+	w -= 0x10000;
+	put_utf8_3(q, 0xd800 | (w >> 10));
+	put_utf8_3(q + 3, 0xdc00 | (w & 0x3ff));
+	break;
+      }
+      q += n;
+      p += k;
+    }
+    s = p;
+    d = (char *)q;
+    return st;
+  }
+
+  template <class C>
+  int need(const C * s, const C * se) const
+  {
+    return (sizeof(C) == 2 || form == alf::unicodestreams::utf8_form::WTF8)
+      && *s >= 0xd800 && *s < 0xdc00 && se - s == 1;
+  }
+
+  alf::unicodestreams::utf8_form form;
+
+}; // end of struct form_encoder
+
+// put_utf8 for one code point, escaped as esc has it.
+std::ostream::int_type
+put_escaped(std::ostream * os, char32_t c,
+	    alf::unicodestreams::escape_type esc)
+{
+  typedef std::ostream::int_type int_type;
+
+  if (esc == alf::unicodestreams::escape_type::NONE)
+    return put_utf8(os, c);
+  if (os == 0)
+    return -(int_type)status_type::NO_STREAM;
+  if (! *os)
+    return -(int_type)status_type::BAD_STREAM;
+
+  char buf[escape_encoder::MAXLEN];
+  const char32_t * s = & c;
+  char * d = buf;
+  status_type st = escape_encoder(esc)(s, s + 1, d, buf + sizeof(buf));
+  if (st != status_type::OK)
+    return -(int_type)st;
+  if (! os->write(buf, d - buf))
+    return -(int_type)status_type::BAD_STREAM;
+  return c;
+}
+
+// put_escaped(), or one code point or lone surrogate in the form f when
+// not escaping.
+std::ostream::int_type
+put_encoded(std::ostream * os, char32_t c,
+	    alf::unicodestreams::escape_type esc,
+	    alf::unicodestreams::utf8_form f)
+{
+  typedef std::ostream::int_type int_type;
+
+  if (esc != alf::unicodestreams::escape_type::NONE
+      || f == alf::unicodestreams::utf8_form::STANDARD)
+    return put_escaped(os, c, esc);
+  if (os == 0)
+    return -(int_type)status_type::NO_STREAM;
+  if (! *os)
+    return -(int_type)status_type::BAD_STREAM;
+
+  char buf[form_encoder::MAXLEN];
+  const char32_t * s = & c;
+  char * d = buf;
+  if (f == alf::unicodestreams::utf8_form::WTF8
+      && c >= 0xd800 && c < 0xe000) {
+    // on its own, the encoder would wait for a low one after a high one.
+    put_utf8_3((unsigned char *)buf, c);
+    d += 3;
+  } else {
+    status_type st = form_encoder(f)(s, s + 1, d, buf + sizeof(buf));
+    if (st != status_type::OK)
+      return -(int_type)st;
+  }
+  if (! os->write(buf, d - buf))
+    return -(int_type)status_type::BAD_STREAM;
+  return c;
+}
+
+////////////////////////////////
+// codecvt helpers
+
+// wchar_t is handled as the char type of the same size.
+typedef std::conditional<sizeof(wchar_t) == 4,
+			 char32_t, char16_t>::type wchar_unit;
+
+// What the facets keep in the mbstate_t between calls: the n bytes
+// of an incomplete UTF-8 sequence in b, and in u either the low
+// surrogate in() had no room for or the high surrogate out() got alone.
+// An all zero mbstate_t is the initial state.
+struct cvt_state {
+  unsigned char n;
+  unsigned char b[3];
+  char16_t u;
+};
+
+static_assert(sizeof(cvt_state) <= sizeof(std::mbstate_t),
+	      "cvt_state must fit in a mbstate_t");
+
+inline
+cvt_state
+load_state(const std::mbstate_t & state)
+{
+  cvt_state cs;
+  std::memcpy(& cs, & state, sizeof(cs));
+  return cs;
+}
+
+inline
+void
+save_state(std::mbstate_t & state, const cvt_state & cs)
+{
+  std::memcpy(& state, & cs, sizeof(cs));
+}
+
+template <class C>
+std::codecvt_base::result
+utf8_in(std::mbstate_t & state,
+	const char * from, const char * from_end, const char *& from_next,
+	C * to, C * to_end, C *& to_next)
+{
+  typedef std::codecvt_base cvt;
+
+  cvt_state cs = load_state(state);
+  const char * s = from;
+  C * d = to;
+  cvt::result r = cvt::ok;
+  C tmp[2];
+  C * t;
+
+  if (cs.u) {
+    if (d == to_end) {
+      from_next = s;
+      to_next = d;
+      return cvt::partial;
+    }
+    *d++ = C(cs.u);
+    cs.u = 0;
+  }
+  if (cs.n && d < to_end) {
+    // complete the sequence from last time.
+    char seq[4];
+    int k = utf8_seq_len(cs.b[0]);
+    int m = cs.n;
+    std::memcpy(seq, cs.b, m);
+    while (m < k && s < from_end)
+      seq[m++] = *s++;
+    if (m < k) {
+      std::memcpy(cs.b, seq, m);
+      cs.n = m;
+      save_state(state, cs);
+      from_next = s;
+      to_next = d;
+      return cvt::partial;
+    }
+    const char * p = seq;
+    t = tmp;
+    if (utf8_decoder()(p, seq + k, t, tmp + 2) != status_type::OK
+	|| p != seq + k) {
+      from_next = from;
+      to_next = d;
+      return cvt::error;
+    }
+    *d++ = tmp[0];
+    if (t - tmp == 2) {
+      if (d < to_end)
+	*d++ = tmp[1];
+      else
+	cs.u = tmp[1];
+    }
+    cs.n = 0;
+  }
+  if (cs.n == 0 && cs.u == 0 && d < to_end) {
+    if (utf8_decoder()(s, from_end, d, to_end) != status_type::OK)
+      r = cvt::error;
+    else if (s < from_end && d < to_end
+	     && utf8_decoder::need(s, from_end) > 0) {
+      // an incomplete sequence at the end, keep it.
+      cs.n = from_end - s;
+      std::memcpy(cs.b, s, cs.n);
+      s = from_end;
+      r = cvt::partial;
+    } else if (s < from_end && d < to_end) {
+      // a surrogate pair and room for only one half.
+      t = tmp;
+      const char * p = s;
+      if (utf8_decoder()(p, from_end, t, tmp + 2) != status_type::OK)
+	r = cvt::error;
+      else {
+	s = p;
+	*d++ = tmp[0];
+	cs.u = tmp[1];
+      }
+    }
+  }
+  if (r == cvt::ok && s < from_end)
+    r = cvt::partial;
+  save_state(state, cs);
+  from_next = s;
+  to_next = d;
+  return r;
+}
+
+template <class C>
+std::codecvt_base::result
+utf8_out(std::mbstate_t & state,
+	 const C * from, const C * from_end, const C *& from_next,
+	 char * to, char * to_end, char *& to_next)
+{
+  typedef std::codecvt_base cvt;
+
+  cvt_state cs = load_state(state);
+  const C * s = from;
+  char * d = to;
+  cvt::result r = cvt::ok;
+
+  if (cs.u) {
+    // the high surrogate from last time.
+    if (s == from_end) {
+      from_next = s;
+      to_next = d;
+      return cvt::partial;
+    }
+    C pair[2] = { C(cs.u), *s };
+    const C * p = pair;
+    if (utf8_encoder()(p, pair + 2, d, to_end) != status_type::OK) {
+      from_next = s;
+      to_next = d;
+      return cvt::error;
+    }
+    if (p == pair) {
+      from_next = s;
+      to_next = d;
+      return cvt::partial;
+    }
+    ++s;
+    cs.u = 0;
+  }
+  if (utf8_encoder()(s, from_end, d, to_end) != status_type::OK)
+    r = cvt::error;
+  else if (s < from_end && utf8_encoder::need(s, from_end) > 0)
+    cs.u = char16_t(*s++);
+  else if (s < from_end)
+    r = cvt::partial;
+  save_state(state, cs);
+  from_next = s;
+  to_next = d;
+  return r;
+}
+
+template <class C>
+int
+utf8_in_length(std::mbstate_t & state,
+	       const char * from, const char * end, std::size_t max)
+{
+  C tmp[256];
+  const char * p = from;
+
+  while (max > 0) {
+    C * d;
+    std::size_t n = max < 256 ? max : 256;
+    // a surrogate pair must fit in max as a whole, as for
+    // std::codecvt_utf8_utf16. One cut before the last unit is completed
+    // next time round, the last unit alone is checked below.
+    if (sizeof(C) == 2 && n == max && n > 1)
+      --n;
+    std::mbstate_t before = state;
+    const char * q = p;
+    std::codecvt_base::result r = utf8_in(state, q, end, q, tmp, tmp + n, d);
+    if (sizeof(C) == 2 && max == 1 && load_state(state).u != 0
+	&& load_state(before).u == 0) {
+      state = before;
+      break;
+    }
+    p = q;
+    max -= d - tmp;
+    if (r == std::codecvt_base::error || d == tmp || p == end)
+      break;
+  }
+  return int(p - from);
+}
+
+template <class C>
+std::codecvt_base::result
+latin1_in(const char * from, const char * from_end, const char *& from_next,
+	  C * to, C * to_end, C *& to_next)
+{
+  std::size_t n = from_end - from;
+  if (std::size_t(to_end - to) < n)
+    n = to_end - to;
+  widen_latin1((const unsigned char *)from, n, to);
+  from_next = from + n;
+  to_next = to + n;
+  return from_next < from_end ? std::codecvt_base::partial
+    : std::codecvt_base::ok;
+}
+
+template <class C>
+std::codecvt_base::result
+latin1_out(const C * from, const C * from_end, const C *& from_next,
+	   char * to, char * to_end, char *& to_next)
+{
+  typedef std::codecvt_base cvt;
+
+  const C * p = from;
+  unsigned char * q = (unsigned char *)to;
+  cvt::result r = cvt::ok;
+
+  while (p < from_end) {
+    if (q == (unsigned char *)to_end) {
+      r = cvt::partial;
+      break;
+    }
+    std::size_t m = from_end - p;
+    if (std::size_t((unsigned char *)to_end - q) < m)
+      m = (unsigned char *)to_end - q;
+    m = narrow_ascii(p, m, q);
+    p += m;
+    q += m;
+    if (p < from_end && q < (unsigned char *)to_end) {
+      if (char32_t(*p) > 0xff) {
+	r = cvt::error;
+	break;
+      }
+      *q++ = (unsigned char)*p++;
+    }
+  }
+  from_next = p;
+  to_next = (char *)q;
+  return r;
+}
+
+template <class E>
+inline
+status_type
+src_status(std::basic_istream<E> * is)
+{
+  if (is == 0)
+    return status_type::NO_STREAM;
+  if (! *is)
+    return status_type::BAD_STREAM;
+  return status_type::OK;
+}
+
+// Read up to n codes from is into buf. Block until at least lo codes
+// are read (or end of file), beyond that only take what is already
+// buffered by is. Return number of codes read.
+template <class E>
+std::streamsize
+read_raw(std::basic_istream<E> * is, E * buf,
+	 std::streamsize n, std::streamsize lo)
+{
+  std::basic_streambuf<E> * sb = is->rdbuf();
+
+  if (sb == 0)
+    return 0;
+  std::streamsize a = sb->in_avail();
+  if (a < lo)
+    a = lo;
+  if (a < n)
+    n = a;
+  if (n <= 0)
+    return 0;
+  std::streamsize k = sb->sgetn(buf, n);
+  if (k < n)
+    is->setstate(std::ios_base::eofbit);
+  return k;
+}
+
+// A decoder for units that must be swapped first as the bswap streams
+// do, D decodes the swapped units. mode is 21 for char16_t and one of
+// 2143, 3412 and 4321 for char32_t.
+template <class D, class U>
+struct swapped_decoder {
+
+  enum { MAXLEN = D::MAXLEN, EXPAND = D::EXPAND, CHUNK = 256 };
+
+  swapped_decoder(D d, int m) : dec(d), mode(m) {}
+
+  // a chunk at a time through tmp, a sequence cut at the end of a chunk
+  // that isn't the last is taken again with the next one.
+  template <class C>
+  status_type operator () (const U *& s, const U * se,
+			   C *& d, C * de) const
+  {
+    U tmp[CHUNK];
+
+    while (s < se && d < de) {
+      std::size_t n = se - s < CHUNK ? se - s : std::size_t(CHUNK);
+      swap_units(mode, s, tmp, n);
+      const U * p = tmp;
+      status_type st = dec(p, tmp + n, d, de);
+      s += p - tmp;
+      if (st != status_type::OK || p == tmp || (p < tmp + n && s + n > se))
+	return st;
+    }
+    return status_type::OK;
+  }
+
+  status_type skip(const U *& s, const U * se, std::streamsize & n) const
+  {
+    U tmp[CHUNK];
+
+    while (s < se && n > 0) {
+      std::size_t k = se - s < CHUNK ? se - s : std::size_t(CHUNK);
+      swap_units(mode, s, tmp, k);
+      const U * p = tmp;
+      status_type st = dec.skip(p, tmp + k, n);
+      s += p - tmp;
+      if (st != status_type::OK || p == tmp || (p < tmp + k && s + k > se))
+	return st;
+    }
+    return status_type::OK;
+  }
+
+  int need(const U * s, const U * se) const
+  {
+    U c;
+    swap_units(mode, s, & c, 1);
+    return se - s == 1 ? D::need(& c, & c + 1) : 0;
+  }
+
+  D dec;
+  int mode;
+
+}; // end of struct swapped_decoder
+
+// The first CR of [p, pe), or NEL or LS if nel, pe if there is none.
+inline
+char32_t *
+find_newline(char32_t * p, char32_t * pe, bool nel)
+{
+  char32_t x = nel ? 0x85 : '\r';
+  char32_t y = nel ? 0x2028 : '\r';
+
+#if defined(__SSE2__)
+  const __m128i vcr = _mm_set1_epi32('\r');
+  const __m128i vx = _mm_set1_epi32(int(x));
+  const __m128i vy = _mm_set1_epi32(int(y));
+  for (; pe - p >= 4; p += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi32(v, vcr),
+			     _mm_or_si128(_mm_cmpeq_epi32(v, vx),
+					  _mm_cmpeq_epi32(v, vy)));
+    if (int b = _mm_movemask_epi8(m))
+      return p + (__builtin_ctz(b) >> 2);
+  }
+#endif
+  for (; p < pe; ++p)
+    if (*p == '\r' || *p == x || *p == y)
+      return p;
+  return pe;
+}
+
+// Make CR LF, a lone CR and if nel NEL and LS each a single LF in
+// [p, pe), moving what follows down. cr tells whether the char before p
+// was a CR and is set for the next block. Return the new end.
+inline
+char32_t *
+fold_newlines(char32_t * p, char32_t * pe, bool & cr, bool nel)
+{
+  char32_t * q = p;
+
+  if (cr && p < pe) {
+    if (*p == '\n')
+      ++p;
+    cr = false;
+  }
+  while (p < pe) {
+    char32_t * r = find_newline(p, pe, nel);
+    if (q != p)
+      std::char_traits<char32_t>::move(q, p, r - p);
+    q += r - p;
+    if (r == pe)
+      break;
+    char32_t c = *r;
+    *q++ = '\n';
+    p = r + 1;
+    if (c == '\r') {
+      if (p == pe)
+	cr = true;
+      else if (*p == '\n')
+	++p;
+    }
+  }
+  return q;
+}
+
+// A decoder that makes line ends LF in what D decodes, see newline_type.
+// *cr carries a CR at the end of one block over to the next.
+template <class D>
+struct newline_decoder {
+
+  enum { MAXLEN = D::MAXLEN, EXPAND = D::EXPAND, CHUNK = 256 };
+
+  newline_decoder(D d, bool * c, unsigned int nl)
+    : dec(d), cr(c), nel(nl & alf::unicodestreams::NEWLINE_NEL)
+  { }
+
+  template <class E>
+  status_type operator () (const E *& s, const E * se,
+			   char32_t *& d, char32_t * de) const
+  {
+    // folding frees room, so go on until either end is reached.
+    for (;;) {
+      char32_t * b = d;
+      const E * r = s;
+      status_type st = dec(s, se, d, de);
+      d = fold_newlines(b, d, *cr, nel);
+      if (st != status_type::OK || s == se || d == de || s == r)
+	return st;
+    }
+  }
+
+  // a chunk at a time through tmp, counting what is left of it.
+  template <class E>
+  status_type skip(const E *& s, const E * se, std::streamsize & n) const
+  {
+    char32_t tmp[CHUNK];
+
+    while (s < se && n > 0) {
+      char32_t * t = tmp;
+      const E * b = s;
+      std::streamsize m = n < CHUNK ? n : std::streamsize(CHUNK);
+      status_type st = (*this)(s, se, t, tmp + m);
+      n -= t - tmp;
+      if (st != status_type::OK || s == b)
+	return st;
+    }
+    return status_type::OK;
+  }
+
+  template <class E>
+  int need(const E * s, const E * se) const
+  { return dec.need(s, se); }
+
+  D dec;
+  bool * cr;
+  bool nel;
+
+}; // end of struct newline_decoder
+
+// Read through a stack of our streams, see fusion. These give -1 when
+// it can't be done now or is is not one of ours.
+template <class E, class C, class D>
+inline std::streamsize
+fused_decode(std::basic_istream<E> *, C *, std::streamsize, std::streamsize,
+	     status_type &, D, C *)
+{
+  return -1;
+}
+
+template <class C>
+std::streamsize
+fused_decode(std::basic_istream<char16_t> * is, C * d, std::streamsize n,
+	     std::streamsize min, status_type & st, u16_decoder dec, C * pend);
+
+template <class C>
+std::streamsize
+fused_decode(std::basic_istream<char32_t> * is, C * d, std::streamsize n,
+	     std::streamsize min, status_type & st, u32_decoder dec, C * pend);
+
+template <class E, class D>
+inline std::streamsize
+fused_skip(std::basic_istream<E> *, std::streamsize, status_type &, D)
+{
+  return -1;
+}
+
+std::streamsize
+fused_skip(std::basic_istream<char16_t> * is, std::streamsize n,
+	   status_type & st, u16_decoder dec);
+
+std::streamsize
+fused_skip(std::basic_istream<char32_t> * is, std::streamsize n,
+	   status_type & st, u32_decoder dec);
+
+// decode_from() for a memory_source, decode directly from its memory.
+template <class E, class C, class D>
+std::streamsize
+decode_memory(std::basic_istream<E> * is,
+	      alf::unicodestreams::memory_source<E> * ms,
+	      C * d, std::streamsize n, std::streamsize min,
+	      status_type & st, D dec, C * pend)
+{
+  std::basic_string_view<E> v = ms->view();
+  const E * p = v.data();
+  const E * pe = p + v.size();
+  C * q = d;
+  C * qe = d + n;
+
+  if (pend)
+    *pend = 0;
+  st = dec(p, pe, q, qe);
+  if (st == status_type::OK && p < pe && q < qe) {
+    if (dec.need(p, pe) > 0) {
+      // an incomplete sequence at the very end.
+      st = status_type::BAD_STREAM;
+      p = pe;
+    } else if (pend && q + 1 == qe) {
+      // a surrogate pair and room for only one half.
+      C tmp[2];
+      C * t = tmp;
+      if ((st = dec(p, pe, t, tmp + 2)) == status_type::OK) {
+	*q++ = tmp[0];
+	*pend = tmp[1];
+      }
+    }
+  }
+  // as decode_from() we take the code where an error is found.
+  if (st != status_type::OK && p < pe)
+    ++p;
+  ms->consume(p - v.data());
+  if (st == status_type::OK && q - d < min) {
+    st = status_type::EOF_STREAM;
+    is->setstate(std::ios_base::eofbit);
+  }
+  return q - d;
+}
+
+// Access to the get area of any streambuf, decode_from() and skip_from()
+// decode straight from it and only take what they have decoded.
+template <class E>
+struct get_area : std::basic_streambuf<E> {
+
+  typedef std::basic_streambuf<E> base;
+
+  static E * begin(base * sb) { return (sb->*& get_area::gptr)(); }
+  static E * end(base * sb) { return (sb->*& get_area::egptr)(); }
+  static void take(base * sb, std::streamsize n)
+  { (sb->*& get_area::gbump)(int(n)); }
+
+}; // end of struct get_area
+
+// Have something in the get area of sb, or at least know that there is
+// something when sb has no get area. Unless must is set we don't block
+// for it. Return 1 if there is, 0 if we would block and -1 at end of
+// file.
+template <class E>
+int
+get_more(std::basic_streambuf<E> * sb, bool must)
+{
+  typedef std::char_traits<E> traits;
+
+  if (get_area<E>::begin(sb) < get_area<E>::end(sb))
+    return 1;
+  if (! must && sb->in_avail() <= 0)
+    return 0;
+  return traits::eq_int_type(sb->sgetc(), traits::eof()) ? -1 : 1;
+}
+
+// [p, pe) is a sequence cut at the end of the get area of is, or empty
+// when is has no get area. Take it into raw and then one code at a time
+// until dec needs no more. Return the number of codes in raw, the last
+// one is still in is for the caller to take if it is good (so a code
+// that shows the sequence is bad isn't lost), or 0 at end of file.
+template <class E, class D>
+int
+get_cut(std::basic_istream<E> * is, const E * p, const E * pe,
+	E * raw, const D & dec)
+{
+  typedef std::char_traits<E> traits;
+  std::basic_streambuf<E> * sb = is->rdbuf();
+  int k = int(pe - p);
+
+  traits::copy(raw, p, k);
+  get_area<E>::take(sb, k);
+  for (;;) {
+    typename traits::int_type c = sb->sgetc();
+    if (traits::eq_int_type(c, traits::eof())) {
+      is->setstate(std::ios_base::eofbit);
+      return 0;
+    }
+    raw[k++] = traits::to_char_type(c);
+    if (dec.need(raw, raw + k) <= 0)
+      return k;
+    sb->sbumpc();
+  }
+}
+
+// Decode from is into [d, d + n) using the decoder D. We decode straight
+// from the get area of is and only take what we decode, so nothing is
+// lost when we stop and on an error only the code where it is found is
+// taken, reading on after clearing the error goes on after it. At least
+// min chars are produced unless we hit end of file or an error, beyond
+// that we only decode what is already buffered by is, and once we have
+// min we stop where there isn't room for D::EXPAND chars (what one code
+// may give, a decoder that can't cut that like a surrogate pair wants at
+// least EXPAND - 1 of room beyond min). If a surrogate pair doesn't fit
+// at the very end its second half is stored in *pend (else *pend is set
+// to 0).
+template <class E, class C, class D>
+std::streamsize
+decode_from(std::basic_istream<E> * is, C * d, std::streamsize n,
+	    std::streamsize min, status_type & st, D dec, C * pend = 0)
+{
+  constexpr int TMPSZ = D::MAXLEN * D::EXPAND + 1;
+  std::basic_streambuf<E> * sb = is->rdbuf();
+  E raw[D::MAXLEN];
+  C tmp[TMPSZ];
+  C * q = d;
+  C * qe = d + n;
+
+  if (alf::unicodestreams::memory_source<E> * ms
+      = dynamic_cast<alf::unicodestreams::memory_source<E> *>(sb))
+    return decode_memory(is, ms, d, n, min, st, dec, pend);
+  std::streamsize f = fused_decode(is, d, n, min, st, dec, pend);
+  if (f >= 0)
+    return f;
+  st = status_type::OK;
+  if (pend)
+    *pend = 0;
+  if (sb == 0) {
+    if (min > 0)
+      st = status_type::EOF_STREAM;
+    return 0;
+  }
+  while (q < qe) {
+    int a = get_more(sb, q - d < min);
+    if (a <= 0) {
+      if (a < 0)
+	is->setstate(std::ios_base::eofbit);
+      if (q - d < min)
+	st = status_type::EOF_STREAM;
+      break;
+    }
+    const E * s = get_area<E>::begin(sb);
+    const E * p = s;
+    const E * pe = get_area<E>::end(sb);
+    st = dec(p, pe, q, qe);
+    get_area<E>::take(sb, p - s);
+    if (st != status_type::OK) {
+      sb->sbumpc();
+      break;
+    }
+    if (p == pe && p > s)
+      continue;
+    if (p < pe && dec.need(p, pe) <= 0) {
+      if (pend == 0 || q + 1 != qe)
+	break;
+      // a surrogate pair and room for only one half.
+      C * t = tmp;
+      s = p;
+      st = dec(p, pe, t, tmp + 2);
+      get_area<E>::take(sb, p - s);
+      if (st != status_type::OK) {
+	sb->sbumpc();
+	break;
+      }
+      *q++ = tmp[0];
+      *pend = tmp[1];
+      break;
+    }
+    // a sequence cut at the end of what is buffered, or no buffer.
+    if ((p < pe && q - d >= min)
+	|| qe - q < D::EXPAND + (sizeof(C) == 2 && pend == 0))
+      break;
+    int k = get_cut(is, p, pe, raw, dec);
+    if (k == 0) {
+      st = status_type::BAD_STREAM;
+      break;
+    }
+    const E * r = raw;
+    C * t = tmp;
+    st = dec(r, raw + k, t, tmp + TMPSZ);
+    if (r == raw + k)
+      sb->sbumpc();
+    if (st != status_type::OK)
+      break;
+    for (C * u = tmp; u < t; ++u) {
+      if (q < qe)
+	*q++ = *u;
+      else
+	*pend = *u;
+    }
+  }
+  return q - d;
+}
+
+// skip_from() for a memory_source.
+template <class E, class D>
+std::streamsize
+skip_memory(std::basic_istream<E> * is,
+	    alf::unicodestreams::memory_source<E> * ms,
+	    std::streamsize n, status_type & st, D dec)
+{
+  std::basic_string_view<E> v = ms->view();
+  const E * p = v.data();
+  const E * pe = p + v.size();
+  std::streamsize left = n;
+
+  st = dec.skip(p, pe, left);
+  if (st == status_type::OK && left > 0) {
+    if (p < pe) {
+      // an incomplete sequence at the very end.
+      st = status_type::BAD_STREAM;
+      p = pe;
+    } else {
+      st = status_type::EOF_STREAM;
+      is->setstate(std::ios_base::eofbit);
+    }
+  }
+  if (st != status_type::OK && p < pe)
+    ++p;
+  ms->consume(p - v.data());
+  return n - left;
+}
+
+// Skip n code points from is using the decoder D, they are validated
+// but not stored anywhere. As decode_from() we only take what we skip.
+// Return the number of code points skipped.
+template <class E, class D>
+std::streamsize
+skip_from(std::basic_istream<E> * is, std::streamsize n,
+	  status_type & st, D dec)
+{
+  std::basic_streambuf<E> * sb = is->rdbuf();
+  E raw[D::MAXLEN];
+  std::streamsize left = n;
+
+  if (alf::unicodestreams::memory_source<E> * ms
+      = dynamic_cast<alf::unicodestreams::memory_source<E> *>(sb))
+    return skip_memory(is, ms, n, st, dec);
+  std::streamsize f = fused_skip(is, n, st, dec);
+  if (f >= 0)
+    return f;
+  st = status_type::OK;
+  if (sb == 0) {
+    if (n > 0)
+      st = status_type::EOF_STREAM;
+    return 0;
+  }
+  while (left > 0) {
+    if (get_more(sb, true) < 0) {
+      is->setstate(std::ios_base::eofbit);
+      st = status_type::EOF_STREAM;
+      break;
+    }
+    const E * s = get_area<E>::begin(sb);
+    const E * p = s;
+    const E * pe = get_area<E>::end(sb);
+    st = dec.skip(p, pe, left);
+    get_area<E>::take(sb, p - s);
+    if (st != status_type::OK) {
+      sb->sbumpc();
+      break;
+    }
+    if (left == 0 || (p == pe && p > s))
+      continue;
+    // a sequence cut at the end of what is buffered, or no buffer.
+    int k = get_cut(is, p, pe, raw, dec);
+    if (k == 0) {
+      st = status_type::BAD_STREAM;
+      break;
+    }
+    const E * r = raw;
+    st = dec.skip(r, raw + k, left);
+    if (r == raw + k)
+      sb->sbumpc();
+    if (st != status_type::OK)
+      break;
+  }
+  return n - left;
+}
+
+// After reading from the source of b instead of through b: errors are
+// those b would have found, they become its status and is sees end of
+// input as it would have.
+template <class B, class E>
+std::streamsize
+fused_status(std::basic_istream<E> * is, B * b, std::streamsize k,
+	     std::streamsize min, status_type & st)
+{
+  if (st != status_type::OK && st != status_type::EOF_STREAM) {
+    alf::unicodestreams::fusion::set_status(b, st);
+    st = k < min ? status_type::EOF_STREAM : status_type::OK;
+  }
+  if (st == status_type::EOF_STREAM)
+    is->setstate(std::ios_base::eofbit);
+  return k;
+}
+
+// Only a failing source is an error of a bswap stream, the rest are
+// errors in the UTF-16 or UTF-32 which are ours.
+template <class B, class E>
+std::streamsize
+fused_swap_status(std::basic_istream<E> * is, B * b,
+		  std::basic_istream<E> * src, std::streamsize k,
+		  std::streamsize min, status_type & st)
+{
+  if (st == status_type::BAD_STREAM && src && src->bad()) {
+    alf::unicodestreams::fusion::set_status(b, st);
+    st = k < min ? status_type::EOF_STREAM : status_type::OK;
+  }
+  if (st == status_type::EOF_STREAM)
+    is->setstate(std::ios_base::eofbit);
+  return k;
+}
+
+// Through a basic_bswap_streambuf<E, M>, which swaps as M always does,
+// N is the mode that doesn't swap.
+template <class E, int M, int N, class C, class D>
+std::streamsize
+fused_basic_bswap(std::basic_istream<E> * is, C * d, std::streamsize n,
+		  std::streamsize min, status_type & st, D dec, C * pend)
+{
+  typedef alf::unicodestreams::basic_bswap_streambuf<E, M> B;
+  B * b = dynamic_cast<B *>(is->rdbuf());
+  std::basic_istream<E> * src = b ? alf::unicodestreams::fusion::source(b) : 0;
+  std::streamsize k;
+
+  if (src == 0)
+    return -1;
+  if (M == N)
+    k = decode_from(src, d, n, min, st, dec, pend);
+  else
+    k = decode_from(src, d, n, min, st, swapped_decoder<D, E>(dec, M), pend);
+  return fused_swap_status(is, b, src, k, min, st);
+}
+
+template <class E, int M, int N, class D>
+std::streamsize
+fused_basic_bswap_skip(std::basic_istream<E> * is, std::streamsize n,
+		       status_type & st, D dec)
+{
+  typedef alf::unicodestreams::basic_bswap_streambuf<E, M> B;
+  B * b = dynamic_cast<B *>(is->rdbuf());
+  std::basic_istream<E> * src = b ? alf::unicodestreams::fusion::source(b) : 0;
+  std::streamsize k;
+
+  if (src == 0)
+    return -1;
+  if (M == N)
+    k = skip_from(src, n, st, dec);
+  else
+    k = skip_from(src, n, st, swapped_decoder<D, E>(dec, M));
+  return fused_swap_status(is, b, src, k, n, st);
+}
+
+template <class C>
+std::streamsize
+fused_decode(std::basic_istream<char16_t> * is, C * d, std::streamsize n,
+	     std::streamsize min, status_type & st, u16_decoder dec, C * pend)
+{
+  typedef alf::unicodestreams::fusion fusion;
+  std::basic_streambuf<char16_t> * sb = is->rdbuf();
+
+  if (alf::unicodestreams::u16utf8streambuf * u
+      = dynamic_cast<alf::unicodestreams::u16utf8streambuf *>(sb)) {
+    std::istream * src = fusion::source(u);
+    if (src == 0)
+      return -1;
+    std::streamsize k = decode_from(src, d, n, min, st, utf8_decoder(), pend);
+    return fused_status(is, u, k, min, st);
+  }
+  if (alf::unicodestreams::u16bswap_streambuf * b
+      = dynamic_cast<alf::unicodestreams::u16bswap_streambuf *>(sb)) {
+    std::basic_istream<char16_t> * src = fusion::source(b);
+    int m = src ? fusion::swap_mode(b) : 0;
+    std::streamsize k;
+    if (m == 12)
+      k = decode_from(src, d, n, min, st, dec, pend);
+    else if (m == 21)
+      k = decode_from(src, d, n, min, st,
+		      swapped_decoder<u16_decoder, char16_t>(dec, m), pend);
+    else
+      return -1;
+    return fused_swap_status(is, b, src, k, min, st);
+  }
+  std::streamsize k = fused_basic_bswap<char16_t, 12, 12>(is, d, n, min, st,
+							  dec, pend);
+  if (k < 0)
+    k = fused_basic_bswap<char16_t, 21, 12>(is, d, n, min, st, dec, pend);
+  return k;
+}
+
+template <class C>
+std::streamsize
+fused_decode(std::basic_istream<char32_t> * is, C * d, std::streamsize n,
+	     std::streamsize min, status_type & st, u32_decoder dec, C * pend)
+{
+  typedef alf::unicodestreams::fusion fusion;
+  std::basic_streambuf<char32_t> * sb = is->rdbuf();
+
+  if (alf::unicodestreams::u32utf8streambuf * u
+      = dynamic_cast<alf::unicodestreams::u32utf8streambuf *>(sb)) {
+    std::istream * src = fusion::source(u);
+    if (src == 0)
+      return -1;
+    std::streamsize k = decode_from(src, d, n, min, st, utf8_decoder(), pend);
+    return fused_status(is, u, k, min, st);
+  }
+  if (alf::unicodestreams::u32bswap_streambuf * b
+      = dynamic_cast<alf::unicodestreams::u32bswap_streambuf *>(sb)) {
+    std::basic_istream<char32_t> * src = fusion::source(b);
+    int m = src ? fusion::swap_mode(b) : 0;
+    std::streamsize k;
+    if (m == 1234)
+      k = decode_from(src, d, n, min, st, dec, pend);
+    else if (m != 0)
+      k = decode_from(src, d, n, min, st,
+		      swapped_decoder<u32_decoder, char32_t>(dec, m), pend);
+    else
+      return -1;
+    return fused_swap_status(is, b, src, k, min, st);
+  }
+  std::streamsize k = fused_basic_bswap<char32_t, 1234, 1234>(is, d, n, min,
+							      st, dec, pend);
+  if (k < 0)
+    k = fused_basic_bswap<char32_t, 2143, 1234>(is, d, n, min, st, dec, pend);
+  if (k < 0)
+    k = fused_basic_bswap<char32_t, 3412, 1234>(is, d, n, min, st, dec, pend);
+  if (k < 0)
+    k = fused_basic_bswap<char32_t, 4321, 1234>(is, d, n, min, st, dec, pend);
+  return k;
+}
+
+std::streamsize
+fused_skip(std::basic_istream<char16_t> * is, std::streamsize n,
+	   status_type & st, u16_decoder dec)
+{
+  typedef alf::unicodestreams::fusion fusion;
+  std::basic_streambuf<char16_t> * sb = is->rdbuf();
+
+  if (alf::unicodestreams::u16utf8streambuf * u
+      = dynamic_cast<alf::unicodestreams::u16utf8streambuf *>(sb)) {
+    std::istream * src = fusion::source(u);
+    if (src == 0)
+      return -1;
+    std::streamsize k = skip_from(src, n, st, utf8_decoder());
+    return fused_status(is, u, k, n, st);
+  }
+  if (alf::unicodestreams::u16bswap_streambuf * b
+      = dynamic_cast<alf::unicodestreams::u16bswap_streambuf *>(sb)) {
+    std::basic_istream<char16_t> * src = fusion::source(b);
+    int m = src ? fusion::swap_mode(b) : 0;
+    std::streamsize k;
+    if (m == 12)
+      k = skip_from(src, n, st, dec);
+    else if (m == 21)
+      k = skip_from(src, n, st,
+		    swapped_decoder<u16_decoder, char16_t>(dec, m));
+    else
+      return -1;
+    return fused_swap_status(is, b, src, k, n, st);
+  }
+  std::streamsize k = fused_basic_bswap_skip<char16_t, 12, 12>(is, n, st, dec);
+  if (k < 0)
+    k = fused_basic_bswap_skip<char16_t, 21, 12>(is, n, st, dec);
+  return k;
+}
+
+std::streamsize
+fused_skip(std::basic_istream<char32_t> * is, std::streamsize n,
+	   status_type & st, u32_decoder dec)
+{
+  typedef alf::unicodestreams::fusion fusion;
+  std::basic_streambuf<char32_t> * sb = is->rdbuf();
+
+  if (alf::unicodestreams::u32utf8streambuf * u
+      = dynamic_cast<alf::unicodestreams::u32utf8streambuf *>(sb)) {
+    std::istream * src = fusion::source(u);
+    if (src == 0)
+      return -1;
+    std::streamsize k = skip_from(src, n, st, utf8_decoder());
+    return fused_status(is, u, k, n, st);
+  }
+  if (alf::unicodestreams::u32bswap_streambuf * b
+      = dynamic_cast<alf::unicodestreams::u32bswap_streambuf *>(sb)) {
+    std::basic_istream<char32_t> * src = fusion::source(b);
+    int m = src ? fusion::swap_mode(b) : 0;
+    std::streamsize k;
+    if (m == 1234)
+      k = skip_from(src, n, st, dec);
+    else if (m != 0)
+      k = skip_from(src, n, st,
+		    swapped_decoder<u32_decoder, char32_t>(dec, m));
+    else
+      return -1;
+    return fused_swap_status(is, b, src, k, n, st);
+  }
+  std::streamsize k = fused_basic_bswap_skip<char32_t, 1234, 1234>(is, n, st,
+								   dec);
+  if (k < 0)
+    k = fused_basic_bswap_skip<char32_t, 2143, 1234>(is, n, st, dec);
+  if (k < 0)
+    k = fused_basic_bswap_skip<char32_t, 3412, 1234>(is, n, st, dec);
+  if (k < 0)
+    k = fused_basic_bswap_skip<char32_t, 4321, 1234>(is, n, st, dec);
+  return k;
+}
+
+// Encode [s, s + n) to os using the encoder N, straight into the buffer
+// if os writes to a memory_sink. Stop on error or at a surrogate pair cut
+// at the very end. Return the number of codes taken from s.
+template <class C, class N>
+std::streamsize
+encode_to(std::ostream * os, const C * s, std::streamsize n,
+	  status_type & st, N enc)
+{
+  constexpr std::streamsize CHUNK = 4096;
+  const C * p = s;
+  const C * pe = s + n;
+
+  st = status_type::OK;
+  if (alf::unicodestreams::memory_sink<char> * ms
+      = dynamic_cast<alf::unicodestreams::memory_sink<char> *>(os->rdbuf())) {
+    while (p < pe) {
+      std::streamsize m = pe - p < CHUNK ? pe - p : CHUNK;
+      char * d0 = ms->prepare(m * N::MAXLEN);
+      char * d = d0;
+      const C * q = p;
+      st = enc(p, p + m, d, d0 + m * N::MAXLEN);
+      ms->commit(d - d0);
+      if (st != status_type::OK || p == q)
+	break;
+    }
+  } else {
+    char buf[1024];
+    while (p < pe) {
+      char * d = buf;
+      const C * q = p;
+      st = enc(p, pe, d, buf + sizeof(buf));
+      if (d > buf && ! os->write(buf, d - buf)) {
+	st = status_type::BAD_STREAM;
+	break;
+      }
+      if (st != status_type::OK || p == q)
+	break;
+    }
+  }
+  return p - s;
+}
+
+// decode_from() and skip_from() through a newline_decoder when nl asks
+// for one.
+template <class E, class D>
+inline
+std::streamsize
+decode_newlines(std::basic_istream<E> * is, char32_t * d, std::streamsize n,
+		std::streamsize min, status_type & st, D dec,
+		unsigned int nl, bool & cr)
+{
+  using namespace alf::unicodestreams;
+
+  if (nl & (NEWLINE_LF | NEWLINE_NEL))
+    return decode_from(is, d, n, min, st, newline_decoder<D>(dec, & cr, nl));
+  return decode_from(is, d, n, min, st, dec);
+}
+
+template <class E, class D>
+inline
+std::streamsize
+skip_newlines(std::basic_istream<E> * is, std::streamsize n,
+	      status_type & st, D dec, unsigned int nl, bool & cr)
+{
+  using namespace alf::unicodestreams;
+
+  if (nl & (NEWLINE_LF | NEWLINE_NEL))
+    return skip_from(is, n, st, newline_decoder<D>(dec, & cr, nl));
+  return skip_from(is, n, st, dec);
+}
+
+// encode_to() through a crlf_encoder when nl asks for one.
+template <class C, class N>
+inline
+std::streamsize
+encode_newlines(std::ostream * os, const C * s, std::streamsize n,
+		status_type & st, N enc, unsigned int nl)
+{
+  if (nl & alf::unicodestreams::NEWLINE_CRLF)
+    return encode_to(os, s, n, st, crlf_encoder<N>(enc));
+  return encode_to(os, s, n, st, enc);
+}
+
+// move the last (up to) k chars before g to b for putback,
+// return the new gptr.
+template <class C>
+inline
+C *
+save_putback(C * b, C * g, std::ptrdiff_t k)
+{
+  std::ptrdiff_t n = g - b;
+  if (n > k) {
+    std::char_traits<C>::move(b, g - k, k);
+    n = k;
+  }
+  return b + n;
+}
+
+// same as save_putback, but for chars in s that were read directly
+// into the callers buffer by xsgetn.
+template <class C>
+inline
+C *
+copy_putback(C * b, const C * s, std::ptrdiff_t n, std::ptrdiff_t k)
+{
+  if (n > k) {
+    s += n - k;
+    n = k;
+  }
+  std::char_traits<C>::copy(b, s, n);
+  return b + n;
+}
+
+// find the first line terminator in [p, pe) according to eol.
+inline
+const char32_t *
+find_eol(const char32_t * p, const char32_t * pe, unsigned int eol)
+{
+  typedef alf::unicodestreams::eol_type eol_type;
+
+  char32_t ls = eol & eol_type::EOL_LS ? 0x2028 : '\n';
+  char32_t ps = eol & eol_type::EOL_PS ? 0x2029 : '\n';
+
+#if defined(__SSE2__)
+  const __m128i vlf = _mm_set1_epi32('\n');
+  const __m128i vls = _mm_set1_epi32(int(ls));
+  const __m128i vps = _mm_set1_epi32(int(ps));
+  for (; pe - p >= 4; p += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi32(v, vlf),
+			     _mm_or_si128(_mm_cmpeq_epi32(v, vls),
+					  _mm_cmpeq_epi32(v, vps)));
+    if (int b = _mm_movemask_epi8(m))
+      return p + (__builtin_ctz(b) >> 2);
+  }
+#endif
+  for (; p < pe; ++p)
+    if (*p == '\n' || *p == ls || *p == ps)
+      break;
+  return p;
+}
+
+inline
+const char16_t *
+find_eol(const char16_t * p, const char16_t * pe, unsigned int eol)
+{
+  typedef alf::unicodestreams::eol_type eol_type;
+
+  char16_t ls = eol & eol_type::EOL_LS ? 0x2028 : '\n';
+  char16_t ps = eol & eol_type::EOL_PS ? 0x2029 : '\n';
+
+#if defined(__SSE2__)
+  const __m128i vlf = _mm_set1_epi16('\n');
+  const __m128i vls = _mm_set1_epi16(short(ls));
+  const __m128i vps = _mm_set1_epi16(short(ps));
+  for (; pe - p >= 8; p += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi16(v, vlf),
+			     _mm_or_si128(_mm_cmpeq_epi16(v, vls),
+					  _mm_cmpeq_epi16(v, vps)));
+    if (int b = _mm_movemask_epi8(m))
+      return p + (__builtin_ctz(b) >> 1);
+  }
+#endif
+  for (; p < pe; ++p)
+    if (*p == '\n' || *p == ls || *p == ps)
+      break;
+  return p;
+}
+
+// is c a line terminator according to eol.
+inline
+bool
+is_eol(char32_t c, unsigned int eol)
+{
+  typedef alf::unicodestreams::eol_type eol_type;
+
+  return c == '\n'
+    || (c == 0x2028 && (eol & eol_type::EOL_LS))
+    || (c == 0x2029 && (eol & eol_type::EOL_PS));
+}
+
+// Reverse decoders decode the code point that ends at e going
+// backwards, b is the start of what we have and at_end tells if e is
+// the end of the input. The input is checked the same way as when we
+// read forwards and give the same status for the same error. The code
+// point is stored in w and its length in k. MAXLEN codes before e is
+// always enough unless b is the start of the input.
+
+struct utf8_rdecoder {
+
+  enum { MAXLEN = 4 };
+
+  status_type operator () (const char * b, const char * e,
+			   char32_t & w, int & k, bool at_end) const
+  {
+    const unsigned char * pb = (const unsigned char *)b;
+    const unsigned char * pe = (const unsigned char *)e;
+    const unsigned char * p = pe - 1;
+    unsigned int c = *p;
+
+    if (c < 0x80) {
+      w = c;
+      k = 1;
+      return status_type::OK;
+    }
+    // find the lead, at most 3 trailing bytes back.
+    while (c >= 0x80 && c < 0xc0 && p > pb && pe - p < 4)
+      c = *--p;
+    if (c < 0xc0)
+      return status_type::NO_LEAD;
+    if ((k = utf8_seq_len(c)) == 0)
+      return status_type::NOT_UTF8;
+    if (k < pe - p)
+      return status_type::NO_LEAD;
+    if (k > pe - p)
+      return at_end ? status_type::BAD_STREAM : status_type::NOT_UTF8;
+    return check_utf8(p, k, w);
+  }
+
+}; // end of struct utf8_rdecoder
+
+struct u16_rdecoder {
+
+  enum { MAXLEN = 2 };
+
+  status_type operator () (const char16_t * b, const char16_t * e,
+			   char32_t & w, int & k, bool at_end) const
+  {
+    char32_t c = e[-1];
+
+    if (c < 0xd800 || c >= 0xe000) {
+      if (! is_valid_utf32(c))
+	return status_type::NOT_UNICODE;
+      w = c;
+      k = 1;
+      return status_type::OK;
+    }
+    if (c < 0xdc00)
+      return at_end ? status_type::BAD_STREAM : status_type::NO_FOLLOW;
+    if (e - b < 2 || e[-2] < 0xd800 || e[-2] >= 0xdc00)
+      return status_type::NO_LEAD;
+    w = (((e[-2] & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
+    if (! is_valid_utf32(w))
+      return status_type::NOT_UNICODE;
+    k = 2;
+    return status_type::OK;
+  }
+
+}; // end of struct u16_rdecoder
+
+////////////////////////////////
+// batch helpers
+
+// How the batch functions convert one way: the output length for sizing
+// (exact for valid text, an upper bound otherwise), the ASCII kernel and
+// the conversion of one value which must take all of [s, se).
+
+struct batch_encoder {
+
+  template <class E>
+  static std::size_t length(const E * s, std::size_t n, char *)
+  { return alf::unicodestreams::utf8_length(s, n); }
+
+  template <class E>
+  static std::size_t ascii(const E * s, std::size_t n, char * d)
+  { return narrow_ascii(s, n, (unsigned char *)d); }
+
+  template <class E>
+  static status_type convert(const E *& s, const E * se, char *& d, char * de)
+  {
+    status_type st = utf8_encoder()(s, se, d, de);
+    // a high surrogate at the very end.
+    return st == status_type::OK && s < se ? status_type::NO_FOLLOW : st;
+  }
+
+}; // end of struct batch_encoder
+
+struct batch_decoder {
+
+  static std::size_t length(const char * s, std::size_t n, char16_t *)
+  { return alf::unicodestreams::u16_length(s, n); }
+
+  static std::size_t length(const char * s, std::size_t n, char32_t *)
+  { return alf::unicodestreams::count_utf8(s, n); }
+
+  template <class C>
+  static std::size_t ascii(const char * s, std::size_t n, C * d)
+  { return widen_ascii((const unsigned char *)s, n, d); }
+
+  template <class C>
+  static status_type convert(const char *& s, const char * se, C *& d, C * de)
+  {
+    status_type st = utf8_decoder()(s, se, d, de);
+    // an incomplete sequence at the very end.
+    return st == status_type::OK && s < se ? status_type::BAD_STREAM : st;
+  }
+
+}; // end of struct batch_decoder
+
+// Convert the n values of data at the offsets off to out using X.
+// A run of ASCII is copied across value boundaries and the values that
+// lie wholly in it are done, the value the run stops in is converted
+// from where the run stopped.
+template <class E, class C, class X>
+std::size_t
+convert_batch(const E * data, const std::size_t * off, std::size_t n,
+	      alf::unicodestreams::batch<C> & out, X)
+{
+  if (n == 0)
+    return 0;
+
+  const E * end = data + off[n];
+  std::size_t room = X::length(data + off[0], off[n] - off[0], (C *)0);
+  C * q = out.prepare(room);
+  C * qe = q + room;
+  std::size_t errors = out.errors();
+  std::size_t i = 0;
+
+  while (i < n) {
+    const E * p = data + off[i];
+    std::size_t m = X::ascii(p, end - p, q);
+    const E * pa = p + m;
+    for (; i < n && data + off[i + 1] <= pa; ++i) {
+      std::size_t k = off[i + 1] - off[i];
+      out.commit(k);
+      q += k;
+    }
+    if (i == n)
+      break;
+    p = pa;
+    C * d = q + (pa - (data + off[i]));
+    status_type st = X::convert(p, data + off[i + 1], d, qe);
+    out.commit(d - q, st);
+    q = d;
+    ++i;
+  }
+  return out.errors() - errors;
+}
+
+// The same for n separate values.
+template <class E, class C, class X>
+std::size_t
+convert_batch(const std::basic_string_view<E> * v, std::size_t n,
+	      alf::unicodestreams::batch<C> & out, X)
+{
+  std::size_t room = 0;
+  for (std::size_t i = 0; i < n; ++i)
+    room += X::length(v[i].data(), v[i].size(), (C *)0);
+
+  C * q = out.prepare(room);
+  C * qe = q + room;
+  std::size_t errors = out.errors();
+
+  for (std::size_t i = 0; i < n; ++i) {
+    const E * p = v[i].data();
+    C * d = q;
+    status_type st = X::convert(p, p + v[i].size(), d, qe);
+    out.commit(d - q, st);
+    q = d;
+  }
+  return out.errors() - errors;
+}
+
+}; // end of anonymous namespace
+
+////////////////////////////////
+// fusion
+
+int
+alf::unicodestreams::fusion::swap_mode(u16bswap_streambuf * b)
+{
+  switch (b->swap_state_) {
+  case u16_swap_state_type::None:
+  case u16_swap_state_type::v12:
+    return 12;
+  case u16_swap_state_type::v21:
+    return 21;
+  case u16_swap_state_type::LE:
+  case u16_swap_state_type::BE:
+    if (u16_check(b->swap_state_) == u16_swap_state_type::None)
+      return 0;
+    b->swap_state_ = u16_check(b->swap_state_);
+    return swap_mode(b);
+  default:
+    return 0;
+  }
+}
+
+int
+alf::unicodestreams::fusion::swap_mode(u32bswap_streambuf * b)
+{
+  switch (b->swap_state_) {
+  case u32_swap_state_type::None:
+  case u32_swap_state_type::v1234:
+    return 1234;
+  case u32_swap_state_type::v2143:
+    return 2143;
+  case u32_swap_state_type::v3412:
+    return 3412;
+  case u32_swap_state_type::v4321:
+    return 4321;
+  case u32_swap_state_type::LE:
+  case u32_swap_state_type::BE:
+    if (u32_check(b->swap_state_) == u32_swap_state_type::None)
+      return 0;
+    b->swap_state_ = u32_check(b->swap_state_);
+    return swap_mode(b);
+  default:
+    return 0;
+  }
+}
+
+///////////////////////////////////////
+// u32
+
+// for reading.
+alf::unicodestreams::u32streambuf::u32streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u32streambuf::u32streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for both.
+alf::unicodestreams::u32streambuf::
+u32streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u32streambuf::streambuf &
+alf::unicodestreams::u32streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+alf::unicodestreams::u32streambuf::~u32streambuf()
+{
+  if (os_)
+    overflow(traits_type::eof());
+}
+
+// underflow decodes a block at a time into the buffer while xsgetn
+// decodes directly into the callers buffer.
+
+// virtual
+alf::unicodestreams::u32streambuf::int_type
+alf::unicodestreams::u32streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u32streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, u32_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  this->setg(ibufb, p, p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char is one code of input.
+std::streamsize
+alf::unicodestreams::u32streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 1;
+}
+
+std::streamsize
+alf::unicodestreams::u32streambuf::skip(std::streamsize n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > n)
+    k = n;
+  this->gbump(int(k));
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_from(is_, n - k, s, u32_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u32streambuf::int_type
+alf::unicodestreams::u32streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u32streambuf::streambuf *
+alf::unicodestreams::u32streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32streambuf::int_type
+alf::unicodestreams::u32streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  std::streamsize r = bounded_ ? 1 : ibufe - p;
+  std::streamsize n = decode_from(is_, p, r, 1, s, u32_decoder());
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u32streambuf::int_type
+alf::unicodestreams::u32streambuf::put(int_type __c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  int_type k = 0;
+  if (! traits_type::eq_int_type(__c, traits_type::eof())) {
+    if ((k = put_u32(os_, __c)) < 0)
+      return err_status((status_type)-k);
+    return __c;
+  }
+  return traits_type::not_eof(__c);
+}
+
+////////////////////////////////
+// u32u16
+
+// for reading.
+alf::unicodestreams::u32u16streambuf::u32u16streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false),
+    newline_(NEWLINE_ASIS), cr_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u32u16streambuf::u32u16streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false),
+    newline_(NEWLINE_ASIS), cr_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for both.
+alf::unicodestreams::u32u16streambuf::
+u32u16streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false),
+    newline_(NEWLINE_ASIS), cr_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u32u16streambuf::streambuf &
+alf::unicodestreams::u32u16streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  cr_ = false;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+alf::unicodestreams::u32u16streambuf::~u32u16streambuf()
+{
+  if (os_)
+    overflow(traits_type::eof());
+}
+
+// virtual
+alf::unicodestreams::u32u16streambuf::int_type
+alf::unicodestreams::u32u16streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u32u16streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += decode_newlines(is_, __s + k, __n - k, __n - k, s, u16_decoder(),
+		       newline_, cr_);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  this->setg(ibufb, p, p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char takes at most 2 codes of input.
+std::streamsize
+alf::unicodestreams::u32u16streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 2;
+}
+
+std::streamsize
+alf::unicodestreams::u32u16streambuf::skip(std::streamsize n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > n)
+    k = n;
+  this->gbump(int(k));
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_newlines(is_, n - k, s, u16_decoder(), newline_, cr_);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u32u16streambuf::int_type
+alf::unicodestreams::u32u16streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u32u16streambuf::streambuf *
+alf::unicodestreams::u32u16streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32u16streambuf::int_type
+alf::unicodestreams::u32u16streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  std::streamsize r = bounded_ ? 1 : ibufe - p;
+  std::streamsize n = decode_newlines(is_, p, r, 1, s, u16_decoder(),
+				      newline_, cr_);
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u32u16streambuf::int_type
+alf::unicodestreams::u32u16streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  if (! is_valid_utf32(c))
+    return err_status(status_type::NOT_UNICODE);
+  // a CR that fails leaves os_ bad for c.
+  if (c == '\n' && (newline_ & NEWLINE_CRLF))
+    put_u16(os_, '\r');
+  int_type k = put_u16(os_, c);
+  if (k < 0)
+    return err_status((status_type)-k);
+  return c;
+}
+
+////////////////////////////////
+// u32utf8
+
+// for reading.
+alf::unicodestreams::u32utf8streambuf::u32utf8streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD),
+    newline_(NEWLINE_ASIS), cr_(false), high_(false), pbuf(0)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u32utf8streambuf::u32utf8streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD),
+    newline_(NEWLINE_ASIS), cr_(false), high_(false), pbuf(0)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for both.
+alf::unicodestreams::u32utf8streambuf::
+u32utf8streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD),
+    newline_(NEWLINE_ASIS), cr_(false), high_(false), pbuf(0)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u32utf8streambuf::streambuf &
+alf::unicodestreams::u32utf8streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  cr_ = false;
+  high_ = false;
+  pbuf = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
 }
 
 alf::unicodestreams::u32utf8streambuf::~u32utf8streambuf()
 {
-  if (os_)
-    overflow(traits_type::eof());
+  if (os_)
+    overflow(traits_type::eof());
+}
+
+// virtual
+alf::unicodestreams::u32utf8streambuf::int_type
+alf::unicodestreams::u32utf8streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u32utf8streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  if (form_ == utf8_form::STANDARD)
+    k += decode_newlines(is_, __s + k, __n - k, __n - k, s, utf8_decoder(),
+			 newline_, cr_);
+  else
+    k += decode_newlines(is_, __s + k, __n - k, __n - k, s,
+			 form_decoder(form_, & high_), newline_, cr_);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  this->setg(ibufb, p, p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char takes at most 4 bytes of input.
+std::streamsize
+alf::unicodestreams::u32utf8streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 4;
+}
+
+// virtual
+// encode a block at a time, in WTF-8 a high surrogate the encoder
+// leaves for a low one that isn't there yet goes through put().
+std::streamsize
+alf::unicodestreams::u32utf8streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (status_ != status_type::OK)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
+  if (! *os_) {
+    err_status(status_type::BAD_STREAM);
+    return 0;
+  }
+
+  std::streamsize k = 0;
+  while (k < __n) {
+    if (pbuf == 0) {
+      status_type s;
+      if (escape_ != escape_type::NONE)
+	k += encode_newlines(os_, __s + k, __n - k, s,
+			     escape_encoder(escape_), newline_);
+      else if (form_ != utf8_form::STANDARD)
+	k += encode_newlines(os_, __s + k, __n - k, s,
+			     form_encoder(form_), newline_);
+      else
+	k += encode_newlines(os_, __s + k, __n - k, s,
+			     utf8_encoder(), newline_);
+      if (s != status_type::OK) {
+	status_ = s;
+	break;
+      }
+      if (k == __n)
+	break;
+    }
+    if (traits_type::eq_int_type(put(traits_type::to_int_type(__s[k])),
+				 traits_type::eof()))
+      break;
+    ++k;
+  }
+  return k;
+}
+
+std::streamsize
+alf::unicodestreams::u32utf8streambuf::skip(std::streamsize n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > n)
+    k = n;
+  this->gbump(int(k));
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  if (form_ == utf8_form::STANDARD)
+    k += skip_newlines(is_, n - k, s, utf8_decoder(), newline_, cr_);
+  else
+    k += skip_newlines(is_, n - k, s, form_decoder(form_, & high_),
+			newline_, cr_);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u32utf8streambuf::int_type
+alf::unicodestreams::u32utf8streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u32utf8streambuf::streambuf *
+alf::unicodestreams::u32utf8streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32utf8streambuf::int_type
+alf::unicodestreams::u32utf8streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  std::streamsize r = bounded_ ? 1 : ibufe - p;
+  std::streamsize n = form_ == utf8_form::STANDARD
+    ? decode_newlines(is_, p, r, 1, s, utf8_decoder(), newline_, cr_)
+    : decode_newlines(is_, p, r, 1, s, form_decoder(form_, & high_),
+		      newline_, cr_);
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u32utf8streambuf::int_type
+alf::unicodestreams::u32utf8streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  int k = 0;
+  if (pbuf) {
+    // WTF-8, a high surrogate joins a low one or goes on its own.
+    char32_t h = pbuf;
+    pbuf = 0;
+    if (c >= 0xdc00 && c < 0xe000) {
+      k = put_encoded(os_, (((h & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000,
+		      escape_, form_);
+      if (k < 0)
+	return err_status((status_type)-k);
+      return c;
+    }
+    if ((k = put_encoded(os_, h, escape_, form_)) < 0)
+      return err_status((status_type)-k);
+  }
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  if (c >= 0xd800 && c < 0xdc00 && form_ == utf8_form::WTF8
+      && escape_ == escape_type::NONE) {
+    pbuf = c;
+    return c;
+  }
+  if (c == '\n' && (newline_ & NEWLINE_CRLF))
+    k = put_encoded(os_, '\r', escape_, form_);
+  if (k >= 0)
+    k = put_encoded(os_, c, escape_, form_);
+  if (k < 0)
+    return err_status((status_type)-k);
+  return c;
+}
+
+////////////////////////////////
+// u16u32
+
+// for reading.
+alf::unicodestreams::u16u32streambuf::u16u32streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u16u32streambuf::u16u32streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::u16u32streambuf::
+u16u32streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u16u32streambuf::streambuf &
+alf::unicodestreams::u16u32streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  pbuf = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u16u32streambuf::int_type
+alf::unicodestreams::u16u32streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u16u32streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  char_type pend;
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, u32_decoder(), & pend);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  if (pend)
+    *p = pend;
+  this->setg(ibufb, p, pend ? p + 1 : p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every code of input gives at least one char.
+std::streamsize
+alf::unicodestreams::u16u32streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 1;
+}
+
+// skip what is buffered a code point at a time, a low surrogate
+// at gptr() only completes a code point already read.
+std::streamsize
+alf::unicodestreams::u16u32streambuf::skip(std::streamsize n)
+{
+  char_type * g = this->gptr();
+  char_type * ge = this->egptr();
+  std::streamsize k = 0;
+
+  if (g < ge && *g >= 0xdc00 && *g < 0xe000)
+    ++g;
+  while (g < ge && k < n) {
+    if (*g >= 0xd800 && *g < 0xdc00 && g + 1 < ge)
+      ++g;
+    ++g;
+    ++k;
+  }
+  this->setg(this->eback(), g, ge);
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_from(is_, n - k, s, u32_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u16u32streambuf::int_type
+alf::unicodestreams::u16u32streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u16u32streambuf::streambuf *
+alf::unicodestreams::u16u32streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u16u32streambuf::int_type
+alf::unicodestreams::u16u32streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  char_type pend;
+  // the last slot is for pend.
+  std::streamsize r = bounded_ ? 1 : ibufe - p - 1;
+  std::streamsize n = decode_from(is_, p, r, 1, s, u32_decoder(), & pend);
+  if (pend)
+    p[n++] = pend;
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u16u32streambuf::int_type
+alf::unicodestreams::u16u32streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c >= 0x10000)
+    return err_status(status_type::NOT_UTF16);
+
+  // int_type is only 16 bits here, so code points are char32_t.
+  if (c < 0xd800 || c >= 0xe000) {
+    if (! is_valid_utf32(char32_t(c)))
+      return err_status(status_type::NOT_UNICODE);
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    if (! os_->put(char32_t(c)))
+      return err_status(status_type::BAD_STREAM);
+    return c;
+  }
+  // c in 0xd800..0xdfff
+  if (c < 0xdc00) {
+    // c in 0xd800..0xdbff
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    pbuf = traits_type::to_char_type(c);
+    return c;
+  }
+  // c in 0xdc00..dfff
+  if (pbuf == 0)
+    return err_status(status_type::NO_LEAD);
+  char32_t w = (((pbuf & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
+  pbuf = 0;
+  if (! is_valid_utf32(w))
+    return err_status(status_type::NOT_UNICODE);
+  if (! os_->put(w))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+}
+
+////////////////////////////////
+// u16
+
+// for reading.
+alf::unicodestreams::u16streambuf::u16streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u16streambuf::u16streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::u16streambuf::
+u16streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u16streambuf::streambuf &
+alf::unicodestreams::u16streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  pbuf = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u16streambuf::int_type
+alf::unicodestreams::u16streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u16streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  char_type pend;
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, u16_decoder(), & pend);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  if (pend)
+    *p = pend;
+  this->setg(ibufb, p, pend ? p + 1 : p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every code of input gives at least one char.
+std::streamsize
+alf::unicodestreams::u16streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 1;
+}
+
+// skip what is buffered a code point at a time, a low surrogate
+// at gptr() only completes a code point already read.
+std::streamsize
+alf::unicodestreams::u16streambuf::skip(std::streamsize n)
+{
+  char_type * g = this->gptr();
+  char_type * ge = this->egptr();
+  std::streamsize k = 0;
+
+  if (g < ge && *g >= 0xdc00 && *g < 0xe000)
+    ++g;
+  while (g < ge && k < n) {
+    if (*g >= 0xd800 && *g < 0xdc00 && g + 1 < ge)
+      ++g;
+    ++g;
+    ++k;
+  }
+  this->setg(this->eback(), g, ge);
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_from(is_, n - k, s, u16_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u16streambuf::int_type
+alf::unicodestreams::u16streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u16streambuf::streambuf *
+alf::unicodestreams::u16streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u16streambuf::int_type
+alf::unicodestreams::u16streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  char_type pend;
+  // the last slot is for pend.
+  std::streamsize r = bounded_ ? 1 : ibufe - p - 1;
+  std::streamsize n = decode_from(is_, p, r, 1, s, u16_decoder(), & pend);
+  if (pend)
+    p[n++] = pend;
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u16streambuf::int_type
+alf::unicodestreams::u16streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c >= 0x10000)
+    return err_status(status_type::NOT_UTF16);
+
+  // int_type is only 16 bits here so we write the codes as they are.
+  if (c < 0xd800 || c >= 0xe000) {
+    if (! is_valid_utf32(char32_t(c)))
+      return err_status(status_type::NOT_UNICODE);
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    if (! os_->put(traits_type::to_char_type(c)))
+      return err_status(status_type::BAD_STREAM);
+    return c;
+  }
+  // c in 0xd800..0xdfff
+  if (c < 0xdc00) {
+    // c in 0xd800..0xdbff
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    pbuf = traits_type::to_char_type(c);
+    return c;
+  }
+  // c in 0xdc00..dfff
+  if (pbuf == 0)
+    return err_status(status_type::NO_LEAD);
+  char32_t w = (((pbuf & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
+  char16_t h = traits_type::to_char_type(pbuf);
+  pbuf = 0;
+  if (! is_valid_utf32(w))
+    return err_status(status_type::NOT_UNICODE);
+  if (! os_->put(h) || ! os_->put(traits_type::to_char_type(c)))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+}
+
+////////////////////////////////
+// u16utf8
+
+// for reading.
+alf::unicodestreams::u16utf8streambuf::u16utf8streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD), high_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u16utf8streambuf::u16utf8streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD), high_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::u16utf8streambuf::
+u16utf8streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false),
+    escape_(escape_type::NONE), form_(utf8_form::STANDARD), high_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  pbuf = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u16utf8streambuf::streambuf &
+alf::unicodestreams::u16utf8streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  high_ = false;
+  pbuf = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// a lone high surrogate still in pbuf goes out in WTF-8.
+alf::unicodestreams::u16utf8streambuf::~u16utf8streambuf()
+{
+  if (os_)
+    overflow(traits_type::eof());
+}
+
+// virtual
+alf::unicodestreams::u16utf8streambuf::int_type
+alf::unicodestreams::u16utf8streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u16utf8streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  char_type pend;
+  if (form_ == utf8_form::STANDARD)
+    k += decode_from(is_, __s + k, __n - k, __n - k, s, utf8_decoder(),
+		     & pend);
+  else
+    k += decode_from(is_, __s + k, __n - k, __n - k, s,
+		     form_decoder(form_, & high_), & pend);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  if (pend)
+    *p = pend;
+  this->setg(ibufb, p, pend ? p + 1 : p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char takes at most 3 bytes of input.
+std::streamsize
+alf::unicodestreams::u16utf8streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 3;
+}
+
+// virtual
+// encode a block at a time, a pending high surrogate and one at the
+// very end go through put() as before.
+std::streamsize
+alf::unicodestreams::u16utf8streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = 0;
+
+  for (; k < __n && pbuf; ++k)
+    if (traits_type::eq_int_type(put(traits_type::to_int_type(__s[k])),
+				 traits_type::eof()))
+      return k;
+  if (k == __n || status_ != status_type::OK)
+    return k;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return k;
+  }
+  if (! *os_) {
+    err_status(status_type::BAD_STREAM);
+    return k;
+  }
+
+  status_type s;
+  if (escape_ != escape_type::NONE)
+    k += encode_to(os_, __s + k, __n - k, s, escape_encoder(escape_));
+  else if (form_ != utf8_form::STANDARD)
+    k += encode_to(os_, __s + k, __n - k, s, form_encoder(form_));
+  else
+    k += encode_to(os_, __s + k, __n - k, s, utf8_encoder());
+  if (s != status_type::OK)
+    status_ = s;
+  else if (k < __n
+	   && ! traits_type::eq_int_type(put(traits_type::to_int_type(__s[k])),
+					 traits_type::eof()))
+    ++k;
+  return k;
+}
+
+// skip what is buffered a code point at a time, a low surrogate
+// at gptr() only completes a code point already read.
+std::streamsize
+alf::unicodestreams::u16utf8streambuf::skip(std::streamsize n)
+{
+  char_type * g = this->gptr();
+  char_type * ge = this->egptr();
+  std::streamsize k = 0;
+
+  if (g < ge && *g >= 0xdc00 && *g < 0xe000)
+    ++g;
+  while (g < ge && k < n) {
+    if (*g >= 0xd800 && *g < 0xdc00 && g + 1 < ge)
+      ++g;
+    ++g;
+    ++k;
+  }
+  this->setg(this->eback(), g, ge);
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += form_ == utf8_form::STANDARD
+    ? skip_from(is_, n - k, s, utf8_decoder())
+    : skip_from(is_, n - k, s, form_decoder(form_, & high_));
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u16utf8streambuf::int_type
+alf::unicodestreams::u16utf8streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u16utf8streambuf::streambuf *
+alf::unicodestreams::u16utf8streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u16utf8streambuf::int_type
+alf::unicodestreams::u16utf8streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  char_type pend;
+  // the last slot is for pend.
+  std::streamsize r = bounded_ ? 1 : ibufe - p - 1;
+  std::streamsize n = form_ == utf8_form::STANDARD
+    ? decode_from(is_, p, r, 1, s, utf8_decoder(), & pend)
+    : decode_from(is_, p, r, 1, s, form_decoder(form_, & high_), & pend);
+  if (pend)
+    p[n++] = pend;
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u16utf8streambuf::int_type
+alf::unicodestreams::u16utf8streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  // int_type is only 16 bits here, put_utf8 takes and gives an int.
+  int a, b;
+  char16_t ch;
+  bool wtf8 = form_ == utf8_form::WTF8 && escape_ == escape_type::NONE;
+
+  // WTF-8 writes a high surrogate that no low one follows on its own.
+  if (pbuf && wtf8 && (traits_type::eq_int_type(c, traits_type::eof())
+		       || c < 0xdc00 || c >= 0xe000)) {
+    a = put_encoded(os_, pbuf, escape_, form_);
+    pbuf = 0;
+    if (a < 0)
+      return err_status((status_type)-a);
+  }
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    // eof, shut down.. .make sure buf has nothing.
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+  if (c >= 0xfffe) {
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    return err_status(status_type::NOT_UNICODE);
+  }
+  if (c < 0xd800 || c >= 0xe000) {
+    // single code.
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    ch = traits_type::to_char_type(c);
+    if (! is_valid_utf32(ch))
+      return err_status(status_type::NOT_UNICODE);
+    a = put_encoded(os_, c, escape_, form_);
+    if (a < 0)
+      return err_status((status_type)-a);
+    return c;
+  }
+  if (c < 0xdc00) {
+    if (pbuf)
+      return err_status(status_type::NO_FOLLOW);
+    pbuf = c;
+    return c;
+  }
+  // c in 0xdc00..0xdfff range.
+  b = pbuf;
+  pbuf = 0;
+  if (b >= 0xd800 && b < 0xdc00) {
+    a = (((b & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
+    if (! is_valid_utf32(char32_t(a)))
+      return err_status(status_type::NOT_UNICODE);
+  } else if (wtf8)
+    a = c;
+  else
+    return err_status(status_type::NO_LEAD);
+  int k = put_encoded(os_, a, escape_, form_);
+  if (k < 0)
+    return err_status((status_type)-k);
+  return c;
+}
+
+////////////////////////////////
+// utf8u32
+
+// for reading.
+alf::unicodestreams::utf8u32streambuf::utf8u32streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::utf8u32streambuf::utf8u32streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::utf8u32streambuf::
+utf8u32streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::utf8u32streambuf::streambuf &
+alf::unicodestreams::utf8u32streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  och_need = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::utf8u32streambuf::int_type
+alf::unicodestreams::utf8u32streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::utf8u32streambuf::int_type
+alf::unicodestreams::utf8u32streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::utf8u32streambuf::streambuf *
+alf::unicodestreams::utf8u32streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::utf8u32streambuf::int_type
+alf::unicodestreams::utf8u32streambuf::get()
+{
+  int_type c, a;
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if ((c = get_u32(is_)) < 0) {
+    if (c == -(int_type)status_type::EOF_STREAM)
+      return traits_type::eof();
+    return err_status((status_type)-c);
+  }
+  if (this->egptr() + 3 == ibufe) {
+    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
+    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  }
+
+  char_type * base = this->gptr();
+  char_type * p = base;
+  int_type ret = 0;
+  if (c < 0x80) {
+    *p++ = char_type(ret = c);
+  } else if (c < 0x800) {
+    *p++ = char_type(ret = 0xc0 | (c >> 6));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    *p++ = char_type(ret = 0xe0 | (c >> 12));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else {
+    *p++ = char_type(ret = 0xf0 | (c >> 18));
+    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  }
+  this->setg(ibufb, base, p);
+  return traits_type::to_int_type(*this->gptr());
+
+}
+
+alf::unicodestreams::utf8u32streambuf::int_type
+alf::unicodestreams::utf8u32streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c > 0xf7)
+    return err_status(status_type::NOT_UTF8);
+
+  if (c < 0x80) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return c;
+  }
+  int_type b;
+  if (c < 0xc0) {
+    if (och_need == 0)
+      return err_status(status_type::NO_LEAD);
+    och = (och << 6) | (c & 0x3f);
+    if (--och_need == 0) {
+      if (! is_valid_utf32(char32_t(och)))
+	return err_status(status_type::NOT_UNICODE);
+      if (och < och_min)
+	return err_status(status_type::NOT_UTF8);
+      b = put_u32(os_, och);
+      if (b < 0)
+	return err_status((status_type)-b);
+      return c;
+    }
+  }
+  if (och_need)
+    return err_status(status_type::NO_FOLLOW);
+  if (c < 0xe0) {
+    // two byte code - minimum 0x80.
+    och_min = 0x80;
+    och_need = 1;
+    och = c & 0x1f;
+    return c;
+  }
+  if (c < 0xf0) {
+    // three byte code - minimum 0x800
+    och_min = 0x800;
+    och_need = 2;
+    och = c & 0x0f;
+    return c;
+  }
+  och_min = 0x10000;
+  och_need = 3;
+  och = c & 0x07;
+  return c;
+
+}
+
+////////////////////////////////
+// utf8u16
+
+// for reading.
+alf::unicodestreams::utf8u16streambuf::utf8u16streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::utf8u16streambuf::utf8u16streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::utf8u16streambuf::
+utf8u16streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::utf8u16streambuf::streambuf &
+alf::unicodestreams::utf8u16streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  och_need = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::utf8u16streambuf::int_type
+alf::unicodestreams::utf8u16streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::utf8u16streambuf::int_type
+alf::unicodestreams::utf8u16streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::utf8u16streambuf::streambuf *
+alf::unicodestreams::utf8u16streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::utf8u16streambuf::int_type
+alf::unicodestreams::utf8u16streambuf::get()
+{
+  int_type c, a;
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if ((c = get_u16(is_)) < 0) {
+    if (c == -(int_type)status_type::EOF_STREAM)
+      return traits_type::eof();
+    return err_status((status_type)-c);
+  }
+  if (this->egptr() + 3 == ibufe) {
+    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
+    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  }
+
+  char_type * base = this->gptr();
+  char_type * p = base;
+  int_type ret = 0;
+  if (c < 0x80) {
+    *p++ = char_type(ret = c);
+  } else if (c < 0x800) {
+    *p++ = char_type(ret = 0xc0 | (c >> 6));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    *p++ = char_type(ret = 0xe0 | (c >> 12));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else {
+    *p++ = char_type(ret = 0xf0 | (c >> 18));
+    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  }
+  this->setg(ibufb, base, p);
+  return traits_type::to_int_type(*this->gptr());
+
+}
+
+alf::unicodestreams::utf8u16streambuf::int_type
+alf::unicodestreams::utf8u16streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c > 0xf7)
+    return err_status(status_type::NOT_UTF8);
+
+  if (c < 0x80) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return c;
+  }
+  int_type b;
+  if (c < 0xc0) {
+    if (och_need == 0)
+      return err_status(status_type::NO_LEAD);
+    och = (och << 6) | (c & 0x3f);
+    if (--och_need == 0) {
+      if (! is_valid_utf32(char32_t(och)))
+	return err_status(status_type::NOT_UNICODE);
+      if (och < och_min)
+	return err_status(status_type::NOT_UTF8);
+      b = put_u16(os_, och);
+      if (b < 0)
+	return err_status((status_type)-b);
+      return c;
+    }
+  }
+  if (och_need)
+    return err_status(status_type::NO_FOLLOW);
+  if (c < 0xe0) {
+    // two byte code - minimum 0x80.
+    och_min = 0x80;
+    och_need = 1;
+    och = c & 0x1f;
+    return c;
+  }
+  if (c < 0xf0) {
+    // three byte code - minimum 0x800
+    och_min = 0x800;
+    och_need = 2;
+    och = c & 0x0f;
+    return c;
+  }
+  och_min = 0x10000;
+  och_need = 3;
+  och = c & 0x07;
+  return c;
+
+}
+
+////////////////////////////////
+// utf8
+
+// for reading.
+alf::unicodestreams::utf8streambuf::utf8streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::utf8streambuf::utf8streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::utf8streambuf::
+utf8streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och_need = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::utf8streambuf::streambuf &
+alf::unicodestreams::utf8streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  och_need = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::utf8streambuf::int_type
+alf::unicodestreams::utf8streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::utf8streambuf::int_type
+alf::unicodestreams::utf8streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::utf8streambuf::streambuf *
+alf::unicodestreams::utf8streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::utf8streambuf::int_type
+alf::unicodestreams::utf8streambuf::get()
+{
+  int_type c, a;
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if ((c = get_utf8(is_)) < 0) {
+    if (c == -(int_type)status_type::EOF_STREAM)
+      return traits_type::eof();
+    return err_status((status_type)-c);
+  }
+  if (this->egptr() + 3 == ibufe) {
+    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
+    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  }
+
+  char_type * base = this->gptr();
+  char_type * p = base;
+  int_type ret = 0;
+  if (c < 0x80) {
+    *p++ = char_type(ret = c);
+  } else if (c < 0x800) {
+    *p++ = char_type(ret = 0xc0 | (c >> 6));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else if (c < 0x10000) {
+    *p++ = char_type(ret = 0xe0 | (c >> 12));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  } else {
+    *p++ = char_type(ret = 0xf0 | (c >> 18));
+    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
+    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
+    *p++ = char_type(0x80 | (c & 0x3f));
+  }
+  this->setg(ibufb, base, p);
+  return traits_type::to_int_type(*this->gptr());
+
+}
+
+alf::unicodestreams::utf8streambuf::int_type
+alf::unicodestreams::utf8streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c > 0xf7)
+    return err_status(status_type::NOT_UTF8);
+
+  if (c < 0x80) {
+    if (och_need)
+      return err_status(status_type::NO_FOLLOW);
+    return c;
+  }
+  int_type b;
+  if (c < 0xc0) {
+    if (och_need == 0)
+      return err_status(status_type::NO_LEAD);
+    och = (och << 6) | (c & 0x3f);
+    if (--och_need == 0) {
+      if (! is_valid_utf32(char32_t(och)))
+	return err_status(status_type::NOT_UNICODE);
+      if (och < och_min)
+	return err_status(status_type::NOT_UTF8);
+      b = put_utf8(os_, och);
+      if (b < 0)
+	return err_status((status_type)-b);
+      return c;
+    }
+  }
+  if (och_need)
+    return err_status(status_type::NO_FOLLOW);
+  if (c < 0xe0) {
+    // two byte code - minimum 0x80.
+    och_min = 0x80;
+    och_need = 1;
+    och = c & 0x1f;
+    return c;
+  }
+  if (c < 0xf0) {
+    // three byte code - minimum 0x800
+    och_min = 0x800;
+    och_need = 2;
+    och = c & 0x0f;
+    return c;
+  }
+  och_min = 0x10000;
+  och_need = 3;
+  och = c & 0x07;
+  return c;
+
+}
+
+////////////////////////////////
+// u32iso8859_1
+
+// for reading.
+alf::unicodestreams::u32iso8859_1_streambuf::
+u32iso8859_1_streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u32iso8859_1_streambuf::
+u32iso8859_1_streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+// for both.
+alf::unicodestreams::u32iso8859_1_streambuf::
+u32iso8859_1_streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u32iso8859_1_streambuf::streambuf &
+alf::unicodestreams::u32iso8859_1_streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_streambuf::int_type
+alf::unicodestreams::u32iso8859_1_streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u32iso8859_1_streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, latin1_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  this->setg(ibufb, p, p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char is one byte of input.
+std::streamsize
+alf::unicodestreams::u32iso8859_1_streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 1;
+}
+
+std::streamsize
+alf::unicodestreams::u32iso8859_1_streambuf::skip(std::streamsize n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > n)
+    k = n;
+  this->gbump(int(k));
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_from(is_, n - k, s, latin1_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_streambuf::int_type
+alf::unicodestreams::u32iso8859_1_streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_streambuf::streambuf *
+alf::unicodestreams::u32iso8859_1_streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32iso8859_1_streambuf::int_type
+alf::unicodestreams::u32iso8859_1_streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  std::streamsize r = bounded_ ? 1 : ibufe - p;
+  std::streamsize n = decode_from(is_, p, r, 1, s, latin1_decoder());
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u32iso8859_1_streambuf::int_type
+alf::unicodestreams::u32iso8859_1_streambuf::put(int_type c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  if (c < 0 || c > 0xff)
+    return err_status(status_type::NOT_ISO_8859_1);
+  if (! os_->put(char(c)))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+
+}
+
+////////////////////////////////
+// u16iso8859_1_
+
+// for reading.
+alf::unicodestreams::u16iso8859_1_streambuf::
+u16iso8859_1_streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u16iso8859_1_streambuf::
+u16iso8859_1_streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+ // for both.
+alf::unicodestreams::u16iso8859_1_streambuf::
+u16iso8859_1_streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u16iso8859_1_streambuf::streambuf &
+alf::unicodestreams::u16iso8859_1_streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_streambuf::int_type
+alf::unicodestreams::u16iso8859_1_streambuf::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// virtual
+std::streamsize
+alf::unicodestreams::u16iso8859_1_streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, latin1_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  char_type * p = copy_putback(ibufb, __s, k, EBACK);
+  this->setg(ibufb, p, p);
+  return k;
+}
+
+// virtual
+// a lower bound on what we can give without blocking,
+// every char is one byte of input.
+std::streamsize
+alf::unicodestreams::u16iso8859_1_streambuf::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  std::streamsize a = is_->rdbuf()->in_avail();
+  return a < 0 ? a : a / 1;
+}
+
+// skip what is buffered a code point at a time, a low surrogate
+// at gptr() only completes a code point already read.
+std::streamsize
+alf::unicodestreams::u16iso8859_1_streambuf::skip(std::streamsize n)
+{
+  char_type * g = this->gptr();
+  char_type * ge = this->egptr();
+  std::streamsize k = 0;
+
+  if (g < ge && *g >= 0xdc00 && *g < 0xe000)
+    ++g;
+  while (g < ge && k < n) {
+    if (*g >= 0xd800 && *g < 0xdc00 && g + 1 < ge)
+      ++g;
+    ++g;
+    ++k;
+  }
+  this->setg(this->eback(), g, ge);
+  if (k == n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += skip_from(is_, n - k, s, latin1_decoder());
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  return k;
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_streambuf::int_type
+alf::unicodestreams::u16iso8859_1_streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_streambuf::streambuf *
+alf::unicodestreams::u16iso8859_1_streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+// decode a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u16iso8859_1_streambuf::int_type
+alf::unicodestreams::u16iso8859_1_streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  std::streamsize r = bounded_ ? 1 : ibufe - p;
+  std::streamsize n = decode_from(is_, p, r, 1, s, latin1_decoder());
+  this->setg(ibufb, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u16iso8859_1_streambuf::int_type
+alf::unicodestreams::u16iso8859_1_streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  if (c < 0 || c > 0xff)
+    return err_status(status_type::NOT_ISO_8859_1);
+  if (! os_->put(char16_t(c)))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+
+}
+
+////////////////////////////////
+// utf8iso8859_1_
+
+// for reading.
+alf::unicodestreams::utf8iso8859_1_streambuf::
+utf8iso8859_1_streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::utf8iso8859_1_streambuf::
+utf8iso8859_1_streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+ // for both.
+alf::unicodestreams::utf8iso8859_1_streambuf::
+utf8iso8859_1_streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type())
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  och = 0;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::utf8iso8859_1_streambuf::streambuf &
+alf::unicodestreams::utf8iso8859_1_streambuf::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  och = 0;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::utf8iso8859_1_streambuf::int_type
+alf::unicodestreams::utf8iso8859_1_streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::utf8iso8859_1_streambuf::int_type
+alf::unicodestreams::utf8iso8859_1_streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::utf8iso8859_1_streambuf::streambuf *
+alf::unicodestreams::utf8iso8859_1_streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::utf8iso8859_1_streambuf::int_type
+alf::unicodestreams::utf8iso8859_1_streambuf::get()
+{
+  char ch;
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (is_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *is_)
+    return err_status(status_type::BAD_STREAM);
+  if (! is_->get(ch)) {
+    if (is_->rdstate() & std::ios_base::eofbit)
+      return traits_type::eof();
+    return err_status(status_type::BAD_STREAM);
+  }
+
+  if (this->egptr() + 1 == ibufe) {
+    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
+    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  }
+
+  char_type * base = this->gptr();
+  char_type * p = base;
+  if (ch < 0x80) {
+    *p++ = char_type(ch);
+  } else {
+    *p++ = char_type(0xc0 | ((ch >> 6) & 3));
+    *p++ = char_type(0x80 | (ch & 0x3f));
+  }
+  this->setg(ibufb, base, p);
+  return traits_type::to_int_type(*this->gptr());
+
+}
+
+alf::unicodestreams::utf8iso8859_1_streambuf::int_type
+alf::unicodestreams::utf8iso8859_1_streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof())) {
+    if (och)
+      return err_status(status_type::NO_FOLLOW);
+    return traits_type::not_eof(c);
+  }
+
+  if (c < 0 || c > 0xf7)
+    return err_status(status_type::NOT_UTF8);
+
+  if (c < 0x80) {
+    if (och)
+      return err_status(status_type::NO_FOLLOW);
+    return c;
+  }
+  int_type b;
+  if (c < 0xc0) {
+    if (och == 0)
+      return err_status(status_type::NO_LEAD);
+
+    b = ((och & 0x1f) << 6) | (c & 0x3f);
+    och = 0;
+
+    if (b < 0x80)
+      return err_status(status_type::NOT_UTF8);
+    if (b > 0xff)
+      return err_status(status_type::NOT_ISO_8859_1);
+    if (! os_->put(char(b)))
+      return err_status(status_type::BAD_STREAM);
+    return c;
+  }
+  if (c >= 0xc4)
+    return err_status(status_type::NOT_ISO_8859_1);
+  if (och)
+    return err_status(status_type::NO_FOLLOW);
+  return och = c;
+
+}
+
+////////////////////////////////
+// u32bswap_
+
+// for reading.
+alf::unicodestreams::u32bswap_streambuf::
+u32bswap_streambuf(src_stream & is,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u32bswap_streambuf::
+u32bswap_streambuf(dst_stream & os,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+ // for both.
+alf::unicodestreams::u32bswap_streambuf::
+u32bswap_streambuf(src_stream & is, dst_stream & os,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u32bswap_streambuf::streambuf &
+alf::unicodestreams::u32bswap_streambuf::
+rebind(src_stream * is, dst_stream * os, swap_state_type s)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  swap_state_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u32bswap_streambuf::int_type
+alf::unicodestreams::u32bswap_streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::u32bswap_streambuf::int_type
+alf::unicodestreams::u32bswap_streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u32bswap_streambuf::streambuf *
+alf::unicodestreams::u32bswap_streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::u32bswap_streambuf::int_type
+alf::unicodestreams::u32bswap_streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  // the swap state is sorted out first so the block is swapped in one
+  // go, for FChar the first unit tells.
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  char_type * q = p;
+  if (swap_state_ == swap_state_type::FChar) {
+    if (read_raw(is_, q, 1, 1) != 1)
+      return traits_type::eof();
+    switch (*q) {
+    case 0xfffe0000:
+      swap_state_ = swap_state_type::v4321;
+      break;
+    case 0x0000fffe:
+      swap_state_ = swap_state_type::v2143;
+      break;
+    case 0xfeff0000:
+      swap_state_ = swap_state_type::v3412;
+      break;
+    case 0x0000feff:
+      swap_state_ = swap_state_type::v1234;
+      break;
+    default:
+      return err_status(status_type::NO_BOM);
+    }
+    swap_units(int(swap_state_), q, q, 1);
+    ++q;
+  } else
+    swap_state_ = u32_check(swap_state_);
+  // bounded, a unit read for the BOM is all this time.
+  std::streamsize r = bounded_ ? q == p : ibufe - q;
+  q += decode_from(is_, q, r, q == p, s,
+		   swap_copier<char_type>(int(swap_state_)));
+  this->setg(ibufb, p, q);
+  if (q == p)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u32bswap_streambuf::int_type
+alf::unicodestreams::u32bswap_streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+
+  char_type a = char_type(c);
+  if (! put_swap_state(os_, swap_state_, swap_state_type::v1234, a))
+    return err_status(status_type::BAD_STREAM);
+  swap_units(int(swap_state_), & a, & a, 1);
+  if (! os_->put(a))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+}
+
+// virtual
+// swap a block at a time.
+std::streamsize
+alf::unicodestreams::u32bswap_streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (status_ != status_type::OK || __n <= 0)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
+  if (! *os_ || ! put_swap_state(os_, swap_state_, swap_state_type::v1234,
+				 *__s)) {
+    err_status(status_type::BAD_STREAM);
+    return 0;
+  }
+  std::streamsize k = put_swapped(os_, int(swap_state_), __s, __n);
+  if (k < __n)
+    err_status(status_type::BAD_STREAM);
+  return k;
+}
+
+////////////////////////////////
+// u16bswap_
+
+// for reading.
+alf::unicodestreams::u16bswap_streambuf::
+u16bswap_streambuf(src_stream & is,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(& is), os_(0), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+alf::unicodestreams::u16bswap_streambuf::
+u16bswap_streambuf(dst_stream & os,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(0), os_(& os), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+ 
+ // for both.
+alf::unicodestreams::u16bswap_streambuf::
+u16bswap_streambuf(src_stream & is, dst_stream & os,
+		   swap_state_type s /* = swap_state_type::None */)
+  : is_(& is), os_(& os), status_(status_type()), bounded_(false),
+    swap_state_(s)
+{
+  ibufb = ibuf;
+  ibufe = ibuf + IBUFSZ;
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+alf::unicodestreams::u16bswap_streambuf::streambuf &
+alf::unicodestreams::u16bswap_streambuf::
+rebind(src_stream * is, dst_stream * os, swap_state_type s)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  swap_state_ = s;
+  this->setg(ibufb, ibufb, ibufb);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+alf::unicodestreams::u16bswap_streambuf::int_type
+alf::unicodestreams::u16bswap_streambuf::underflow()
+{
+  return get();
+}
+
+// virtual
+alf::unicodestreams::u16bswap_streambuf::int_type
+alf::unicodestreams::u16bswap_streambuf::overflow(int_type __c)
+{
+  return put(__c);
+}
+
+// virtual
+alf::unicodestreams::u16bswap_streambuf::streambuf *
+alf::unicodestreams::u16bswap_streambuf::
+setbuf(char_type * __s, std::streamsize __n)
+{
+
+  std::streamsize n = this->egptr() - this->eback();
+  std::streamsize q = this->gptr() - this->eback();
+  std::streamsize m = n - q; // still need to read.
+  std::streamsize u = q + m; // chars to keep over to new buffer.
+  if (__n > EBACK + 4 && __n >= m) {
+    if (q + m > 0) {
+      if (n > __n) n = __n;
+      if (q + m > n) q = n - m;
+      traits_type::move(__s, this->gptr() - q, u = q + m);
+    }
+    ibufb = __s;
+    ibufe = __s + __n;
+    this->setg(__s, __s + q, __s + u);
+  }
+  return this;
+
+}
+
+alf::unicodestreams::u16bswap_streambuf::int_type
+alf::unicodestreams::u16bswap_streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  // the swap state is sorted out first so the block is swapped in one
+  // go, for FChar the first unit tells.
+  char_type * p = save_putback(ibufb, this->gptr(), EBACK);
+  char_type * q = p;
+  if (swap_state_ == swap_state_type::FChar) {
+    if (read_raw(is_, q, 1, 1) != 1)
+      return traits_type::eof();
+    switch (*q) {
+    case 0xfffe:
+      swap_state_ = swap_state_type::v21;
+      break;
+    case 0xfeff:
+      swap_state_ = swap_state_type::v12;
+      break;
+    default:
+      return err_status(status_type::NO_BOM);
+    }
+    swap_units(int(swap_state_), q, q, 1);
+    ++q;
+  } else
+    swap_state_ = u16_check(swap_state_);
+  // bounded, a unit read for the BOM is all this time.
+  std::streamsize r = bounded_ ? q == p : ibufe - q;
+  q += decode_from(is_, q, r, q == p, s,
+		   swap_copier<char_type>(int(swap_state_)));
+  this->setg(ibufb, p, q);
+  if (q == p)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+alf::unicodestreams::u16bswap_streambuf::int_type
+alf::unicodestreams::u16bswap_streambuf::put(int_type c)
+{
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_ )
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+
+  char_type a = char_type(c);
+  if (! put_swap_state(os_, swap_state_, swap_state_type::v12, a))
+    return err_status(status_type::BAD_STREAM);
+  swap_units(int(swap_state_), & a, & a, 1);
+  if (! os_->put(a))
+    return err_status(status_type::BAD_STREAM);
+  return c;
+}
+
+// virtual
+// swap a block at a time.
+std::streamsize
+alf::unicodestreams::u16bswap_streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (status_ != status_type::OK || __n <= 0)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
+  if (! *os_ || ! put_swap_state(os_, swap_state_, swap_state_type::v12,
+				 *__s)) {
+    err_status(status_type::BAD_STREAM);
+    return 0;
+  }
+  std::streamsize k = put_swapped(os_, int(swap_state_), __s, __n);
+  if (k < __n)
+    err_status(status_type::BAD_STREAM);
+  return k;
+}
+
+////////////////////////////////
+// basic_bswap_
+
+// for reading.
+template <class C, int M>
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+basic_bswap_streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for writing
+template <class C, int M>
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+basic_bswap_streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for both.
+template <class C, int M>
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+basic_bswap_streambuf(src_stream & is, dst_stream & os)
+  : is_(& is), os_(& os), status_(status_type())
+{
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
+
+// for reuse, keep the buffer but nothing in it.
+template <class C, int M>
+typename alf::unicodestreams::basic_bswap_streambuf<C, M>::streambuf &
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+rebind(src_stream * is, dst_stream * os)
+{
+  is_ = is;
+  os_ = os;
+  status_ = status_type();
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+  return *this;
+}
+
+// virtual
+template <class C, int M>
+typename alf::unicodestreams::basic_bswap_streambuf<C, M>::int_type
+alf::unicodestreams::basic_bswap_streambuf<C, M>::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  C * p = save_putback(ibuf, this->gptr(), EBACK);
+  std::streamsize n = decode_from(is_, p, ibuf + IBUFSZ - p, 1, s,
+				  swap_copier<C, M>());
+  this->setg(ibuf, p, p + n);
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
+
+// virtual
+// swap straight into the callers buffer.
+template <class C, int M>
+std::streamsize
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  k += decode_from(is_, __s + k, __n - k, __n - k, s, swap_copier<C, M>());
+  C * p = copy_putback(ibuf, __s, k, EBACK);
+  this->setg(ibuf, p, p);
+  return k;
+}
+
+// virtual
+template <class C, int M>
+std::streamsize
+alf::unicodestreams::basic_bswap_streambuf<C, M>::showmanyc()
+{
+  if (status_ != status_type::OK || src_status(is_) != status_type::OK)
+    return 0;
+  return is_->rdbuf()->in_avail();
+}
+
+// virtual
+template <class C, int M>
+typename alf::unicodestreams::basic_bswap_streambuf<C, M>::int_type
+alf::unicodestreams::basic_bswap_streambuf<C, M>::overflow(int_type __c)
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (! *os_)
+    return err_status(status_type::BAD_STREAM);
+  if (traits_type::eq_int_type(__c, traits_type::eof()))
+    return traits_type::not_eof(__c);
+  if (! os_->put(swap_unit<M>(C(__c))))
+    return err_status(status_type::BAD_STREAM);
+  return __c;
+}
+
+// virtual
+// swap a block at a time.
+template <class C, int M>
+std::streamsize
+alf::unicodestreams::basic_bswap_streambuf<C, M>::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  constexpr std::streamsize CHUNK = 256;
+  C tmp[CHUNK];
+  std::streamsize k = 0;
+
+  if (status_ != status_type::OK)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
+  while (k < __n) {
+    std::streamsize j = __n - k < CHUNK ? __n - k : CHUNK;
+    swap_units<M>(__s + k, tmp, j);
+    if (! os_->write(tmp, j)) {
+      err_status(status_type::BAD_STREAM);
+      break;
+    }
+    k += j;
+  }
+  return k;
+}
+
+template class alf::unicodestreams::basic_bswap_streambuf<char16_t, 12>;
+template class alf::unicodestreams::basic_bswap_streambuf<char16_t, 21>;
+template class alf::unicodestreams::basic_bswap_streambuf<char32_t, 1234>;
+template class alf::unicodestreams::basic_bswap_streambuf<char32_t, 2143>;
+template class alf::unicodestreams::basic_bswap_streambuf<char32_t, 3412>;
+template class alf::unicodestreams::basic_bswap_streambuf<char32_t, 4321>;
+
+////////////////////////////////
+// u32line_reader
+
+alf::unicodestreams::u32line_reader::
+u32line_reader(src_stream & is, unsigned int eol /* = EOL_LF */,
+               std::size_t bufsz /* = BUFSZ */)
+  : sb_(is.rdbuf()), eol_(eol), eof_(false)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = lineb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
+}
+
+alf::unicodestreams::u32line_reader::
+u32line_reader(src_streambuf * sb, unsigned int eol /* = EOL_LF */,
+               std::size_t bufsz /* = BUFSZ */)
+  : sb_(sb), eol_(eol), eof_(false)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = lineb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
+}
+
+alf::unicodestreams::u32line_reader::~u32line_reader()
+{
+  delete [] bufb;
+}
+
+alf::unicodestreams::u32line_reader &
+alf::unicodestreams::u32line_reader::reset(src_streambuf * sb)
+{
+  sb_ = sb;
+  eof_ = false;
+  lineb = datae = bufb;
+  return *this;
+}
+
+bool
+alf::unicodestreams::u32line_reader::getline(view_type & line)
+{
+  std::size_t from = 0; // what we have already searched.
+
+  while (true) {
+    const char_type * p = find_eol(lineb + from, datae, eol_);
+    if (p < datae) {
+      const char_type * e = p;
+      if (*p == '\n' && (eol_ & EOL_CRLF) && e > lineb && e[-1] == '\r')
+	--e;
+      line = view_type(lineb, e - lineb);
+      lineb += p - lineb + 1;
+      return true;
+    }
+    from = datae - lineb;
+    if (! fill())
+      break;
+  }
+  if (lineb == datae)
+    return false;
+  line = view_type(lineb, datae - lineb);
+  lineb = datae;
+  return true;
+}
+
+// move what is left to the front of the buffer (grow it if it is full)
+// and read as much as the stream has available without blocking,
+// block only if we have nothing. Return false if nothing was read.
+bool
+alf::unicodestreams::u32line_reader::fill()
+{
+  if (sb_ == 0 || eof_)
+    return false;
+
+  std::size_t n = datae - lineb;
+  if (lineb > bufb) {
+    traits_type::move(bufb, lineb, n);
+  } else if (datae == bufe) {
+    std::size_t sz = 2 * (bufe - bufb);
+    char_type * b = new char_type[sz];
+    traits_type::copy(b, bufb, n);
+    delete [] bufb;
+    bufb = b;
+    bufe = b + sz;
+  }
+  lineb = bufb;
+  datae = bufb + n;
+
+  char_type * p = datae;
+  while (datae < bufe) {
+    std::streamsize k = sb_->in_avail();
+    if (k <= 0) {
+      if (datae > p)
+	break;
+      if (traits_type::eq_int_type(sb_->sgetc(), traits_type::eof())) {
+	eof_ = true;
+	break;
+      }
+      k = sb_->in_avail();
+    }
+    if (k > bufe - datae)
+      k = bufe - datae;
+    std::streamsize m = sb_->sgetn(datae, k);
+    datae += m;
+    if (m < k) {
+      eof_ = true;
+      break;
+    }
+  }
+  return datae > p;
+}
+
+////////////////////////////////
+// u16line_reader
+
+alf::unicodestreams::u16line_reader::
+u16line_reader(src_stream & is, unsigned int eol /* = EOL_LF */,
+               std::size_t bufsz /* = BUFSZ */)
+  : sb_(is.rdbuf()), eol_(eol), eof_(false)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = lineb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
+}
+
+alf::unicodestreams::u16line_reader::
+u16line_reader(src_streambuf * sb, unsigned int eol /* = EOL_LF */,
+               std::size_t bufsz /* = BUFSZ */)
+  : sb_(sb), eol_(eol), eof_(false)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = lineb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
+}
+
+alf::unicodestreams::u16line_reader::~u16line_reader()
+{
+  delete [] bufb;
+}
+
+alf::unicodestreams::u16line_reader &
+alf::unicodestreams::u16line_reader::reset(src_streambuf * sb)
+{
+  sb_ = sb;
+  eof_ = false;
+  lineb = datae = bufb;
+  return *this;
+}
+
+bool
+alf::unicodestreams::u16line_reader::getline(view_type & line)
+{
+  std::size_t from = 0; // what we have already searched.
+
+  while (true) {
+    const char_type * p = find_eol(lineb + from, datae, eol_);
+    if (p < datae) {
+      const char_type * e = p;
+      if (*p == '\n' && (eol_ & EOL_CRLF) && e > lineb && e[-1] == '\r')
+	--e;
+      line = view_type(lineb, e - lineb);
+      lineb += p - lineb + 1;
+      return true;
+    }
+    from = datae - lineb;
+    if (! fill())
+      break;
+  }
+  if (lineb == datae)
+    return false;
+  line = view_type(lineb, datae - lineb);
+  lineb = datae;
+  return true;
+}
+
+// move what is left to the front of the buffer (grow it if it is full)
+// and read as much as the stream has available without blocking,
+// block only if we have nothing. Return false if nothing was read.
+bool
+alf::unicodestreams::u16line_reader::fill()
+{
+  if (sb_ == 0 || eof_)
+    return false;
+
+  std::size_t n = datae - lineb;
+  if (lineb > bufb) {
+    traits_type::move(bufb, lineb, n);
+  } else if (datae == bufe) {
+    std::size_t sz = 2 * (bufe - bufb);
+    char_type * b = new char_type[sz];
+    traits_type::copy(b, bufb, n);
+    delete [] bufb;
+    bufb = b;
+    bufe = b + sz;
+  }
+  lineb = bufb;
+  datae = bufb + n;
+
+  char_type * p = datae;
+  while (datae < bufe) {
+    std::streamsize k = sb_->in_avail();
+    if (k <= 0) {
+      if (datae > p)
+	break;
+      if (traits_type::eq_int_type(sb_->sgetc(), traits_type::eof())) {
+	eof_ = true;
+	break;
+      }
+      k = sb_->in_avail();
+    }
+    if (k > bufe - datae)
+      k = bufe - datae;
+    std::streamsize m = sb_->sgetn(datae, k);
+    datae += m;
+    if (m < k) {
+      eof_ = true;
+      break;
+    }
+  }
+  return datae > p;
+}
+
+////////////////////////////////
+// u32utf8_reverse_reader
+
+alf::unicodestreams::u32utf8_reverse_reader::
+u32utf8_reverse_reader(src_stream & is, unsigned int eol /* = EOL_LF */,
+                       std::size_t bufsz /* = BUFSZ */)
+  : is_(& is), eol_(eol), status_(status_type::OK),
+    beg_(0), end_(0), pos_(0)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  buf = new ext_char_type[bufsz];
+  bufe = buf + bufsz;
+  bufb = cur = bufe;
+  if (! is) {
+    status_ = status_type::BAD_STREAM;
+    return;
+  }
+  beg_ = is.tellg();
+  if (beg_ < 0 || ! is.seekg(0, std::ios_base::end)
+      || (end_ = is.tellg()) < beg_) {
+    status_ = status_type::BAD_STREAM;
+    beg_ = end_ = 0;
+  }
+  pos_ = end_;
+}
+
+alf::unicodestreams::u32utf8_reverse_reader::~u32utf8_reverse_reader()
+{
+  delete [] buf;
+}
+
+alf::unicodestreams::u32utf8_reverse_reader::int_type
+alf::unicodestreams::u32utf8_reverse_reader::get()
+{
+  enum { MAXLEN = utf8_rdecoder::MAXLEN };
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (cur - bufb < MAXLEN)
+    fill();
+  if (cur == bufb)
+    return traits_type::eof();
+
+  char32_t w;
+  int k;
+  status_type s = utf8_rdecoder()(bufb, cur, w, k, tell() == end_);
+  if (s != status_type::OK) {
+    status_ = s;
+    return traits_type::eof();
+  }
+  cur -= k;
+  return traits_type::to_int_type(w);
+}
+
+// every call first eats the line terminator that ends the line, either
+// the one at the end of the stream or the one we left last time.
+bool
+alf::unicodestreams::u32utf8_reverse_reader::getline(std::u32string & line)
+{
+  bool first = true;
+
+  line.clear();
+  if (status_ != status_type::OK || tell() == beg_)
+    return false;
+  while (true) {
+    std::streamoff at = tell();
+    int_type c = get();
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      if (status_ != status_type::OK)
+	return false;
+      break;
+    }
+    if (is_eol(c, eol_)) {
+      if (! first) {
+	// leave it for the next line, get() keeps it in the buffer.
+	cur = bufb + (at - pos_);
+	break;
+      }
+      if (c == '\n' && (eol_ & EOL_CRLF)
+	  && (cur > bufb || fill()) && cur[-1] == '\r')
+	--cur;
+    } else
+      line += char32_t(c);
+    first = false;
+  }
+  std::reverse(line.begin(), line.end());
+  return true;
+}
+
+// read the block before what we have to the front of the buffer, the
+// codes not yet returned and a few after them are moved to the end.
+// Return false if there is nothing more to read.
+bool
+alf::unicodestreams::u32utf8_reverse_reader::fill()
+{
+  enum { MAXLEN = utf8_rdecoder::MAXLEN };
+  typedef std::char_traits<ext_char_type> ext_traits_type;
+
+  if (pos_ <= beg_ || status_ != status_type::OK)
+    return false;
+
+  std::streamoff tail = bufe - cur;
+  if (tail > MAXLEN)
+    tail = MAXLEN;
+  std::streamoff keep = (cur - bufb) + tail;
+  ext_traits_type::move(bufe - keep, bufb, keep);
+  cur = bufe - tail;
+
+  std::streamoff n = (bufe - buf) - keep;
+  if (n > pos_ - beg_)
+    n = pos_ - beg_;
+  bufb = bufe - keep - n;
+  pos_ -= n;
+  is_->clear();
+  if (! is_->seekg(pos_) || ! is_->read(bufb, n)) {
+    status_ = status_type::BAD_STREAM;
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////
+// u32u16_reverse_reader
+
+alf::unicodestreams::u32u16_reverse_reader::
+u32u16_reverse_reader(src_stream & is, unsigned int eol /* = EOL_LF */,
+                      std::size_t bufsz /* = BUFSZ */)
+  : is_(& is), eol_(eol), status_(status_type::OK),
+    beg_(0), end_(0), pos_(0)
+{
+  if (bufsz < 16)
+    bufsz = 16;
+  buf = new ext_char_type[bufsz];
+  bufe = buf + bufsz;
+  bufb = cur = bufe;
+  if (! is) {
+    status_ = status_type::BAD_STREAM;
+    return;
+  }
+  beg_ = is.tellg();
+  if (beg_ < 0 || ! is.seekg(0, std::ios_base::end)
+      || (end_ = is.tellg()) < beg_) {
+    status_ = status_type::BAD_STREAM;
+    beg_ = end_ = 0;
+  }
+  pos_ = end_;
+}
+
+alf::unicodestreams::u32u16_reverse_reader::~u32u16_reverse_reader()
+{
+  delete [] buf;
+}
+
+alf::unicodestreams::u32u16_reverse_reader::int_type
+alf::unicodestreams::u32u16_reverse_reader::get()
+{
+  enum { MAXLEN = u16_rdecoder::MAXLEN };
+
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (cur - bufb < MAXLEN)
+    fill();
+  if (cur == bufb)
+    return traits_type::eof();
+
+  char32_t w;
+  int k;
+  status_type s = u16_rdecoder()(bufb, cur, w, k, tell() == end_);
+  if (s != status_type::OK) {
+    status_ = s;
+    return traits_type::eof();
+  }
+  cur -= k;
+  return traits_type::to_int_type(w);
+}
+
+// every call first eats the line terminator that ends the line, either
+// the one at the end of the stream or the one we left last time.
+bool
+alf::unicodestreams::u32u16_reverse_reader::getline(std::u32string & line)
+{
+  bool first = true;
+
+  line.clear();
+  if (status_ != status_type::OK || tell() == beg_)
+    return false;
+  while (true) {
+    std::streamoff at = tell();
+    int_type c = get();
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+      if (status_ != status_type::OK)
+	return false;
+      break;
+    }
+    if (is_eol(c, eol_)) {
+      if (! first) {
+	// leave it for the next line, get() keeps it in the buffer.
+	cur = bufb + (at - pos_);
+	break;
+      }
+      if (c == '\n' && (eol_ & EOL_CRLF)
+	  && (cur > bufb || fill()) && cur[-1] == '\r')
+	--cur;
+    } else
+      line += char32_t(c);
+    first = false;
+  }
+  std::reverse(line.begin(), line.end());
+  return true;
+}
+
+// read the block before what we have to the front of the buffer, the
+// codes not yet returned and a few after them are moved to the end.
+// Return false if there is nothing more to read.
+bool
+alf::unicodestreams::u32u16_reverse_reader::fill()
+{
+  enum { MAXLEN = u16_rdecoder::MAXLEN };
+  typedef std::char_traits<ext_char_type> ext_traits_type;
+
+  if (pos_ <= beg_ || status_ != status_type::OK)
+    return false;
+
+  std::streamoff tail = bufe - cur;
+  if (tail > MAXLEN)
+    tail = MAXLEN;
+  std::streamoff keep = (cur - bufb) + tail;
+  ext_traits_type::move(bufe - keep, bufb, keep);
+  cur = bufe - tail;
+
+  std::streamoff n = (bufe - buf) - keep;
+  if (n > pos_ - beg_)
+    n = pos_ - beg_;
+  bufb = bufe - keep - n;
+  pos_ -= n;
+  is_->clear();
+  if (! is_->seekg(pos_) || ! is_->read(bufb, n)) {
+    status_ = status_type::BAD_STREAM;
+    return false;
+  }
+  return true;
+}
+
+////////////////////////////////
+// u32utf8_codecvt
+
+alf::unicodestreams::u32utf8_codecvt::~u32utf8_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::u32utf8_codecvt::result
+alf::unicodestreams::u32utf8_codecvt::
+do_out(state_type & state,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  return utf8_out(state, from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+alf::unicodestreams::u32utf8_codecvt::result
+alf::unicodestreams::u32utf8_codecvt::
+do_unshift(state_type & state, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return load_state(state).u ? error : noconv;
+}
+
+// virtual
+alf::unicodestreams::u32utf8_codecvt::result
+alf::unicodestreams::u32utf8_codecvt::
+do_in(state_type & state,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  return utf8_in(state, from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+int
+alf::unicodestreams::u32utf8_codecvt::do_encoding() const throw()
+{
+  return 0;
+}
+
+// virtual
+bool
+alf::unicodestreams::u32utf8_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::u32utf8_codecvt::
+do_length(state_type & state, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return utf8_in_length<char32_t>(state, from, end, max);
+}
+
+// virtual
+int
+alf::unicodestreams::u32utf8_codecvt::do_max_length() const throw()
+{
+  return 4;
+}
+
+////////////////////////////////
+// u16utf8_codecvt
+
+alf::unicodestreams::u16utf8_codecvt::~u16utf8_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::u16utf8_codecvt::result
+alf::unicodestreams::u16utf8_codecvt::
+do_out(state_type & state,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  return utf8_out(state, from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+alf::unicodestreams::u16utf8_codecvt::result
+alf::unicodestreams::u16utf8_codecvt::
+do_unshift(state_type & state, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return load_state(state).u ? error : noconv;
+}
+
+// virtual
+alf::unicodestreams::u16utf8_codecvt::result
+alf::unicodestreams::u16utf8_codecvt::
+do_in(state_type & state,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  return utf8_in(state, from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+int
+alf::unicodestreams::u16utf8_codecvt::do_encoding() const throw()
+{
+  return 0;
+}
+
+// virtual
+bool
+alf::unicodestreams::u16utf8_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::u16utf8_codecvt::
+do_length(state_type & state, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return utf8_in_length<char16_t>(state, from, end, max);
+}
+
+// virtual
+int
+alf::unicodestreams::u16utf8_codecvt::do_max_length() const throw()
+{
+  return 4;
+}
+
+////////////////////////////////
+// wutf8_codecvt
+
+alf::unicodestreams::wutf8_codecvt::~wutf8_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::wutf8_codecvt::result
+alf::unicodestreams::wutf8_codecvt::
+do_out(state_type & state,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  const wchar_unit * p;
+  result r = utf8_out(state, (const wchar_unit *)from,
+		      (const wchar_unit *)from_end, p, to, to_end, to_next);
+  from_next = (const intern_type *)p;
+  return r;
+}
+
+// virtual
+alf::unicodestreams::wutf8_codecvt::result
+alf::unicodestreams::wutf8_codecvt::
+do_unshift(state_type & state, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return load_state(state).u ? error : noconv;
+}
+
+// virtual
+alf::unicodestreams::wutf8_codecvt::result
+alf::unicodestreams::wutf8_codecvt::
+do_in(state_type & state,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  wchar_unit * q;
+  result r = utf8_in(state, from, from_end, from_next,
+		     (wchar_unit *)to, (wchar_unit *)to_end, q);
+  to_next = (intern_type *)q;
+  return r;
+}
+
+// virtual
+int
+alf::unicodestreams::wutf8_codecvt::do_encoding() const throw()
+{
+  return 0;
+}
+
+// virtual
+bool
+alf::unicodestreams::wutf8_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::wutf8_codecvt::
+do_length(state_type & state, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return utf8_in_length<wchar_unit>(state, from, end, max);
+}
+
+// virtual
+int
+alf::unicodestreams::wutf8_codecvt::do_max_length() const throw()
+{
+  return 4;
+}
+
+////////////////////////////////
+// u32iso8859_1_codecvt
+
+alf::unicodestreams::u32iso8859_1_codecvt::~u32iso8859_1_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_codecvt::result
+alf::unicodestreams::u32iso8859_1_codecvt::
+do_out(state_type &,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  return latin1_out(from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_codecvt::result
+alf::unicodestreams::u32iso8859_1_codecvt::
+do_unshift(state_type &, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return noconv;
+}
+
+// virtual
+alf::unicodestreams::u32iso8859_1_codecvt::result
+alf::unicodestreams::u32iso8859_1_codecvt::
+do_in(state_type &,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  return latin1_in(from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+int
+alf::unicodestreams::u32iso8859_1_codecvt::do_encoding() const throw()
+{
+  return 1;
+}
+
+// virtual
+bool
+alf::unicodestreams::u32iso8859_1_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::u32iso8859_1_codecvt::
+do_length(state_type &, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return int(std::size_t(end - from) < max ? end - from : max);
+}
+
+// virtual
+int
+alf::unicodestreams::u32iso8859_1_codecvt::do_max_length() const throw()
+{
+  return 1;
+}
+
+////////////////////////////////
+// u16iso8859_1_codecvt
+
+alf::unicodestreams::u16iso8859_1_codecvt::~u16iso8859_1_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_codecvt::result
+alf::unicodestreams::u16iso8859_1_codecvt::
+do_out(state_type &,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  return latin1_out(from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_codecvt::result
+alf::unicodestreams::u16iso8859_1_codecvt::
+do_unshift(state_type &, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return noconv;
+}
+
+// virtual
+alf::unicodestreams::u16iso8859_1_codecvt::result
+alf::unicodestreams::u16iso8859_1_codecvt::
+do_in(state_type &,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  return latin1_in(from, from_end, from_next, to, to_end, to_next);
+}
+
+// virtual
+int
+alf::unicodestreams::u16iso8859_1_codecvt::do_encoding() const throw()
+{
+  return 1;
+}
+
+// virtual
+bool
+alf::unicodestreams::u16iso8859_1_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::u16iso8859_1_codecvt::
+do_length(state_type &, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return int(std::size_t(end - from) < max ? end - from : max);
+}
+
+// virtual
+int
+alf::unicodestreams::u16iso8859_1_codecvt::do_max_length() const throw()
+{
+  return 1;
+}
+
+////////////////////////////////
+// wiso8859_1_codecvt
+
+alf::unicodestreams::wiso8859_1_codecvt::~wiso8859_1_codecvt()
+{
+}
+
+// virtual
+alf::unicodestreams::wiso8859_1_codecvt::result
+alf::unicodestreams::wiso8859_1_codecvt::
+do_out(state_type &,
+       const intern_type * from, const intern_type * from_end,
+       const intern_type *& from_next,
+       extern_type * to, extern_type * to_end, extern_type *& to_next) const
+{
+  const wchar_unit * p;
+  result r = latin1_out((const wchar_unit *)from, (const wchar_unit *)from_end,
+			p, to, to_end, to_next);
+  from_next = (const intern_type *)p;
+  return r;
+}
+
+// virtual
+alf::unicodestreams::wiso8859_1_codecvt::result
+alf::unicodestreams::wiso8859_1_codecvt::
+do_unshift(state_type &, extern_type * to, extern_type *,
+	   extern_type *& to_next) const
+{
+  to_next = to;
+  return noconv;
+}
+
+// virtual
+alf::unicodestreams::wiso8859_1_codecvt::result
+alf::unicodestreams::wiso8859_1_codecvt::
+do_in(state_type &,
+      const extern_type * from, const extern_type * from_end,
+      const extern_type *& from_next,
+      intern_type * to, intern_type * to_end, intern_type *& to_next) const
+{
+  wchar_unit * q;
+  result r = latin1_in(from, from_end, from_next,
+		       (wchar_unit *)to, (wchar_unit *)to_end, q);
+  to_next = (intern_type *)q;
+  return r;
+}
+
+// virtual
+int
+alf::unicodestreams::wiso8859_1_codecvt::do_encoding() const throw()
+{
+  return 1;
+}
+
+// virtual
+bool
+alf::unicodestreams::wiso8859_1_codecvt::do_always_noconv() const throw()
+{
+  return false;
+}
+
+// virtual
+int
+alf::unicodestreams::wiso8859_1_codecvt::
+do_length(state_type &, const extern_type * from,
+	  const extern_type * end, std::size_t max) const
+{
+  return int(std::size_t(end - from) < max ? end - from : max);
+}
+
+// virtual
+int
+alf::unicodestreams::wiso8859_1_codecvt::do_max_length() const throw()
+{
+  return 1;
+}
+
+////////////////////////////////
+// utf8_reader
+
+template <class C>
+alf::unicodestreams::utf8_reader<C>::
+utf8_reader(source_type src, void * ctx, std::size_t bufsz /* = BUFSZ */)
+  : src_(src), ctx_(ctx), buf_(0), bufsz_(0), pos_(0), end_(0),
+    status_(status_type::OK), pend_(0), own_(true), eof_(false)
+{
+  if (bufsz < MINBUFSZ)
+    bufsz = MINBUFSZ;
+  buf_ = new char[bufsz];
+  bufsz_ = std::uint32_t(bufsz);
+  if (src_ == 0)
+    status_ = status_type::NO_STREAM;
+}
+
+template <class C>
+alf::unicodestreams::utf8_reader<C>::
+utf8_reader(source_type src, void * ctx, char * buf, std::size_t bufsz)
+  : src_(src), ctx_(ctx), buf_(buf), bufsz_(std::uint32_t(bufsz)),
+    pos_(0), end_(0), status_(status_type::OK), pend_(0), own_(false),
+    eof_(false)
+{
+  if (src_ == 0)
+    status_ = status_type::NO_STREAM;
+  else if (buf_ == 0 || bufsz < MINBUFSZ)
+    status_ = status_type::BAD_STREAM;
+}
+
+template <class C>
+alf::unicodestreams::utf8_reader<C>::~utf8_reader()
+{
+  if (own_)
+    delete [] buf_;
+}
+
+template <class C>
+alf::unicodestreams::utf8_reader<C> &
+alf::unicodestreams::utf8_reader<C>::reset(source_type src, void * ctx)
+{
+  src_ = src;
+  ctx_ = ctx;
+  pos_ = end_ = 0;
+  pend_ = 0;
+  eof_ = false;
+  if (src_ == 0)
+    status_ = status_type::NO_STREAM;
+  else if (buf_ == 0 || bufsz_ < MINBUFSZ)
+    status_ = status_type::BAD_STREAM;
+  else
+    status_ = status_type::OK;
+  return *this;
+}
+
+template <class C>
+typename alf::unicodestreams::utf8_reader<C>::int_type
+alf::unicodestreams::utf8_reader<C>::get()
+{
+  char_type c;
+
+  if (read(& c, 1) == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(c);
+}
+
+template <class C>
+typename alf::unicodestreams::utf8_reader<C>::int_type
+alf::unicodestreams::utf8_reader<C>::peek()
+{
+  char_type c[2];
+  char_type * d = c;
+
+  if (pend_)
+    return traits_type::to_int_type(pend_);
+  while (status_ == status_type::OK) {
+    if (pos_ == end_ && ! fill(1))
+      break;
+    const char * p = buf_ + pos_;
+    const char * pe = buf_ + end_;
+    int m = utf8_decoder::need(p, pe);
+    if (m > 0) {
+      if (! fill(end_ - pos_ + m))
+	break;
+      continue;
+    }
+    // only the first code point, an error after it is for read().
+    int k = utf8_seq_len((unsigned char)*p);
+    if (k > 0 && pe - p > k)
+      pe = p + k;
+    status_type st = utf8_decoder()(p, pe, d, c + 2);
+    if (d > c)
+      return traits_type::to_int_type(c[0]);
+    status_ = st != status_type::OK ? st : status_type::BAD_STREAM;
+    break;
+  }
+  return traits_type::eof();
+}
+
+template <class C>
+std::size_t
+alf::unicodestreams::utf8_reader<C>::read(char_type * s, std::size_t n)
+{
+  std::size_t k = 0;
+
+  if (n > 0 && pend_) {
+    s[k++] = pend_;
+    pend_ = 0;
+  }
+  while (k < n && status_ == status_type::OK) {
+    if (pos_ == end_ && ! fill(1))
+      break;
+    const char * p = buf_ + pos_;
+    const char * pe = buf_ + end_;
+    char_type * d = s + k;
+    status_type st = utf8_decoder()(p, pe, d, s + n);
+    pos_ = std::uint32_t(p - buf_);
+    k = d - s;
+    if (st != status_type::OK) {
+      status_ = st;
+      break;
+    }
+    if (k == n || p == pe)
+      continue;
+    int m = utf8_decoder::need(p, pe);
+    if (m > 0) {
+      fill(end_ - pos_ + m);
+      continue;
+    }
+    // a surrogate pair and room for only one half.
+    char_type c[2];
+    d = c;
+    if ((st = utf8_decoder()(p, pe, d, c + 2)) != status_type::OK) {
+      status_ = st;
+      break;
+    }
+    pos_ = std::uint32_t(p - buf_);
+    s[k++] = c[0];
+    pend_ = c[1];
+  }
+  return k;
+}
+
+template <class C>
+std::size_t
+alf::unicodestreams::utf8_reader<C>::skip(std::size_t n)
+{
+  std::streamsize left = n;
+
+  // the low half of a pair completes a code point already read.
+  pend_ = 0;
+  while (left > 0 && status_ == status_type::OK) {
+    if (pos_ == end_ && ! fill(1))
+      break;
+    const char * p = buf_ + pos_;
+    const char * pe = buf_ + end_;
+    status_type st = utf8_decoder().skip(p, pe, left);
+    pos_ = std::uint32_t(p - buf_);
+    if (st != status_type::OK) {
+      status_ = st;
+      break;
+    }
+    if (left > 0 && p < pe)
+      fill(end_ - pos_ + utf8_decoder::need(p, pe));
+  }
+  return n - left;
+}
+
+// make sure we have at least want bytes after pos_, move what we have
+// to the front and call the source until we do. Return false at end of
+// input or on error, an incomplete sequence at the end is BAD_STREAM.
+template <class C>
+bool
+alf::unicodestreams::utf8_reader<C>::fill(std::size_t want)
+{
+  if (pos_ > 0) {
+    std::memmove(buf_, buf_ + pos_, end_ - pos_);
+    end_ -= pos_;
+    pos_ = 0;
+  }
+  while (end_ < want) {
+    std::ptrdiff_t k = eof_ ? 0 : src_(ctx_, buf_ + end_, bufsz_ - end_);
+    if (k <= 0) {
+      if (k < 0)
+	status_ = status_type::BAD_STREAM;
+      eof_ = true;
+      if (end_ > 0)
+	status_ = status_type::BAD_STREAM;
+      return false;
+    }
+    end_ += std::uint32_t(k);
+  }
+  return true;
+}
+
+template class alf::unicodestreams::utf8_reader<char32_t>;
+template class alf::unicodestreams::utf8_reader<char16_t>;
+
+////////////////////////////////
+// utf8_writer
+
+template <class C>
+alf::unicodestreams::utf8_writer<C>::
+utf8_writer(sink_type snk, void * ctx, std::size_t bufsz /* = BUFSZ */)
+  : snk_(snk), ctx_(ctx), buf_(0), bufsz_(0), end_(0),
+    status_(status_type::OK), pend_(0), own_(true)
+{
+  if (bufsz < MINBUFSZ)
+    bufsz = MINBUFSZ;
+  buf_ = new char[bufsz];
+  bufsz_ = std::uint32_t(bufsz);
+  if (snk_ == 0)
+    status_ = status_type::NO_STREAM;
+}
+
+template <class C>
+alf::unicodestreams::utf8_writer<C>::
+utf8_writer(sink_type snk, void * ctx, char * buf, std::size_t bufsz)
+  : snk_(snk), ctx_(ctx), buf_(buf), bufsz_(std::uint32_t(bufsz)), end_(0),
+    status_(status_type::OK), pend_(0), own_(false)
+{
+  if (snk_ == 0)
+    status_ = status_type::NO_STREAM;
+  else if (buf_ == 0 || bufsz < MINBUFSZ)
+    status_ = status_type::BAD_STREAM;
+}
+
+template <class C>
+alf::unicodestreams::utf8_writer<C>::~utf8_writer()
+{
+  flush();
+  if (own_)
+    delete [] buf_;
+}
+
+template <class C>
+alf::unicodestreams::utf8_writer<C> &
+alf::unicodestreams::utf8_writer<C>::reset(sink_type snk, void * ctx)
+{
+  snk_ = snk;
+  ctx_ = ctx;
+  end_ = 0;
+  pend_ = 0;
+  if (snk_ == 0)
+    status_ = status_type::NO_STREAM;
+  else if (buf_ == 0 || bufsz_ < MINBUFSZ)
+    status_ = status_type::BAD_STREAM;
+  else
+    status_ = status_type::OK;
+  return *this;
+}
+
+template <class C>
+std::size_t
+alf::unicodestreams::utf8_writer<C>::write(const char_type * s, std::size_t n)
+{
+  std::size_t k = 0;
+  status_type st;
+
+  if (status_ != status_type::OK)
+    return 0;
+  if (n > 0 && pend_) {
+    // the high surrogate from last time.
+    char_type pair[2] = { pend_, s[0] };
+    const char_type * p = pair;
+    if (bufsz_ - end_ < 4 && ! flush())
+      return 0;
+    char * d = buf_ + end_;
+    if ((st = utf8_encoder()(p, pair + 2, d, buf_ + bufsz_))
+	!= status_type::OK) {
+      status_ = st;
+      return 0;
+    }
+    end_ = std::uint32_t(d - buf_);
+    pend_ = 0;
+    k = 1;
+  }
+  while (k < n) {
+    const char_type * p = s + k;
+    char * d = buf_ + end_;
+    st = utf8_encoder()(p, s + n, d, buf_ + bufsz_);
+    end_ = std::uint32_t(d - buf_);
+    k = p - s;
+    if (st != status_type::OK) {
+      status_ = st;
+      break;
+    }
+    if (k == n)
+      break;
+    if (utf8_encoder::need(p, s + n) > 0) {
+      pend_ = s[k++];
+      break;
+    }
+    if (! flush())
+      break;
+  }
+  return k;
+}
+
+template <class C>
+bool
+alf::unicodestreams::utf8_writer<C>::flush()
+{
+  std::uint32_t i = 0;
+
+  // what was encoded before an invalid code is still written.
+  if (snk_ == 0 || status_ == status_type::BAD_STREAM)
+    return false;
+  while (i < end_) {
+    std::ptrdiff_t k = snk_(ctx_, buf_ + i, end_ - i);
+    if (k <= 0) {
+      status_ = status_type::BAD_STREAM;
+      break;
+    }
+    i += std::uint32_t(k);
+  }
+  std::memmove(buf_, buf_ + i, end_ - i);
+  end_ -= i;
+  return end_ == 0;
+}
+
+template class alf::unicodestreams::utf8_writer<char32_t>;
+template class alf::unicodestreams::utf8_writer<char16_t>;
+
+////////////////////////////////
+// memory_source
+
+// virtual
+template <class E>
+typename alf::unicodestreams::memory_source<E>::pos_type
+alf::unicodestreams::memory_source<E>::
+seekoff(off_type off, std::ios_base::seekdir dir,
+	std::ios_base::openmode which)
+{
+  off_type n = this->egptr() - this->eback();
+  off_type at = off;
+
+  if (! (which & std::ios_base::in))
+    return pos_type(off_type(-1));
+  if (dir == std::ios_base::cur)
+    at += this->gptr() - this->eback();
+  else if (dir == std::ios_base::end)
+    at += n;
+  if (at < 0 || at > n)
+    return pos_type(off_type(-1));
+  this->setg(this->eback(), this->eback() + at, this->egptr());
+  return pos_type(at);
+}
+
+// virtual
+template <class E>
+typename alf::unicodestreams::memory_source<E>::pos_type
+alf::unicodestreams::memory_source<E>::
+seekpos(pos_type pos, std::ios_base::openmode which)
+{
+  return seekoff(off_type(pos), std::ios_base::beg, which);
+}
+
+template class alf::unicodestreams::memory_source<char>;
+template class alf::unicodestreams::memory_source<char16_t>;
+template class alf::unicodestreams::memory_source<char32_t>;
+
+////////////////////////////////
+// memory_sink
+
+template <class E>
+void
+alf::unicodestreams::memory_sink<E>::reserve(std::size_t n)
+{
+  if (n > buf_.size()) {
+    std::size_t k = size();
+    buf_.resize(n);
+    set_size(k);
+  }
+}
+
+template <class E>
+typename alf::unicodestreams::memory_sink<E>::char_type *
+alf::unicodestreams::memory_sink<E>::prepare(std::size_t n)
+{
+  if (std::size_t(this->epptr() - this->pptr()) < n) {
+    std::size_t k = 2 * buf_.size();
+    if (k < size() + n)
+      k = size() + n;
+    if (k < 64)
+      k = 64;
+    reserve(k);
+  }
+  return this->pptr();
+}
+
+template <class E>
+typename alf::unicodestreams::memory_sink<E>::string_type
+alf::unicodestreams::memory_sink<E>::release()
+{
+  buf_.resize(size());
+  string_type s(std::move(buf_));
+  buf_ = string_type();
+  this->setp(0, 0);
+  return s;
+}
+
+// virtual
+template <class E>
+typename alf::unicodestreams::memory_sink<E>::int_type
+alf::unicodestreams::memory_sink<E>::overflow(int_type c)
+{
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  *prepare(1) = traits_type::to_char_type(c);
+  commit(1);
+  return c;
+}
+
+// virtual
+template <class E>
+std::streamsize
+alf::unicodestreams::memory_sink<E>::
+xsputn(const char_type * s, std::streamsize n)
+{
+  traits_type::copy(prepare(n), s, n);
+  commit(n);
+  return n;
+}
+
+// the put area is all of buf_ and the first n codes are used.
+template <class E>
+void
+alf::unicodestreams::memory_sink<E>::set_size(std::size_t n)
+{
+  char_type * b = buf_.empty() ? 0 : & buf_[0];
+  this->setp(b, b + buf_.size());
+  for (; n > INT_MAX; n -= INT_MAX)
+    this->pbump(INT_MAX);
+  this->pbump(int(n));
+}
+
+template class alf::unicodestreams::memory_sink<char>;
+template class alf::unicodestreams::memory_sink<char16_t>;
+template class alf::unicodestreams::memory_sink<char32_t>;
+
+////////////////////////////////
+// one shot conversions
+
+std::string
+alf::unicodestreams::to_utf8(std::u32string_view s,
+			     status_type * st /* = 0 */)
+{
+  std::string r(utf8_length(s.data(), s.size()), '\0');
+  const char32_t * p = s.data();
+  char * d = & r[0];
+  status_type e = utf8_encoder()(p, p + s.size(), d, d + r.size());
+
+  r.resize(d - r.data());
+  if (st)
+    *st = e;
+  return r;
 }
 
-// virtual
-alf::unicodestreams::u32utf8streambuf::int_type
-alf::unicodestreams::u32utf8streambuf::underflow()
+std::string
+alf::unicodestreams::to_utf8(std::u16string_view s,
+			     status_type * st /* = 0 */)
 {
-  return get();
+  std::string r(utf8_length(s.data(), s.size()), '\0');
+  const char16_t * p = s.data();
+  const char16_t * pe = p + s.size();
+  char * d = & r[0];
+  status_type e = utf8_encoder()(p, pe, d, d + r.size());
+
+  // a high surrogate at the very end.
+  if (e == status_type::OK && p < pe)
+    e = status_type::NO_FOLLOW;
+  r.resize(d - r.data());
+  if (st)
+    *st = e;
+  return r;
 }
 
-// virtual
-alf::unicodestreams::u32utf8streambuf::int_type
-alf::unicodestreams::u32utf8streambuf::overflow(int_type __c)
+std::u32string
+alf::unicodestreams::to_u32(std::string_view s, status_type * st /* = 0 */)
 {
-  return put(__c);
+  std::u32string r(count_utf8(s.data(), s.size()), U'\0');
+  const char * p = s.data();
+  const char * pe = p + s.size();
+  char32_t * d = & r[0];
+  status_type e = utf8_decoder()(p, pe, d, d + r.size());
+
+  // an incomplete sequence at the very end.
+  if (e == status_type::OK && p < pe)
+    e = status_type::BAD_STREAM;
+  r.resize(d - r.data());
+  if (st)
+    *st = e;
+  return r;
 }
 
-// virtual
-alf::unicodestreams::u32utf8streambuf::streambuf *
-alf::unicodestreams::u32utf8streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+std::u16string
+alf::unicodestreams::to_u16(std::string_view s, status_type * st /* = 0 */)
 {
+  std::u16string r(u16_length(s.data(), s.size()), u'\0');
+  const char * p = s.data();
+  const char * pe = p + s.size();
+  char16_t * d = & r[0];
+  status_type e = utf8_decoder()(p, pe, d, d + r.size());
+
+  // an incomplete sequence at the very end.
+  if (e == status_type::OK && p < pe)
+    e = status_type::BAD_STREAM;
+  r.resize(d - r.data());
+  if (st)
+    *st = e;
+  return r;
+}
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
+////////////////////////////////
+// batch conversions
 
+std::size_t
+alf::unicodestreams::batch_to_utf8(const char16_t * data,
+				   const std::size_t * off, std::size_t n,
+				   batch<char> & out)
+{
+  return convert_batch(data, off, n, out, batch_encoder());
 }
 
-alf::unicodestreams::u32utf8streambuf::int_type
-alf::unicodestreams::u32utf8streambuf::get()
+std::size_t
+alf::unicodestreams::batch_to_utf8(const char32_t * data,
+				   const std::size_t * off, std::size_t n,
+				   batch<char> & out)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  int_type c = get_utf8(is_);
-  if (c < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb, ibufe - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
-  }
-  this->setg(this->egptr(), this->gptr(), this->egptr() + 1);
-  return traits_type::to_int_type(*gptr() = c);
+  return convert_batch(data, off, n, out, batch_encoder());
 }
 
-alf::unicodestreams::u32utf8streambuf::int_type
-alf::unicodestreams::u32utf8streambuf::put(int_type c)
+std::size_t
+alf::unicodestreams::batch_to_u16(const char * data,
+				  const std::size_t * off, std::size_t n,
+				  batch<char16_t> & out)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
-  int_type k = put_utf8(os_, c);
-  if (k < 0)
-    return err_status((status_type)-c);
-  return c;
+  return convert_batch(data, off, n, out, batch_decoder());
 }
 
-////////////////////////////////
-// u16u32
+std::size_t
+alf::unicodestreams::batch_to_u32(const char * data,
+				  const std::size_t * off, std::size_t n,
+				  batch<char32_t> & out)
+{
+  return convert_batch(data, off, n, out, batch_decoder());
+}
 
-// for reading.
-alf::unicodestreams::u16u32streambuf::u16u32streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+std::size_t
+alf::unicodestreams::batch_to_utf8(const std::u16string_view * v,
+				   std::size_t n, batch<char> & out)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return convert_batch(v, n, out, batch_encoder());
 }
 
-// for writing
-alf::unicodestreams::u16u32streambuf::u16u32streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+std::size_t
+alf::unicodestreams::batch_to_utf8(const std::u32string_view * v,
+				   std::size_t n, batch<char> & out)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return convert_batch(v, n, out, batch_encoder());
 }
- 
-// for both.
-alf::unicodestreams::u16u32streambuf::
-u16u32streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+std::size_t
+alf::unicodestreams::batch_to_u16(const std::string_view * v,
+				  std::size_t n, batch<char16_t> & out)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return convert_batch(v, n, out, batch_decoder());
 }
 
-// virtual
-alf::unicodestreams::u16u32streambuf::int_type
-alf::unicodestreams::u16u32streambuf::underflow()
+std::size_t
+alf::unicodestreams::batch_to_u32(const std::string_view * v,
+				  std::size_t n, batch<char32_t> & out)
 {
-  return get();
+  return convert_batch(v, n, out, batch_decoder());
 }
 
-// virtual
-alf::unicodestreams::u16u32streambuf::int_type
-alf::unicodestreams::u16u32streambuf::overflow(int_type __c)
+////////////////////////////////
+// shared_u32utf8ostream
+
+// The queue is an intrusive MPSC queue: producers exchange head_ and
+// then link the old head to their node, the single writer (the one who
+// holds busy_) follows next from tail_. stub_ keeps it from ever being
+// empty. pending_ counts the linked records not yet popped.
+
+namespace {
+
+// the buffer a thread gives to its next record.
+std::string &
+spare_text()
 {
-  return put(__c);
+  static thread_local std::string s;
+  return s;
 }
 
-// virtual
-alf::unicodestreams::u16u32streambuf::streambuf *
-alf::unicodestreams::u16u32streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+}; // end of anonymous namespace
+
+alf::unicodestreams::shared_u32utf8ostream::
+shared_u32utf8ostream(dst_stream & os)
+  : os_(& os), head_(& stub_), tail_(& stub_), pending_(0),
+    status_(status_type::OK)
 {
+  stub_.next.store(0);
+  stub_.n = 0;
+  busy_.clear();
+}
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
+alf::unicodestreams::shared_u32utf8ostream::~shared_u32utf8ostream()
+{
+  flush();
+}
 
+alf::unicodestreams::shared_u32utf8ostream &
+alf::unicodestreams::shared_u32utf8ostream::write(std::u32string_view s)
+{
+  std::string & buf = spare_text();
+  std::size_t n = utf8_length(s.data(), s.size());
+  buf.resize(n);
+  const char32_t * p = s.data();
+  char * d = & buf[0];
+  status_type st = utf8_encoder()(p, p + s.size(), d, d + n);
+
+  publish(buf.data(), d - buf.data(), st);
+  return *this;
 }
 
-alf::unicodestreams::u16u32streambuf::int_type
-alf::unicodestreams::u16u32streambuf::get()
+alf::unicodestreams::shared_u32utf8ostream &
+alf::unicodestreams::shared_u32utf8ostream::flush()
 {
-  int_type c, a;
+  while (busy_.test_and_set())
+    std::this_thread::yield();
+  write_queued();
+  if (! os_->flush())
+    status_.store(status_type::BAD_STREAM);
+  busy_.clear();
+  drain();
+  return *this;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+void
+alf::unicodestreams::shared_u32utf8ostream::
+publish(const char * s, std::size_t n, status_type st)
+{
+  if (st != status_type::OK)
+    status_.store(st);
+  if (n > 0) {
+    node * p = new (::operator new(sizeof(node) + n)) node;
+    p->n = n;
+    std::memcpy(reinterpret_cast<char *>(p + 1), s, n);
+    // counted before it can be popped, so pending_ never goes below 0.
+    ++pending_;
+    push(p);
+  }
+  drain();
+}
 
-  if ((c = get_u32(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
+void
+alf::unicodestreams::shared_u32utf8ostream::push(node * p)
+{
+  p->next.store(0, std::memory_order_relaxed);
+  node * prev = head_.exchange(p, std::memory_order_acq_rel);
+  prev->next.store(p, std::memory_order_release);
+}
+
+// Only the one holding busy_ may pop. Return 0 if nothing is linked
+// yet, a producer may be between its exchange and its link.
+alf::unicodestreams::shared_u32utf8ostream::node *
+alf::unicodestreams::shared_u32utf8ostream::pop()
+{
+  node * t = tail_;
+  node * n = t->next.load(std::memory_order_acquire);
+
+  if (t == & stub_) {
+    if (n == 0)
+      return 0;
+    tail_ = t = n;
+    n = n->next.load(std::memory_order_acquire);
   }
-  if (this->egptr() + 1 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  if (n) {
+    tail_ = n;
+    return t;
+  }
+  if (t != head_.load(std::memory_order_acquire))
+    return 0;
+  push(& stub_);
+  n = t->next.load(std::memory_order_acquire);
+  if (n) {
+    tail_ = n;
+    return t;
   }
-  if (c < 0x10000)
-    return traits_type::to_int_type(*gptr() = c);
+  return 0;
+}
 
-  c -= 0x10000;
-  *gptr() = a = 0xd800 | (c >> 10);
-  gptr()[1] = 0xdc00 | (c & 0x3ff);
-  this->setg(this->eback(), this->gptr(), this->gptr() + 2);
-  return traits_type::to_int_type(*gptr());
+// Write what is queued unless someone else does. Whoever holds busy_
+// looks at pending_ again after letting go, so a record pushed while
+// it wrote is never left behind.
+void
+alf::unicodestreams::shared_u32utf8ostream::drain()
+{
+  while (pending_.load() > 0) {
+    if (busy_.test_and_set())
+      return;
+    write_queued();
+    busy_.clear();
+  }
+}
 
+void
+alf::unicodestreams::shared_u32utf8ostream::write_queued()
+{
+  while (node * p = pop()) {
+    --pending_;
+    if (! os_->write((const char *)(p + 1), p->n))
+      status_.store(status_type::BAD_STREAM);
+    p->~node();
+    ::operator delete(p);
+  }
 }
 
-alf::unicodestreams::u16u32streambuf::int_type
-alf::unicodestreams::u16u32streambuf::put(int_type c)
+////////////////////////////////
+// u32utf8recordbuf
+
+alf::unicodestreams::u32utf8recordbuf::
+u32utf8recordbuf(shared_u32utf8ostream & out)
+  : out_(& out), status_(status_type::OK), flush_(false)
+{
+  text_.swap(spare_text());
+  text_.clear();
+  this->setp(obuf, obuf + OBUFSZ);
+}
+
+// virtual
+alf::unicodestreams::u32utf8recordbuf::~u32utf8recordbuf()
+{
+  commit();
+  if (flush_)
+    out_->flush();
+  if (text_.capacity() > spare_text().capacity())
+    text_.swap(spare_text());
+}
+
+void
+alf::unicodestreams::u32utf8recordbuf::commit()
+{
+  encode(this->pbase(), this->pptr());
+  this->setp(obuf, obuf + OBUFSZ);
+  out_->publish(text_.data(), text_.size(), status_);
+  text_.clear();
+}
+
+// encode [s, se) to text_, false on error.
+bool
+alf::unicodestreams::u32utf8recordbuf::
+encode(const char_type * s, const char_type * se)
 {
   if (status_ != status_type::OK)
-    return traits_type::eof();
+    return false;
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
-  }
+  std::size_t k = text_.size();
+  std::size_t n = (se - s) * utf8_encoder::MAXLEN;
+  text_.resize(k + n);
+  char * d = & text_[k];
+  status_ = utf8_encoder()(s, se, d, d + n);
+  text_.resize(d - text_.data());
+  return status_ == status_type::OK;
+}
 
-  if (c < 0 || c >= 0x10000)
-    return err_status(status_type::NOT_UTF16);
+// virtual
+alf::unicodestreams::u32utf8recordbuf::int_type
+alf::unicodestreams::u32utf8recordbuf::overflow(int_type c)
+{
+  bool ok = encode(this->pbase(), this->pptr());
 
-  int_type b;
-  if (c < 0xd800 || c >= 0xe000) {
-    if (! is_valid_utf32(char32_t(c)))
-      return err_status(status_type::NOT_UNICODE);
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    b = put_u32(os_, c);
-    if (b < 0)
-      return err_status((status_type)-b);
-    return c;
-  }
-  // c in 0xd800..0xdfff
-  if (c < 0xdc00) {
-    // c in 0xd800..0xdbff
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    pbuf = traits_type::to_char_type(c);
-    return c;
-  }
-  // c in 0xdc00..dfff
-  if (pbuf == 0)
-    return err_status(status_type::NO_LEAD);
-  int_type w = (((pbuf & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
-  pbuf = 0;
-  b = put_u32(os_, w);
-  if (b < 0)
-    return err_status((status_type)-b);
+  this->setp(obuf, obuf + OBUFSZ);
+  if (! ok)
+    return traits_type::eof();
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  *this->pptr() = traits_type::to_char_type(c);
+  this->pbump(1);
   return c;
 }
 
+// virtual
+std::streamsize
+alf::unicodestreams::u32utf8recordbuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (__n <= this->epptr() - this->pptr()) {
+    traits_type::copy(this->pptr(), __s, __n);
+    this->pbump(int(__n));
+    return __n;
+  }
+  bool ok = encode(this->pbase(), this->pptr()) && encode(__s, __s + __n);
+  this->setp(obuf, obuf + OBUFSZ);
+  return ok ? __n : 0;
+}
+
+// virtual
+// the record stays whole, the flush is done when it is handed over.
+int
+alf::unicodestreams::u32utf8recordbuf::sync()
+{
+  flush_ = true;
+  return status_ == status_type::OK ? 0 : -1;
+}
+
 ////////////////////////////////
-// u16
+// readahead_streambuf
+
+// head_ and tail_ only grow, block i of the ring is i % nblocks_. The
+// thread writes block head_ and then bumps head_, the reader decodes
+// block tail_ and bumps tail_ when it wants the next one. Either waits
+// on cv_ when it can't go on, and they notify with m_ taken so no wakeup
+// is lost.
+
+alf::unicodestreams::readahead_streambuf::
+readahead_streambuf(src_stream & is, std::size_t blocksz /* = BLOCKSZ */,
+		    std::size_t nblocks /* = NBLOCKS */)
+  : is_(& is), blocksz_(blocksz ? blocksz : 1),
+    nblocks_(nblocks ? nblocks : 1),
+    buf_(blocksz_ * nblocks_), len_(nblocks_),
+    head_(0), tail_(0), done_(false), stop_(false),
+    status_(status_type::OK), holding_(false)
+{
+  this->setg(0, 0, 0);
+  th_ = std::thread(& readahead_streambuf::run, this);
+}
 
-// for reading.
-alf::unicodestreams::u16streambuf::u16streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+// virtual
+alf::unicodestreams::readahead_streambuf::~readahead_streambuf()
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  stop_.store(true);
+  notify();
+  th_.join();
 }
 
-// for writing
-alf::unicodestreams::u16streambuf::u16streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+void
+alf::unicodestreams::readahead_streambuf::notify()
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  { std::lock_guard<std::mutex> l(m_); }
+  cv_.notify_all();
 }
- 
-// for both.
-alf::unicodestreams::u16streambuf::
-u16streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+// the thread.
+void
+alf::unicodestreams::readahead_streambuf::run()
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  for (;;) {
+    std::size_t h = head_.load(std::memory_order_relaxed);
+    if (h - tail_.load(std::memory_order_acquire) == nblocks_) {
+      std::unique_lock<std::mutex> l(m_);
+      cv_.wait(l, [&] { return stop_.load()
+	    || h - tail_.load(std::memory_order_acquire) < nblocks_; });
+    }
+    if (stop_.load())
+      break;
+
+    // what the source has now, waiting for one char only when it has
+    // nothing, so a pipe gives what is written as it comes. Only end of
+    // file or an error ends it, not a short block.
+    std::size_t i = h % nblocks_;
+    char_type * p = & buf_[i * blocksz_];
+    std::size_t n = 0;
+    if (*is_ && (n = is_->readsome(p, blocksz_)) == 0 && *is_
+	&& is_->read(p, 1))
+      n = 1 + is_->readsome(p + 1, blocksz_ - 1);
+    if (is_->bad())
+      status_.store(status_type::BAD_STREAM);
+    len_[i] = n;
+    bool last = n == 0;
+    head_.store(h + 1, std::memory_order_release);
+    if (last)
+      done_.store(true);
+    notify();
+    if (last)
+      break;
+  }
 }
 
 // virtual
-alf::unicodestreams::u16streambuf::int_type
-alf::unicodestreams::u16streambuf::underflow()
+alf::unicodestreams::readahead_streambuf::int_type
+alf::unicodestreams::readahead_streambuf::underflow()
 {
-  return get();
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+
+  std::size_t t = tail_.load(std::memory_order_relaxed);
+  if (holding_) {
+    holding_ = false;
+    this->setg(0, 0, 0);
+    tail_.store(++t, std::memory_order_release);
+    notify();
+  }
+  if (head_.load(std::memory_order_acquire) == t) {
+    std::unique_lock<std::mutex> l(m_);
+    cv_.wait(l, [&] { return done_.load()
+	  || head_.load(std::memory_order_acquire) != t; });
+    // done_ is set after head_ so this is the end.
+    if (head_.load(std::memory_order_acquire) == t)
+      return traits_type::eof();
+  }
+
+  std::size_t i = t % nblocks_;
+  if (len_[i] == 0)
+    return traits_type::eof();
+  char_type * b = & buf_[i * blocksz_];
+  holding_ = true;
+  this->setg(b, b, b + len_[i]);
+  return traits_type::to_int_type(*b);
 }
 
 // virtual
-alf::unicodestreams::u16streambuf::int_type
-alf::unicodestreams::u16streambuf::overflow(int_type __c)
+std::streamsize
+alf::unicodestreams::readahead_streambuf::showmanyc()
 {
-  return put(__c);
+  std::size_t t = tail_.load(std::memory_order_relaxed) + holding_;
+  if (head_.load(std::memory_order_acquire) > t)
+    return len_[t % nblocks_];
+  return done_.load() ? -1 : 0;
 }
 
-// virtual
-alf::unicodestreams::u16streambuf::streambuf *
-alf::unicodestreams::u16streambuf::
-setbuf(char_type * __s, std::streamsize __n)
-{
+////////////////////////////////
+// step decoders
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_utf8(const char *& s, const char * se,
+				 char32_t *& d, char32_t * de)
+{
+  return utf8_decoder()(s, se, d, de);
+}
 
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_utf8(const char *& s, const char * se,
+				 char16_t *& d, char16_t * de)
+{
+  return utf8_decoder()(s, se, d, de);
 }
 
-alf::unicodestreams::u16streambuf::int_type
-alf::unicodestreams::u16streambuf::get()
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_u16(const char16_t *& s, const char16_t * se,
+				char32_t *& d, char32_t * de)
 {
-  int_type c, a;
+  return u16_decoder()(s, se, d, de);
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+#if defined(__unix__) || defined(__APPLE__)
 
-  if ((c = get_u16(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() + 1 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
-  }
-  if (c < 0x10000)
-    return traits_type::to_int_type(*gptr() = c);
+////////////////////////////////
+// uring_ring
 
-  c -= 0x10000;
-  *gptr() = a = 0xd800 | (c >> 10);
-  gptr()[1] = 0xdc00 | (c & 0x3ff);
-  this->setg(this->eback(), this->gptr(), this->gptr() + 2);
-  return traits_type::to_int_type(*gptr());
+namespace {
 
+// read() what there is, at most n bytes, 0 at end of file and -1 on
+// error.
+long
+read_some(int fd, char * b, std::size_t n)
+{
+  for (;;) {
+    ssize_t r = ::read(fd, b, n);
+    if (r >= 0 || errno != EINTR)
+      return long(r);
+  }
 }
 
-alf::unicodestreams::u16streambuf::int_type
-alf::unicodestreams::u16streambuf::put(int_type c)
+// pread()/pwrite() all of n bytes unless at end of file,
+// return the number of bytes done or -1 on error. pwrite_full()
+// write()s in order when off is -1.
+long
+pread_full(int fd, char * b, std::size_t n, std::int64_t off)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+  std::size_t k = 0;
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
+  while (k < n) {
+    ssize_t r = ::pread(fd, b + k, n - k, off + k);
+    if (r == 0)
+      break;
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    k += r;
   }
+  return long(k);
+}
 
-  if (c < 0 || c >= 0x10000)
-    return err_status(status_type::NOT_UTF16);
+long
+pwrite_full(int fd, const char * b, std::size_t n, std::int64_t off)
+{
+  std::size_t k = 0;
 
-  int_type b;
-  if (c < 0xd800 || c >= 0xe000) {
-    if (! is_valid_utf32(char32_t(c)))
-      return err_status(status_type::NOT_UNICODE);
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    b = put_u16(os_, c);
-    if (b < 0)
-      return err_status((status_type)-b);
-    return c;
-  }
-  // c in 0xd800..0xdfff
-  if (c < 0xdc00) {
-    // c in 0xd800..0xdbff
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    pbuf = traits_type::to_char_type(c);
-    return c;
+  while (k < n) {
+    ssize_t r = off < 0 ? ::write(fd, b + k, n - k)
+      : ::pwrite(fd, b + k, n - k, off + k);
+    if (r < 0) {
+      if (errno == EINTR)
+	continue;
+      return -1;
+    }
+    k += r;
   }
-  // c in 0xdc00..dfff
-  if (pbuf == 0)
-    return err_status(status_type::NO_LEAD);
-  int_type w = (((pbuf & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
-  pbuf = 0;
-  b = put_u16(os_, w);
-  if (b < 0)
-    return err_status((status_type)-b);
-  return c;
+  return long(k);
 }
 
-////////////////////////////////
-// u16utf8
+// the buffers are aligned to this and blocks are a multiple of it.
+const std::size_t URING_ALIGN = 4096;
 
-// for reading.
-alf::unicodestreams::u16utf8streambuf::u16utf8streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+char *
+alloc_blocks(std::size_t & blocksz, unsigned & depth)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (depth == 0)
+    depth = 1;
+  blocksz = (blocksz + URING_ALIGN - 1) & ~(URING_ALIGN - 1);
+  if (blocksz == 0)
+    blocksz = URING_ALIGN;
+  void * p = std::aligned_alloc(URING_ALIGN, blocksz * depth);
+  if (p == 0)
+    throw std::bad_alloc();
+  return (char *)p;
 }
 
-// for writing
-alf::unicodestreams::u16utf8streambuf::u16utf8streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
-{
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
-}
- 
-// for both.
-alf::unicodestreams::u16utf8streambuf::
-u16utf8streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+}; // end of anonymous namespace
+
+// A bare io_uring without liburing: the two rings and the sqes mapped.
+// Every request is a readv or writev of one block tagged with its slot.
+// queue() puts it on the submission ring, enter() submits all that is
+// queued and waits for wait completions and reap() takes a completion.
+// open() gives 0 where there's no io_uring or we may not use it.
+
+class alf::unicodestreams::uring_ring {
+
+public:
+
+  static uring_ring * open(unsigned entries);
+  ~uring_ring();
+
+  void read(unsigned slot, int fd, char * b, std::size_t n, std::int64_t off)
+  { queue(slot, fd, b, n, off, true); }
+  void write(unsigned slot, int fd, const char * b, std::size_t n,
+	     std::int64_t off)
+  { queue(slot, fd, const_cast<char *>(b), n, off, false); }
+
+  bool enter(unsigned wait);
+  bool reap(unsigned & slot, int & res);
+
+private:
+
+  uring_ring() {}
+  void queue(unsigned slot, int fd, char * b, std::size_t n,
+	     std::int64_t off, bool rd);
+
+#if defined(ALF_UNICODESTREAMS_URING)
+  int fd_;
+  void * sq_;
+  std::size_t sqsz_;
+  void * cq_;
+  std::size_t cqsz_;
+  io_uring_sqe * sqes_;
+  std::size_t sqessz_;
+  unsigned * sqhead_;
+  unsigned * sqtail_;
+  unsigned sqmask_;
+  unsigned * sqarray_;
+  unsigned * cqhead_;
+  unsigned * cqtail_;
+  unsigned cqmask_;
+  io_uring_cqe * cqes_;
+  unsigned queued_;
+  std::vector<struct iovec> iov_; // per slot
+#endif
+
+}; // end of class uring_ring
+
+#if defined(ALF_UNICODESTREAMS_URING)
+
+alf::unicodestreams::uring_ring *
+alf::unicodestreams::uring_ring::open(unsigned entries)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  pbuf = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  io_uring_params p;
+  std::memset(& p, 0, sizeof(p));
+  int fd = int(::syscall(__NR_io_uring_setup, entries, & p));
+  if (fd < 0)
+    return 0;
+
+  uring_ring * r = new uring_ring;
+  r->fd_ = fd;
+  r->queued_ = 0;
+  r->iov_.resize(entries);
+  r->sqsz_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cqsz_ = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && r->sqsz_ < r->cqsz_)
+    r->sqsz_ = r->cqsz_;
+  r->sqessz_ = p.sq_entries * sizeof(io_uring_sqe);
+  r->sq_ = ::mmap(0, r->sqsz_, PROT_READ | PROT_WRITE,
+		  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  r->cq_ = single ? r->sq_
+    : ::mmap(0, r->cqsz_, PROT_READ | PROT_WRITE,
+	     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+  r->sqes_ = (io_uring_sqe *)::mmap(0, r->sqessz_, PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, fd,
+				    IORING_OFF_SQES);
+  if (r->sq_ == MAP_FAILED || r->cq_ == MAP_FAILED
+      || r->sqes_ == MAP_FAILED) {
+    delete r;
+    return 0;
+  }
+
+  char * sq = (char *)r->sq_;
+  char * cq = (char *)r->cq_;
+  r->sqhead_ = (unsigned *)(sq + p.sq_off.head);
+  r->sqtail_ = (unsigned *)(sq + p.sq_off.tail);
+  r->sqmask_ = *(unsigned *)(sq + p.sq_off.ring_mask);
+  r->sqarray_ = (unsigned *)(sq + p.sq_off.array);
+  r->cqhead_ = (unsigned *)(cq + p.cq_off.head);
+  r->cqtail_ = (unsigned *)(cq + p.cq_off.tail);
+  r->cqmask_ = *(unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes_ = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  return r;
 }
 
-// virtual
-alf::unicodestreams::u16utf8streambuf::int_type
-alf::unicodestreams::u16utf8streambuf::underflow()
+alf::unicodestreams::uring_ring::~uring_ring()
 {
-  return get();
+  if (sqes_ != MAP_FAILED)
+    ::munmap(sqes_, sqessz_);
+  if (cq_ != MAP_FAILED && cq_ != sq_)
+    ::munmap(cq_, cqsz_);
+  if (sq_ != MAP_FAILED)
+    ::munmap(sq_, sqsz_);
+  ::close(fd_);
 }
 
-// virtual
-alf::unicodestreams::u16utf8streambuf::int_type
-alf::unicodestreams::u16utf8streambuf::overflow(int_type __c)
+void
+alf::unicodestreams::uring_ring::
+queue(unsigned slot, int fd, char * b, std::size_t n, std::int64_t off,
+      bool rd)
 {
-  return put(__c);
+  unsigned t = *sqtail_;
+  unsigned i = t & sqmask_;
+  io_uring_sqe * e = & sqes_[i];
+
+  iov_[slot].iov_base = b;
+  iov_[slot].iov_len = n;
+  std::memset(e, 0, sizeof(*e));
+  e->opcode = rd ? IORING_OP_READV : IORING_OP_WRITEV;
+  e->fd = fd;
+  e->addr = (std::uint64_t)(std::uintptr_t)& iov_[slot];
+  e->len = 1;
+  e->off = std::uint64_t(off);
+  e->user_data = slot;
+  sqarray_[i] = i;
+  __atomic_store_n(sqtail_, t + 1, __ATOMIC_RELEASE);
+  ++queued_;
 }
 
-// virtual
-alf::unicodestreams::u16utf8streambuf::streambuf *
-alf::unicodestreams::u16utf8streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+bool
+alf::unicodestreams::uring_ring::enter(unsigned wait)
 {
-
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+  for (;;) {
+    int r = int(::syscall(__NR_io_uring_enter, fd_, queued_, wait,
+			  wait ? IORING_ENTER_GETEVENTS : 0, 0, 0));
+    if (r >= 0) {
+      queued_ -= r;
+      return true;
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
+    if (errno != EINTR)
+      return false;
   }
-  return this;
-
 }
 
-alf::unicodestreams::u16utf8streambuf::int_type
-alf::unicodestreams::u16utf8streambuf::get()
+bool
+alf::unicodestreams::uring_ring::reap(unsigned & slot, int & res)
 {
-  int_type c, a;
+  unsigned h = *cqhead_;
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+  if (h == __atomic_load_n(cqtail_, __ATOMIC_ACQUIRE))
+    return false;
+  io_uring_cqe & c = cqes_[h & cqmask_];
+  slot = unsigned(c.user_data);
+  res = c.res;
+  __atomic_store_n(cqhead_, h + 1, __ATOMIC_RELEASE);
+  return true;
+}
 
-  if ((c = get_utf8(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() + 1 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
-  }
-  if (c < 0x10000)
-    return traits_type::to_int_type(*gptr() = c);
+#else
 
-  c -= 0x10000;
-  *gptr() = a = 0xd800 | (c >> 10);
-  gptr()[1] = 0xdc00 | (c & 0x3ff);
-  this->setg(this->eback(), this->gptr(), this->gptr() + 2);
-  return traits_type::to_int_type(*gptr());
+alf::unicodestreams::uring_ring *
+alf::unicodestreams::uring_ring::open(unsigned)
+{
+  return 0;
+}
 
+alf::unicodestreams::uring_ring::~uring_ring()
+{
 }
 
-alf::unicodestreams::u16utf8streambuf::int_type
-alf::unicodestreams::u16utf8streambuf::put(int_type c)
+void
+alf::unicodestreams::uring_ring::
+queue(unsigned, int, char *, std::size_t, std::int64_t, bool)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  int_type a, b;
-  char16_t ch;
+}
 
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    // eof, shut down.. .make sure buf has nothing.
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
-  }
-  if (c >= 0xfffe) {
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    return err_status(status_type::NOT_UNICODE);
-  }
-  if (c < 0xd800 || c >= 0xe000) {
-    // single code.
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    ch = traits_type::to_char_type(c);
-    if (! is_valid_utf32(ch))
-      return err_status(status_type::NOT_UNICODE);
-    a = put_utf8(os_, c);
-    if (a < 0)
-      return err_status((status_type)-a);
-    return c;
-  }
-  if (c < 0xdc00) {
-    if (pbuf)
-      return err_status(status_type::NO_FOLLOW);
-    pbuf = c;
-    return c;
-  }
-  // c in 0xdc00..0xdfff range.
-  b = pbuf;
-  pbuf = 0;
-  if (b < 0xd800 || b >= 0xdc00)
-    return err_status(status_type::NO_LEAD);
-  a = (((b & 0x3ff) << 10) | (c & 0x3ff)) + 0x10000;
-  if (! is_valid_utf32(traits_type::to_char_type(a)))
-      return err_status(status_type::NOT_UNICODE);
-  int_type k = put_utf8(os_, a);
-  if (k < 0)
-    return err_status((status_type)-k);
-  return c;
+bool
+alf::unicodestreams::uring_ring::enter(unsigned)
+{
+  return false;
 }
 
-////////////////////////////////
-// utf8u32
+bool
+alf::unicodestreams::uring_ring::reap(unsigned &, int &)
+{
+  return false;
+}
 
-// for reading.
-alf::unicodestreams::utf8u32streambuf::utf8u32streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+#endif
+
+////////////////////////////////
+// uring_source
+
+// Block k is read at base_ + k * blocksz_ into slot k % depth_. With a
+// ring the blocks cur_ to next_ - 1 are in flight or done, when the
+// reader is done with block cur_ block cur_ + depth_ is read into its
+// slot. A short read is finished with pread(), it is only short at the
+// end of the file, and without a ring every block is read that way. A
+// pipe has no offsets, base_ is -1 and each block is what one read()
+// gives, short or not, until it gives nothing.
+
+alf::unicodestreams::uring_source::
+uring_source(const char * path, std::size_t blocksz /* = BLOCKSZ */,
+	     unsigned depth /* = DEPTH */, bool try_uring /* = true */)
+  : fd_(::open(path, O_RDONLY | O_CLOEXEC)), own_(true), base_(0)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  start(blocksz, depth, try_uring);
 }
 
-// for writing
-alf::unicodestreams::utf8u32streambuf::utf8u32streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+alf::unicodestreams::uring_source::
+uring_source(int fd, std::size_t blocksz /* = BLOCKSZ */,
+	     unsigned depth /* = DEPTH */, bool try_uring /* = true */)
+  : fd_(fd), own_(false), base_(fd >= 0 ? ::lseek(fd, 0, SEEK_CUR) : 0)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  start(blocksz, depth, try_uring);
 }
- 
-// for both.
-alf::unicodestreams::utf8u32streambuf::
-utf8u32streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+void
+alf::unicodestreams::uring_source::
+start(std::size_t blocksz, unsigned depth, bool try_uring)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  ring_ = 0;
+  buf_ = 0;
+  blocksz_ = blocksz;
+  depth_ = depth;
+  cur_ = 0;
+  next_ = 0;
+  end_ = std::uint64_t(-1);
+  inflight_ = 0;
+  holding_ = false;
+  status_ = status_type::OK;
+  this->setg(0, 0, 0);
+  if (fd_ < 0) {
+    status_ = status_type::NO_STREAM;
+    return;
+  }
+  if (::lseek(fd_, 0, SEEK_CUR) < 0)
+    base_ = -1;
+  buf_ = alloc_blocks(blocksz_, depth_);
+  res_.assign(depth_, 0);
+  done_.assign(depth_, 0);
+  if (try_uring && base_ >= 0 && (ring_ = uring_ring::open(depth_)) != 0) {
+    while (next_ < depth_)
+      submit(next_++);
+    if (! ring_->enter(0)) {
+      delete ring_;
+      ring_ = 0;
+      inflight_ = 0;
+    }
+  }
 }
 
 // virtual
-alf::unicodestreams::utf8u32streambuf::int_type
-alf::unicodestreams::utf8u32streambuf::underflow()
+alf::unicodestreams::uring_source::~uring_source()
 {
-  return get();
+  if (ring_) {
+    while (inflight_ > 0 && ring_->enter(1))
+      reap();
+    delete ring_;
+  }
+  std::free(buf_);
+  if (own_ && fd_ >= 0)
+    ::close(fd_);
 }
 
-// virtual
-alf::unicodestreams::utf8u32streambuf::int_type
-alf::unicodestreams::utf8u32streambuf::overflow(int_type __c)
+void
+alf::unicodestreams::uring_source::submit(std::uint64_t k)
 {
-  return put(__c);
+  unsigned s = unsigned(k % depth_);
+
+  done_[s] = 0;
+  ring_->read(s, fd_, buf_ + s * blocksz_, blocksz_, base_ + k * blocksz_);
+  ++inflight_;
 }
 
-// virtual
-alf::unicodestreams::utf8u32streambuf::streambuf *
-alf::unicodestreams::utf8u32streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+void
+alf::unicodestreams::uring_source::reap()
 {
+  unsigned s;
+  int r;
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
+  while (ring_->reap(s, r)) {
+    res_[s] = r;
+    done_[s] = 1;
+    --inflight_;
   }
-  return this;
-
 }
 
-alf::unicodestreams::utf8u32streambuf::int_type
-alf::unicodestreams::utf8u32streambuf::get()
+// the bytes of block k, -1 on error.
+long
+alf::unicodestreams::uring_source::complete(std::uint64_t k)
 {
-  int_type c, a;
+  unsigned s = unsigned(k % depth_);
+  char * b = buf_ + s * blocksz_;
+  long n = 0;
+
+  if (base_ < 0)
+    return read_some(fd_, b, blocksz_);
+  if (ring_) {
+    while (! done_[s] && ring_->enter(1))
+      reap();
+    if (! done_[s])
+      return -1;
+    // on error, try again the plain way.
+    if ((n = res_[s]) < 0)
+      n = 0;
+  }
+  if (std::size_t(n) < blocksz_) {
+    long m = pread_full(fd_, b + n, blocksz_ - n, base_ + k * blocksz_ + n);
+    if (m < 0)
+      return -1;
+    n += m;
+  }
+  return n;
+}
 
-  if (status_ != status_type::OK)
+// virtual
+alf::unicodestreams::uring_source::int_type
+alf::unicodestreams::uring_source::underflow()
+{
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  if (fd_ < 0 || status_ != status_type::OK)
     return traits_type::eof();
 
-  if ((c = get_u32(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() + 3 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  if (holding_) {
+    holding_ = false;
+    this->setg(0, 0, 0);
+    ++cur_;
+    if (ring_ && next_ < end_)
+      submit(next_++);
   }
+  if (cur_ >= end_)
+    return traits_type::eof();
 
-  char_type * base = this->gptr();
-  char_type * p = base;
-  int_type ret = 0;
-  if (c < 0x80) {
-    *p++ = char_type(ret = c);
-  } else if (c < 0x800) {
-    *p++ = char_type(ret = 0xc0 | (c >> 6));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else if (c < 0x10000) {
-    *p++ = char_type(ret = 0xe0 | (c >> 12));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else {
-    *p++ = char_type(ret = 0xf0 | (c >> 18));
-    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
+  long n = complete(cur_);
+  if (n < 0) {
+    status_ = status_type::BAD_STREAM;
+    return traits_type::eof();
   }
-  this->setg(ibufb, base, p);
-  return traits_type::to_int_type(*this->gptr());
+  if (n == 0 || (base_ >= 0 && std::size_t(n) < blocksz_))
+    end_ = cur_ + 1;
+  if (n == 0)
+    return traits_type::eof();
 
+  char_type * b = buf_ + (cur_ % depth_) * blocksz_;
+  holding_ = true;
+  this->setg(b, b, b + n);
+  return traits_type::to_int_type(*b);
 }
 
-alf::unicodestreams::utf8u32streambuf::int_type
-alf::unicodestreams::utf8u32streambuf::put(int_type c)
+////////////////////////////////
+// uring_sink
+
+// The put area is slot cur_. A full block is queued as a write at off_
+// and the next slot is taken, waiting for the write in it if there is
+// one, so the writes are submitted depth_ at a time. len_[s] is the size
+// of the write in slot s, 0 when there is none. A short write is
+// finished with pwrite() and without a ring every block is written
+// that way. A pipe has no offsets, off_ is -1 and the blocks are
+// written in order with write().
+
+alf::unicodestreams::uring_sink::
+uring_sink(const char * path, std::size_t blocksz /* = BLOCKSZ */,
+	   unsigned depth /* = DEPTH */, bool try_uring /* = true */)
+  : fd_(::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)),
+    own_(true), off_(0)
 {
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+  start(blocksz, depth, try_uring);
+}
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
+alf::unicodestreams::uring_sink::
+uring_sink(int fd, std::size_t blocksz /* = BLOCKSZ */,
+	   unsigned depth /* = DEPTH */, bool try_uring /* = true */)
+  : fd_(fd), own_(false), off_(fd >= 0 ? ::lseek(fd, 0, SEEK_CUR) : 0)
+{
+  start(blocksz, depth, try_uring);
+}
+
+void
+alf::unicodestreams::uring_sink::
+start(std::size_t blocksz, unsigned depth, bool try_uring)
+{
+  ring_ = 0;
+  buf_ = 0;
+  blocksz_ = blocksz;
+  depth_ = depth;
+  cur_ = 0;
+  status_ = status_type::OK;
+  this->setp(0, 0);
+  if (fd_ < 0) {
+    status_ = status_type::NO_STREAM;
+    return;
   }
+  if (::lseek(fd_, 0, SEEK_CUR) < 0)
+    off_ = -1;
+  buf_ = alloc_blocks(blocksz_, depth_);
+  at_.assign(depth_, 0);
+  len_.assign(depth_, 0);
+  if (try_uring && off_ >= 0)
+    ring_ = uring_ring::open(depth_);
+  this->setp(buf_, buf_ + blocksz_);
+}
 
-  if (c < 0 || c > 0xf7)
-    return err_status(status_type::NOT_UTF8);
+// virtual
+alf::unicodestreams::uring_sink::~uring_sink()
+{
+  if (fd_ >= 0)
+    sync();
+  delete ring_;
+  std::free(buf_);
+  if (own_ && fd_ >= 0)
+    ::close(fd_);
+}
 
-  if (c < 0x80) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return c;
+void
+alf::unicodestreams::uring_sink::reap()
+{
+  unsigned s;
+  int r;
+
+  while (ring_->reap(s, r)) {
+    std::size_t n = r < 0 ? 0 : std::size_t(r);
+    if (n < len_[s]
+	&& pwrite_full(fd_, buf_ + s * blocksz_ + n, len_[s] - n, at_[s] + n)
+	   != long(len_[s] - n))
+      status_ = status_type::BAD_STREAM;
+    len_[s] = 0;
   }
-  int_type b;
-  if (c < 0xc0) {
-    if (och_need == 0)
-      return err_status(status_type::NO_LEAD);
-    och = (och << 6) | (c & 0x3f);
-    if (--och_need == 0) {
-      if (! is_valid_utf32(char32_t(och)))
-	return err_status(status_type::NOT_UNICODE);
-      if (och < och_min)
-	return err_status(status_type::NOT_UTF8);
-      b = put_u32(os_, och);
-      if (b < 0)
-	return err_status((status_type)-b);
-      return c;
+}
+
+bool
+alf::unicodestreams::uring_sink::wait_slot(unsigned s)
+{
+  while (len_[s] != 0) {
+    if (! ring_->enter(1)) {
+      status_ = status_type::BAD_STREAM;
+      return false;
     }
+    reap();
   }
-  if (och_need)
-    return err_status(status_type::NO_FOLLOW);
-  if (c < 0xe0) {
-    // two byte code - minimum 0x80.
-    och_min = 0x80;
-    och_need = 1;
-    och = c & 0x1f;
-    return c;
-  }
-  if (c < 0xf0) {
-    // three byte code - minimum 0x800
-    och_min = 0x800;
-    och_need = 2;
-    och = c & 0x0f;
-    return c;
+  return status_ == status_type::OK;
+}
+
+// write the put area and start a new one.
+bool
+alf::unicodestreams::uring_sink::put_block()
+{
+  std::size_t n = this->pptr() - this->pbase();
+
+  if (n == 0)
+    return true;
+  if (ring_ == 0) {
+    if (pwrite_full(fd_, this->pbase(), n, off_) != long(n))
+      status_ = status_type::BAD_STREAM;
+    if (off_ >= 0)
+      off_ += n;
+    this->setp(this->pbase(), this->epptr());
+    return status_ == status_type::OK;
   }
-  och_min = 0x10000;
-  och_need = 3;
-  och = c & 0x07;
+
+  at_[cur_] = off_;
+  len_[cur_] = n;
+  ring_->write(cur_, fd_, this->pbase(), n, off_);
+  off_ += n;
+  cur_ = (cur_ + 1) % depth_;
+  if (! wait_slot(cur_))
+    return false;
+  char_type * b = buf_ + cur_ * blocksz_;
+  this->setp(b, b + blocksz_);
+  return true;
+}
+
+// virtual
+alf::unicodestreams::uring_sink::int_type
+alf::unicodestreams::uring_sink::overflow(int_type c)
+{
+  if (fd_ < 0 || status_ != status_type::OK || ! put_block())
+    return traits_type::eof();
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  *this->pptr() = traits_type::to_char_type(c);
+  this->pbump(1);
   return c;
+}
 
+// virtual
+int
+alf::unicodestreams::uring_sink::sync()
+{
+  if (fd_ < 0 || ! put_block())
+    return -1;
+  if (ring_)
+    for (unsigned s = 0; s < depth_; ++s)
+      wait_slot(s);
+  return status_ == status_type::OK ? 0 : -1;
 }
 
+#endif
+
 ////////////////////////////////
-// utf8u16
+// counting
 
-// for reading.
-alf::unicodestreams::utf8u16streambuf::utf8u16streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+// The SSE2 loops count in 8 or 16 bit lanes, they add up the lanes
+// often enough that the lanes never overflow.
+
+std::size_t
+alf::unicodestreams::count_utf8(const char * s, std::size_t n)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  std::size_t i = 0;
+  std::size_t r = 0;
+
+#if defined(__SSE2__)
+  const __m128i cont = _mm_set1_epi8(-65); // 0xbf, last follow byte.
+  const __m128i z = _mm_setzero_si128();
+  while (i + 16 <= n) {
+    __m128i acc = z;
+    for (int j = 0; j < 255 && i + 16 <= n; ++j, i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, cont));
+    }
+    acc = _mm_sad_epu8(acc, z);
+    r += _mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4);
+  }
+#endif
+  for (; i < n; ++i)
+    r += (signed char)s[i] > -65;
+  return r;
 }
 
-// for writing
-alf::unicodestreams::utf8u16streambuf::utf8u16streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+std::size_t
+alf::unicodestreams::count_u16(const char16_t * s, std::size_t n)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  std::size_t i = 0;
+  std::size_t r = n;
+
+#if defined(__SSE2__)
+  const __m128i mask = _mm_set1_epi16(short(0xfc00));
+  const __m128i follow = _mm_set1_epi16(short(0xdc00));
+  for (; i + 8 <= n; i += 8) {
+    __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(s + i)), mask);
+    int m = _mm_movemask_epi8(_mm_cmpeq_epi16(v, follow));
+    r -= __builtin_popcount(m) >> 1;
+  }
+#endif
+  for (; i < n; ++i)
+    r -= (s[i] & 0xfc00) == 0xdc00;
+  return r;
 }
- 
-// for both.
-alf::unicodestreams::utf8u16streambuf::
-utf8u16streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+std::size_t
+alf::unicodestreams::utf8_length(const char32_t * s, std::size_t n)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  std::size_t i = 0;
+  std::size_t r = n;
+
+#if defined(__SSE2__)
+  const __m128i c1 = _mm_set1_epi32(0x7f);
+  const __m128i c2 = _mm_set1_epi32(0x7ff);
+  const __m128i c3 = _mm_set1_epi32(0xffff);
+  while (i + 4 <= n) {
+    __m128i acc = _mm_setzero_si128();
+    for (int j = 0; j < 65536 && i + 4 <= n; ++j, i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, c1));
+      acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, c2));
+      acc = _mm_sub_epi32(acc, _mm_cmpgt_epi32(v, c3));
+    }
+    unsigned int a[4];
+    _mm_storeu_si128((__m128i *)a, acc);
+    r += std::size_t(a[0]) + a[1] + a[2] + a[3];
+  }
+#endif
+  for (; i < n; ++i)
+    r += (s[i] >= 0x80) + (s[i] >= 0x800) + (s[i] >= 0x10000);
+  return r;
 }
 
-// virtual
-alf::unicodestreams::utf8u16streambuf::int_type
-alf::unicodestreams::utf8u16streambuf::underflow()
+// a surrogate pair is 4 bytes, so each half counts 2.
+std::size_t
+alf::unicodestreams::utf8_length(const char16_t * s, std::size_t n)
 {
-  return get();
+  std::size_t i = 0;
+  std::size_t r = 0;
+
+#if defined(__SSE2__)
+  const __m128i three = _mm_set1_epi16(3);
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i m1 = _mm_set1_epi16(short(0xff80));
+  const __m128i m2 = _mm_set1_epi16(short(0xf800));
+  const __m128i sur = _mm_set1_epi16(short(0xd800));
+  const __m128i z = _mm_setzero_si128();
+  while (i + 8 <= n) {
+    __m128i acc = z;
+    for (int j = 0; j < 4096 && i + 8 <= n; ++j, i += 8) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      __m128i k = _mm_add_epi16(three,
+				_mm_cmpeq_epi16(_mm_and_si128(v, m1), z));
+      k = _mm_add_epi16(k, _mm_cmpeq_epi16(_mm_and_si128(v, m2), z));
+      k = _mm_add_epi16(k, _mm_cmpeq_epi16(_mm_and_si128(v, m2), sur));
+      acc = _mm_add_epi16(acc, k);
+    }
+    unsigned int a[4];
+    _mm_storeu_si128((__m128i *)a, _mm_madd_epi16(acc, ones));
+    r += std::size_t(a[0]) + a[1] + a[2] + a[3];
+  }
+#endif
+  for (; i < n; ++i) {
+    char16_t c = s[i];
+    if (c < 0x80)
+      r += 1;
+    else if (c < 0x800 || (c & 0xf800) == 0xd800)
+      r += 2;
+    else
+      r += 3;
+  }
+  return r;
 }
 
-// virtual
-alf::unicodestreams::utf8u16streambuf::int_type
-alf::unicodestreams::utf8u16streambuf::overflow(int_type __c)
+std::size_t
+alf::unicodestreams::u16_length(const char32_t * s, std::size_t n)
 {
-  return put(__c);
+  std::size_t i = 0;
+  std::size_t r = n;
+
+#if defined(__SSE2__)
+  const __m128i bmp = _mm_set1_epi32(0xffff);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+    r += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi32(v, bmp))) >> 2;
+  }
+#endif
+  for (; i < n; ++i)
+    r += s[i] >= 0x10000;
+  return r;
 }
 
-// virtual
-alf::unicodestreams::utf8u16streambuf::streambuf *
-alf::unicodestreams::utf8u16streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+// every code point is one code, except the 4 byte ones which are two.
+std::size_t
+alf::unicodestreams::u16_length(const char * s, std::size_t n)
 {
-
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+  std::size_t i = 0;
+  std::size_t r = 0;
+
+#if defined(__SSE2__)
+  const __m128i cont = _mm_set1_epi8(-65); // 0xbf, last follow byte.
+  const __m128i lead4 = _mm_set1_epi8(-17); // 0xef, last 3 byte lead.
+  const __m128i z = _mm_setzero_si128();
+  while (i + 16 <= n) {
+    __m128i acc = z;
+    for (int j = 0; j < 127 && i + 16 <= n; ++j, i += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+      acc = _mm_sub_epi8(acc, _mm_cmpgt_epi8(v, cont));
+      acc = _mm_sub_epi8(acc, _mm_and_si128(_mm_cmpgt_epi8(v, lead4),
+					    _mm_cmplt_epi8(v, z)));
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
+    acc = _mm_sad_epu8(acc, z);
+    r += _mm_cvtsi128_si32(acc) + _mm_extract_epi16(acc, 4);
   }
-  return this;
-
+#endif
+  for (; i < n; ++i) {
+    unsigned char c = s[i];
+    r += (c < 0x80 || c >= 0xc0) + (c >= 0xf0);
+  }
+  return r;
 }
 
-alf::unicodestreams::utf8u16streambuf::int_type
-alf::unicodestreams::utf8u16streambuf::get()
-{
-  int_type c, a;
+////////////////////////////////
+// normalization
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+namespace {
 
-  if ((c = get_u16(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() + 3 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
-  }
+#include "unicodetables.inc"
 
-  char_type * base = this->gptr();
-  char_type * p = base;
-  int_type ret = 0;
-  if (c < 0x80) {
-    *p++ = char_type(ret = c);
-  } else if (c < 0x800) {
-    *p++ = char_type(ret = 0xc0 | (c >> 6));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else if (c < 0x10000) {
-    *p++ = char_type(ret = 0xe0 | (c >> 12));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else {
-    *p++ = char_type(ret = 0xf0 | (c >> 18));
-    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  }
-  this->setg(ibufb, base, p);
-  return traits_type::to_int_type(*this->gptr());
+// Hangul syllables are composed and decomposed by arithmetic.
+enum {
+  HANGUL_S = 0xac00, HANGUL_L = 0x1100, HANGUL_V = 0x1161, HANGUL_T = 0x11a7,
+  HANGUL_LN = 19, HANGUL_VN = 21, HANGUL_TN = 28,
+  HANGUL_NN = HANGUL_VN * HANGUL_TN, HANGUL_SN = HANGUL_LN * HANGUL_NN
+};
 
+// the streams cut a segment here if it gets this long.
+const std::size_t NORM_MAXSEG = 1024;
+
+// what norm_props() tells, f is the normal_form as an int.
+inline
+unsigned
+norm_ccc(std::uint16_t p)
+{
+  return p & 0xff;
+}
+
+inline
+bool
+norm_not_yes(std::uint16_t p, int f)
+{
+  return (p >> (8 + 2 * f)) & 1;
 }
 
-alf::unicodestreams::utf8u16streambuf::int_type
-alf::unicodestreams::utf8u16streambuf::put(int_type c)
+inline
+bool
+norm_starts(std::uint16_t p, int f)
 {
+  return ! ((p >> (9 + 2 * f)) & 1);
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
+// Append the full decomposition of c to d, the compatibility one if
+// compat.
+void
+decompose(char32_t c, bool compat, std::u32string & d)
+{
+  char32_t s = c - HANGUL_S;
+
+  if (s < HANGUL_SN) {
+    d += char32_t(HANGUL_L + s / HANGUL_NN);
+    d += char32_t(HANGUL_V + s % HANGUL_NN / HANGUL_TN);
+    if (s % HANGUL_TN)
+      d += char32_t(HANGUL_T + s % HANGUL_TN);
+    return;
   }
+  unsigned i = decomp_index(c);
+  if (i == 0) {
+    d += c;
+    return;
+  }
+  unsigned n = decomp_pool[i] & 0xff;
+  unsigned k = decomp_pool[i] >> 8;
+  if (compat && k > 0)
+    d.append(decomp_pool + i + 1 + n, k);
+  else if (n > 0)
+    d.append(decomp_pool + i + 1, n);
+  else
+    d += c;
+}
 
-  if (c < 0 || c > 0xf7)
-    return err_status(status_type::NOT_UTF8);
+// the primary composite of a and b, 0 if there is none.
+char32_t
+compose(char32_t a, char32_t b)
+{
+  char32_t l = a - HANGUL_L;
+  char32_t v = b - HANGUL_V;
+  if (l < HANGUL_LN && v < HANGUL_VN)
+    return HANGUL_S + (l * HANGUL_VN + v) * HANGUL_TN;
+  char32_t s = a - HANGUL_S;
+  char32_t t = b - HANGUL_T;
+  if (s < HANGUL_SN && s % HANGUL_TN == 0 && t - 1 < HANGUL_TN - 1)
+    return a + t;
+
+  const compose_pair * e = compose_pairs + std::size(compose_pairs);
+  const compose_pair * p =
+    std::lower_bound(compose_pairs, e, a,
+		     [b](const compose_pair & x, char32_t y) {
+		       return x.first < y || (x.first == y && x.second < b);
+		     });
+  return p < e && p->first == a && p->second == b ? p->composite : 0;
+}
 
-  if (c < 0x80) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return c;
-  }
-  int_type b;
-  if (c < 0xc0) {
-    if (och_need == 0)
-      return err_status(status_type::NO_LEAD);
-    och = (och << 6) | (c & 0x3f);
-    if (--och_need == 0) {
-      if (! is_valid_utf32(char32_t(och)))
-	return err_status(status_type::NOT_UNICODE);
-      if (och < och_min)
-	return err_status(status_type::NOT_UTF8);
-      b = put_u16(os_, och);
-      if (b < 0)
-	return err_status((status_type)-b);
-      return c;
+// Normalize the segment [s, s + n) to form f and append it to out, d is
+// for scratch.
+void
+normalize_segment(int f, const char32_t * s, std::size_t n,
+		  std::u32string & out, std::u32string & d)
+{
+  d.clear();
+  for (std::size_t i = 0; i < n; ++i)
+    decompose(s[i], f >= 2, d);
+
+  // the canonical order, a stable sort of each run of non-starters on
+  // their combining class.
+  for (std::size_t i = 1; i < d.size(); ++i) {
+    unsigned k = norm_ccc(norm_props(d[i]));
+    for (std::size_t j = i; j > 0 && k != 0; --j) {
+      if (norm_ccc(norm_props(d[j - 1])) <= k)
+	break;
+      std::swap(d[j], d[j - 1]);
     }
   }
-  if (och_need)
-    return err_status(status_type::NO_FOLLOW);
-  if (c < 0xe0) {
-    // two byte code - minimum 0x80.
-    och_min = 0x80;
-    och_need = 1;
-    och = c & 0x1f;
-    return c;
+
+  // and for NFC and NFKC the canonical composition.
+  if (f % 2 == 0 && ! d.empty()) {
+    std::size_t starter = 0;
+    std::size_t w = 1;
+    unsigned last = norm_ccc(norm_props(d[0])) ? 256 : 0;
+    for (std::size_t i = 1; i < d.size(); ++i) {
+      char32_t c = d[i];
+      unsigned k = norm_ccc(norm_props(c));
+      char32_t p = last == 256 ? 0 : compose(d[starter], c);
+      if (p != 0 && (last < k || last == 0)) {
+	d[starter] = p;
+	continue;
+      }
+      if (k == 0)
+	starter = w;
+      last = k;
+      d[w++] = c;
+    }
+    d.resize(w);
   }
-  if (c < 0xf0) {
-    // three byte code - minimum 0x800
-    och_min = 0x800;
-    och_need = 2;
-    och = c & 0x0f;
-    return c;
+  out += d;
+}
+
+// The next place in [s + i, s + n) where a segment starts, a segment is
+// cut where it reaches maxseg after seg.
+std::size_t
+next_start(int f, const char32_t * s, std::size_t i, std::size_t n,
+	   std::size_t seg, std::size_t maxseg = NORM_MAXSEG)
+{
+  char32_t fast = norm_fast_limit[f];
+
+  for (; i < n; ++i)
+    if (s[i] < fast || norm_starts(norm_props(s[i]), f)
+	|| i - seg >= maxseg)
+      return i;
+  return n;
+}
+
+// The quick check: how much of [s, s + n) is whole segments that are
+// normalized already. It stops at the first segment that isn't, or
+// unless last at the last one since what follows may change it.
+// [s, s + n) must start a segment, which is cut at maxseg.
+std::size_t
+quick_span(int f, const char32_t * s, std::size_t n, bool last,
+	   std::size_t maxseg = NORM_MAXSEG)
+{
+  char32_t fast = norm_fast_limit[f];
+  std::size_t seg = 0;
+  unsigned prev = 0;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    if (s[i] < fast) {
+      while (i + 1 < n && s[i + 1] < fast)
+	++i;
+      seg = i;
+      prev = 0;
+      continue;
+    }
+    std::uint16_t p = norm_props(s[i]);
+    if (norm_starts(p, f) || i - seg >= maxseg)
+      seg = i;
+    unsigned k = norm_ccc(p);
+    if (norm_not_yes(p, f) || (k != 0 && k < prev))
+      return seg;
+    prev = k;
   }
-  och_min = 0x10000;
-  och_need = 3;
-  och = c & 0x07;
-  return c;
+  return last ? n : seg;
+}
+
+// Normalize [s, s + n) to form f as far as it can be done without
+// seeing what comes next, all of it if last, and append it to out.
+// Return how much of [s, s + n) was taken, it must start a segment.
+// Segments are cut at maxseg.
+std::size_t
+normalize_text(int f, const char32_t * s, std::size_t n, bool last,
+	       std::u32string & out, std::u32string & d,
+	       std::size_t maxseg = NORM_MAXSEG)
+{
+  std::size_t i = 0;
 
+  while (i < n) {
+    std::size_t q = quick_span(f, s + i, n - i, last, maxseg);
+    out.append(s + i, q);
+    i += q;
+    if (i == n)
+      break;
+    std::size_t e = next_start(f, s, i + 1, n, i, maxseg);
+    if (e == n && ! last)
+      break;
+    normalize_segment(f, s + i, e - i, out, d);
+    i = e;
+  }
+  return i;
 }
 
-////////////////////////////////
-// utf8
+}; // end of anonymous namespace
 
 // for reading.
-alf::unicodestreams::utf8streambuf::utf8streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+alf::unicodestreams::u32normalize_streambuf::
+u32normalize_streambuf(src_stream & is, normal_form f /* = NFC */)
+  : is_(& is), os_(0), status_(status_type()), form_(f), eof_(false)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
+  this->setg(0, 0, 0);
   this->setp(0, 0);
 }
 
 // for writing
-alf::unicodestreams::utf8streambuf::utf8streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+alf::unicodestreams::u32normalize_streambuf::
+u32normalize_streambuf(dst_stream & os, normal_form f /* = NFC */)
+  : is_(0), os_(& os), status_(status_type()), form_(f), eof_(false)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
+  this->setg(0, 0, 0);
   this->setp(0, 0);
 }
- 
-// for both.
-alf::unicodestreams::utf8streambuf::
-utf8streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+alf::unicodestreams::u32normalize_streambuf::~u32normalize_streambuf()
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och_need = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (os_)
+    finish();
 }
 
 // virtual
-alf::unicodestreams::utf8streambuf::int_type
-alf::unicodestreams::utf8streambuf::underflow()
+alf::unicodestreams::u32normalize_streambuf::int_type
+alf::unicodestreams::u32normalize_streambuf::underflow()
 {
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
   return get();
 }
 
-// virtual
-alf::unicodestreams::utf8streambuf::int_type
-alf::unicodestreams::utf8streambuf::overflow(int_type __c)
+// Normalize until there is something to give, keeping the last chars
+// given for putback.
+alf::unicodestreams::u32normalize_streambuf::int_type
+alf::unicodestreams::u32normalize_streambuf::get()
 {
-  return put(__c);
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  std::size_t used = this->gptr() - this->eback();
+  std::size_t keep = used < EBACK ? used : std::size_t(EBACK);
+  std::u32string d;
+
+  out_.erase(0, used - keep);
+  while (out_.size() == keep) {
+    if (! eof_) {
+      status_type s = src_status(is_);
+      if (s != status_type::OK)
+	return err_status(s);
+      std::size_t h = in_.size();
+      in_.resize(h + RAWSZ);
+      std::streamsize k = read_raw(is_, & in_[h], RAWSZ, 1);
+      in_.resize(h + k);
+      eof_ = k == 0;
+    } else if (in_.empty())
+      break;
+    std::size_t t = normalize_text(int(form_), in_.data(), in_.size(), eof_,
+				   out_, d);
+    in_.erase(0, t);
+  }
+  this->setg(& out_[0], & out_[0] + keep, & out_[0] + out_.size());
+  if (out_.size() == keep)
+    return traits_type::eof();
+  return traits_type::to_int_type(*this->gptr());
 }
 
 // virtual
-alf::unicodestreams::utf8streambuf::streambuf *
-alf::unicodestreams::utf8streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+// Text that is normalized already is read straight into __s, only what
+// comes after it goes through the buffers.
+std::streamsize
+alf::unicodestreams::u32normalize_streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
 {
-
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+  std::streamsize k = 0;
+
+  while (k < __n) {
+    std::streamsize a = this->egptr() - this->gptr();
+    if (a > 0) {
+      if (a > __n - k)
+	a = __n - k;
+      traits_type::copy(__s + k, this->gptr(), a);
+      this->gbump(int(a));
+      k += a;
+      continue;
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
+    if (status_ != status_type::OK)
+      break;
+    std::streamsize h = in_.size();
+    if (! eof_ && h < __n - k && src_status(is_) == status_type::OK) {
+      traits_type::copy(__s + k, in_.data(), h);
+      std::streamsize m = read_raw(is_, __s + k + h, __n - k - h, 1);
+      eof_ = m == 0;
+      std::size_t q = quick_span(int(form_), __s + k, h + m, eof_);
+      in_.assign(__s + k + q, h + m - q);
+      k += q;
+      if (q > 0)
+	continue;
+    }
+    if (traits_type::eq_int_type(get(), traits_type::eof()))
+      break;
   }
-  return this;
-
+  if (this->gptr() == this->egptr() && k > 0) {
+    std::streamsize b = k < EBACK ? k : std::streamsize(EBACK);
+    out_.assign(__s + k - b, b);
+    this->setg(& out_[0], & out_[0] + b, & out_[0] + b);
+  }
+  return k;
 }
 
-alf::unicodestreams::utf8streambuf::int_type
-alf::unicodestreams::utf8streambuf::get()
+// Normalize what is in in_ and write it, as far as it can be done or
+// all of it if last.
+bool
+alf::unicodestreams::u32normalize_streambuf::put_text(bool last)
 {
-  int_type c, a;
+  std::u32string d;
+
+  out_.clear();
+  std::size_t t = normalize_text(int(form_), in_.data(), in_.size(), last,
+				 out_, d);
+  in_.erase(0, t);
+  if (! out_.empty() && ! os_->write(out_.data(), out_.size())) {
+    err_status(status_type::BAD_STREAM);
+    return false;
+  }
+  return true;
+}
 
+// virtual
+alf::unicodestreams::u32normalize_streambuf::int_type
+alf::unicodestreams::u32normalize_streambuf::overflow(int_type __c)
+{
   if (status_ != status_type::OK)
     return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (traits_type::eq_int_type(__c, traits_type::eof()))
+    return traits_type::not_eof(__c);
+  in_ += char32_t(__c);
+  if (in_.size() >= RAWSZ && ! put_text(false))
+    return traits_type::eof();
+  return __c;
+}
 
-  if ((c = get_utf8(is_)) < 0) {
-    if (c == -(int_type)status_type::EOF_STREAM)
-      return traits_type::eof();
-    return err_status((status_type)-c);
-  }
-  if (this->egptr() + 3 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+// virtual
+// Finish the segment held back, then write what is normalized already
+// straight from __s.
+std::streamsize
+alf::unicodestreams::u32normalize_streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (status_ != status_type::OK)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
   }
 
-  char_type * base = this->gptr();
-  char_type * p = base;
-  int_type ret = 0;
-  if (c < 0x80) {
-    *p++ = char_type(ret = c);
-  } else if (c < 0x800) {
-    *p++ = char_type(ret = 0xc0 | (c >> 6));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else if (c < 0x10000) {
-    *p++ = char_type(ret = 0xe0 | (c >> 12));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
-  } else {
-    *p++ = char_type(ret = 0xf0 | (c >> 18));
-    *p++ = char_type(0x80 | ((c >> 12) & 0x3f));
-    *p++ = char_type(0x80 | ((c >> 6) & 0x3f));
-    *p++ = char_type(0x80 | (c & 0x3f));
+  int f = int(form_);
+  std::size_t i = 0;
+  std::size_t n = __n;
+
+  if (! in_.empty()) {
+    i = next_start(f, __s, 0, n, 0);
+    in_.append(__s, i);
+    if (i == n)
+      return in_.size() >= RAWSZ && ! put_text(false) ? 0 : __n;
+    if (! put_text(true))
+      return 0;
   }
-  this->setg(ibufb, base, p);
-  return traits_type::to_int_type(*this->gptr());
+  std::size_t q = quick_span(f, __s + i, n - i, false);
+  if (q > 0 && ! os_->write(__s + i, q)) {
+    err_status(status_type::BAD_STREAM);
+    return 0;
+  }
+  in_.assign(__s + i + q, n - i - q);
+  if (in_.size() >= RAWSZ && ! put_text(false))
+    return 0;
+  return __n;
+}
 
+// virtual
+// writes what can be written, the last segment is still held back.
+int
+alf::unicodestreams::u32normalize_streambuf::sync()
+{
+  if (os_ == 0)
+    return 0;
+  if (status_ != status_type::OK || ! put_text(false) || ! os_->flush())
+    return -1;
+  return 0;
 }
 
-alf::unicodestreams::utf8streambuf::int_type
-alf::unicodestreams::utf8streambuf::put(int_type c)
+alf::unicodestreams::u32normalize_streambuf &
+alf::unicodestreams::u32normalize_streambuf::finish()
 {
+  if (os_ && status_ == status_type::OK && put_text(true))
+    os_->flush();
+  return *this;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+std::u32string
+alf::unicodestreams::normalize(std::u32string_view s,
+			       normal_form f /* = NFC */)
+{
+  std::u32string r;
+  std::u32string d;
+
+  // all of s is here, so no segment is cut short as the streams do.
+  if (quick_span(int(f), s.data(), s.size(), true, s.size()) == s.size())
+    return std::u32string(s);
+  r.reserve(s.size());
+  normalize_text(int(f), s.data(), s.size(), true, r, d, s.size());
+  return r;
+}
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
-  }
+////////////////////////////////
+// case folding
 
-  if (c < 0 || c > 0xf7)
-    return err_status(status_type::NOT_UTF8);
+namespace {
 
-  if (c < 0x80) {
-    if (och_need)
-      return err_status(status_type::NO_FOLLOW);
-    return c;
-  }
-  int_type b;
-  if (c < 0xc0) {
-    if (och_need == 0)
-      return err_status(status_type::NO_LEAD);
-    och = (och << 6) | (c & 0x3f);
-    if (--och_need == 0) {
-      if (! is_valid_utf32(char32_t(och)))
-	return err_status(status_type::NOT_UNICODE);
-      if (och < och_min)
-	return err_status(status_type::NOT_UTF8);
-      b = put_utf8(os_, och);
-      if (b < 0)
-	return err_status((status_type)-b);
-      return c;
-    }
+// U+00B5 and U+00DF are the only ISO 8859-1 chars that don't fold to
+// themselves or to the small letter 32 above them.
+inline
+bool
+latin1_folds_simply(char32_t c)
+{
+  return c < 0x100 && c != 0xb5 && c != 0xdf;
+}
+
+// fold c, one of those.
+inline
+char32_t
+fold_latin1(char32_t c)
+{
+  return c - 'A' < 26 || (c - 0xc0 < 0x1f && c != 0xd7) ? c + 32 : c;
+}
+
+// Store how c folds at d, return the number of chars stored.
+inline
+unsigned
+fold_char(char32_t c, char32_t * d)
+{
+  unsigned v = case_fold(c);
+  if (v < 0x8000) {
+    *d = char32_t(c + fold_deltas[v]);
+    return 1;
   }
-  if (och_need)
-    return err_status(status_type::NO_FOLLOW);
-  if (c < 0xe0) {
-    // two byte code - minimum 0x80.
-    och_min = 0x80;
-    och_need = 1;
-    och = c & 0x1f;
-    return c;
+  unsigned n = (v >> 11) & 0xf;
+  const char32_t * f = fold_pool + (v & 0x7ff);
+  for (unsigned i = 0; i < n; ++i)
+    d[i] = f[i];
+  return n;
+}
+
+#if defined(__SSE2__)
+// the upper case letters of ISO 8859-1 among the 32 bit values in v.
+inline
+__m128i
+upper_latin1(__m128i v)
+{
+  __m128i a = _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32('A' - 1)),
+			    _mm_cmplt_epi32(v, _mm_set1_epi32('Z' + 1)));
+  __m128i b = _mm_and_si128(_mm_cmpgt_epi32(v, _mm_set1_epi32(0xbf)),
+			    _mm_cmplt_epi32(v, _mm_set1_epi32(0xdf)));
+  b = _mm_andnot_si128(_mm_cmpeq_epi32(v, _mm_set1_epi32(0xd7)), b);
+  return _mm_or_si128(a, b);
+}
+#endif
+
+// Fold the leading chars of [p, p + n) that latin1_folds_simply() to
+// q, which may be p. Return how many.
+inline
+std::size_t
+fold_latin1_run(const char32_t * p, std::size_t n, char32_t * q)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i top = _mm_set1_epi32(0xff);
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i odd = _mm_or_si128(_mm_cmpgt_epi32(v, top), _mm_cmplt_epi32(v, z));
+    odd = _mm_or_si128(odd, _mm_cmpeq_epi32(v, _mm_set1_epi32(0xb5)));
+    odd = _mm_or_si128(odd, _mm_cmpeq_epi32(v, _mm_set1_epi32(0xdf)));
+    if (_mm_movemask_epi8(odd))
+      break;
+    __m128i up = _mm_and_si128(upper_latin1(v), _mm_set1_epi32(32));
+    _mm_storeu_si128((__m128i *)(q + i), _mm_add_epi32(v, up));
   }
-  if (c < 0xf0) {
-    // three byte code - minimum 0x800
-    och_min = 0x800;
-    och_need = 2;
-    och = c & 0x0f;
-    return c;
+#endif
+  for (; i < n && latin1_folds_simply(p[i]); ++i)
+    q[i] = fold_latin1(p[i]);
+  return i;
+}
+
+// widen_ascii() that also folds, A-Z become a-z.
+inline
+std::size_t
+fold_ascii_run(const unsigned char * p, std::size_t n, char32_t * q)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i z = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    if (_mm_movemask_epi8(v))
+      break;
+    __m128i up = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+			       _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    v = _mm_add_epi8(v, _mm_and_si128(up, _mm_set1_epi8(32)));
+    __m128i lo = _mm_unpacklo_epi8(v, z);
+    __m128i hi = _mm_unpackhi_epi8(v, z);
+    _mm_storeu_si128((__m128i *)(q + i), _mm_unpacklo_epi16(lo, z));
+    _mm_storeu_si128((__m128i *)(q + i + 4), _mm_unpackhi_epi16(lo, z));
+    _mm_storeu_si128((__m128i *)(q + i + 8), _mm_unpacklo_epi16(hi, z));
+    _mm_storeu_si128((__m128i *)(q + i + 12), _mm_unpackhi_epi16(hi, z));
   }
-  och_min = 0x10000;
-  och_need = 3;
-  och = c & 0x07;
-  return c;
+#endif
+  for (; i < n && p[i] < 0x80; ++i)
+    q[i] = fold_latin1(p[i]);
+  return i;
+}
 
+// Fold [s, se) to [d, de) as far as whole foldings fit, s and d are
+// left after what is done.
+inline
+void
+fold_text(const char32_t *& s, const char32_t * se,
+	  char32_t *& d, char32_t * de)
+{
+  const char32_t * p = s;
+  char32_t * q = d;
+  char32_t t[fold_maxlen];
+
+  while (p < se && q < de) {
+    std::size_t n = se - p;
+    if (std::size_t(de - q) < n)
+      n = de - q;
+    n = fold_latin1_run(p, n, q);
+    p += n;
+    q += n;
+    if (p == se || q == de)
+      break;
+    unsigned k = fold_char(*p, t);
+    if (de - q < k)
+      break;
+    for (unsigned i = 0; i < k; ++i)
+      q[i] = t[i];
+    q += k;
+    ++p;
+  }
+  s = p;
+  d = q;
 }
 
-////////////////////////////////
-// u32iso8859_1
+// fold_text() for decode_from(), folding what is read from a char32_t
+// stream.
+struct fold_decoder {
+
+  enum { MAXLEN = 1, EXPAND = fold_maxlen };
+
+  status_type operator () (const char32_t *& s, const char32_t * se,
+			   char32_t *& d, char32_t * de) const
+  {
+    fold_text(s, se, d, de);
+    return status_type::OK;
+  }
+
+  static int need(const char32_t *, const char32_t *)
+  { return 0; }
+
+}; // end of struct fold_decoder
+
+// utf8_decoder that folds what it decodes. No code point folds to more
+// than EXPAND chars so that many for every byte leaves room for the one
+// decode_from() completes at the end.
+struct utf8_fold_decoder {
+
+  enum { MAXLEN = 4, EXPAND = fold_maxlen };
+
+  status_type operator () (const char *& s, const char * se,
+			   char32_t *& d, char32_t * de) const
+  {
+    const unsigned char * p = (const unsigned char *)s;
+    const unsigned char * pe = (const unsigned char *)se;
+    char32_t * q = d;
+    status_type st = status_type::OK;
+    char32_t w;
+    char32_t t[fold_maxlen];
+    int k;
+
+    while (p < pe && q < de) {
+      unsigned int c = *p;
+      if (c < 0x80) {
+	std::size_t n = pe - p;
+	if (std::size_t(de - q) < n)
+	  n = de - q;
+	n = fold_ascii_run(p, n, q);
+	p += n;
+	q += n;
+	continue;
+      }
+      if ((k = utf8_seq_len(c)) == 0) {
+	st = c < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+	break;
+      }
+      if (pe - p < k) {
+	if (! utf8_cut_ok(p, pe))
+	  st = status_type::NOT_UTF8;
+	break;
+      }
+      if ((st = check_utf8(p, k, w)) != status_type::OK)
+	break;
+      if (latin1_folds_simply(w))
+	*q++ = fold_latin1(w);
+      else {
+	unsigned m = fold_char(w, t);
+	if (de - q < m)
+	  break;
+	for (unsigned i = 0; i < m; ++i)
+	  q[i] = t[i];
+	q += m;
+      }
+      p += k;
+    }
+    s = (const char *)p;
+    d = q;
+    return st;
+  }
+
+  static int need(const char * s, const char * se)
+  { return utf8_decoder::need(s, se); }
+
+}; // end of struct utf8_fold_decoder
+
+// utf8_encoder that folds before it encodes.
+struct utf8_fold_encoder {
+
+  enum { MAXLEN = 4 * fold_maxlen };
+
+  status_type operator () (const char32_t *& s, const char32_t * se,
+			   char *& d, char * de) const
+  {
+    const char32_t * p = s;
+    char * q = d;
+    status_type st = status_type::OK;
+    char32_t t[fold_maxlen];
+
+    while (p < se && q < de) {
+      char32_t w = *p;
+      if (w < 0x80) {
+	std::size_t m = se - p;
+	if (std::size_t(de - q) < m)
+	  m = de - q;
+	m = narrow_ascii(p, m, (unsigned char *)q);
+	for (std::size_t i = 0; i < m; ++i)
+	  q[i] = char(fold_latin1(q[i]));
+	p += m;
+	q += m;
+	continue;
+      }
+      if (! is_valid_utf32(w)) {
+	st = status_type::NOT_UNICODE;
+	break;
+      }
+      unsigned k = fold_char(w, t);
+      if (std::size_t(de - q) < alf::unicodestreams::utf8_length(t, k))
+	break;
+      const char32_t * f = t;
+      utf8_encoder()(f, t + k, q, de);
+      ++p;
+    }
+    s = p;
+    d = q;
+    return st;
+  }
+
+  static int need(const char32_t *, const char32_t *)
+  { return 0; }
+
+}; // end of struct utf8_fold_encoder
+
+}; // end of anonymous namespace
 
 // for reading.
-alf::unicodestreams::u32iso8859_1_streambuf::
-u32iso8859_1_streambuf(src_stream & is)
+alf::unicodestreams::u32casefold_streambuf::
+u32casefold_streambuf(src_stream & is)
   : is_(& is), os_(0), status_(status_type())
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
   this->setg(ibuf, ibuf, ibuf);
   this->setp(0, 0);
 }
 
 // for writing
-alf::unicodestreams::u32iso8859_1_streambuf::
-u32iso8859_1_streambuf(dst_stream & os)
+alf::unicodestreams::u32casefold_streambuf::
+u32casefold_streambuf(dst_stream & os)
   : is_(0), os_(& os), status_(status_type())
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
   this->setg(ibuf, ibuf, ibuf);
   this->setp(0, 0);
 }
- 
-// for both.
-alf::unicodestreams::u32iso8859_1_streambuf::
-u32iso8859_1_streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+// virtual
+alf::unicodestreams::u32casefold_streambuf::int_type
+alf::unicodestreams::u32casefold_streambuf::underflow()
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
+
+// fold a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32casefold_streambuf::int_type
+alf::unicodestreams::u32casefold_streambuf::get()
+{
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibuf, this->gptr(), EBACK);
+  std::streamsize n = decode_from(is_, p, ibuf + IBUFSZ - p, 1, s,
+				  fold_decoder());
+  this->setg(ibuf, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
 }
 
 // virtual
-alf::unicodestreams::u32iso8859_1_streambuf::int_type
-alf::unicodestreams::u32iso8859_1_streambuf::underflow()
+// Fold straight into __s, except for the last few chars where a
+// folding might not fit, those go through ibuf.
+std::streamsize
+alf::unicodestreams::u32casefold_streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
 {
-  return get();
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
+  }
+  if (__n - k >= fold_maxlen) {
+    k += decode_from(is_, __s + k, __n - k, __n - k - fold_maxlen + 1, s,
+		     fold_decoder());
+    if (s != status_type::OK && s != status_type::EOF_STREAM)
+      status_ = s;
+    char_type * p = copy_putback(ibuf, __s, k, EBACK);
+    this->setg(ibuf, p, p);
+    if (s != status_type::OK)
+      return k;
+  }
+  while (k < __n && ! traits_type::eq_int_type(get(), traits_type::eof())) {
+    std::streamsize a = this->egptr() - this->gptr();
+    if (a > __n - k)
+      a = __n - k;
+    traits_type::copy(__s + k, this->gptr(), a);
+    this->gbump(int(a));
+    k += a;
+  }
+  return k;
 }
 
 // virtual
-alf::unicodestreams::u32iso8859_1_streambuf::int_type
-alf::unicodestreams::u32iso8859_1_streambuf::overflow(int_type __c)
+alf::unicodestreams::u32casefold_streambuf::int_type
+alf::unicodestreams::u32casefold_streambuf::overflow(int_type __c)
 {
-  return put(__c);
+  if (status_ != status_type::OK)
+    return traits_type::eof();
+  if (os_ == 0)
+    return err_status(status_type::NO_STREAM);
+  if (traits_type::eq_int_type(__c, traits_type::eof()))
+    return traits_type::not_eof(__c);
+
+  char_type t[fold_maxlen];
+  unsigned k = fold_char(char_type(__c), t);
+  if (! os_->write(t, k))
+    return err_status(status_type::BAD_STREAM);
+  return __c;
 }
 
 // virtual
-alf::unicodestreams::u32iso8859_1_streambuf::streambuf *
-alf::unicodestreams::u32iso8859_1_streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+// fold a block at a time.
+std::streamsize
+alf::unicodestreams::u32casefold_streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
 {
+  if (status_ != status_type::OK)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+  const char_type * p = __s;
+  const char_type * pe = __s + __n;
+  char_type buf[IBUFSZ];
+
+  while (p < pe) {
+    const char_type * q = p;
+    char_type * d = buf;
+    fold_text(p, pe, d, buf + IBUFSZ);
+    if (! os_->write(buf, d - buf)) {
+      err_status(status_type::BAD_STREAM);
+      return q - __s;
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
   }
-  return this;
+  return __n;
+}
+
+// for reading.
+alf::unicodestreams::u32utf8casefold_streambuf::
+u32utf8casefold_streambuf(src_stream & is)
+  : is_(& is), os_(0), status_(status_type())
+{
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
+}
 
+// for writing
+alf::unicodestreams::u32utf8casefold_streambuf::
+u32utf8casefold_streambuf(dst_stream & os)
+  : is_(0), os_(& os), status_(status_type())
+{
+  this->setg(ibuf, ibuf, ibuf);
+  this->setp(0, 0);
 }
 
-alf::unicodestreams::u32iso8859_1_streambuf::int_type
-alf::unicodestreams::u32iso8859_1_streambuf::get()
+// virtual
+alf::unicodestreams::u32utf8casefold_streambuf::int_type
+alf::unicodestreams::u32utf8casefold_streambuf::underflow()
 {
-  char ch;
+  if (this->gptr() < this->egptr())
+    return traits_type::to_int_type(*this->gptr());
+  return get();
+}
 
+// decode and fold a block from is_ into the buffer after what we keep
+// for putback.
+alf::unicodestreams::u32utf8casefold_streambuf::int_type
+alf::unicodestreams::u32utf8casefold_streambuf::get()
+{
   if (status_ != status_type::OK)
     return traits_type::eof();
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_)
-    return err_status(status_type::BAD_STREAM);
-  if (! is_->get(ch)) {
-    if (is_->rdstate() & std::ios_base::eofbit)
-      return traits_type::eof();
-    return err_status(status_type::BAD_STREAM);
-  }
+  status_type s = src_status(is_);
+  if (s != status_type::OK)
+    return err_status(s);
+
+  char_type * p = save_putback(ibuf, this->gptr(), EBACK);
+  std::streamsize n = decode_from(is_, p, ibuf + IBUFSZ - p, 1, s,
+				  utf8_fold_decoder());
+  this->setg(ibuf, p, p + n);
+  if (s != status_type::OK && s != status_type::EOF_STREAM)
+    status_ = s;
+  if (n == 0)
+    return traits_type::eof();
+  return traits_type::to_int_type(*p);
+}
 
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+// virtual
+// as u32casefold_streambuf::xsgetn().
+std::streamsize
+alf::unicodestreams::u32utf8casefold_streambuf::
+xsgetn(char_type * __s, std::streamsize __n)
+{
+  std::streamsize k = this->egptr() - this->gptr();
+  if (k > __n)
+    k = __n;
+  traits_type::copy(__s, this->gptr(), k);
+  this->gbump(int(k));
+  if (k == __n || status_ != status_type::OK)
+    return k;
+
+  status_type s = src_status(is_);
+  if (s != status_type::OK) {
+    err_status(s);
+    return k;
   }
-
-  return traits_type::to_int_type(*this->gptr() = ch);
-
+  if (__n - k >= fold_maxlen) {
+    k += decode_from(is_, __s + k, __n - k, __n - k - fold_maxlen + 1, s,
+		     utf8_fold_decoder());
+    if (s != status_type::OK && s != status_type::EOF_STREAM)
+      status_ = s;
+    char_type * p = copy_putback(ibuf, __s, k, EBACK);
+    this->setg(ibuf, p, p);
+    if (s != status_type::OK)
+      return k;
+  }
+  while (k < __n && ! traits_type::eq_int_type(get(), traits_type::eof())) {
+    std::streamsize a = this->egptr() - this->gptr();
+    if (a > __n - k)
+      a = __n - k;
+    traits_type::copy(__s + k, this->gptr(), a);
+    this->gbump(int(a));
+    k += a;
+  }
+  return k;
 }
 
-alf::unicodestreams::u32iso8859_1_streambuf::int_type
-alf::unicodestreams::u32iso8859_1_streambuf::put(int_type c)
+// virtual
+alf::unicodestreams::u32utf8casefold_streambuf::int_type
+alf::unicodestreams::u32utf8casefold_streambuf::overflow(int_type __c)
 {
   if (status_ != status_type::OK)
     return traits_type::eof();
-
   if (os_ == 0)
     return err_status(status_type::NO_STREAM);
   if (! *os_ )
     return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
-  if (c < 0 || c > 0xff)
-    return err_status(status_type::NOT_ISO_8859_1);
-  if (! os_->put(char(c)))
-    return err_status(status_type::BAD_STREAM);
-  return c;
+  if (traits_type::eq_int_type(__c, traits_type::eof()))
+    return traits_type::not_eof(__c);
+
+  char_type c = char_type(__c);
+  status_type s;
+  if (encode_to(os_, & c, 1, s, utf8_fold_encoder()) != 1)
+    return err_status(s);
+  return __c;
+}
+
+// virtual
+// fold and encode a block at a time.
+std::streamsize
+alf::unicodestreams::u32utf8casefold_streambuf::
+xsputn(const char_type * __s, std::streamsize __n)
+{
+  if (status_ != status_type::OK)
+    return 0;
+  if (os_ == 0) {
+    err_status(status_type::NO_STREAM);
+    return 0;
+  }
+  if (! *os_) {
+    err_status(status_type::BAD_STREAM);
+    return 0;
+  }
 
+  status_type s;
+  std::streamsize k = encode_to(os_, __s, __n, s, utf8_fold_encoder());
+  if (s != status_type::OK)
+    status_ = s;
+  return k;
+}
+
+std::u32string
+alf::unicodestreams::casefold(std::u32string_view s)
+{
+  std::u32string r(s.size(), char32_t());
+  const char32_t * p = s.data();
+  const char32_t * pe = p + s.size();
+  std::size_t k = 0;
+
+  while (p < pe) {
+    char32_t * d = r.data() + k;
+    fold_text(p, pe, d, r.data() + r.size());
+    k = d - r.data();
+    if (p < pe)
+      r.resize(r.size() + (pe - p) + fold_maxlen);
+  }
+  r.resize(k);
+  return r;
 }
 
 ////////////////////////////////
-// u16iso8859_1_
+// grapheme clusters
 
-// for reading.
-alf::unicodestreams::u16iso8859_1_streambuf::
-u16iso8859_1_streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+namespace {
+
+// the grapheme_props() of c, with the Hangul LV syllables told apart.
+inline
+unsigned
+grapheme_prop(char32_t c)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  unsigned p = grapheme_props(c);
+  if (p == GCB_LVT && (c - HANGUL_S) % HANGUL_TN == 0)
+    return GCB_LV;
+  return p;
 }
 
-// for writing
-alf::unicodestreams::u16iso8859_1_streambuf::
-u16iso8859_1_streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+// What decides if the next char is in the cluster, see UAX #29.
+struct grapheme_state {
+
+  unsigned prev; // grapheme_prop() of the last char.
+  unsigned emoji; // 1 after ExtPict Extend*, 2 after that and ZWJ.
+  bool ri_odd; // after an odd number of Regional_Indicator.
+
+  explicit grapheme_state(unsigned p)
+    : prev(p), emoji(p & GCB_EXTPICT ? 1 : 0), ri_odd((p & 15) == GCB_RI)
+  { }
+
+  // true if a char with grapheme_prop() p starts a new cluster.
+  bool breaks(unsigned p)
+  {
+    unsigned a = prev & 15;
+    unsigned b = p & 15;
+    bool join;
+
+    if (a == GCB_CR || a == GCB_LF || a == GCB_CONTROL)
+      join = a == GCB_CR && b == GCB_LF; // GB3, GB4
+    else if (b == GCB_CR || b == GCB_LF || b == GCB_CONTROL)
+      join = false; // GB5
+    else if (b == GCB_EXTEND || b == GCB_ZWJ || b == GCB_SPACINGMARK
+	     || a == GCB_PREPEND)
+      join = true; // GB9, GB9a, GB9b
+    else if (a == GCB_L)
+      join = b == GCB_L || b == GCB_V || b == GCB_LV || b == GCB_LVT; // GB6
+    else if (a == GCB_LV || a == GCB_V)
+      join = b == GCB_V || b == GCB_T; // GB7
+    else if (a == GCB_LVT || a == GCB_T)
+      join = b == GCB_T; // GB8
+    else if (a == GCB_ZWJ)
+      join = emoji == 2 && (p & GCB_EXTPICT); // GB11
+    else
+      join = a == GCB_RI && b == GCB_RI && ri_odd; // GB12, GB13
+
+    if (! join) {
+      *this = grapheme_state(p);
+      return true;
+    }
+    if (p & GCB_EXTPICT)
+      emoji = 1;
+    else if (b == GCB_ZWJ && emoji == 1)
+      emoji = 2;
+    else if (b != GCB_EXTEND || emoji != 1)
+      emoji = 0;
+    ri_odd = b == GCB_RI && ! (a == GCB_RI && ri_odd);
+    prev = p;
+    return false;
+  }
+
+}; // end of struct grapheme_state
+
+// The end of the cluster that starts at s, se if it may go on after se.
+const char32_t *
+grapheme_end(const char32_t * s, const char32_t * se)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (s == se)
+    return s;
+  if (*s < 0x80 && *s != '\r' && se - s > 1 && s[1] < 0x80)
+    return s + 1;
+
+  grapheme_state st(grapheme_prop(*s));
+  const char32_t * p = s + 1;
+  while (p < se && ! st.breaks(grapheme_prop(*p)))
+    ++p;
+  return p;
 }
- 
- // for both.
-alf::unicodestreams::u16iso8859_1_streambuf::
-u16iso8859_1_streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+}; // end of anonymous namespace
+
+alf::unicodestreams::u32grapheme_reader::
+u32grapheme_reader(src_stream & is, std::size_t bufsz /* = BUFSZ */)
+  : sb_(is.rdbuf()), eof_(false)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = clusterb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
 }
 
-// virtual
-alf::unicodestreams::u16iso8859_1_streambuf::int_type
-alf::unicodestreams::u16iso8859_1_streambuf::underflow()
+alf::unicodestreams::u32grapheme_reader::
+u32grapheme_reader(src_streambuf * sb, std::size_t bufsz /* = BUFSZ */)
+  : sb_(sb), eof_(false)
 {
-  return get();
+  if (bufsz < 16)
+    bufsz = 16;
+  bufb = clusterb = datae = new char_type[bufsz];
+  bufe = bufb + bufsz;
 }
 
-// virtual
-alf::unicodestreams::u16iso8859_1_streambuf::int_type
-alf::unicodestreams::u16iso8859_1_streambuf::overflow(int_type __c)
+alf::unicodestreams::u32grapheme_reader::~u32grapheme_reader()
 {
-  return put(__c);
+  delete [] bufb;
 }
 
-// virtual
-alf::unicodestreams::u16iso8859_1_streambuf::streambuf *
-alf::unicodestreams::u16iso8859_1_streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+alf::unicodestreams::u32grapheme_reader &
+alf::unicodestreams::u32grapheme_reader::reset(src_streambuf * sb)
 {
+  sb_ = sb;
+  eof_ = false;
+  clusterb = datae = bufb;
+  return *this;
+}
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
+// A cluster that reaches the end of what we have may go on, then read
+// more and look again.
+bool
+alf::unicodestreams::u32grapheme_reader::next(view_type & cluster)
+{
+  const char_type * e;
+
+  while ((e = grapheme_end(clusterb, datae)) == datae) {
+    if (! fill()) {
+      e = datae; // fill() may have moved it.
+      break;
     }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
   }
-  return this;
+  if (clusterb == datae)
+    return false;
+  cluster = view_type(clusterb, e - clusterb);
+  clusterb += e - clusterb;
+  return true;
+}
+
+// as u32line_reader::fill().
+bool
+alf::unicodestreams::u32grapheme_reader::fill()
+{
+  if (sb_ == 0 || eof_)
+    return false;
+
+  std::size_t n = datae - clusterb;
+  if (clusterb > bufb) {
+    traits_type::move(bufb, clusterb, n);
+  } else if (datae == bufe) {
+    std::size_t sz = 2 * (bufe - bufb);
+    char_type * b = new char_type[sz];
+    traits_type::copy(b, bufb, n);
+    delete [] bufb;
+    bufb = b;
+    bufe = b + sz;
+  }
+  clusterb = bufb;
+  datae = bufb + n;
+
+  char_type * p = datae;
+  while (datae < bufe) {
+    std::streamsize k = sb_->in_avail();
+    if (k <= 0) {
+      if (datae > p)
+	break;
+      if (traits_type::eq_int_type(sb_->sgetc(), traits_type::eof())) {
+	eof_ = true;
+	break;
+      }
+      k = sb_->in_avail();
+    }
+    if (k > bufe - datae)
+      k = bufe - datae;
+    std::streamsize m = sb_->sgetn(datae, k);
+    datae += m;
+    if (m < k) {
+      eof_ = true;
+      break;
+    }
+  }
+  return datae > p;
+}
+
+std::u32string_view
+alf::unicodestreams::first_grapheme(std::u32string_view s)
+{
+  const char32_t * p = s.data();
+  return std::u32string_view(p, grapheme_end(p, p + s.size()) - p);
+}
+
+////////////////////////////////
+// display width
+
+namespace {
 
+// The next code point of [p, pe), U+FFFD for a code that is wrong.
+inline
+char32_t
+next_code(const char32_t *& p, const char32_t *)
+{
+  return *p++;
 }
 
-alf::unicodestreams::u16iso8859_1_streambuf::int_type
-alf::unicodestreams::u16iso8859_1_streambuf::get()
+inline
+char32_t
+next_code(const char16_t *& p, const char16_t * pe)
 {
-  char ch;
+  char32_t c = *p++;
+  if (c < 0xd800 || c >= 0xe000)
+    return c;
+  if (c < 0xdc00 && p < pe && *p >= 0xdc00 && *p < 0xe000)
+    return (((c & 0x3ff) << 10) | (*p++ & 0x3ff)) + 0x10000;
+  return 0xfffd;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+inline
+char32_t
+next_code(const char *& s, const char * se)
+{
+  const unsigned char * p = (const unsigned char *)s;
+  int k = utf8_seq_len(*p);
+  char32_t w;
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_)
-    return err_status(status_type::BAD_STREAM);
-  if (! is_->get(ch)) {
-    if (is_->rdstate() & std::ios_base::eofbit)
-      return traits_type::eof();
-    return err_status(status_type::BAD_STREAM);
+  if (k == 1) {
+    ++s;
+    return *p;
   }
-
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  if (k == 0 || se - s < k || check_utf8(p, k, w) != status_type::OK) {
+    ++s;
+    return 0xfffd;
   }
+  s += k;
+  return w;
+}
 
-  return traits_type::to_int_type(*this->gptr() = ch);
+// Number of leading printable ASCII codes of [p, p + n).
+template <class C>
+inline
+std::size_t
+printable_run(const C * p, std::size_t n)
+{
+  std::size_t i = 0;
 
+  while (i < n && p[i] >= 0x20 && p[i] < 0x7f)
+    ++i;
+  return i;
 }
 
-alf::unicodestreams::u16iso8859_1_streambuf::int_type
-alf::unicodestreams::u16iso8859_1_streambuf::put(int_type c)
+inline
+std::size_t
+printable_run(const char * s, std::size_t n)
+{
+  const unsigned char * p = (const unsigned char *)s;
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i lo = _mm_set1_epi8(0x1f);
+  const __m128i hi = _mm_set1_epi8(0x7f);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    int m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpgt_epi8(v, lo),
+					    _mm_cmplt_epi8(v, hi)));
+    if (m != 0xffff)
+      return i + __builtin_ctz(~m);
+  }
+#endif
+  while (i < n && p[i] >= 0x20 && p[i] < 0x7f)
+    ++i;
+  return i;
+}
+
+template <class C>
+inline
+bool
+is_ascii_unit(C c)
 {
+  return std::char_traits<C>::to_int_type(c) < 0x80;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+// Adds up the columns of the clusters of a text, see display_width().
+struct width_counter {
+
+  grapheme_state st;
+  std::size_t before; // columns of the clusters before this one.
+  int cols; // columns of this cluster.
+  bool pict; // this cluster starts with an Extended_Pictographic.
+
+  // the first char always starts a cluster after a control.
+  width_counter()
+    : st(GCB_CONTROL), before(0), cols(0), pict(false)
+  { }
+
+  // add c, true if it starts a cluster.
+  bool add(char32_t c)
+  {
+    unsigned p = grapheme_prop(c);
+    int w = alf::unicodestreams::char_width(c);
+
+    if (w < 0)
+      w = 0;
+    if (st.breaks(p)) {
+      before += cols;
+      cols = w;
+      pict = p & GCB_EXTPICT;
+      return true;
+    }
+    if (c == 0xfe0f && pict)
+      cols = 2;
+    else if (c == 0xfe0e && pict)
+      cols = 1;
+    else if ((p & 15) == GCB_RI)
+      cols = 2;
+    else if (w > cols)
+      cols = w;
+    return false;
+  }
 
-  if (os_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *os_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
-  if (c < 0 || c > 0xff)
-    return err_status(status_type::NOT_ISO_8859_1);
-  if (! os_->put(char16_t(c)))
-    return err_status(status_type::BAD_STREAM);
-  return c;
+  // add n > 1 printable ASCII chars, after the first one each of them
+  // is a cluster of one column.
+  void add_ascii(char32_t first, std::size_t n)
+  {
+    add(first);
+    before += cols + n - 2;
+    cols = 1;
+    st = grapheme_state(GCB_OTHER);
+    pict = false;
+  }
 
-}
+  std::size_t width() const { return before + cols; }
 
-////////////////////////////////
-// utf8iso8859_1_
+}; // end of struct width_counter
 
-// for reading.
-alf::unicodestreams::utf8iso8859_1_streambuf::
-utf8iso8859_1_streambuf(src_stream & is)
-  : is_(& is), os_(0), status_(status_type())
+template <class C>
+std::size_t
+text_width(const C * p, const C * pe)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  width_counter w;
+
+  while (p < pe) {
+    if (is_ascii_unit(*p)) {
+      std::size_t n = printable_run(p, pe - p);
+      if (n > 1) {
+	w.add_ascii(*p, n);
+	p += n;
+	continue;
+      }
+    }
+    w.add(next_code(p, pe));
+  }
+  return w.width();
 }
 
-// for writing
-alf::unicodestreams::utf8iso8859_1_streambuf::
-utf8iso8859_1_streambuf(dst_stream & os)
-  : is_(0), os_(& os), status_(status_type())
+// The length of the start of [s, se) that truncate_width() gives.
+template <class C>
+std::size_t
+text_truncate(const C * s, const C * se, std::size_t columns)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  width_counter w;
+  const C * p = s;
+  const C * cut = s; // where the clusters that fit end.
+
+  while (p < se) {
+    if (is_ascii_unit(*p)) {
+      std::size_t n = printable_run(p, se - p);
+      if (n > 1 && w.width() + n <= columns) {
+	w.add_ascii(*p, n);
+	p += n;
+	cut = p - 1;
+	continue;
+      }
+    }
+    const C * q = p;
+    if (w.add(next_code(p, se))) {
+      if (w.before > columns)
+	return cut - s;
+      cut = q;
+    }
+  }
+  return w.width() <= columns ? se - s : cut - s;
 }
- 
- // for both.
-alf::unicodestreams::utf8iso8859_1_streambuf::
-utf8iso8859_1_streambuf(src_stream & is, dst_stream & os)
-  : is_(& is), os_(& os), status_(status_type())
+
+}; // end of anonymous namespace
+
+std::size_t
+alf::unicodestreams::display_width(std::string_view s)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  och = 0;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return text_width(s.data(), s.data() + s.size());
 }
 
-// virtual
-alf::unicodestreams::utf8iso8859_1_streambuf::int_type
-alf::unicodestreams::utf8iso8859_1_streambuf::underflow()
+std::size_t
+alf::unicodestreams::display_width(std::u16string_view s)
 {
-  return get();
+  return text_width(s.data(), s.data() + s.size());
 }
 
-// virtual
-alf::unicodestreams::utf8iso8859_1_streambuf::int_type
-alf::unicodestreams::utf8iso8859_1_streambuf::overflow(int_type __c)
+std::size_t
+alf::unicodestreams::display_width(std::u32string_view s)
 {
-  return put(__c);
+  return text_width(s.data(), s.data() + s.size());
 }
 
-// virtual
-alf::unicodestreams::utf8iso8859_1_streambuf::streambuf *
-alf::unicodestreams::utf8iso8859_1_streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+std::string_view
+alf::unicodestreams::truncate_width(std::string_view s, std::size_t columns)
 {
+  return s.substr(0, text_truncate(s.data(), s.data() + s.size(), columns));
+}
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
-
+std::u16string_view
+alf::unicodestreams::truncate_width(std::u16string_view s,
+				    std::size_t columns)
+{
+  return s.substr(0, text_truncate(s.data(), s.data() + s.size(), columns));
 }
 
-alf::unicodestreams::utf8iso8859_1_streambuf::int_type
-alf::unicodestreams::utf8iso8859_1_streambuf::get()
+std::u32string_view
+alf::unicodestreams::truncate_width(std::u32string_view s,
+				    std::size_t columns)
 {
-  char ch;
+  return s.substr(0, text_truncate(s.data(), s.data() + s.size(), columns));
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+////////////////////////////////
+// JSON strings
 
-  if (is_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *is_)
-    return err_status(status_type::BAD_STREAM);
-  if (! is_->get(ch)) {
-    if (is_->rdstate() & std::ios_base::eofbit)
-      return traits_type::eof();
-    return err_status(status_type::BAD_STREAM);
+namespace {
+
+// Number of leading bytes of [p, p + n) that are in a JSON string as
+// they are: all but the quote, the backslash and control chars.
+inline
+std::size_t
+json_run(const unsigned char * p, std::size_t n)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i quot = _mm_set1_epi8('"');
+  const __m128i bs = _mm_set1_epi8('\\');
+  const __m128i ctl = _mm_set1_epi8(0x1f);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, bs));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+    if (int b = _mm_movemask_epi8(m))
+      return i + __builtin_ctz(b);
   }
+#endif
+  while (i < n && p[i] != '"' && p[i] != '\\' && p[i] >= 0x20)
+    ++i;
+  return i;
+}
 
-  if (this->egptr() + 1 == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+// the value of the four hex digits at p, -1 if they aren't. Only those
+// before pe are looked at so a cut escape is bad once what is there is.
+inline
+long
+hex4(const unsigned char * p, const unsigned char * pe)
+{
+  long w = 0;
+
+  for (int i = 0; i < 4 && i < pe - p; ++i) {
+    unsigned int c = p[i];
+    if (c >= '0' && c <= '9')
+      c -= '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      c = (c | 0x20) - 'a' + 10;
+    else
+      return -1;
+    w = (w << 4) | c;
   }
+  return w;
+}
 
-  char_type * base = this->gptr();
-  char_type * p = base;
-  if (ch < 0x80) {
-    *p++ = char_type(ch);
+// The escape at p (a backslash) in w and its length in k, k is 0 if it
+// is cut at pe. \u escapes of surrogates pair up as get_u16 has it.
+inline
+status_type
+json_escape(const unsigned char * p, const unsigned char * pe,
+	    char32_t & w, int & k)
+{
+  k = 0;
+  if (pe - p < 2)
+    return status_type::OK;
+  switch (p[1]) {
+  case '"': case '\\': case '/':
+    w = p[1];
+    k = 2;
+    return status_type::OK;
+  case 'b': w = '\b'; k = 2; return status_type::OK;
+  case 'f': w = '\f'; k = 2; return status_type::OK;
+  case 'n': w = '\n'; k = 2; return status_type::OK;
+  case 'r': w = '\r'; k = 2; return status_type::OK;
+  case 't': w = '\t'; k = 2; return status_type::OK;
+  case 'u':
+    break;
+  default:
+    return status_type::BAD_INPUT;
+  }
+  long h = hex4(p + 2, pe);
+  if (h < 0)
+    return status_type::BAD_INPUT;
+  if (pe - p < 6)
+    return status_type::OK;
+  if (h >= 0xd800 && h < 0xe000) {
+    if (h >= 0xdc00)
+      return status_type::NO_LEAD;
+    if ((pe - p > 6 && p[6] != '\\') || (pe - p > 7 && p[7] != 'u'))
+      return status_type::NO_FOLLOW;
+    long l = pe - p > 8 ? hex4(p + 8, pe) : 0;
+    if (l < 0)
+      return status_type::BAD_INPUT;
+    if (pe - p < 12)
+      return status_type::OK;
+    if (l < 0xdc00 || l >= 0xe000)
+      return status_type::NO_FOLLOW;
+    w = (((h & 0x3ff) << 10) | (l & 0x3ff)) + 0x10000;
+    k = 12;
   } else {
-    *p++ = char_type(0xc0 | ((ch >> 6) & 3));
-    *p++ = char_type(0x80 | (ch & 0x3f));
+    w = h;
+    k = 6;
   }
-  this->setg(ibufb, base, p);
-  return traits_type::to_int_type(*this->gptr());
+  if (! is_valid_utf32(w))
+    return status_type::NOT_UNICODE;
+  return status_type::OK;
+}
 
+inline
+void
+put_unit(char *& q, char32_t w)
+{
+  if (w < 0x80) {
+    *q++ = char(w);
+    return;
+  }
+  if (w < 0x800)
+    *q++ = char(0xc0 | (w >> 6));
+  else {
+    if (w < 0x10000)
+      *q++ = char(0xe0 | (w >> 12));
+    else {
+      *q++ = char(0xf0 | (w >> 18));
+      *q++ = char(0x80 | ((w >> 12) & 0x3f));
+    }
+    *q++ = char(0x80 | ((w >> 6) & 0x3f));
+  }
+  *q++ = char(0x80 | (w & 0x3f));
 }
 
-alf::unicodestreams::utf8iso8859_1_streambuf::int_type
-alf::unicodestreams::utf8iso8859_1_streambuf::put(int_type c)
+// number of codes of C that put_unit() gives for w.
+template <class C>
+inline
+int
+unit_count(char32_t w)
 {
+  if (sizeof(C) == 4)
+    return 1;
+  if (sizeof(C) == 2)
+    return w < 0x10000 ? 1 : 2;
+  return w < 0x80 ? 1 : w < 0x800 ? 2 : w < 0x10000 ? 3 : 4;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+// Raw text of a JSON string, UTF-8 with no quote, backslash or control
+// chars, as utf8_decoder does it.
+template <class C>
+inline
+status_type
+json_raw(const unsigned char *& p, const unsigned char * pe, C *& q, C * qe)
+{
+  const char * s = (const char *)p;
+  status_type st = utf8_decoder()(s, (const char *)pe, q, qe);
+  p = (const unsigned char *)s;
+  return st;
+}
 
-  if (os_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *os_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof())) {
-    if (och)
-      return err_status(status_type::NO_FOLLOW);
-    return traits_type::not_eof(c);
+// same for UTF-8, which is checked and copied.
+inline
+status_type
+json_raw(const unsigned char *& p, const unsigned char * pe,
+	 char *& q, char * qe)
+{
+  status_type st = status_type::OK;
+  char32_t w;
+  int k;
+
+  while (p < pe && q < qe) {
+    unsigned int c = *p;
+    if (c < 0x80) {
+      std::size_t m = pe - p;
+      if (std::size_t(qe - q) < m)
+	m = qe - q;
+      m = ascii_run(p, m);
+      std::memcpy(q, p, m);
+      p += m;
+      q += m;
+      continue;
+    }
+    if ((k = utf8_seq_len(c)) == 0) {
+      st = c < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+      break;
+    }
+    if (pe - p < k) {
+      if (! utf8_cut_ok(p, pe))
+	st = status_type::NOT_UTF8;
+      break;
+    }
+    if (qe - q < k)
+      break;
+    if ((st = check_utf8(p, k, w)) != status_type::OK)
+      break;
+    std::memcpy(q, p, k);
+    p += k;
+    q += k;
   }
+  return st;
+}
 
-  if (c < 0 || c > 0xf7)
-    return err_status(status_type::NOT_UTF8);
-
-  if (c < 0x80) {
-    if (och)
-      return err_status(status_type::NO_FOLLOW);
-    return c;
+template <class C>
+status_type
+json_decode(const char *& s, const char * se, C *& d, C * de)
+{
+  const unsigned char * p = (const unsigned char *)s;
+  const unsigned char * pe = (const unsigned char *)se;
+  C * q = d;
+  status_type st = status_type::OK;
+
+  while (p < pe && q < de) {
+    const unsigned char * r = p + json_run(p, pe - p);
+    if (r > p) {
+      st = json_raw(p, r, q, de);
+      if (st == status_type::OK && p < r && r < pe
+	  && r - p < utf8_seq_len(*p))
+	st = status_type::NOT_UTF8; // cut by a quote or the like.
+      if (st != status_type::OK || p < r)
+	break;
+      continue;
+    }
+    if (*p == '"')
+      break;
+    if (*p < 0x20) {
+      st = status_type::BAD_INPUT;
+      break;
+    }
+    char32_t w;
+    int k;
+    if ((st = json_escape(p, pe, w, k)) != status_type::OK || k == 0)
+      break;
+    if (de - q < unit_count<C>(w))
+      break;
+    put_unit(q, w);
+    p += k;
   }
-  int_type b;
-  if (c < 0xc0) {
-    if (och == 0)
-      return err_status(status_type::NO_LEAD);
-
-    b = ((och & 0x1f) << 6) | (c & 0x3f);
-    och = 0;
+  s = (const char *)p;
+  d = q;
+  return st;
+}
 
-    if (b < 0x80)
-      return err_status(status_type::NOT_UTF8);
-    if (b > 0xff)
-      return err_status(status_type::NOT_ISO_8859_1);
-    if (! os_->put(char(b)))
-      return err_status(status_type::BAD_STREAM);
-    return c;
+// json_to_u32() and friends, a block at a time.
+template <class C>
+std::basic_string<C>
+json_to(std::string_view v, status_type * st, std::size_t * n)
+{
+  enum { BUFSZ = 1024 };
+  std::basic_string<C> r;
+  C buf[BUFSZ];
+  const char * s = v.data();
+  const char * se = s + v.size();
+  status_type t;
+
+  for (;;) {
+    C * d = buf;
+    const char * b = s;
+    t = json_decode(s, se, d, buf + BUFSZ);
+    r.append(buf, d - buf);
+    if (t != status_type::OK)
+      break;
+    if (s == se) {
+      t = status_type::EOF_STREAM;
+      break;
+    }
+    if (*s == '"')
+      break;
+    if (s == b) {
+      // an escape or a sequence cut at the end.
+      t = status_type::BAD_STREAM;
+      break;
+    }
   }
-  if (c >= 0xc4)
-    return err_status(status_type::NOT_ISO_8859_1);
-  if (och)
-    return err_status(status_type::NO_FOLLOW);
-  return och = c;
-
+  if (st)
+    *st = t;
+  if (n)
+    *n = s - v.data();
+  return r;
 }
 
-////////////////////////////////
-// u32bswap_
-
-// for reading.
-alf::unicodestreams::u32bswap_streambuf::
-u32bswap_streambuf(src_stream & is,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(& is), os_(0), status_(status_type()), swap_state_(s)
-{
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+}; // end of anonymous namespace
+
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_json(const char *& s, const char * se,
+				 char32_t *& d, char32_t * de)
+{
+  return json_decode(s, se, d, de);
 }
 
-// for writing
-alf::unicodestreams::u32bswap_streambuf::
-u32bswap_streambuf(dst_stream & os,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(0), os_(& os), status_(status_type()), swap_state_(s)
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_json(const char *& s, const char * se,
+				 char16_t *& d, char16_t * de)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return json_decode(s, se, d, de);
 }
- 
- // for both.
-alf::unicodestreams::u32bswap_streambuf::
-u32bswap_streambuf(src_stream & is, dst_stream & os,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(& is), os_(& os), status_(status_type()), swap_state_(s)
+
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_json(const char *& s, const char * se,
+				 char *& d, char * de)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  return json_decode(s, se, d, de);
 }
 
-// virtual
-alf::unicodestreams::u32bswap_streambuf::int_type
-alf::unicodestreams::u32bswap_streambuf::underflow()
+std::u32string
+alf::unicodestreams::json_to_u32(std::string_view s, status_type * st,
+				 std::size_t * n)
 {
-  return get();
+  return json_to<char32_t>(s, st, n);
 }
 
-// virtual
-alf::unicodestreams::u32bswap_streambuf::int_type
-alf::unicodestreams::u32bswap_streambuf::overflow(int_type __c)
+std::u16string
+alf::unicodestreams::json_to_u16(std::string_view s, status_type * st,
+				 std::size_t * n)
 {
-  return put(__c);
+  return json_to<char16_t>(s, st, n);
 }
 
-// virtual
-alf::unicodestreams::u32bswap_streambuf::streambuf *
-alf::unicodestreams::u32bswap_streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+std::string
+alf::unicodestreams::json_to_utf8(std::string_view s, status_type * st,
+				  std::size_t * n)
 {
+  return json_to<char>(s, st, n);
+}
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
-  }
-  return this;
+////////////////////////////////
+// percent encoding
+
+namespace {
 
+// Number of leading bytes of [p, p + n) below 0x80 that aren't '%'.
+inline
+std::size_t
+percent_run(const unsigned char * p, std::size_t n)
+{
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  const __m128i pct = _mm_set1_epi8('%');
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    if (int b = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, pct))))
+      return i + __builtin_ctz(b);
+  }
+#endif
+  while (i < n && p[i] < 0x80 && p[i] != '%')
+    ++i;
+  return i;
 }
 
-alf::unicodestreams::u32bswap_streambuf::int_type
-alf::unicodestreams::u32bswap_streambuf::get()
+// copy the n ASCII bytes at p to q.
+template <class C>
+inline
+void
+copy_ascii(const unsigned char * p, std::size_t n, C * q)
 {
-  char32_t ch;
+  widen_ascii(p, n, q);
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+inline
+void
+copy_ascii(const unsigned char * p, std::size_t n, char * q)
+{
+  std::memcpy(q, p, n);
+}
 
-  if (! is_->get(ch)) {
-    if (is_->rdstate() & std::ios_base::eofbit)
-      return traits_type::eof();
-    return err_status(status_type::BAD_STREAM);
-  }
-  int_type c = (int_type)ch;
-  swap_state_type s;
-  while (true) {
-    switch (swap_state_) {
-    case swap_state_type::None:
-    case swap_state_type::v1234: // no swap
-      break;
-    case swap_state_type::FChar:
-      // This is first char, check it for fffe in swapped state:
-      switch (c) {
-      case 0xfffe0000:
-	swap_state_ = swap_state_type::v4321;
-	continue;
-      case 0x0000fffe:
-	swap_state_ = swap_state_type::v2143;
-	continue;
-      case 0xfeff0000:
-	swap_state_ = swap_state_type::v3412;
-	continue;
-      case 0x0000feff:
-	swap_state_ = swap_state_type::v1234;
-	continue;
-      default:
-	return err_status(status_type::NO_BOM);
-      }
-    case swap_state_type::LE:
-      // no swap if we're on a LE machine, swap if BE machine.
-    case swap_state_type::BE:
-      // swap if we're on a LE machine, no swap if on BE.
-      if ((s = u32_check(swap_state_)) == swap_state_type::None)
-	throw "Something is very wrong E105";
-      swap_state_ = s;
-      continue;
-    case swap_state_type::v2143:
-      c = ((c & 0xff00ff) << 8) | ((c >> 8) & 0xff00ff);
-      break;
-    case swap_state_type::v3412:
-      c = ((c & 0xffff) << 16) | (c >> 16);
-      break;
-    case swap_state_type::v4321:
-      c = (c << 24) | ((c & 0xff00) << 8) | ((c >> 8) & 0xff00) | (c >> 24);
-      break;
-    }
-    break;
+// The byte at p, raw or as %XX, in b and the number of codes it takes
+// in k, k is 0 if it is cut at pe.
+inline
+status_type
+percent_byte(const unsigned char * p, const unsigned char * pe,
+	     unsigned int & b, int & k)
+{
+  k = 0;
+  if (*p != '%') {
+    b = *p;
+    k = 1;
+    return status_type::OK;
   }
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+  b = 0;
+  for (int i = 1; i < 3; ++i) {
+    if (p + i == pe)
+      return status_type::OK;
+    unsigned int c = p[i];
+    if (c >= '0' && c <= '9')
+      c -= '0';
+    else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f')
+      c = (c | 0x20) - 'a' + 10;
+    else
+      return status_type::BAD_INPUT;
+    b = (b << 4) | c;
   }
-  return traits_type::to_int_type(*this->gptr() = c);
-
+  k = 3;
+  return status_type::OK;
 }
 
-alf::unicodestreams::u32bswap_streambuf::int_type
-alf::unicodestreams::u32bswap_streambuf::put(int_type c)
+template <class C>
+status_type
+percent_decode(const char *& s, const char * se, C *& d, C * de)
 {
-
-  if (status_ != status_type::OK)
-    return traits_type::eof();
-
-  int_type a = c;
-  swap_state_type s;
-
-  if (os_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *os_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
-
-  while (true) {
-    switch (swap_state_) {
-    case swap_state_type::None:
-    case swap_state_type::v1234:
-      break;
-    case swap_state_type::FChar:
-      // no particular swap state, but if c is not 0xfeff
-      // we write out 0xfeff (BOM) before writing c.
-      if (c != 0xfeff && ! os_->put(char32_t(0xfeff)))
-	return err_status(status_type::BAD_STREAM);
-      swap_state_ = swap_state_type::v1234;
-      break;
-    case swap_state_type::LE:
-    case swap_state_type::BE:
-      // swap if we're on a LE machine, no swap if on BE.
-      if ((s = u32_check(swap_state_)) == swap_state_type::None)
-	throw "Something is very wrong E106";
-      swap_state_ = s;
+  const unsigned char * p = (const unsigned char *)s;
+  const unsigned char * pe = (const unsigned char *)se;
+  C * q = d;
+  status_type st = status_type::OK;
+
+  while (p < pe && q < de) {
+    std::size_t n = pe - p;
+    if (std::size_t(de - q) < n)
+      n = de - q;
+    if ((n = percent_run(p, n)) > 0) {
+      copy_ascii(p, n, q);
+      p += n;
+      q += n;
       continue;
-    case swap_state_type::v2143:
-      a = ((a & 0xff00ff) << 8) | ((a >> 8) & 0xff00ff);
-      break;
-    case swap_state_type::v3412:
-      a = ((a & 0xffff) << 16) | (a >> 16);
+    }
+    // one code point, a byte at a time.
+    unsigned char u[4];
+    const unsigned char * r = p;
+    unsigned int b;
+    int m, k, i;
+    if ((st = percent_byte(r, pe, b, m)) != status_type::OK || m == 0)
       break;
-    case swap_state_type::v4321:
-      a = (a << 24) | ((a & 0xff00) << 8) | ((a >> 8) & 0xff00) | (a >> 24);
+    r += m;
+    u[0] = (unsigned char)b;
+    if ((k = utf8_seq_len(u[0])) == 0) {
+      st = b < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
       break;
     }
-    break;
+    for (i = 1; i < k && r < pe; ++i, r += m) {
+      if ((st = percent_byte(r, pe, b, m)) != status_type::OK || m == 0)
+	break;
+      u[i] = (unsigned char)b;
+    }
+    if (st != status_type::OK || i < k)
+      break;
+    char32_t w = u[0];
+    if (k > 1 && (st = check_utf8(u, k, w)) != status_type::OK)
+      break;
+    if (de - q < unit_count<C>(w))
+      break;
+    put_unit(q, w);
+    p = r;
   }
-  if (! os_->put(char32_t(a)))
-    return err_status(status_type::BAD_STREAM);
-  return c;
+  s = (const char *)p;
+  d = q;
+  return st;
 }
 
-////////////////////////////////
-// u16bswap_
-
-// for reading.
-alf::unicodestreams::u16bswap_streambuf::
-u16bswap_streambuf(src_stream & is,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(& is), os_(0), status_(status_type()), swap_state_(s)
+// percent_to_u32() and friends, nothing gets longer when decoded.
+template <class C>
+std::basic_string<C>
+percent_to(std::string_view v, status_type * st)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  std::basic_string<C> r(v.size(), C());
+  const char * s = v.data();
+  const char * se = s + v.size();
+  C * d = & r[0];
+
+  status_type t = percent_decode(s, se, d, d + r.size());
+  if (t == status_type::OK && s < se)
+    t = status_type::BAD_STREAM;
+  r.resize(d - r.data());
+  if (st)
+    *st = t;
+  return r;
 }
 
-// for writing
-alf::unicodestreams::u16bswap_streambuf::
-u16bswap_streambuf(dst_stream & os,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(0), os_(& os), status_(status_type()), swap_state_(s)
+#if defined(__SSE2__)
+// the lanes of v with a letter, a digit or - . _ ~ in them.
+inline
+__m128i
+unreserved8(__m128i v)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  __m128i l = _mm_or_si128(v, _mm_set1_epi8(0x20));
+  __m128i m = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+			    _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+  m = _mm_or_si128(m,
+		   _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+				 _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1))));
+  m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+				   _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))));
+  return _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+				      _mm_cmpeq_epi8(v, _mm_set1_epi8('~'))));
 }
- 
- // for both.
-alf::unicodestreams::u16bswap_streambuf::
-u16bswap_streambuf(src_stream & is, dst_stream & os,
-		   swap_state_type s /* = swap_state_type::None */)
-  : is_(& is), os_(& os), status_(status_type()), swap_state_(s)
+
+inline
+__m128i
+unreserved16(__m128i v)
 {
-  ibufb = ibuf;
-  ibufe = ibuf + IBUFSZ;
-  this->setg(ibuf, ibuf, ibuf);
-  this->setp(0, 0);
+  __m128i l = _mm_or_si128(v, _mm_set1_epi16(0x20));
+  __m128i m = _mm_and_si128(_mm_cmpgt_epi16(l, _mm_set1_epi16('a' - 1)),
+			    _mm_cmplt_epi16(l, _mm_set1_epi16('z' + 1)));
+  m = _mm_or_si128(m,
+		   _mm_and_si128(_mm_cmpgt_epi16(v, _mm_set1_epi16('0' - 1)),
+				 _mm_cmplt_epi16(v, _mm_set1_epi16('9' + 1))));
+  m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16('-')),
+				   _mm_cmpeq_epi16(v, _mm_set1_epi16('.'))));
+  m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi16(v, _mm_set1_epi16('_')),
+				   _mm_cmpeq_epi16(v, _mm_set1_epi16('~'))));
+  return m;
 }
+#endif
 
-// virtual
-alf::unicodestreams::u16bswap_streambuf::int_type
-alf::unicodestreams::u16bswap_streambuf::underflow()
+inline
+bool
+is_unreserved(char32_t c)
 {
-  return get();
+  return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'z')
+    || c == '-' || c == '.' || c == '_' || c == '~';
 }
 
-// virtual
-alf::unicodestreams::u16bswap_streambuf::int_type
-alf::unicodestreams::u16bswap_streambuf::overflow(int_type __c)
+// Copy the leading letters, digits and - . _ ~ of [p, p + n) to q as
+// bytes, return the number of codes copied.
+template <class C>
+inline
+std::size_t
+unreserved_run(const C * p, std::size_t n, char * q)
 {
-  return put(__c);
+  std::size_t i = 0;
+
+#if defined(__SSE2__)
+  for (; i + 8 <= n; i += 8) {
+    __m128i v;
+    if (! load_ascii8(p + i, v)
+	|| _mm_movemask_epi8(unreserved16(v)) != 0xffff)
+      break;
+    _mm_storel_epi64((__m128i *)(q + i), _mm_packus_epi16(v, v));
+  }
+#endif
+  for (; i < n && p[i] < 0x80 && is_unreserved(p[i]); ++i)
+    q[i] = char(p[i]);
+  return i;
 }
 
-// virtual
-alf::unicodestreams::u16bswap_streambuf::streambuf *
-alf::unicodestreams::u16bswap_streambuf::
-setbuf(char_type * __s, std::streamsize __n)
+inline
+std::size_t
+unreserved_run(const char * s, std::size_t n, char * q)
 {
+  const unsigned char * p = (const unsigned char *)s;
+  std::size_t i = 0;
 
-  std::streamsize n = this->egptr() - this->eback();
-  std::streamsize q = this->gptr() - this->eback();
-  std::streamsize m = n - q; // still need to read.
-  std::streamsize u = q + m; // chars to keep over to new buffer.
-  if (__n > EBACK + 4 && __n >= m) {
-    if (q + m > 0) {
-      if (n > __n) n = __n;
-      if (q + m > n) q = n - m;
-      traits_type::move(__s, this->gptr() - q, u = q + m);
-    }
-    ibufb = __s;
-    ibufe = __s + __n;
-    this->setg(__s, __s + q, __s + u);
+#if defined(__SSE2__)
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    if (_mm_movemask_epi8(unreserved8(v)) != 0xffff)
+      break;
+    _mm_storeu_si128((__m128i *)(q + i), v);
   }
-  return this;
+#endif
+  for (; i < n && is_unreserved(p[i]); ++i)
+    q[i] = char(p[i]);
+  return i;
+}
 
+// The code point at p in w and the number of codes it takes in k, k is
+// 0 if it is cut at pe. Checked the same way as the streams do.
+inline
+status_type
+take_code(const char32_t * p, const char32_t *, char32_t & w, int & k)
+{
+  w = *p;
+  k = 1;
+  return is_valid_utf32(w) ? status_type::OK : status_type::NOT_UNICODE;
 }
 
-alf::unicodestreams::u16bswap_streambuf::int_type
-alf::unicodestreams::u16bswap_streambuf::get()
+inline
+status_type
+take_code(const char16_t * p, const char16_t * pe, char32_t & w, int & k)
 {
-  char16_t ch;
+  w = *p;
+  k = 0;
+  if (w >= 0xd800 && w < 0xe000) {
+    if (w >= 0xdc00)
+      return status_type::NO_LEAD;
+    if (pe - p < 2)
+      return status_type::OK;
+    char32_t v = p[1];
+    if (v < 0xdc00 || v >= 0xe000)
+      return status_type::NO_FOLLOW;
+    w = (((w & 0x3ff) << 10) | (v & 0x3ff)) + 0x10000;
+    k = 2;
+  } else
+    k = 1;
+  return is_valid_utf32(w) ? status_type::OK : status_type::NOT_UNICODE;
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+inline
+status_type
+take_code(const char * s, const char * se, char32_t & w, int & k)
+{
+  const unsigned char * p = (const unsigned char *)s;
+
+  w = *p;
+  k = utf8_seq_len(*p);
+  if (k == 0)
+    return w < 0xc0 ? status_type::NO_LEAD : status_type::NOT_UTF8;
+  if (k == 1)
+    return status_type::OK;
+  if (se - s < k) {
+    k = 0;
+    return utf8_cut_ok(p, (const unsigned char *)se) ? status_type::OK
+      : status_type::NOT_UTF8;
+  }
+  return check_utf8(p, k, w);
+}
 
-  if (! is_->get(ch)) {
-    if (is_->rdstate() & std::ios_base::eofbit)
-      return traits_type::eof();
-    return err_status(status_type::BAD_STREAM);
+// whether c can't be in a URI as it is.
+inline
+bool
+percent_always(char32_t c)
+{
+  if (c <= 0x20 || c >= 0x7f)
+    return true;
+  switch (c) {
+  case '"': case '%': case '<': case '>': case '\\': case '^': case '`':
+  case '{': case '|': case '}':
+    return true;
   }
-  int_type c = (int_type)ch;
-  swap_state_type s;
-  while (true) {
-    switch (swap_state_) {
-    case swap_state_type::None:
-    case swap_state_type::v12: // no swap
-      break;
-    case swap_state_type::FChar:
-      // This is first char, check it for fffe in swapped state:
-      switch (c) {
-      case 0xfffe:
-	swap_state_ = swap_state_type::v21;
+  return false;
+}
+
+// Percent-encodes [s, se) to [d, de) the way the other encoders do.
+struct percent_encoder {
+
+  enum { MAXLEN = 12 };
+
+  alf::unicodestreams::percent_set set;
+
+  explicit percent_encoder(alf::unicodestreams::percent_set r)
+    : set(r)
+  { }
+
+  template <class C>
+  status_type operator () (const C *& s, const C * se,
+			   char *& d, char * de) const
+  {
+    static const char hex[] = "0123456789ABCDEF";
+    const C * p = s;
+    char * q = d;
+    status_type st = status_type::OK;
+
+    while (p < se && q < de) {
+      std::size_t n = se - p;
+      if (std::size_t(de - q) < n)
+	n = de - q;
+      if ((n = unreserved_run(p, n, q)) > 0) {
+	p += n;
+	q += n;
 	continue;
-      case 0xfeff:
-	swap_state_ = swap_state_type::v12;
+      }
+      char32_t w;
+      int k;
+      if ((st = take_code(p, se, w, k)) != status_type::OK || k == 0)
+	break;
+      if (w < 0x80 && ! percent_always(w) && ! set.has(w)) {
+	*q++ = char(w);
+	p += k;
 	continue;
-      default:
-	return err_status(status_type::NO_BOM);
       }
-    case swap_state_type::LE:
-      // no swap if we're on a LE machine, swap if BE machine.
-    case swap_state_type::BE:
-      // swap if we're on a LE machine, no swap if on BE.
-      if ((s = u16_check(swap_state_)) == swap_state_type::None)
-	throw "Something is very wrong E115";
-      swap_state_ = s;
-      continue;
-    case swap_state_type::v21:
-      c = ((c << 8) | (c >> 8)) & 0xffff;
-      break;
+      char u[4];
+      char * e = u;
+      put_unit(e, w);
+      if (de - q < 3 * (e - u))
+	break;
+      for (const char * b = u; b < e; ++b) {
+	*q++ = '%';
+	*q++ = hex[(unsigned char)*b >> 4];
+	*q++ = hex[*b & 15];
+      }
+      p += k;
     }
-    break;
+    s = p;
+    d = q;
+    return st;
   }
-  if (this->egptr() == ibufe) {
-    traits_type::move(ibufb,  this->gptr() - EBACK, EBACK);
-    this->setg(ibufb, ibufb + EBACK, ibufb + EBACK);
+
+}; // end of struct percent_encoder
+
+// percent_encode() a block at a time.
+template <class C>
+std::string
+percent_enc(const C * p, const C * pe, alf::unicodestreams::percent_set r,
+	    status_type * st)
+{
+  enum { BUFSZ = 1024 };
+  std::string res;
+  char buf[BUFSZ];
+  percent_encoder enc(r);
+  status_type t = status_type::OK;
+
+  res.reserve(pe - p);
+  while (p < pe) {
+    char * d = buf;
+    const C * b = p;
+    t = enc(p, pe, d, buf + BUFSZ);
+    res.append(buf, d - buf);
+    if (t != status_type::OK)
+      break;
+    if (p == b) {
+      // a surrogate pair or sequence cut at the end.
+      t = status_type::BAD_STREAM;
+      break;
+    }
   }
-  return traits_type::to_int_type(*this->gptr() = c);
+  if (st)
+    *st = t;
+  return res;
+}
 
+}; // end of anonymous namespace
+
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_percent(const char *& s, const char * se,
+				    char32_t *& d, char32_t * de)
+{
+  return percent_decode(s, se, d, de);
 }
 
-alf::unicodestreams::u16bswap_streambuf::int_type
-alf::unicodestreams::u16bswap_streambuf::put(int_type c)
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_percent(const char *& s, const char * se,
+				    char16_t *& d, char16_t * de)
 {
+  return percent_decode(s, se, d, de);
+}
 
-  if (status_ != status_type::OK)
-    return traits_type::eof();
+alf::unicodestreams::status_type
+alf::unicodestreams::decode_percent(const char *& s, const char * se,
+				    char *& d, char * de)
+{
+  return percent_decode(s, se, d, de);
+}
 
-  int_type a = c;
-  swap_state_type s;
+std::u32string
+alf::unicodestreams::percent_to_u32(std::string_view s, status_type * st)
+{
+  return percent_to<char32_t>(s, st);
+}
 
-  if (os_ == 0)
-    return err_status(status_type::NO_STREAM);
-  if (! *os_ )
-    return err_status(status_type::BAD_STREAM);
-  if (traits_type::eq_int_type(c, traits_type::eof()))
-    return traits_type::not_eof(c);
+std::u16string
+alf::unicodestreams::percent_to_u16(std::string_view s, status_type * st)
+{
+  return percent_to<char16_t>(s, st);
+}
 
-  while (true) {
-    switch (swap_state_) {
-    case swap_state_type::None:
-    case swap_state_type::v12:
-      break;
-    case swap_state_type::FChar:
-      // no particular swap state, but if c is not 0xfeff
-      // we write out 0xfeff (BOM) before writing c.
-      if (c != 0xfeff && ! os_->put(char16_t(0xfeff)))
-	return err_status(status_type::BAD_STREAM);
-      swap_state_ = swap_state_type::v12;
-      break;
-    case swap_state_type::LE:
-    case swap_state_type::BE:
-      // swap if we're on a LE machine, no swap if on BE.
-      if ((s = u16_check(swap_state_)) == swap_state_type::None)
-	throw "Something is very wrong E116";
-      swap_state_ = s;
-      continue;
-    case swap_state_type::v21:
-      a = ((a << 8) | (a >> 8)) & 0xffff;
-      break;
-    }
-    break;
-  }
-  if (! os_->put(char16_t(a)))
-    return err_status(status_type::BAD_STREAM);
-  return c;
+std::string
+alf::unicodestreams::percent_to_utf8(std::string_view s, status_type * st)
+{
+  return percent_to<char>(s, st);
+}
+
+std::string
+alf::unicodestreams::percent_encode(std::u32string_view s, percent_set r,
+				    status_type * st)
+{
+  return percent_enc(s.data(), s.data() + s.size(), r, st);
+}
+
+std::string
+alf::unicodestreams::percent_encode(std::u16string_view s, percent_set r,
+				    status_type * st)
+{
+  return percent_enc(s.data(), s.data() + s.size(), r, st);
+}
+
+std::string
+alf::unicodestreams::percent_encode(std::string_view s, percent_set r,
+				    status_type * st)
+{
+  return percent_enc(s.data(), s.data() + s.size(), r, st);
 }
@@ -1,6 +1,30 @@
 #ifndef __ALF_UNICODESTREAMS_HXX__
 #define __ALF_UNICODESTREAMS_HXX__
 
+#include <cstdint>
+#include <iostream>
+#include <locale>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// std::endian is C++20, before that we ask the compiler.
+#if defined(__has_include)
+#if __has_include(<bit>)
+#include <bit>
+#endif
+#endif
+
+// The coroutine interface at the end needs C++20.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <utility>
+#define ALF_UNICODESTREAMS_COROUTINES 1
+#endif
+#endif
+
 // This provide the following stream classes and the corresponding
 // streambuf classes:
 //
@@ -33,6 +57,12 @@
 // UTF-8, make sure you are in a situation where the next byte to read from F
 // is the first UTF-8 byte. Then read from G and make sure you stop when you
 // read the last UTF-8 text. Then continue to read from F again and so on.
+// Note that G decodes F in blocks: besides what you ask for it will also
+// take whatever F already has buffered (see in_avail()). G used to take
+// one code point at a time, so code that does this must now call
+// G.set_bounded(true) first, G then takes one code point at a time again
+// and F is left right after the last char you got from G. read() and
+// sgetn() on G never take more from F than the chars you ask for.
 // 
 // u32utf8streambuf  -- used by u32utf8{i,o,io}stream
 // u32utf8istream    -- read a char32_t stream, source is an utf8 char stream.
@@ -96,6 +126,10 @@ class u32iso8859_1_istream;
 class u32iso8859_1_ostream;
 class u32iso8859_1_iostream;
 
+// fusion lets a stream read straight through the stream below it when
+// that is one of these, see the implementation.
+class fusion;
+
 class u32streambuf;
 class u32u16streambuf;
 class u32utf8streambuf;
@@ -126,8 +160,109 @@ enum class status_type : int {
   NOT_ISO_8859_1, // This isn't ISO 8859-1.
   NO_BOM, // byte order mark is missing.
 };
+
+//////////////////////////////
+// escape_type
+
+// How u32utf8streambuf and u16utf8streambuf escape what they write while
+// they encode it, so it can go straight into a JSON string or XML text
+// or attribute value. Runs that need no escaping are copied 8 codes at a
+// time. Code points that aren't Unicode are still errors.
+enum class escape_type : unsigned char {
+  NONE,
+  // " and \ as \" and \\, control chars as \n, \t etc. or \u001f.
+  JSON,
+  // JSON, and all but ASCII as \u00e9, or a surrogate pair of them.
+  JSON_ASCII,
+  // & < > " ' as entities, CR as &#13;. The other control chars but tab
+  // and LF can't be in XML at all and become U+FFFD.
+  XML,
+};
+
+//////////////////////////////
+// newline_type
+
+// How u32utf8streambuf and u32u16streambuf change line ends. The flags
+// for reading are done in the same pass that decodes, and a CR at the
+// end of one block still joins an LF at the start of the next.
+enum newline_type : unsigned int {
+  NEWLINE_ASIS = 0, // as they are.
+  NEWLINE_LF = 1, // reading: CR LF and a lone CR become LF.
+  NEWLINE_NEL = 2, // reading: NEL and U+2028 become LF too, implies LF.
+  NEWLINE_CRLF = 4, // writing: LF becomes CR LF.
+};
+
+//////////////////////////////
+// utf8_form
+
+// Which UTF-8 u32utf8streambuf and u16utf8streambuf read and write. ASCII
+// goes the same fast way in all of them. Escaping (escape_type) always
+// writes standard UTF-8, JSON and XML want nothing else.
+enum class utf8_form : unsigned char {
+  STANDARD,
+  // Java's modified UTF-8: NUL as C0 80 and what isn't in the BMP as a
+  // surrogate pair of 3 bytes each. A plain 0 byte is taken when reading.
+  MODIFIED,
+  // CESU-8: like MODIFIED, but NUL is a plain 0 byte.
+  CESU8,
+  // WTF-8: standard UTF-8 that also has lone surrogates as 3 bytes each,
+  // for UTF-16 that isn't well-formed like Windows file names. Reading
+  // gives them as they are, in char32_t too, but a high and a low one of
+  // 3 bytes each are an error, a pair is only 4 bytes. Writing joins a
+  // high and a low surrogate to 4 bytes from char32_t too.
+  WTF8,
+};
     
 
+///////////////////////////////////
+// character properties
+
+// General_Category, East_Asian_Width, Script and some binary properties
+// of a code point. The tables are in unicodeprops.inc, generated by
+// mkunicodetables.pl from the UCD (make tables). They are two or three
+// stages deep so a lookup is that many loads and one branch for code
+// points past the tables, and it is all constexpr. What isn't a code
+// point is Cn, N and Unknown with no flags.
+
+#include "unicodeprops.inc"
+
+constexpr general_category general_category_of(char32_t c)
+{ return general_category(ucd::props(c) & 0x1f); }
+
+constexpr east_asian_width east_asian_width_of(char32_t c)
+{ return east_asian_width((ucd::props(c) >> 5) & 7); }
+
+// the char_flag values of c or'ed together.
+constexpr unsigned int char_flags(char32_t c)
+{ return ucd::props(c) >> 8; }
+
+constexpr script script_of(char32_t c)
+{ return script(ucd::scripts(c)); }
+
+// the name of s in the UCD, "Latin" for script::Latin.
+constexpr const char * script_name(script s)
+{ return ucd::script_names[std::size_t(s)]; }
+
+
+///////////////////////////////////
+// counting
+
+// count_utf8 and count_u16 give the number of code points in an UTF-8 or
+// UTF-16 text. utf8_length and u16_length give the number of codes the
+// text becomes when written as UTF-8 or UTF-16, using the same encoding
+// as u32utf8ostream, u32u16ostream etc. so you can size your buffers once.
+// None of them validate the text: for valid text the result is exact,
+// otherwise it is an upper bound since the streams stop at the first
+// invalid code.
+
+std::size_t count_utf8(const char * s, std::size_t n);
+std::size_t count_u16(const char16_t * s, std::size_t n);
+
+std::size_t utf8_length(const char32_t * s, std::size_t n);
+std::size_t utf8_length(const char16_t * s, std::size_t n);
+std::size_t u16_length(const char32_t * s, std::size_t n);
+std::size_t u16_length(const char * s, std::size_t n);
+
 ///////////////////////////////////
 // u32_swap_state_type
 
@@ -185,6 +320,32 @@ enum class u16_swap_state_type : unsigned short {
   v21 = 21, // swapping the bytes within each 16 bit unit.
 };
 
+// The byte order of this machine and the swap states that read and
+// write little and big endian here, known at compile time. LE and BE
+// above become these.
+#if defined(__cpp_lib_endian)
+constexpr bool native_little_endian =
+  std::endian::native == std::endian::little;
+constexpr bool native_big_endian = std::endian::native == std::endian::big;
+#else
+constexpr bool native_little_endian =
+  __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+constexpr bool native_big_endian = __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+#endif
+
+constexpr u32_swap_state_type u32_le_state =
+  native_little_endian ? u32_swap_state_type::v1234
+  : native_big_endian ? u32_swap_state_type::v4321
+  : u32_swap_state_type::v3412;
+constexpr u32_swap_state_type u32_be_state =
+  native_big_endian ? u32_swap_state_type::v1234
+  : native_little_endian ? u32_swap_state_type::v4321
+  : u32_swap_state_type::v2143;
+constexpr u16_swap_state_type u16_le_state =
+  native_big_endian ? u16_swap_state_type::v21 : u16_swap_state_type::v12;
+constexpr u16_swap_state_type u16_be_state =
+  native_big_endian ? u16_swap_state_type::v12 : u16_swap_state_type::v21;
+
 
 
 ///////////////////////////////////
@@ -213,18 +374,38 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   src_stream * src_stream_() { return is_; }
   dst_stream * dst_stream_() { return os_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
 private:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -232,6 +413,7 @@ private:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   char_type * ibufb;
   char_type * ibufe;
   char_type ibuf[IBUFSZ];
@@ -257,6 +439,24 @@ public:
   u32istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u32istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u32istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -282,6 +482,10 @@ public:
   u32ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u32ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -309,6 +513,24 @@ public:
   u32iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u32iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u32iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -338,16 +560,40 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
+  // change line ends from now on, newline_type flags or'ed together.
+  streambuf & set_newline(unsigned int nl) { newline_ = nl; return *this; }
+  unsigned int newline() const { return newline_; }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -355,6 +601,9 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
+  unsigned int newline_;
+  bool cr_; // the last char read was a CR, an LF after it goes.
   char_type * ibufb;
   char_type * ibufe;
   char_type ibuf[IBUFSZ];
@@ -371,15 +620,37 @@ class u32u16istream : public std::basic_istream<char32_t> {
 
 public:
 
-  u32u16istream(src_stream & is)
+  u32u16istream(src_stream & is, unsigned int nl = NEWLINE_ASIS)
     : base_type(0), isbuf_(is)
-  { this->init(& isbuf_); }
+  { isbuf_.set_newline(nl); this->init(& isbuf_); }
 
   status_type streambuf_status() const { return isbuf_.status(); }
 
   u32u16istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u32u16istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // change line ends from now on, see newline_type.
+  u32u16istream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u32u16istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -406,6 +677,14 @@ public:
   u32u16ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u32u16ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
+  // change line ends from now on, see newline_type.
+  u32u16ostream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -434,6 +713,28 @@ public:
   u32u16iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u32u16iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // change line ends from now on, see newline_type.
+  u32u16iostream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u32u16iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -454,6 +755,8 @@ class u32utf8streambuf : public std::basic_streambuf<char32_t> {
   typedef std::ostream dst_stream;
   typedef u32utf8streambuf streambuf;
 
+  friend class fusion;
+
 public:
 
   u32utf8streambuf(src_stream & is); // for reading.
@@ -464,16 +767,49 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
+  // escape what is written from now on, see escape_type.
+  streambuf & set_escape(escape_type e) { escape_ = e; return *this; }
+  escape_type escape() const { return escape_; }
+
+  // change line ends from now on, newline_type flags or'ed together.
+  streambuf & set_newline(unsigned int nl) { newline_ = nl; return *this; }
+  unsigned int newline() const { return newline_; }
+
+  // read and write this form of UTF-8 from now on, see utf8_form.
+  streambuf & set_form(utf8_form f) { form_ = f; return *this; }
+  utf8_form form() const { return form_; }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -481,6 +817,13 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
+  escape_type escape_;
+  utf8_form form_;
+  unsigned int newline_;
+  bool cr_; // the last char read was a CR, an LF after it goes.
+  bool high_; // the last char read was a lone high surrogate (WTF-8).
+  char32_t pbuf; // a high surrogate written waits for a low one (WTF-8).
   char_type * ibufb;
   char_type * ibufe;
   char_type ibuf[IBUFSZ];
@@ -497,15 +840,41 @@ class u32utf8istream : public std::basic_istream<char32_t> {
 
 public:
 
-  u32utf8istream(src_stream & is)
+  u32utf8istream(src_stream & is, unsigned int nl = NEWLINE_ASIS)
     : base_type(0), isbuf_(is)
-  { this->init(& isbuf_); }
+  { isbuf_.set_newline(nl); this->init(& isbuf_); }
 
   status_type streambuf_status() const { return isbuf_.status(); }
 
   u32utf8istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u32utf8istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // change line ends from now on, see newline_type.
+  u32utf8istream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
+  // read this form of UTF-8 from now on, see utf8_form.
+  u32utf8istream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u32utf8istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -522,15 +891,31 @@ class u32utf8ostream : public std::basic_ostream<char32_t> {
 
 public:
 
-  u32utf8ostream(dst_stream & os)
+  u32utf8ostream(dst_stream & os, escape_type e = escape_type::NONE)
     : base_type(0), isbuf_(os)
-  { this->init(& isbuf_); }
+  { isbuf_.set_escape(e); this->init(& isbuf_); }
 
   status_type streambuf_status() const { return isbuf_.status(); }
 
   u32utf8ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u32utf8ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
+  // escape what is written from now on, see escape_type.
+  u32utf8ostream & set_escape(escape_type e)
+  { isbuf_.set_escape(e); return *this; }
+
+  // change line ends from now on, see newline_type.
+  u32utf8ostream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
+  // write this form of UTF-8 from now on, see utf8_form.
+  u32utf8ostream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -555,6 +940,36 @@ public:
   u32utf8iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u32utf8iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // escape what is written from now on, see escape_type.
+  u32utf8iostream & set_escape(escape_type e)
+  { isbuf_.set_escape(e); return *this; }
+
+  // change line ends from now on, see newline_type.
+  u32utf8iostream & set_newline(unsigned int nl)
+  { isbuf_.set_newline(nl); return *this; }
+
+  // read and write this form of UTF-8 from now on, see utf8_form.
+  u32utf8iostream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u32utf8iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -584,10 +999,29 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -595,6 +1029,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -602,6 +1037,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   char_type * ibufb;
   char_type * ibufe;
   int_type pbuf;
@@ -628,6 +1064,24 @@ public:
   u16u32istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u16u32istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16u32istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -654,6 +1108,10 @@ public:
   u16u32ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u16u32ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -682,6 +1140,24 @@ public:
   u16u32iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u16u32iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16u32iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -710,10 +1186,29 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -721,6 +1216,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -728,6 +1224,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   char_type * ibufb;
   char_type * ibufe;
   int_type pbuf; // put buffer has only one char.
@@ -754,6 +1251,24 @@ public:
   u16istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u16istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -780,6 +1295,10 @@ public:
   u16ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u16ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -808,6 +1327,24 @@ public:
   u16iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u16iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -828,19 +1365,50 @@ class u16utf8streambuf : public std::basic_streambuf<char16_t> {
   typedef std::basic_ostream<ext_char_type> dst_stream;
   typedef u16utf8streambuf streambuf;
 
+  friend class fusion;
+
 public:
 
   u16utf8streambuf(src_stream & is); // for reading.
   u16utf8streambuf(dst_stream & os); // for writing
   u16utf8streambuf(src_stream & is, dst_stream & os); // for both.
+  ~u16utf8streambuf();
 
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
+  // escape what is written from now on, see escape_type.
+  streambuf & set_escape(escape_type e) { escape_ = e; return *this; }
+  escape_type escape() const { return escape_; }
+
+  // read and write this form of UTF-8 from now on, see utf8_form.
+  streambuf & set_form(utf8_form f) { form_ = f; return *this; }
+  utf8_form form() const { return form_; }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -848,6 +1416,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -855,6 +1424,10 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
+  escape_type escape_;
+  utf8_form form_;
+  bool high_; // the last char read was a lone high surrogate (WTF-8).
   char_type * ibufb;
   char_type * ibufe;
   int_type pbuf; // put buffer has only one char.
@@ -881,6 +1454,28 @@ public:
   u16utf8istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u16utf8istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // read this form of UTF-8 from now on, see utf8_form.
+  u16utf8istream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u16utf8istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -898,15 +1493,27 @@ class u16utf8ostream : public std::basic_ostream<char16_t> {
 
 public:
 
-  u16utf8ostream(dst_stream & os)
+  u16utf8ostream(dst_stream & os, escape_type e = escape_type::NONE)
     : base_type(0), isbuf_(os)
-  { this->init(& isbuf_); }
+  { isbuf_.set_escape(e); this->init(& isbuf_); }
 
   status_type streambuf_status() const { return isbuf_.status(); }
 
   u16utf8ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u16utf8ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
+  // escape what is written from now on, see escape_type.
+  u16utf8ostream & set_escape(escape_type e)
+  { isbuf_.set_escape(e); return *this; }
+
+  // write this form of UTF-8 from now on, see utf8_form.
+  u16utf8ostream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -935,6 +1542,32 @@ public:
   u16utf8iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u16utf8iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // escape what is written from now on, see escape_type.
+  u16utf8iostream & set_escape(escape_type e)
+  { isbuf_.set_escape(e); return *this; }
+
+  // read and write this form of UTF-8 from now on, see utf8_form.
+  u16utf8iostream & set_form(utf8_form f)
+  { isbuf_.set_form(f); return *this; }
+
+  // take only the next code point from the source, see the streambuf.
+  u16utf8iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -968,6 +1601,14 @@ public:
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -975,6 +1616,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1010,6 +1652,10 @@ public:
   utf8u32istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  utf8u32istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1036,6 +1682,10 @@ public:
   utf8u32ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  utf8u32ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1064,6 +1714,10 @@ public:
   utf8u32iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  utf8u32iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1097,6 +1751,14 @@ public:
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -1104,6 +1766,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1139,6 +1802,10 @@ public:
   utf8u16istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  utf8u16istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1165,6 +1832,10 @@ public:
   utf8u16ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  utf8u16ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1193,6 +1864,10 @@ public:
   utf8u16iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  utf8u16iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1225,6 +1900,14 @@ public:
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -1232,6 +1915,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1267,6 +1951,10 @@ public:
   utf8istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  utf8istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1293,6 +1981,10 @@ public:
   utf8ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  utf8ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1321,6 +2013,10 @@ public:
   utf8iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  utf8iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1350,16 +2046,36 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1367,6 +2083,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   char_type * ibufb;
   char_type * ibufe;
   char_type ibuf[IBUFSZ];
@@ -1392,6 +2109,24 @@ public:
   u32iso8859_1_istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u32iso8859_1_istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u32iso8859_1_istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1418,6 +2153,10 @@ public:
   u32iso8859_1_ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u32iso8859_1_ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1446,6 +2185,24 @@ public:
   u32iso8859_1_iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u32iso8859_1_iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u32iso8859_1_iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1475,16 +2232,36 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+  // skip n code points without giving them to you, they are still
+  // validated. Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n);
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1492,6 +2269,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   char_type * ibufb;
   char_type * ibufe;
   char_type ibuf[IBUFSZ];
@@ -1517,6 +2295,24 @@ public:
   u16iso8859_1_istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u16iso8859_1_istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16iso8859_1_istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1543,6 +2339,10 @@ public:
   u16iso8859_1_ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u16iso8859_1_ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1571,6 +2371,24 @@ public:
   u16iso8859_1_iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u16iso8859_1_iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+  // skip n code points, set eof if there were fewer.
+  // Return the number of code points skipped.
+  std::streamsize skip(std::streamsize n)
+  {
+    std::streamsize k = isbuf_.skip(n);
+    if (k < n)
+      this->setstate(std::ios_base::eofbit);
+    return k;
+  }
+
+  // take only the next code point from the source, see the streambuf.
+  u16iso8859_1_iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1603,6 +2421,14 @@ public:
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and any partial sequence.
+  // This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
@@ -1610,6 +2436,7 @@ protected:
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1643,6 +2470,10 @@ public:
   utf8iso8859_1_istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  utf8iso8859_1_istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1669,6 +2500,10 @@ public:
   utf8iso8859_1_ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  utf8iso8859_1_ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1697,6 +2532,10 @@ public:
   utf8iso8859_1_iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  utf8iso8859_1_iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1713,6 +2552,8 @@ class u32bswap_streambuf : public std::basic_streambuf<char32_t> {
   typedef std::basic_ostream<char_type> dst_stream;
   typedef u32bswap_streambuf streambuf;
 
+  friend class fusion;
+
 public:
 
   typedef u32_swap_state_type swap_state_type;
@@ -1732,20 +2573,40 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
+
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
   swap_state_type swap_state() const { return swap_state_; }
 
   swap_state_type set_swap_state(swap_state_type s)
   { swap_state_type t=swap_state_; swap_state_ = s; return t; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and the swap state. This lets
+  // you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(& is, 0, s); }
+  streambuf & reset(dst_stream & os,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(0, & os, s); }
+  streambuf & reset(src_stream & is, dst_stream & os,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(& is, & os, s); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os, swap_state_type s);
   static swap_state_type check(swap_state_type s);
 
   int_type err_status(status_type s)
@@ -1754,6 +2615,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   swap_state_type swap_state_;
   char_type * ibufb;
   char_type * ibufe;
@@ -1782,11 +2644,20 @@ public:
   u32bswap_istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u32bswap_istream & reset(src_stream & is,
+			   swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(is, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
   { return isbuf_.set_swap_state(s); }
 
+  // take only the next code point from the source, see the streambuf.
+  u32bswap_istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1814,6 +2685,11 @@ public:
   u32bswap_ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u32bswap_ostream & reset(dst_stream & os,
+			   swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(os, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
@@ -1848,11 +2724,20 @@ public:
   u32bswap_iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u32bswap_iostream & reset(src_stream & is, dst_stream & os,
+			    swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(is, os, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
   { return isbuf_.set_swap_state(s); }
 
+  // take only the next code point from the source, see the streambuf.
+  u32bswap_iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1870,6 +2755,8 @@ class u16bswap_streambuf : public std::basic_streambuf<char16_t> {
   typedef std::basic_ostream<char_type> dst_stream;
   typedef u16bswap_streambuf streambuf;
 
+  friend class fusion;
+
 public:
 
   typedef u16_swap_state_type swap_state_type;
@@ -1889,20 +2776,40 @@ public:
   virtual int_type underflow();
   virtual int_type overflow(int_type __c);
   virtual streambuf * setbuf(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
 
   status_type status() const { return status_; }
   streambuf & clear_status() { status_ = status_type::OK; return *this; }
+
+  // underflow() takes no more from the source than the next code point,
+  // so you can go on reading the source itself after any char.
+  streambuf & set_bounded(bool b) { bounded_ = b; return *this; }
+  bool bounded() const { return bounded_; }
   swap_state_type swap_state() const { return swap_state_; }
 
   swap_state_type set_swap_state(swap_state_type s)
   { swap_state_type t=swap_state_; swap_state_ = s; return t; }
 
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones: status, what is buffered and the swap state. This lets
+  // you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(& is, 0, s); }
+  streambuf & reset(dst_stream & os,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(0, & os, s); }
+  streambuf & reset(src_stream & is, dst_stream & os,
+		    swap_state_type s = swap_state_type::None)
+  { return rebind(& is, & os, s); }
+
 protected:
 
   enum { EBACK = 16, IBUFSZ = 64 };
 
   int_type get();
   int_type put(int_type c);
+  streambuf & rebind(src_stream * is, dst_stream * os, swap_state_type s);
 
   int_type err_status(status_type s)
   { status_ = s; return traits_type::eof(); }
@@ -1910,6 +2817,7 @@ protected:
   src_stream * is_;
   dst_stream * os_;
   status_type status_;
+  bool bounded_; // get() takes one code point at a time.
   swap_state_type swap_state_;
   char_type * ibufb;
   char_type * ibufe;
@@ -1938,11 +2846,20 @@ public:
   u16bswap_istream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source, see the streambuf reset().
+  u16bswap_istream & reset(src_stream & is,
+			   swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(is, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
   { return isbuf_.set_swap_state(s); }
 
+  // take only the next code point from the source, see the streambuf.
+  u16bswap_istream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
@@ -1970,6 +2887,11 @@ public:
   u16bswap_ostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new destination, see the streambuf reset().
+  u16bswap_ostream & reset(dst_stream & os,
+			   swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(os, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
@@ -2004,17 +2926,2151 @@ public:
   u16bswap_iostream & clear_streambuf_status()
   { isbuf_.clear_status(); return *this; }
 
+  // attach to a new source and destination, see the streambuf reset().
+  u16bswap_iostream & reset(src_stream & is, dst_stream & os,
+			    swap_state_type s = swap_state_type::None)
+  { isbuf_.reset(is, os, s); this->clear(); return *this; }
+
   swap_state_type streambuf_swap_state() const { return isbuf_.swap_state(); }
 
   swap_state_type set_swap_state(swap_state_type s)
   { return isbuf_.set_swap_state(s); }
 
+  // take only the next code point from the source, see the streambuf.
+  u16bswap_iostream & set_bounded(bool b)
+  { isbuf_.set_bounded(b); return *this; }
+
 private:
 
   streambuf isbuf_;
 
 }; // end of class u16bswap_iostream
 
+// The same with the swap state fixed at compile time, M is its value:
+// 12 or 21 for char16_t and 1234, 2143, 3412 or 4321 for char32_t.
+// There is no FChar, LE or BE to sort out and no state to change, it
+// reads a block at a time and swaps all of it in one loop. Use
+// u16le_streambuf and the others below to read or write a given byte
+// order on this machine.
+template <class C, int M>
+class basic_bswap_streambuf : public std::basic_streambuf<C> {
+
+  typedef C char_type;
+  typedef std::basic_streambuf<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef basic_bswap_streambuf streambuf;
+
+  friend class fusion;
+
+  static_assert(sizeof(C) == 2 ? M == 12 || M == 21
+		: M == 1234 || M == 2143 || M == 3412 || M == 4321,
+		"M must be one of the swap states without FChar, LE and BE");
+
+public:
+
+  typedef typename base_type::int_type int_type;
+  typedef typename base_type::traits_type traits_type;
+
+  basic_bswap_streambuf(src_stream & is); // for reading.
+  basic_bswap_streambuf(dst_stream & os); // for writing
+  basic_bswap_streambuf(src_stream & is, dst_stream & os); // for both.
+
+  virtual int_type underflow();
+  virtual int_type overflow(int_type __c);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize showmanyc();
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
+
+  status_type status() const { return status_; }
+  streambuf & clear_status() { status_ = status_type::OK; return *this; }
+
+  // bind to a new source and/or destination, forgetting everything about
+  // the old ones. This lets you keep the streambuf for reuse.
+  streambuf & reset(src_stream & is) { return rebind(& is, 0); }
+  streambuf & reset(dst_stream & os) { return rebind(0, & os); }
+  streambuf & reset(src_stream & is, dst_stream & os)
+  { return rebind(& is, & os); }
+
+protected:
+
+  enum { EBACK = 16, IBUFSZ = 256 };
+
+  streambuf & rebind(src_stream * is, dst_stream * os);
+
+  int_type err_status(status_type s)
+  { status_ = s; return traits_type::eof(); }
+
+  src_stream * is_;
+  dst_stream * os_;
+  status_type status_;
+  char_type ibuf[IBUFSZ];
+
+}; // end of class basic_bswap_streambuf
+
+template <class C, int M>
+class basic_bswap_istream : public std::basic_istream<C> {
+
+  typedef C char_type;
+  typedef std::basic_istream<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef basic_bswap_streambuf<C, M> streambuf;
+
+public:
+
+  basic_bswap_istream(src_stream & is)
+    : base_type(0), isbuf_(is)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  basic_bswap_istream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+  // attach to a new source, see the streambuf reset().
+  basic_bswap_istream & reset(src_stream & is)
+  { isbuf_.reset(is); this->clear(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class basic_bswap_istream
+
+template <class C, int M>
+class basic_bswap_ostream : public std::basic_ostream<C> {
+
+  typedef C char_type;
+  typedef std::basic_ostream<char_type> base_type;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef basic_bswap_streambuf<C, M> streambuf;
+
+public:
+
+  basic_bswap_ostream(dst_stream & os)
+    : base_type(0), isbuf_(os)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  basic_bswap_ostream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+  // attach to a new destination, see the streambuf reset().
+  basic_bswap_ostream & reset(dst_stream & os)
+  { isbuf_.reset(os); this->clear(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class basic_bswap_ostream
+
+template <class C, int M>
+class basic_bswap_iostream : public std::basic_iostream<C> {
+
+  typedef C char_type;
+  typedef std::basic_iostream<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef basic_bswap_streambuf<C, M> streambuf;
+
+public:
+
+  basic_bswap_iostream(src_stream & is, dst_stream & os)
+    : base_type(0), isbuf_(is, os)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  basic_bswap_iostream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+  // attach to a new source and destination, see the streambuf reset().
+  basic_bswap_iostream & reset(src_stream & is, dst_stream & os)
+  { isbuf_.reset(is, os); this->clear(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class basic_bswap_iostream
+
+// little and big endian on this machine.
+typedef basic_bswap_streambuf<char32_t, int(u32_le_state)> u32le_streambuf;
+typedef basic_bswap_streambuf<char32_t, int(u32_be_state)> u32be_streambuf;
+typedef basic_bswap_streambuf<char16_t, int(u16_le_state)> u16le_streambuf;
+typedef basic_bswap_streambuf<char16_t, int(u16_be_state)> u16be_streambuf;
+typedef basic_bswap_istream<char32_t, int(u32_le_state)> u32le_istream;
+typedef basic_bswap_istream<char32_t, int(u32_be_state)> u32be_istream;
+typedef basic_bswap_istream<char16_t, int(u16_le_state)> u16le_istream;
+typedef basic_bswap_istream<char16_t, int(u16_be_state)> u16be_istream;
+typedef basic_bswap_ostream<char32_t, int(u32_le_state)> u32le_ostream;
+typedef basic_bswap_ostream<char32_t, int(u32_be_state)> u32be_ostream;
+typedef basic_bswap_ostream<char16_t, int(u16_le_state)> u16le_ostream;
+typedef basic_bswap_ostream<char16_t, int(u16_be_state)> u16be_ostream;
+typedef basic_bswap_iostream<char32_t, int(u32_le_state)> u32le_iostream;
+typedef basic_bswap_iostream<char32_t, int(u32_be_state)> u32be_iostream;
+typedef basic_bswap_iostream<char16_t, int(u16_le_state)> u16le_iostream;
+typedef basic_bswap_iostream<char16_t, int(u16_be_state)> u16be_iostream;
+
+//////////////////////////////////////
+// line readers
+
+// u32line_reader and u16line_reader read lines from any char32_t or
+// char16_t stream (u32utf8istream, u32u16istream, u16utf8istream ...).
+// The stream decodes a block of text directly into the buffer of the
+// reader and getline() gives you a view of the next line in that buffer.
+// The view is only valid until the next call to getline() - if you need
+// to keep the line, copy it.
+//
+// '\n' always ends a line, the eol flags below add more line terminators.
+// The line terminator itself is never part of the line. A last line that
+// is not terminated is also returned.
+//
+// Example: read UTF-8 lines as UTF-32.
+//
+// std::ifstream F("My file");
+// u32utf8istream G(F);
+// u32line_reader R(G, EOL_CRLF);
+// std::u32string_view line;
+// while (R.getline(line))
+//   do_something_with(line);
+
+enum eol_type : unsigned int {
+  EOL_LF = 0, // '\n' - always recognized.
+  EOL_CRLF = 1, // "\r\n" is a single line terminator.
+  EOL_LS = 2, // U+2028 LINE SEPARATOR.
+  EOL_PS = 4, // U+2029 PARAGRAPH SEPARATOR.
+  EOL_ALL = 7,
+};
+
+class u32line_reader {
+
+  typedef char32_t char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef std::basic_streambuf<char_type> src_streambuf;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::u32string_view view_type;
+
+public:
+
+  enum { BUFSZ = 4096 };
+
+  u32line_reader(src_stream & is, unsigned int eol = EOL_LF,
+		 std::size_t bufsz = BUFSZ);
+  u32line_reader(src_streambuf * sb, unsigned int eol = EOL_LF,
+		 std::size_t bufsz = BUFSZ);
+  u32line_reader(const u32line_reader &) = delete;
+  u32line_reader & operator = (const u32line_reader &) = delete;
+  ~u32line_reader();
+
+  // false at end of file (or error, see the status of the stream).
+  bool getline(view_type & line);
+
+  // read from another stream, what is buffered is dropped.
+  u32line_reader & reset(src_stream & is) { return reset(is.rdbuf()); }
+  u32line_reader & reset(src_streambuf * sb);
+
+  unsigned int eol() const { return eol_; }
+  src_streambuf * rdbuf() const { return sb_; }
+
+private:
+
+  bool fill();
+
+  src_streambuf * sb_;
+  unsigned int eol_;
+  bool eof_;
+  char_type * bufb;
+  char_type * bufe;
+  char_type * lineb; // start of what getline() has not yet returned.
+  char_type * datae; // end of what we have read.
+
+}; // end of class u32line_reader
+
+class u16line_reader {
+
+  typedef char16_t char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef std::basic_streambuf<char_type> src_streambuf;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::u16string_view view_type;
+
+public:
+
+  enum { BUFSZ = 4096 };
+
+  u16line_reader(src_stream & is, unsigned int eol = EOL_LF,
+		 std::size_t bufsz = BUFSZ);
+  u16line_reader(src_streambuf * sb, unsigned int eol = EOL_LF,
+		 std::size_t bufsz = BUFSZ);
+  u16line_reader(const u16line_reader &) = delete;
+  u16line_reader & operator = (const u16line_reader &) = delete;
+  ~u16line_reader();
+
+  // false at end of file (or error, see the status of the stream).
+  bool getline(view_type & line);
+
+  // read from another stream, what is buffered is dropped.
+  u16line_reader & reset(src_stream & is) { return reset(is.rdbuf()); }
+  u16line_reader & reset(src_streambuf * sb);
+
+  unsigned int eol() const { return eol_; }
+  src_streambuf * rdbuf() const { return sb_; }
+
+private:
+
+  bool fill();
+
+  src_streambuf * sb_;
+  unsigned int eol_;
+  bool eof_;
+  char_type * bufb;
+  char_type * bufe;
+  char_type * lineb; // start of what getline() has not yet returned.
+  char_type * datae; // end of what we have read.
+
+}; // end of class u16line_reader
+
+////////////////////////////////
+// reverse readers
+
+// u32utf8_reverse_reader and u32u16_reverse_reader read a UTF-8 or
+// UTF-16 stream backwards, from the end towards the position the stream
+// had when the reader was made. They read blocks from the end using
+// seekg() so only the tail of a big file that is actually used is ever
+// read. The stream must be seekable and the reader moves its position
+// around as it pleases.
+//
+// get() gives the code points last first and getline() gives the lines
+// last first, each line itself in normal order. Lines are split the same
+// way as u32line_reader does, a line terminator at the very end does not
+// give an empty last line. The input is checked the same way as when
+// reading forwards and the first error found stops the reader, see
+// status(). tell() is the position in the stream where the last code
+// point or line returned starts - seekg() there to read forwards again.
+//
+// Example: the last 10 lines of a UTF-8 file.
+//
+// std::ifstream F("My log");
+// u32utf8_reverse_reader R(F, EOL_CRLF);
+// std::u32string line;
+// for (int i = 0; i < 10 && R.getline(line); ++i)
+//   do_something_with(line);
+
+class u32utf8_reverse_reader {
+
+  typedef char32_t char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef traits_type::int_type int_type;
+  typedef char ext_char_type;
+  typedef std::basic_istream<ext_char_type> src_stream;
+
+public:
+
+  enum { BUFSZ = 4096 };
+
+  u32utf8_reverse_reader(src_stream & is, unsigned int eol = EOL_LF,
+			 std::size_t bufsz = BUFSZ);
+  u32utf8_reverse_reader(const u32utf8_reverse_reader &) = delete;
+  u32utf8_reverse_reader &
+  operator = (const u32utf8_reverse_reader &) = delete;
+  ~u32utf8_reverse_reader();
+
+  // the code point before the one last returned, eof at the start.
+  int_type get();
+  // false at the start (or error, see status()).
+  bool getline(std::u32string & line);
+
+  std::streamoff tell() const { return pos_ + (cur - bufb); }
+  unsigned int eol() const { return eol_; }
+  status_type status() const { return status_; }
+
+private:
+
+  bool fill();
+
+  src_stream * is_;
+  unsigned int eol_;
+  status_type status_;
+  std::streamoff beg_; // where we stop.
+  std::streamoff end_; // end of the stream.
+  std::streamoff pos_; // position of bufb in the stream.
+  ext_char_type * buf;
+  ext_char_type * bufb; // start of what we have read.
+  ext_char_type * bufe;
+  ext_char_type * cur; // end of what we have not yet returned.
+
+}; // end of class u32utf8_reverse_reader
+
+class u32u16_reverse_reader {
+
+  typedef char32_t char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef traits_type::int_type int_type;
+  typedef char16_t ext_char_type;
+  typedef std::basic_istream<ext_char_type> src_stream;
+
+public:
+
+  enum { BUFSZ = 4096 };
+
+  u32u16_reverse_reader(src_stream & is, unsigned int eol = EOL_LF,
+			std::size_t bufsz = BUFSZ);
+  u32u16_reverse_reader(const u32u16_reverse_reader &) = delete;
+  u32u16_reverse_reader &
+  operator = (const u32u16_reverse_reader &) = delete;
+  ~u32u16_reverse_reader();
+
+  // the code point before the one last returned, eof at the start.
+  int_type get();
+  // false at the start (or error, see status()).
+  bool getline(std::u32string & line);
+
+  std::streamoff tell() const { return pos_ + (cur - bufb); }
+  unsigned int eol() const { return eol_; }
+  status_type status() const { return status_; }
+
+private:
+
+  bool fill();
+
+  src_stream * is_;
+  unsigned int eol_;
+  status_type status_;
+  std::streamoff beg_; // where we stop.
+  std::streamoff end_; // end of the stream.
+  std::streamoff pos_; // position of bufb in the stream.
+  ext_char_type * buf;
+  ext_char_type * bufb; // start of what we have read.
+  ext_char_type * bufe;
+  ext_char_type * cur; // end of what we have not yet returned.
+
+}; // end of class u32u16_reverse_reader
+
+////////////////////////////////
+// codecvt facets
+
+// These let basic_filebuf, std::wbuffer_convert and the like use the
+// same conversions as the streams, in place of std::codecvt_utf8 and
+// friends. The internal chars are char32_t (UTF-32), char16_t (UTF-16)
+// or wchar_t which is UTF-32 or UTF-16 depending on its size. The
+// external chars are UTF-8 or ISO 8859-1. They check the codes the same
+// way the streams do and an invalid code gives error.
+//
+// in() keeps an incomplete UTF-8 sequence at the end of the input in the
+// mbstate_t, as well as the second half of a surrogate pair when there
+// is room for only the first. out() keeps a high surrogate at the end of
+// the input until it gets the low one, unshift() gives error if one is
+// left over.
+//
+// Example: read an UTF-8 file with a wifstream.
+//
+// std::wifstream F;
+// F.imbue(std::locale(F.getloc(), new wutf8_codecvt));
+// F.open("My file");
+
+// char32_t UTF-32 <-> UTF-8.
+class u32utf8_codecvt : public std::codecvt<char32_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<char32_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef char32_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit u32utf8_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~u32utf8_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class u32utf8_codecvt
+
+// char16_t UTF-16 <-> UTF-8.
+class u16utf8_codecvt : public std::codecvt<char16_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<char16_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef char16_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit u16utf8_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~u16utf8_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class u16utf8_codecvt
+
+// wchar_t UTF-32 or UTF-16 <-> UTF-8.
+class wutf8_codecvt : public std::codecvt<wchar_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<wchar_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef wchar_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit wutf8_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~wutf8_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class wutf8_codecvt
+
+// char32_t UTF-32 <-> ISO 8859-1.
+class u32iso8859_1_codecvt
+  : public std::codecvt<char32_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<char32_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef char32_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit u32iso8859_1_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~u32iso8859_1_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class u32iso8859_1_codecvt
+
+// char16_t UTF-16 <-> ISO 8859-1.
+class u16iso8859_1_codecvt
+  : public std::codecvt<char16_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<char16_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef char16_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit u16iso8859_1_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~u16iso8859_1_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class u16iso8859_1_codecvt
+
+// wchar_t <-> ISO 8859-1.
+class wiso8859_1_codecvt : public std::codecvt<wchar_t, char, std::mbstate_t> {
+
+  typedef std::codecvt<wchar_t, char, std::mbstate_t> base_type;
+
+public:
+
+  typedef wchar_t intern_type;
+  typedef char extern_type;
+  typedef std::mbstate_t state_type;
+  typedef std::codecvt_base::result result;
+
+  explicit wiso8859_1_codecvt(std::size_t refs = 0) : base_type(refs) { }
+  virtual ~wiso8859_1_codecvt();
+
+protected:
+
+  virtual result do_out(state_type & state,
+			const intern_type * from, const intern_type * from_end,
+			const intern_type *& from_next,
+			extern_type * to, extern_type * to_end,
+			extern_type *& to_next) const;
+  virtual result do_unshift(state_type & state,
+			    extern_type * to, extern_type * to_end,
+			    extern_type *& to_next) const;
+  virtual result do_in(state_type & state,
+		       const extern_type * from, const extern_type * from_end,
+		       const extern_type *& from_next,
+		       intern_type * to, intern_type * to_end,
+		       intern_type *& to_next) const;
+  virtual int do_encoding() const throw();
+  virtual bool do_always_noconv() const throw();
+  virtual int do_length(state_type & state,
+			const extern_type * from, const extern_type * end,
+			std::size_t max) const;
+  virtual int do_max_length() const throw();
+
+}; // end of class wiso8859_1_codecvt
+
+////////////////////////////////
+// light readers and writers
+
+// utf8_reader<C> and utf8_writer<C> do what u32utf8istream, u16utf8ostream
+// and friends do but without iostreams: no ios_base, no locale and no
+// sentries, just a small object with a buffer of the size you choose
+// (down to 4 bytes). C is char32_t or char16_t. They are meant for when
+// you have very many of them, one per connection say.
+//
+// The bytes come from, or go to, a function you give together with a
+// context pointer that is passed to it:
+//
+// source: std::ptrdiff_t src(void * ctx, char * buf, std::size_t n);
+//   store at most n bytes in buf and return how many, 0 at end of input
+//   and < 0 on error.
+// sink: std::ptrdiff_t snk(void * ctx, const char * buf, std::size_t n);
+//   take at most n bytes from buf and return how many, < 0 on error.
+//
+// The input is checked the same way the streams do and the first error
+// stops the reader, see status(). read() and write() count chars,
+// skip() counts code points (a surrogate pair is one).
+//
+// Example: read UTF-8 from a socket as UTF-32.
+//
+// std::ptrdiff_t from_socket(void * ctx, char * buf, std::size_t n)
+// { return ::read(*(int *)ctx, buf, n); }
+//
+// utf8_reader<char32_t> R(from_socket, & fd, 64);
+// std::char_traits<char32_t>::int_type c;
+// while ((c = R.get()) != std::char_traits<char32_t>::eof())
+//   do_something_with(char32_t(c));
+
+template <class C>
+class utf8_reader {
+
+public:
+
+  typedef C char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef typename traits_type::int_type int_type;
+  typedef std::ptrdiff_t (* source_type)(void * ctx, char * buf,
+					 std::size_t n);
+
+  enum { BUFSZ = 256, MINBUFSZ = 4 };
+
+  utf8_reader(source_type src, void * ctx, std::size_t bufsz = BUFSZ);
+  // use buf (of bufsz bytes) as buffer, it is not freed.
+  utf8_reader(source_type src, void * ctx, char * buf, std::size_t bufsz);
+  utf8_reader(const utf8_reader &) = delete;
+  utf8_reader & operator = (const utf8_reader &) = delete;
+  ~utf8_reader();
+
+  int_type get();
+  int_type peek();
+  // read up to n chars, fewer only at end of input or error.
+  std::size_t read(char_type * s, std::size_t n);
+  // skip n code points, return how many were skipped.
+  std::size_t skip(std::size_t n);
+
+  // read from another source, what is buffered is dropped.
+  utf8_reader & reset(source_type src, void * ctx);
+
+  bool eof() const { return eof_ && pos_ == end_ && pend_ == 0; }
+  status_type status() const { return status_; }
+  void clear_status() { status_ = status_type::OK; }
+
+private:
+
+  bool fill(std::size_t want);
+
+  source_type src_;
+  void * ctx_;
+  char * buf_;
+  std::uint32_t bufsz_;
+  std::uint32_t pos_; // next byte to decode.
+  std::uint32_t end_; // end of what we have read.
+  status_type status_;
+  char_type pend_; // second half of a surrogate pair read() had no room for.
+  bool own_;
+  bool eof_;
+
+}; // end of class utf8_reader
+
+template <class C>
+class utf8_writer {
+
+public:
+
+  typedef C char_type;
+  typedef std::ptrdiff_t (* sink_type)(void * ctx, const char * buf,
+				       std::size_t n);
+
+  enum { BUFSZ = 256, MINBUFSZ = 4 };
+
+  utf8_writer(sink_type snk, void * ctx, std::size_t bufsz = BUFSZ);
+  // use buf (of bufsz bytes) as buffer, it is not freed.
+  utf8_writer(sink_type snk, void * ctx, char * buf, std::size_t bufsz);
+  utf8_writer(const utf8_writer &) = delete;
+  utf8_writer & operator = (const utf8_writer &) = delete;
+  // flushes what is left.
+  ~utf8_writer();
+
+  bool put(char_type c) { return write(& c, 1) == 1; }
+  // write up to n chars, fewer only on error.
+  std::size_t write(const char_type * s, std::size_t n);
+  // give all we have buffered to the sink.
+  bool flush();
+  // write to another sink, what is buffered is dropped so flush() first.
+  utf8_writer & reset(sink_type snk, void * ctx);
+
+  status_type status() const { return status_; }
+  void clear_status() { status_ = status_type::OK; }
+
+private:
+
+  sink_type snk_;
+  void * ctx_;
+  char * buf_;
+  std::uint32_t bufsz_;
+  std::uint32_t end_; // end of what we have encoded.
+  status_type status_;
+  char_type pend_; // high surrogate waiting for its low half.
+  bool own_;
+
+}; // end of class utf8_writer
+
+extern template class utf8_reader<char32_t>;
+extern template class utf8_reader<char16_t>;
+extern template class utf8_writer<char32_t>;
+extern template class utf8_writer<char16_t>;
+
+////////////////////////////////
+// memory sources and sinks
+
+// memory_source<E> is a streambuf that reads straight from memory you
+// own (a string_view or pointer and size) without copying it, and
+// memory_sink<E> is a streambuf that writes to a buffer that grows as
+// needed and that you can move out as a string. memory_istream<E> and
+// memory_ostream<E> are the streams to attach the unicode streams to.
+// E is char, char16_t or char32_t.
+//
+// The unicode streams recognize these: they decode directly from the
+// memory of a memory_source and u32utf8ostream/u16utf8ostream encode
+// directly into the buffer of a memory_sink, so nothing is copied on the
+// way. Any other streambuf works as before.
+//
+// Example: UTF-8 in a string_view to a std::u16string.
+//
+// memory_istream<char> F(text);
+// u16utf8istream G(F);
+// memory_ostream<char16_t> H;
+// ... read from G and write to H ...
+// std::u16string s = H.release();
+//
+// For a whole string at once to_utf8(), to_u32() and to_u16() below are
+// simpler and faster, they size the result exactly before converting.
+
+template <class E>
+class memory_source : public std::basic_streambuf<E> {
+
+  typedef std::basic_streambuf<E> base_type;
+
+public:
+
+  typedef E char_type;
+  typedef std::char_traits<E> traits_type;
+  typedef typename traits_type::int_type int_type;
+  typedef typename traits_type::pos_type pos_type;
+  typedef typename traits_type::off_type off_type;
+  typedef std::basic_string_view<E> view_type;
+
+  memory_source() { reset(view_type()); }
+  explicit memory_source(view_type v) { reset(v); }
+  memory_source(const char_type * s, std::size_t n)
+  { reset(view_type(s, n)); }
+
+  // read from v instead, from the start of it.
+  memory_source & reset(view_type v)
+  {
+    char_type * p = const_cast<char_type *>(v.data());
+    this->setg(p, p, p + v.size());
+    return *this;
+  }
+
+  // what is not yet read.
+  view_type view() const
+  { return view_type(this->gptr(), this->egptr() - this->gptr()); }
+
+  // mark n more codes of view() as read.
+  void consume(std::size_t n)
+  { this->setg(this->eback(), this->gptr() + n, this->egptr()); }
+
+protected:
+
+  virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+			   std::ios_base::openmode which
+			   = std::ios_base::in | std::ios_base::out);
+  virtual pos_type seekpos(pos_type pos,
+			   std::ios_base::openmode which
+			   = std::ios_base::in | std::ios_base::out);
+
+}; // end of class memory_source
+
+template <class E>
+class memory_sink : public std::basic_streambuf<E> {
+
+  typedef std::basic_streambuf<E> base_type;
+
+public:
+
+  typedef E char_type;
+  typedef std::char_traits<E> traits_type;
+  typedef typename traits_type::int_type int_type;
+  typedef std::basic_string_view<E> view_type;
+  typedef std::basic_string<E> string_type;
+
+  memory_sink() { this->setp(0, 0); }
+  explicit memory_sink(std::size_t n) { this->setp(0, 0); reserve(n); }
+
+  // make room for n codes in total.
+  void reserve(std::size_t n);
+  // room for at least n more codes at the returned pointer, tell how
+  // many you used with commit().
+  char_type * prepare(std::size_t n);
+  void commit(std::size_t n) { set_size(size() + n); }
+
+  std::size_t size() const { return this->pptr() - this->pbase(); }
+  view_type view() const { return view_type(this->pbase(), size()); }
+  // move out what was written and start over empty.
+  string_type release();
+  void clear() { set_size(0); }
+
+protected:
+
+  virtual int_type overflow(int_type c);
+  virtual std::streamsize xsputn(const char_type * s, std::streamsize n);
+
+private:
+
+  void set_size(std::size_t n);
+
+  string_type buf_; // its size is what we have room for.
+
+}; // end of class memory_sink
+
+template <class E>
+class memory_istream : public std::basic_istream<E> {
+
+  typedef std::basic_istream<E> base_type;
+  typedef memory_source<E> streambuf;
+
+public:
+
+  typedef std::basic_string_view<E> view_type;
+
+  memory_istream() : base_type(0) { this->init(& buf_); }
+  explicit memory_istream(view_type v) : base_type(0), buf_(v)
+  { this->init(& buf_); }
+  memory_istream(const E * s, std::size_t n) : base_type(0), buf_(s, n)
+  { this->init(& buf_); }
+
+  memory_istream & reset(view_type v)
+  { buf_.reset(v); this->clear(); return *this; }
+
+  view_type view() const { return buf_.view(); }
+  streambuf * rdbuf() const { return const_cast<streambuf *>(& buf_); }
+
+private:
+
+  streambuf buf_;
+
+}; // end of class memory_istream
+
+template <class E>
+class memory_ostream : public std::basic_ostream<E> {
+
+  typedef std::basic_ostream<E> base_type;
+  typedef memory_sink<E> streambuf;
+
+public:
+
+  typedef std::basic_string_view<E> view_type;
+  typedef std::basic_string<E> string_type;
+
+  memory_ostream() : base_type(0) { this->init(& buf_); }
+  explicit memory_ostream(std::size_t n) : base_type(0), buf_(n)
+  { this->init(& buf_); }
+
+  void reserve(std::size_t n) { buf_.reserve(n); }
+  std::size_t size() const { return buf_.size(); }
+  view_type view() const { return buf_.view(); }
+  string_type release() { return buf_.release(); }
+  memory_ostream & clear_output()
+  { buf_.clear(); this->clear(); return *this; }
+
+  streambuf * rdbuf() const { return const_cast<streambuf *>(& buf_); }
+
+private:
+
+  streambuf buf_;
+
+}; // end of class memory_ostream
+
+extern template class memory_source<char>;
+extern template class memory_source<char16_t>;
+extern template class memory_source<char32_t>;
+extern template class memory_sink<char>;
+extern template class memory_sink<char16_t>;
+extern template class memory_sink<char32_t>;
+
+// One shot conversions of a whole string. The result is sized exactly
+// before converting (see utf8_length() and friends above). The input is
+// checked the same way as the streams do, on error the result has what
+// was converted before the error and *st, if given, tells what it was.
+std::string to_utf8(std::u32string_view s, status_type * st = 0);
+std::string to_utf8(std::u16string_view s, status_type * st = 0);
+std::u32string to_u32(std::string_view s, status_type * st = 0);
+std::u16string to_u16(std::string_view s, status_type * st = 0);
+
+////////////////////////////////
+// batch conversions
+
+// Many short strings at once, Arrow style. The input is one array of
+// codes and n + 1 offsets so that value i is data[off[i], off[i + 1]),
+// or simply n string_views. The output values are appended one after
+// the other to a single batch<C> which keeps their offsets and a status
+// per value. The output is sized once for the whole input and runs of
+// ASCII are converted across value boundaries in one go, so a batch of
+// mostly ASCII values costs about as much as one long string.
+//
+// A value with an error has what was converted before the error and
+// its status() tells what it was, the other values are not affected.
+// The functions return the number of values with an error.
+//
+// Example: UTF-16 column values to UTF-8.
+//
+// batch<char> B;
+// batch_to_utf8(col_data, col_offsets, rows, B);
+// for (std::size_t i = 0; i < B.size(); ++i)
+//   if (B.status(i) == status_type::OK)
+//     use(B[i]);
+
+template <class C>
+class batch {
+
+public:
+
+  typedef C char_type;
+  typedef std::basic_string_view<C> view_type;
+
+  batch() : used_(0), errors_(0) { off_.push_back(0); }
+
+  // number of values.
+  std::size_t size() const { return status_.size(); }
+  bool empty() const { return status_.empty(); }
+
+  // all the values one after the other, length() codes in all.
+  const char_type * data() const { return data_.data(); }
+  std::size_t length() const { return used_; }
+  // size() + 1 offsets into data(), value i is [offsets()[i],
+  // offsets()[i + 1]).
+  const std::size_t * offsets() const { return off_.data(); }
+
+  view_type operator [] (std::size_t i) const
+  { return view_type(data_.data() + off_[i], off_[i + 1] - off_[i]); }
+  status_type status(std::size_t i) const { return status_[i]; }
+  // number of values with an error.
+  std::size_t errors() const { return errors_; }
+
+  // room for at least n more codes at the returned pointer, then
+  // commit() the next value as k codes there.
+  char_type * prepare(std::size_t n)
+  {
+    if (data_.size() - used_ < n)
+      data_.resize(used_ + n < 2 * data_.size()
+		   ? 2 * data_.size() : used_ + n);
+    return & data_[0] + used_;
+  }
+  void commit(std::size_t k, status_type st = status_type::OK)
+  {
+    used_ += k;
+    off_.push_back(used_);
+    status_.push_back(st);
+    if (st != status_type::OK)
+      ++errors_;
+  }
+
+  // forget all values, keep the memory.
+  void clear()
+  {
+    used_ = 0;
+    errors_ = 0;
+    off_.resize(1);
+    status_.clear();
+  }
+
+private:
+
+  std::basic_string<C> data_; // its size is what we have room for.
+  std::size_t used_;
+  std::size_t errors_;
+  std::vector<std::size_t> off_;
+  std::vector<status_type> status_;
+
+}; // end of class batch
+
+std::size_t batch_to_utf8(const char16_t * data, const std::size_t * off,
+			  std::size_t n, batch<char> & out);
+std::size_t batch_to_utf8(const char32_t * data, const std::size_t * off,
+			  std::size_t n, batch<char> & out);
+std::size_t batch_to_u16(const char * data, const std::size_t * off,
+			 std::size_t n, batch<char16_t> & out);
+std::size_t batch_to_u32(const char * data, const std::size_t * off,
+			 std::size_t n, batch<char32_t> & out);
+
+std::size_t batch_to_utf8(const std::u16string_view * v, std::size_t n,
+			  batch<char> & out);
+std::size_t batch_to_utf8(const std::u32string_view * v, std::size_t n,
+			  batch<char> & out);
+std::size_t batch_to_u16(const std::string_view * v, std::size_t n,
+			 batch<char16_t> & out);
+std::size_t batch_to_u32(const std::string_view * v, std::size_t n,
+			 batch<char32_t> & out);
+
+////////////////////////////////
+// step decoders
+
+// decode_utf8() and decode_u16() are the decoding kernels of the streams
+// for when you keep the buffers yourself. They decode [s, se) to
+// [d, de) and leave s and d past what was taken and given, checking the
+// input the same way the streams do. They stop on error, when there is
+// no room for the next code point (a surrogate pair needs two char16_t)
+// or at a sequence cut at se. In the last two cases OK is returned with
+// s < se: call again with more room or more input. At the end of the
+// input s < se means the input was cut, the streams say BAD_STREAM.
+
+status_type decode_utf8(const char *& s, const char * se,
+			char32_t *& d, char32_t * de);
+status_type decode_utf8(const char *& s, const char * se,
+			char16_t *& d, char16_t * de);
+status_type decode_u16(const char16_t *& s, const char16_t * se,
+		       char32_t *& d, char32_t * de);
+
+////////////////////////////////
+// uring_source, uring_sink
+
+#if defined(__unix__) || defined(__APPLE__)
+
+// uring_source and uring_sink read and write a file with io_uring on
+// Linux, keeping depth block reads (or writes) in flight at once, and
+// with plain pread()/pwrite() elsewhere or when io_uring isn't allowed.
+// They suit files where mmap doesn't, such as network mounts. The
+// blocks are aligned to 4096 and blocksz is rounded up to it. Reads are
+// at the file offsets of the blocks. A pipe or a socket has none, it is
+// read with read() as the data comes and written with write(), without
+// io_uring. A sink queues the blocks it fills and submits them together
+// when it has to wait for a free block, and sync() waits for all.
+//
+// uring_istream and uring_ostream are the streams to attach the unicode
+// streams to:
+//
+// uring_istream F("big.txt");
+// u32utf8istream G(F);
+//
+// Given a file descriptor instead of a path they start at its current
+// offset and leave it open. status() is NO_STREAM if the file couldn't
+// be opened and BAD_STREAM on an I/O error.
+
+class uring_ring;
+
+class uring_source : public std::streambuf {
+
+  typedef char char_type;
+  typedef std::streambuf base_type;
+  typedef std::char_traits<char> traits_type;
+  typedef traits_type::int_type int_type;
+
+public:
+
+  enum { BLOCKSZ = 64 * 1024, DEPTH = 4 };
+
+  explicit uring_source(const char * path, std::size_t blocksz = BLOCKSZ,
+			unsigned depth = DEPTH, bool try_uring = true);
+  explicit uring_source(int fd, std::size_t blocksz = BLOCKSZ,
+			unsigned depth = DEPTH, bool try_uring = true);
+  virtual ~uring_source();
+
+  uring_source(const uring_source &) = delete;
+  uring_source & operator = (const uring_source &) = delete;
+
+  bool is_open() const { return fd_ >= 0; }
+  bool uses_uring() const { return ring_ != 0; }
+  status_type status() const { return status_; }
+
+protected:
+
+  virtual int_type underflow();
+
+private:
+
+  void start(std::size_t blocksz, unsigned depth, bool try_uring);
+  void submit(std::uint64_t k);
+  void reap();
+  long complete(std::uint64_t k);
+
+  int fd_;
+  bool own_;
+  uring_ring * ring_;
+  char * buf_;            // depth_ blocks of blocksz_
+  std::size_t blocksz_;
+  unsigned depth_;
+  std::int64_t base_;     // file offset of block 0, -1 for a pipe
+  std::uint64_t cur_;     // the block in the get area
+  std::uint64_t next_;    // the next block to submit
+  std::uint64_t end_;     // no block from here on has data
+  std::vector<long> res_; // per slot, what the read gave
+  std::vector<char> done_;
+  unsigned inflight_;
+  bool holding_;
+  status_type status_;
+
+}; // end of class uring_source
+
+class uring_sink : public std::streambuf {
+
+  typedef char char_type;
+  typedef std::streambuf base_type;
+  typedef std::char_traits<char> traits_type;
+  typedef traits_type::int_type int_type;
+
+public:
+
+  enum { BLOCKSZ = 64 * 1024, DEPTH = 4 };
+
+  explicit uring_sink(const char * path, std::size_t blocksz = BLOCKSZ,
+		      unsigned depth = DEPTH, bool try_uring = true);
+  explicit uring_sink(int fd, std::size_t blocksz = BLOCKSZ,
+		      unsigned depth = DEPTH, bool try_uring = true);
+  virtual ~uring_sink();
+
+  uring_sink(const uring_sink &) = delete;
+  uring_sink & operator = (const uring_sink &) = delete;
+
+  bool is_open() const { return fd_ >= 0; }
+  bool uses_uring() const { return ring_ != 0; }
+  status_type status() const { return status_; }
+
+protected:
+
+  virtual int_type overflow(int_type c);
+  virtual int sync();
+
+private:
+
+  void start(std::size_t blocksz, unsigned depth, bool try_uring);
+  bool put_block();
+  bool wait_slot(unsigned s);
+  void reap();
+
+  int fd_;
+  bool own_;
+  uring_ring * ring_;
+  char * buf_;             // depth_ blocks of blocksz_
+  std::size_t blocksz_;
+  unsigned depth_;
+  std::int64_t off_;       // file offset of the put area, -1 for a pipe
+  unsigned cur_;           // the slot of the put area
+  std::vector<std::int64_t> at_;  // per slot, offset and size of the
+  std::vector<std::size_t> len_;  // write in flight, len_ 0 if none
+  status_type status_;
+
+}; // end of class uring_sink
+
+class uring_istream : public std::istream {
+
+  typedef std::istream base_type;
+  typedef uring_source streambuf;
+
+public:
+
+  explicit uring_istream(const char * path,
+			 std::size_t blocksz = streambuf::BLOCKSZ,
+			 unsigned depth = streambuf::DEPTH,
+			 bool try_uring = true)
+    : base_type(0), isbuf_(path, blocksz, depth, try_uring)
+  {
+    this->init(& isbuf_);
+    if (! isbuf_.is_open())
+      this->setstate(std::ios_base::failbit);
+  }
+
+  bool is_open() const { return isbuf_.is_open(); }
+  bool uses_uring() const { return isbuf_.uses_uring(); }
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class uring_istream
+
+class uring_ostream : public std::ostream {
+
+  typedef std::ostream base_type;
+  typedef uring_sink streambuf;
+
+public:
+
+  explicit uring_ostream(const char * path,
+			 std::size_t blocksz = streambuf::BLOCKSZ,
+			 unsigned depth = streambuf::DEPTH,
+			 bool try_uring = true)
+    : base_type(0), osbuf_(path, blocksz, depth, try_uring)
+  {
+    this->init(& osbuf_);
+    if (! osbuf_.is_open())
+      this->setstate(std::ios_base::failbit);
+  }
+
+  bool is_open() const { return osbuf_.is_open(); }
+  bool uses_uring() const { return osbuf_.uses_uring(); }
+  status_type streambuf_status() const { return osbuf_.status(); }
+
+private:
+
+  streambuf osbuf_;
+
+}; // end of class uring_ostream
+
+#endif
+
+////////////////////////////////
+// coroutines
+
+#if defined(ALF_UNICODESTREAMS_COROUTINES)
+
+// With C++20 the decoding can be awaited instead of blocking in
+// underflow(). async_reader<C, E, S> decodes UTF-8 (E is char) or
+// UTF-16 (E is char16_t) from a source s of type S to C, using the same
+// kernels as the streams (see decode_utf8() above). S is anything with
+//
+//   read_some(E * buf, std::size_t n)
+//
+// returning an awaitable whose result is the number of codes stored in
+// buf, 0 at end of input and < 0 on error, a socket say. When the source
+// has no data the awaiting coroutine is suspended, no thread blocks.
+//
+// co_await R.read_some(buf, n) gives at least one char (0 only at end of
+// input or on error, see status()) and R.blocks(n) is an async generator
+// of decoded blocks of at most n chars:
+//
+// task<void> copy(my_socket & s)
+// {
+//   async_u32utf8_reader<my_socket> R(s);
+//   auto g = R.blocks();
+//   while (const std::u32string_view * b = co_await g.next())
+//     use(*b);
+// }
+//
+// task<T> is a lazy coroutine that runs when awaited, or from plain code
+// with start(), and async_generator<T> is what blocks() gives.
+
+template <class T>
+class task {
+
+public:
+
+  struct promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  struct final_awaiter {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept
+    {
+      std::coroutine_handle<> c = h.promise().cont_;
+      return c ? c : std::noop_coroutine();
+    }
+    void await_resume() const noexcept {}
+  };
+
+  struct promise_base {
+    std::coroutine_handle<> cont_;
+    std::exception_ptr ex_;
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() { ex_ = std::current_exception(); }
+  };
+
+  struct promise_type : promise_base {
+    T value_;
+    task get_return_object()
+    { return task(handle_type::from_promise(*this)); }
+    void return_value(T v) { value_ = std::move(v); }
+    T result()
+    {
+      if (this->ex_)
+	std::rethrow_exception(this->ex_);
+      return std::move(value_);
+    }
+  };
+
+  task(task && t) noexcept : h_(std::exchange(t.h_, nullptr)) {}
+  task(const task &) = delete;
+  task & operator = (const task &) = delete;
+  ~task() { if (h_) h_.destroy(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+  {
+    h_.promise().cont_ = c;
+    return h_;
+  }
+  T await_resume() { return h_.promise().result(); }
+
+  // run it from plain code until it first suspends, done() tells when
+  // it has finished and result() then gives what it returned.
+  void start() { h_.resume(); }
+  bool done() const { return h_.done(); }
+  T result() { return h_.promise().result(); }
+
+private:
+
+  explicit task(handle_type h) : h_(h) {}
+
+  handle_type h_;
+
+}; // end of class task
+
+template <>
+struct task<void>::promise_type : task<void>::promise_base {
+  task get_return_object()
+  { return task(handle_type::from_promise(*this)); }
+  void return_void() {}
+  void result()
+  {
+    if (this->ex_)
+      std::rethrow_exception(this->ex_);
+  }
+};
+
+template <class T>
+class async_generator {
+
+public:
+
+  struct promise_type;
+  typedef std::coroutine_handle<promise_type> handle_type;
+
+  // give control back to whoever awaits next().
+  struct yield_awaiter {
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(handle_type h) noexcept
+    { return h.promise().cont_; }
+    void await_resume() const noexcept {}
+  };
+
+  struct promise_type {
+    std::coroutine_handle<> cont_;
+    std::exception_ptr ex_;
+    const T * value_ = 0;
+    async_generator get_return_object()
+    { return async_generator(handle_type::from_promise(*this)); }
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    yield_awaiter final_suspend() noexcept { value_ = 0; return {}; }
+    yield_awaiter yield_value(const T & v) noexcept
+    { value_ = & v; return {}; }
+    void return_void() {}
+    void unhandled_exception() { ex_ = std::current_exception(); }
+  };
+
+  struct next_awaiter {
+    handle_type h_;
+    bool await_ready() const noexcept { return ! h_ || h_.done(); }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) noexcept
+    {
+      h_.promise().cont_ = c;
+      return h_;
+    }
+    // the next value, valid until the next call, 0 at the end.
+    const T * await_resume()
+    {
+      if (! h_ || h_.done()) {
+	if (h_ && h_.promise().ex_)
+	  std::rethrow_exception(h_.promise().ex_);
+	return 0;
+      }
+      return h_.promise().value_;
+    }
+  };
+
+  async_generator(async_generator && g) noexcept
+    : h_(std::exchange(g.h_, nullptr)) {}
+  async_generator(const async_generator &) = delete;
+  async_generator & operator = (const async_generator &) = delete;
+  ~async_generator() { if (h_) h_.destroy(); }
+
+  next_awaiter next() { return next_awaiter{ h_ }; }
+
+private:
+
+  explicit async_generator(handle_type h) : h_(h) {}
+
+  handle_type h_;
+
+}; // end of class async_generator
+
+template <class C, class E, class S>
+class async_reader {
+
+public:
+
+  typedef C char_type;
+  typedef E src_char_type;
+  typedef S source_type;
+  typedef std::basic_string_view<C> view_type;
+
+  enum { BUFSZ = 4096, MINBUFSZ = 4 };
+
+  explicit async_reader(source_type & src, std::size_t bufsz = BUFSZ)
+    : src_(& src), buf_(bufsz < MINBUFSZ ? std::size_t(MINBUFSZ) : bufsz, E()),
+      b_(0), e_(0), pend_(0), has_pend_(false), eof_(false),
+      status_(status_type::OK) {}
+
+  async_reader(const async_reader &) = delete;
+  async_reader & operator = (const async_reader &) = delete;
+
+  // at least one char into [s, s + n), 0 only at end or on error.
+  task<std::size_t> read_some(char_type * s, std::size_t n);
+
+  // the input as blocks of at most n chars.
+  async_generator<view_type> blocks(std::size_t n = 1024);
+
+  status_type status() const { return status_; }
+  bool eof() const { return eof_ && b_ == e_ && ! has_pend_; }
+
+private:
+
+  static status_type step(const char *& s, const char * se,
+			  C *& d, C * de)
+  { return decode_utf8(s, se, d, de); }
+  static status_type step(const char16_t *& s, const char16_t * se,
+			  char32_t *& d, char32_t * de)
+  { return decode_u16(s, se, d, de); }
+
+  source_type * src_;
+  std::basic_string<E> buf_;
+  std::size_t b_, e_; // what is not yet decoded in buf_
+  C pend_;            // decoded when there was room for one char only,
+  bool has_pend_;     // a low surrogate or the next code point
+  bool eof_;
+  status_type status_;
+
+}; // end of class async_reader
+
+template <class C, class E, class S>
+task<std::size_t>
+async_reader<C, E, S>::read_some(char_type * s, std::size_t n)
+{
+  char_type * q = s;
+  char_type * qe = s + n;
+
+  if (n == 0)
+    co_return 0;
+  if (has_pend_) {
+    *q++ = pend_;
+    has_pend_ = false;
+  }
+  while (status_ == status_type::OK) {
+    const E * p = buf_.data() + b_;
+    const E * pe = buf_.data() + e_;
+    if (qe - q == 1) {
+      // a surrogate pair may not fit, keep what is after the first char.
+      char_type tmp[2];
+      char_type * t = tmp;
+      status_ = step(p, pe, t, tmp + 2);
+      if (t > tmp) {
+	*q++ = tmp[0];
+	if (t - tmp == 2) {
+	  pend_ = tmp[1];
+	  has_pend_ = true;
+	}
+      }
+    } else
+      status_ = step(p, pe, q, qe);
+    b_ = p - buf_.data();
+    if (q > s || status_ != status_type::OK)
+      break;
+
+    // need more input, keep what is left of a cut sequence.
+    if (eof_) {
+      if (b_ < e_)
+	status_ = status_type::BAD_STREAM;
+      break;
+    }
+    std::char_traits<E>::move(& buf_[0], buf_.data() + b_, e_ - b_);
+    e_ -= b_;
+    b_ = 0;
+    std::ptrdiff_t r = co_await src_->read_some(buf_.data() + e_,
+						buf_.size() - e_);
+    if (r < 0)
+      status_ = status_type::BAD_STREAM;
+    else if (r == 0)
+      eof_ = true;
+    else
+      e_ += r;
+  }
+  co_return q - s;
+}
+
+template <class C, class E, class S>
+async_generator<typename async_reader<C, E, S>::view_type>
+async_reader<C, E, S>::blocks(std::size_t n /* = 1024 */)
+{
+  std::basic_string<C> buf(n ? n : 1, C());
+
+  for (;;) {
+    std::size_t k = co_await read_some(buf.data(), buf.size());
+    if (k == 0)
+      co_return;
+    co_yield view_type(buf.data(), k);
+  }
+}
+
+template <class S>
+using async_u32utf8_reader = async_reader<char32_t, char, S>;
+template <class S>
+using async_u16utf8_reader = async_reader<char16_t, char, S>;
+template <class S>
+using async_u32u16_reader = async_reader<char32_t, char16_t, S>;
+
+#endif
+
+////////////////////////////////
+// normalization
+
+// The Unicode normalization forms, see UAX #15.
+enum class normal_form : unsigned char { NFC, NFD, NFKC, NFKD };
+
+// Normalize what is read from is or written to os, both char32_t so it
+// goes on top of u32istream, u32utf8istream and the others:
+//
+// u32utf8istream G(F);
+// u32normalize_istream N(G, normal_form::NFC);
+//
+// Text that the quick check says is normalized already goes through as
+// it is, only the segments around chars that need it are normalized. A
+// segment runs from a char that nothing before it can change to the
+// next one, so reading looks ahead to the start of the next segment and
+// writing holds back the last one until more is written, finish() is
+// called or the streambuf goes away. A segment longer than 1024 chars,
+// which only odd text has, is normalized in pieces of that size.
+// Invalid code points go through unchanged, u32istream below catches
+// them.
+class u32normalize_streambuf : public std::basic_streambuf<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_streambuf<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef u32normalize_streambuf streambuf;
+
+public:
+
+  // for reading.
+  u32normalize_streambuf(src_stream & is, normal_form f = normal_form::NFC);
+  // for writing
+  u32normalize_streambuf(dst_stream & os, normal_form f = normal_form::NFC);
+  ~u32normalize_streambuf();
+
+  virtual int_type underflow();
+  virtual int_type overflow(int_type __c);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
+  virtual int sync();
+
+  status_type status() const { return status_; }
+  streambuf & clear_status() { status_ = status_type::OK; return *this; }
+  normal_form form() const { return form_; }
+
+  // write the segment held back as if the text ended here.
+  streambuf & finish();
+
+protected:
+
+  enum { EBACK = 16, RAWSZ = 1024 };
+
+  int_type get();
+  bool put_text(bool last);
+
+  int_type err_status(status_type s)
+  { status_ = s; return traits_type::eof(); }
+
+  src_stream * is_;
+  dst_stream * os_;
+  status_type status_;
+  normal_form form_;
+  bool eof_;
+  std::u32string in_; // read or written, not yet normalized.
+  std::u32string out_; // normalized, not yet read or written.
+
+}; // end of class u32normalize_streambuf
+
+class u32normalize_istream : public std::basic_istream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_istream<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef u32normalize_streambuf streambuf;
+
+public:
+
+  u32normalize_istream(src_stream & is, normal_form f = normal_form::NFC)
+    : base_type(0), isbuf_(is, f)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32normalize_istream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32normalize_istream
+
+class u32normalize_ostream : public std::basic_ostream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_ostream<char_type> base_type;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef u32normalize_streambuf streambuf;
+
+public:
+
+  u32normalize_ostream(dst_stream & os, normal_form f = normal_form::NFC)
+    : base_type(0), isbuf_(os, f)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32normalize_ostream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+  // write what is held back, see the streambuf.
+  u32normalize_ostream & finish() { isbuf_.finish(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32normalize_ostream
+
+// A whole string at once. A segment is normalized in one piece however
+// long it is, only the streams above cut it at 1024 chars.
+std::u32string normalize(std::u32string_view s,
+			 normal_form f = normal_form::NFC);
+
+////////////////////////////////
+// case folding
+
+// Full case folding, the C and F mappings of CaseFolding.txt, of what
+// is read from is or written to os, both char32_t as for normalization.
+// Texts that differ only in case read the same after folding. A char
+// folds to at most 3 chars, U+00DF becomes "ss", and nothing around it
+// matters so nothing is held back. ASCII and ISO 8859-1 text is folded
+// several chars at a time, the rest is looked up in a table. Invalid
+// code points go through unchanged.
+class u32casefold_streambuf : public std::basic_streambuf<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_streambuf<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef u32casefold_streambuf streambuf;
+
+public:
+
+  u32casefold_streambuf(src_stream & is); // for reading.
+  u32casefold_streambuf(dst_stream & os); // for writing
+
+  virtual int_type underflow();
+  virtual int_type overflow(int_type __c);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
+
+  status_type status() const { return status_; }
+  streambuf & clear_status() { status_ = status_type::OK; return *this; }
+
+protected:
+
+  enum { EBACK = 16, IBUFSZ = 256 };
+
+  int_type get();
+
+  int_type err_status(status_type s)
+  { status_ = s; return traits_type::eof(); }
+
+  src_stream * is_;
+  dst_stream * os_;
+  status_type status_;
+  char_type ibuf[IBUFSZ];
+
+}; // end of class u32casefold_streambuf
+
+class u32casefold_istream : public std::basic_istream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_istream<char_type> base_type;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef u32casefold_streambuf streambuf;
+
+public:
+
+  u32casefold_istream(src_stream & is)
+    : base_type(0), isbuf_(is)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32casefold_istream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32casefold_istream
+
+class u32casefold_ostream : public std::basic_ostream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_ostream<char_type> base_type;
+  typedef std::basic_ostream<char_type> dst_stream;
+  typedef u32casefold_streambuf streambuf;
+
+public:
+
+  u32casefold_ostream(dst_stream & os)
+    : base_type(0), isbuf_(os)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32casefold_ostream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32casefold_ostream
+
+// The same folding done while decoding UTF-8 from is or encoding it to
+// os, so
+//
+// u32utf8casefold_istream C(F);
+//
+// gives what u32casefold_istream on top of u32utf8istream gives, without
+// a second pass over the text. ASCII is folded 16 bytes at a time as it
+// is decoded. Errors are the ones of u32utf8streambuf.
+class u32utf8casefold_streambuf : public std::basic_streambuf<char32_t> {
+
+  typedef char32_t char_type;
+  typedef char ext_char_type;
+  typedef std::basic_streambuf<char_type> base_type;
+  typedef std::istream src_stream;
+  typedef std::ostream dst_stream;
+  typedef u32utf8casefold_streambuf streambuf;
+
+public:
+
+  u32utf8casefold_streambuf(src_stream & is); // for reading.
+  u32utf8casefold_streambuf(dst_stream & os); // for writing
+
+  virtual int_type underflow();
+  virtual int_type overflow(int_type __c);
+  virtual std::streamsize xsgetn(char_type * __s, std::streamsize __n);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
+
+  status_type status() const { return status_; }
+  streambuf & clear_status() { status_ = status_type::OK; return *this; }
+
+protected:
+
+  enum { EBACK = 16, IBUFSZ = 256 };
+
+  int_type get();
+
+  int_type err_status(status_type s)
+  { status_ = s; return traits_type::eof(); }
+
+  src_stream * is_;
+  dst_stream * os_;
+  status_type status_;
+  char_type ibuf[IBUFSZ];
+
+}; // end of class u32utf8casefold_streambuf
+
+class u32utf8casefold_istream : public std::basic_istream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef char src_char_type;
+  typedef std::basic_istream<char32_t> base_type;
+  typedef std::istream src_stream;
+  typedef u32utf8casefold_streambuf streambuf;
+
+public:
+
+  u32utf8casefold_istream(src_stream & is)
+    : base_type(0), isbuf_(is)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32utf8casefold_istream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32utf8casefold_istream
+
+class u32utf8casefold_ostream : public std::basic_ostream<char32_t> {
+
+  typedef char32_t char_type;
+  typedef char dst_char_type;
+  typedef std::basic_ostream<char32_t> base_type;
+  typedef std::ostream dst_stream;
+  typedef u32utf8casefold_streambuf streambuf;
+
+public:
+
+  u32utf8casefold_ostream(dst_stream & os)
+    : base_type(0), isbuf_(os)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+  u32utf8casefold_ostream & clear_streambuf_status()
+  { isbuf_.clear_status(); return *this; }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class u32utf8casefold_ostream
+
+// A whole string at once.
+std::u32string casefold(std::u32string_view s);
+
+////////////////////////////////
+// grapheme clusters
+
+// u32grapheme_reader reads the extended grapheme clusters of UAX #29,
+// what a reader takes as one character such as e with U+0301 after it
+// or a flag, from any char32_t stream the way u32line_reader reads lines:
+// next() gives a view of the next cluster in the buffer of the reader,
+// only valid until the next call to next().
+//
+// std::ifstream F("My file");
+// u32utf8istream G(F);
+// u32grapheme_reader R(G);
+// std::u32string_view c;
+// while (R.next(c))
+//   ++chars;
+//
+// Whether a char belongs to the cluster before it depends only on the
+// chars of that cluster, so the reader looks one char past a cluster
+// and no further before it gives it. An ASCII char other than CR with
+// ASCII after it is a cluster by itself, that is found without looking
+// anything up. The rules are those of Unicode 14, so there is no GB9c.
+class u32grapheme_reader {
+
+  typedef char32_t char_type;
+  typedef std::char_traits<char_type> traits_type;
+  typedef std::basic_streambuf<char_type> src_streambuf;
+  typedef std::basic_istream<char_type> src_stream;
+  typedef std::u32string_view view_type;
+
+public:
+
+  enum { BUFSZ = 4096 };
+
+  u32grapheme_reader(src_stream & is, std::size_t bufsz = BUFSZ);
+  u32grapheme_reader(src_streambuf * sb, std::size_t bufsz = BUFSZ);
+  u32grapheme_reader(const u32grapheme_reader &) = delete;
+  u32grapheme_reader & operator = (const u32grapheme_reader &) = delete;
+  ~u32grapheme_reader();
+
+  // false at end of file (or error, see the status of the stream).
+  bool next(view_type & cluster);
+
+  // read from another stream, what is buffered is dropped.
+  u32grapheme_reader & reset(src_stream & is) { return reset(is.rdbuf()); }
+  u32grapheme_reader & reset(src_streambuf * sb);
+
+  src_streambuf * rdbuf() const { return sb_; }
+
+private:
+
+  bool fill();
+
+  src_streambuf * sb_;
+  bool eof_;
+  char_type * bufb;
+  char_type * bufe;
+  char_type * clusterb; // start of what next() has not yet returned.
+  char_type * datae; // end of what we have read.
+
+}; // end of class u32grapheme_reader
+
+// The first cluster of s, empty if s is. The text is taken to end where
+// s ends.
+std::u32string_view first_grapheme(std::u32string_view s);
+
+////////////////////////////////
+// display width
+
+// The columns c takes on a terminal, as wcwidth() has it: 2 for East
+// Asian Wide and Fullwidth chars and for emoji shown as such, 0 for NUL,
+// combining marks, format chars, other default ignorables and the
+// Hangul vowels and final consonants that join a syllable, -1 for the
+// other control chars and 1 for the rest.
+constexpr int char_width(char32_t c)
+{
+  if (c < 0x7f)
+    return c >= 0x20 ? 1 : c == 0 ? 0 : -1;
+
+  general_category g = general_category_of(c);
+  east_asian_width e = east_asian_width_of(c);
+  if (g == general_category::Cc)
+    return -1;
+  if (c == 0xad) // the soft hyphen shows if the line breaks there.
+    return 1;
+  if (g == general_category::Mn || g == general_category::Me
+      || g == general_category::Cf || (c >= 0x1160 && c < 0x1200)
+      || (char_flags(c) & PROP_DEFAULT_IGNORABLE))
+    return 0;
+  if (e == east_asian_width::W || e == east_asian_width::F
+      || (char_flags(c) & PROP_EMOJI_PRESENTATION))
+    return 2;
+  return 1;
+}
+
+// The columns text takes, a grapheme cluster at a time: a cluster is as
+// wide as its widest char, except that an emoji with U+FE0F after it is
+// 2, with U+FE0E 1, and a flag is 2. Control chars take none. Invalid
+// UTF-8 or UTF-16 counts as U+FFFD for every code that is wrong, as
+// count_utf8() these don't validate. Printable ASCII is counted 16 bytes
+// at a time in UTF-8.
+std::size_t display_width(std::string_view s);
+std::size_t display_width(std::u16string_view s);
+std::size_t display_width(std::u32string_view s);
+
+// The longest start of s that is at most columns wide and doesn't cut a
+// grapheme cluster, widths as display_width().
+std::string_view truncate_width(std::string_view s, std::size_t columns);
+std::u16string_view truncate_width(std::u16string_view s,
+				   std::size_t columns);
+std::u32string_view truncate_width(std::u32string_view s,
+				   std::size_t columns);
+
+////////////////////////////////
+// JSON strings
+
+// decode_json() decodes the body of a JSON string, what comes after the
+// opening quote, the way the step decoders above do and in one pass:
+// escapes are resolved, \uXXXX escapes of surrogates must pair up the
+// way get_u16 wants them and the rest must be UTF-8 the way get_utf8
+// wants it. It stops in front of the closing quote, so at the end of the
+// string s < se and *s is '"'. A bad escape or a control char that isn't
+// escaped is BAD_INPUT. Runs with no escapes are found 16 bytes at a
+// time. For UTF-8 they are checked and copied as they are.
+
+status_type decode_json(const char *& s, const char * se,
+			char32_t *& d, char32_t * de);
+status_type decode_json(const char *& s, const char * se,
+			char16_t *& d, char16_t * de);
+status_type decode_json(const char *& s, const char * se,
+			char *& d, char * de);
+
+// One shot: the JSON string whose body starts at s, as to_u32() and
+// friends. *n, if given, gets the length of the body, where the closing
+// quote is. With no closing quote *st is EOF_STREAM.
+std::u32string json_to_u32(std::string_view s, status_type * st = 0,
+			   std::size_t * n = 0);
+std::u16string json_to_u16(std::string_view s, status_type * st = 0,
+			   std::size_t * n = 0);
+std::string json_to_utf8(std::string_view s, status_type * st = 0,
+			 std::size_t * n = 0);
+
+////////////////////////////////
+// percent encoding
+
+// decode_percent() decodes percent-encoded UTF-8, as in a URL, the way
+// the step decoders above do: %XX escapes and raw bytes together are the
+// UTF-8, which must be as get_utf8 wants it. A % without two hex digits
+// after it is BAD_INPUT, and + is not a space. Runs with no % or
+// non-ASCII byte in them are found 16 bytes at a time.
+
+status_type decode_percent(const char *& s, const char * se,
+			   char32_t *& d, char32_t * de);
+status_type decode_percent(const char *& s, const char * se,
+			   char16_t *& d, char16_t * de);
+status_type decode_percent(const char *& s, const char * se,
+			   char *& d, char * de);
+
+// One shot decoding, as to_u32() and friends.
+std::u32string percent_to_u32(std::string_view s, status_type * st = 0);
+std::u16string percent_to_u16(std::string_view s, status_type * st = 0);
+std::string percent_to_utf8(std::string_view s, status_type * st = 0);
+
+// The ASCII chars percent_encode() writes as %XX besides those that
+// can't be in a URI as they are: controls, space, DEL and " % < > \ ^ `
+// { | }. Letters, digits and - . _ ~ never are.
+class percent_set {
+
+public:
+
+  constexpr percent_set() : lo_(0), hi_(0) { }
+  constexpr explicit percent_set(const char * s) : lo_(0), hi_(0)
+  { while (*s) add(*s++); }
+
+  constexpr percent_set & add(char c)
+  {
+    unsigned int u = (unsigned char)c;
+    if (u < 64)
+      lo_ |= std::uint64_t(1) << u;
+    else if (u < 128)
+      hi_ |= std::uint64_t(1) << (u - 64);
+    return *this;
+  }
+
+  constexpr bool has(char32_t c) const
+  { return c < 64 ? (lo_ >> c) & 1 : c < 128 ? (hi_ >> (c - 64)) & 1 : false; }
+
+  // the reserved chars of RFC 3986, so that what is encoded can be any
+  // part of a URI.
+  static constexpr percent_set reserved()
+  { return percent_set(":/?#[]@!$&'()*+,;="); }
+
+private:
+
+  std::uint64_t lo_;
+  std::uint64_t hi_;
+
+}; // end of class percent_set
+
+// Percent-encode s as UTF-8, with the chars of r as %XX too. The input
+// is checked the same way as the streams do, on error the result has
+// what was encoded before the error and *st, if given, tells what it
+// was. Runs of letters and digits are found 8 or 16 codes at a time.
+std::string percent_encode(std::u32string_view s,
+			   percent_set r = percent_set::reserved(),
+			   status_type * st = 0);
+std::string percent_encode(std::u16string_view s,
+			   percent_set r = percent_set::reserved(),
+			   status_type * st = 0);
+std::string percent_encode(std::string_view s,
+			   percent_set r = percent_set::reserved(),
+			   status_type * st = 0);
+
 }; // end of namespace unicodestreams
 
 }; // end of namespace alf
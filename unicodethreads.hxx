@@ -0,0 +1,245 @@
+#ifndef __ALF_UNICODETHREADS_HXX__
+#define __ALF_UNICODETHREADS_HXX__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "unicodestreams.hxx"
+
+// The stream classes that use threads. They are here and not in
+// unicodestreams.hxx so that only those who use them get <thread> and
+// friends. They are built with the rest in unicodestreams.cxx, link
+// with -pthread.
+
+namespace alf {
+
+namespace unicodestreams {
+
+////////////////////////////////
+// shared_u32utf8ostream
+
+// shared_u32utf8ostream is one UTF-8 destination, typically a log file,
+// that many threads write to without a mutex. A thread writes a record
+// through an u32utf8record (a std::basic_ostream<char32_t> of its own)
+// or with write(): the text is encoded in the thread into a buffer that
+// belongs to that thread and the finished record is handed over on a
+// lock-free queue. Records are written whole and, for each thread, in
+// the order they were made.
+//
+// There is no writer thread: whoever hands over a record writes what is
+// queued if no one else is doing so, otherwise the one who is writes it
+// too. So encoding runs in parallel and only the writing is serial.
+// flush() writes everything queued and flushes the destination, and so
+// does a record that was flushed (std::flush) when it is done.
+//
+// Example:
+//
+// std::ofstream F("log.txt");
+// shared_u32utf8ostream L(F);
+// ... in any thread ...
+// u32utf8record(L) << U"job " << name << U" done\n" << std::flush;
+//
+// All records must be done before L is destroyed. A record that has
+// invalid code points is written up to the first one and the status of
+// both the record and L tells.
+
+class shared_u32utf8ostream {
+
+  typedef std::ostream dst_stream;
+
+public:
+
+  explicit shared_u32utf8ostream(dst_stream & os);
+  ~shared_u32utf8ostream();
+
+  shared_u32utf8ostream(const shared_u32utf8ostream &) = delete;
+  shared_u32utf8ostream & operator = (const shared_u32utf8ostream &) = delete;
+
+  // write s as one record.
+  shared_u32utf8ostream & write(std::u32string_view s);
+
+  // write all that is queued and flush the destination.
+  shared_u32utf8ostream & flush();
+
+  status_type status() const { return status_.load(); }
+  void clear_status() { status_.store(status_type::OK); }
+
+private:
+
+  friend class u32utf8recordbuf;
+
+  // a record, n bytes of UTF-8 follow it in memory.
+  struct node {
+    std::atomic<node *> next;
+    std::size_t n;
+  };
+
+  void publish(const char * s, std::size_t n, status_type st);
+  void push(node * p);
+  node * pop();
+  void drain();
+  void write_queued();
+
+  dst_stream * os_;
+  std::atomic<node *> head_; // producers push here
+  node * tail_;              // the writer pops here
+  node stub_;
+  std::atomic<std::size_t> pending_;
+  std::atomic_flag busy_;    // set while someone writes
+  std::atomic<status_type> status_;
+
+}; // end of class shared_u32utf8ostream
+
+class u32utf8recordbuf : public std::basic_streambuf<char32_t> {
+
+  typedef char32_t char_type;
+  typedef std::basic_streambuf<char32_t> base_type;
+  typedef std::char_traits<char32_t> traits_type;
+  typedef traits_type::int_type int_type;
+
+  enum { OBUFSZ = 128 };
+
+public:
+
+  explicit u32utf8recordbuf(shared_u32utf8ostream & out);
+  virtual ~u32utf8recordbuf();
+
+  // hand over what is written so far as one record and start a new one.
+  void commit();
+
+  status_type status() const { return status_; }
+
+protected:
+
+  virtual int_type overflow(int_type c);
+  virtual std::streamsize xsputn(const char_type * __s, std::streamsize __n);
+  virtual int sync();
+
+private:
+
+  bool encode(const char_type * s, const char_type * se);
+
+  shared_u32utf8ostream * out_;
+  std::string text_; // this thread's buffer
+  status_type status_;
+  bool flush_;
+  char_type obuf[OBUFSZ];
+
+}; // end of class u32utf8recordbuf
+
+class u32utf8record : public std::basic_ostream<char32_t> {
+
+  typedef std::basic_ostream<char32_t> base_type;
+  typedef u32utf8recordbuf streambuf;
+
+public:
+
+  explicit u32utf8record(shared_u32utf8ostream & out)
+    : base_type(0), osbuf_(out)
+  { this->init(& osbuf_); }
+
+  u32utf8record & commit() { osbuf_.commit(); return *this; }
+
+  status_type streambuf_status() const { return osbuf_.status(); }
+
+private:
+
+  streambuf osbuf_;
+
+}; // end of class u32utf8record
+
+////////////////////////////////
+// readahead_streambuf
+
+// readahead_streambuf reads a source stream ahead in a thread of its
+// own so the reading overlaps with the decoding. Put it between the
+// source and any of the decoding streams:
+//
+// std::ifstream F("big.txt", std::ios::binary);
+// readahead_istream R(F);
+// u32utf8istream G(R);
+//
+// The thread fills blocks of up to blocksz bytes in a ring of nblocks
+// (two by default, one being decoded and one being read) with what the
+// source has at the time, and waits when the ring is full. Once started
+// the source belongs to the thread, do not use it directly until the
+// readahead_streambuf is destroyed. The destructor stops the thread,
+// waiting for a read that has begun. On a read error status() is
+// BAD_STREAM after what was read before it.
+
+class readahead_streambuf : public std::streambuf {
+
+  typedef char char_type;
+  typedef std::streambuf base_type;
+  typedef std::istream src_stream;
+  typedef std::char_traits<char> traits_type;
+  typedef traits_type::int_type int_type;
+
+public:
+
+  enum { BLOCKSZ = 64 * 1024, NBLOCKS = 2 };
+
+  explicit readahead_streambuf(src_stream & is,
+			       std::size_t blocksz = BLOCKSZ,
+			       std::size_t nblocks = NBLOCKS);
+  virtual ~readahead_streambuf();
+
+  status_type status() const { return status_.load(); }
+
+protected:
+
+  virtual int_type underflow();
+  virtual std::streamsize showmanyc();
+
+private:
+
+  void run();
+  void notify();
+
+  src_stream * is_;
+  std::size_t blocksz_;
+  std::size_t nblocks_;
+  std::vector<char> buf_;        // nblocks_ blocks of blocksz_
+  std::vector<std::size_t> len_; // bytes read into each block
+  // blocks filled and blocks done with, the ring holds head_ - tail_.
+  std::atomic<std::size_t> head_;
+  std::atomic<std::size_t> tail_;
+  std::atomic<bool> done_;       // the thread read its last block
+  std::atomic<bool> stop_;
+  std::atomic<status_type> status_;
+  bool holding_;                 // the get area is block tail_
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::thread th_;
+
+}; // end of class readahead_streambuf
+
+class readahead_istream : public std::istream {
+
+  typedef std::istream base_type;
+  typedef std::istream src_stream;
+  typedef readahead_streambuf streambuf;
+
+public:
+
+  explicit readahead_istream(src_stream & is,
+			     std::size_t blocksz = streambuf::BLOCKSZ,
+			     std::size_t nblocks = streambuf::NBLOCKS)
+    : base_type(0), isbuf_(is, blocksz, nblocks)
+  { this->init(& isbuf_); }
+
+  status_type streambuf_status() const { return isbuf_.status(); }
+
+private:
+
+  streambuf isbuf_;
+
+}; // end of class readahead_istream
+
+}; // end of namespace unicodestreams
+
+}; // end of namespace alf
+
+#endif